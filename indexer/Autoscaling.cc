@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "spdlog/fmt/fmt.h"
+#include "spdlog/spdlog.h"
+
+#include "indexer/Autoscaling.h"
+
+namespace scip_clang {
+
+constexpr static std::string_view CGROUP_V2_MOUNT = "/sys/fs/cgroup";
+
+// Thresholds for PSI readings, as a percentage of wall-clock time.
+constexpr static double MEMORY_PRESSURE_HIGH = 10.0;
+constexpr static double MEMORY_PRESSURE_LOW = 1.0;
+constexpr static double CPU_PRESSURE_HIGH = 50.0;
+constexpr static double CPU_PRESSURE_LOW = 10.0;
+/// Fraction of the memory limit above which the pool is not grown.
+constexpr static double MEMORY_USAGE_HIGH = 0.8;
+
+static std::optional<std::string> readSmallFile(const std::string &path) {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    return {};
+  }
+  std::stringstream contents;
+  contents << in.rdbuf();
+  if (in.bad()) {
+    return {};
+  }
+  return contents.str();
+}
+
+std::optional<double> parseCpuMax(std::string_view contents) {
+  std::vector<std::string_view> parts =
+      absl::StrSplit(absl::StripAsciiWhitespace(contents), ' ');
+  double quota, period;
+  if (parts.size() != 2 || !absl::SimpleAtod(parts[0], &quota)
+      || !absl::SimpleAtod(parts[1], &period) || period <= 0) {
+    // Includes "max 100000", for no quota.
+    return {};
+  }
+  return quota / period;
+}
+
+std::optional<double> parsePressureAvg10(std::string_view contents) {
+  for (std::string_view line : absl::StrSplit(contents, '\n')) {
+    if (!absl::ConsumePrefix(&line, "some ")) {
+      continue;
+    }
+    for (std::string_view field : absl::StrSplit(line, ' ')) {
+      double value;
+      if (absl::ConsumePrefix(&field, "avg10=")
+          && absl::SimpleAtod(field, &value)) {
+        return value;
+      }
+    }
+  }
+  return {};
+}
+
+static std::optional<uint64_t> parseMemoryValue(std::string_view contents) {
+  uint64_t value;
+  // memory.max contains "max" if there is no limit.
+  if (!absl::SimpleAtoi(absl::StripAsciiWhitespace(contents), &value)) {
+    return {};
+  }
+  return value;
+}
+
+std::string ResourceSnapshot::debugString() const {
+  auto percent = [](std::optional<double> value) -> std::string {
+    return value ? fmt::format("{:.1f}%", *value) : "n/a";
+  };
+  auto mebibytes = [](std::optional<uint64_t> value) -> std::string {
+    return value ? fmt::format("{}MiB", *value / (1024 * 1024)) : "n/a";
+  };
+  return fmt::format(
+      "cpu quota: {}, cpu pressure: {}, memory: {} (limit: {}), "
+      "memory pressure: {}",
+      this->cpuQuota ? fmt::format("{:.1f}", *this->cpuQuota) : "none",
+      percent(this->cpuPressure), mebibytes(this->memoryUsageBytes),
+      this->memoryLimitBytes ? mebibytes(this->memoryLimitBytes) : "none",
+      percent(this->memoryPressure));
+}
+
+// static
+ResourceMonitor ResourceMonitor::forCurrentProcess() {
+  ResourceMonitor monitor{};
+  std::error_code error;
+  auto controllersPath =
+      std::filesystem::path(CGROUP_V2_MOUNT) / "cgroup.controllers";
+  auto cgroupFile = scip_clang::readSmallFile("/proc/self/cgroup");
+  if (!std::filesystem::exists(controllersPath, error) || !cgroupFile) {
+    spdlog::warn("cgroup v2 is not available; only system-wide pressure "
+                 "will be used for autoscaling");
+    return monitor;
+  }
+  // With cgroup v2, there is a single line of the form '0::/some/path'.
+  for (std::string_view line : absl::StrSplit(*cgroupFile, '\n')) {
+    if (absl::ConsumePrefix(&line, "0::")) {
+      monitor.cgroupDir = fmt::format("{}{}", CGROUP_V2_MOUNT, line);
+      break;
+    }
+  }
+  spdlog::debug("using cgroup directory '{}' for autoscaling",
+                monitor.cgroupDir);
+  return monitor;
+}
+
+ResourceSnapshot ResourceMonitor::read() const {
+  ResourceSnapshot snapshot{};
+  auto readCgroupFile =
+      [&](std::string_view name) -> std::optional<std::string> {
+    if (this->cgroupDir.empty()) {
+      return {};
+    }
+    return scip_clang::readSmallFile(
+        fmt::format("{}/{}", this->cgroupDir, name));
+  };
+  if (auto contents = readCgroupFile("cpu.max")) {
+    snapshot.cpuQuota = scip_clang::parseCpuMax(*contents);
+  }
+  if (auto contents = readCgroupFile("memory.max")) {
+    snapshot.memoryLimitBytes = scip_clang::parseMemoryValue(*contents);
+  }
+  if (auto contents = readCgroupFile("memory.current")) {
+    snapshot.memoryUsageBytes = scip_clang::parseMemoryValue(*contents);
+  }
+  auto readPressure =
+      [&](std::string_view resource) -> std::optional<double> {
+    auto contents = readCgroupFile(fmt::format("{}.pressure", resource));
+    if (!contents) {
+      contents = scip_clang::readSmallFile(
+          fmt::format("/proc/pressure/{}", resource));
+    }
+    if (!contents) {
+      return {};
+    }
+    return scip_clang::parsePressureAvg10(*contents);
+  };
+  snapshot.cpuPressure = readPressure("cpu");
+  snapshot.memoryPressure = readPressure("memory");
+  return snapshot;
+}
+
+size_t WorkerAutoscaler::update(const ResourceSnapshot &snapshot,
+                                std::string &reason) {
+  auto current = this->numActiveWorkers;
+  auto ceiling = this->maxWorkers;
+  if (snapshot.cpuQuota) {
+    auto quota = std::max(std::ceil(*snapshot.cpuQuota), 1.0);
+    ceiling = std::min(ceiling, size_t(quota));
+  }
+  bool memoryNearLimit =
+      snapshot.memoryLimitBytes && snapshot.memoryUsageBytes
+      && double(*snapshot.memoryUsageBytes)
+             >= MEMORY_USAGE_HIGH * double(*snapshot.memoryLimitBytes);
+  auto target = current;
+  if (snapshot.memoryPressure.value_or(0.0) >= MEMORY_PRESSURE_HIGH) {
+    target = current - std::max(current / 4, size_t(1));
+    reason = "memory pressure";
+  } else if (snapshot.cpuPressure.value_or(0.0) >= CPU_PRESSURE_HIGH) {
+    target = current - 1;
+    reason = "cpu pressure";
+  } else if (current > ceiling) {
+    target = ceiling;
+    reason = "cpu quota";
+  } else if (current < ceiling
+             && snapshot.cpuPressure.value_or(0.0) < CPU_PRESSURE_LOW
+             && snapshot.memoryPressure.value_or(0.0) < MEMORY_PRESSURE_LOW
+             && !memoryNearLimit) {
+    target = current + 1;
+    reason = "low pressure";
+  }
+  this->numActiveWorkers = std::clamp(target, size_t(1), ceiling);
+  return this->numActiveWorkers;
+}
+
+} // namespace scip_clang
@@ -0,0 +1,97 @@
+#ifndef SCIP_CLANG_AUTOSCALING_H
+#define SCIP_CLANG_AUTOSCALING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace scip_clang {
+
+// NOTE(def: worker-autoscaling): The number of workers is fixed by
+// --jobs, but under cgroup limits (e.g. in containers), the right amount
+// of parallelism depends on the CPU quota and on how much memory the
+// TUs being indexed need, which changes over the course of a run.
+//
+// With --autoscale-workers (Linux only), the driver periodically reads
+// the cgroup v2 limits for its own cgroup (cpu.max, memory.max and
+// memory.current) and the pressure stall information (PSI) for CPU and
+// memory, falling back to the system-wide PSI outside of a cgroup. The
+// WorkerAutoscaler then decides how many workers should be active:
+// - Memory pressure shrinks the pool by a quarter, as running out of
+//   memory is much worse than running slower.
+// - High CPU pressure (i.e. workers waiting for a CPU) shrinks the pool
+//   by one worker.
+// - The pool never grows beyond the CPU quota (rounded up).
+// - Otherwise, if there is little pressure, the pool grows by one
+//   worker, unless memory usage is close to the limit. Usage includes
+//   the page cache, so it is not a reason to shrink on its own.
+//
+// All --jobs workers are spawned upfront. The Scheduler shrinks the pool
+// by parking idle workers, i.e. moving them to the spare pool (see
+// NOTE(ref: spare-workers)), and grows it by unparking them, so resizing
+// doesn't need to spawn or kill any processes. Each change is logged
+// along with the readings it was based on.
+
+/// Resource usage and limits for the current cgroup. Readings which are
+/// not available (e.g. because there is no limit) are unset.
+struct ResourceSnapshot {
+  /// Number of CPUs' worth of time the cgroup may use.
+  std::optional<double> cpuQuota;
+  std::optional<uint64_t> memoryLimitBytes;
+  std::optional<uint64_t> memoryUsageBytes;
+  /// Share of the last 10s (as a percentage) during which some tasks
+  /// were waiting for a CPU.
+  std::optional<double> cpuPressure;
+  /// Share of the last 10s (as a percentage) during which some tasks
+  /// were stalled on memory.
+  std::optional<double> memoryPressure;
+
+  std::string debugString() const;
+};
+
+/// Parses the contents of cpu.max, e.g. "200000 100000" (2 CPUs).
+/// Returns null if there is no quota.
+std::optional<double> parseCpuMax(std::string_view contents);
+
+/// Parses the "some avg10" value from the contents of a PSI file
+/// like cpu.pressure.
+std::optional<double> parsePressureAvg10(std::string_view contents);
+
+class ResourceMonitor final {
+  /// Directory for the cgroup of the current process under the cgroup v2
+  /// mount, or empty if it could not be determined.
+  std::string cgroupDir;
+
+public:
+  ResourceMonitor() : cgroupDir() {}
+
+  /// Locates the cgroup for the current process. On failure (e.g. if
+  /// only cgroup v1 is available), logs a warning, and later readings
+  /// will only include system-wide PSI.
+  static ResourceMonitor forCurrentProcess();
+
+  ResourceSnapshot read() const;
+};
+
+class WorkerAutoscaler final {
+  size_t maxWorkers;
+  size_t numActiveWorkers;
+
+public:
+  explicit WorkerAutoscaler(size_t maxWorkers)
+      : maxWorkers(maxWorkers), numActiveWorkers(maxWorkers) {}
+
+  size_t activeWorkers() const {
+    return this->numActiveWorkers;
+  }
+
+  /// Returns the new number of active workers (which may be unchanged),
+  /// setting \p reason to a short description if it changed.
+  size_t update(const ResourceSnapshot &snapshot, std::string &reason);
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_AUTOSCALING_H
@@ -0,0 +1,36 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+#include "indexer/BatchSizer.h"
+
+namespace scip_clang {
+
+void BatchSizer::recordTuLatency(std::chrono::steady_clock::duration latency) {
+  auto micros = double(
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+  this->averageTuMicros =
+      this->averageTuMicros.has_value()
+          ? (SMOOTHING_FACTOR * micros
+             + (1.0 - SMOOTHING_FACTOR) * *this->averageTuMicros)
+          : micros;
+}
+
+size_t BatchSizer::nextBatchSize(size_t numPendingJobs,
+                                 size_t numIdleWorkers) const {
+  if (this->maxBatchSize <= 1 || !this->averageTuMicros.has_value()) {
+    return 1;
+  }
+  auto targetMicros =
+      double(std::chrono::duration_cast<std::chrono::microseconds>(
+                 TARGET_BATCH_DURATION)
+                 .count());
+  auto predictedSize =
+      size_t(targetMicros / std::max(*this->averageTuMicros, 1.0));
+  // Avoid handing out so many jobs that other idle workers get none.
+  auto fairShare = numPendingJobs / std::max(numIdleWorkers, size_t(1));
+  return std::clamp(std::min(predictedSize, fairShare), size_t(1),
+                    this->maxBatchSize);
+}
+
+} // namespace scip_clang
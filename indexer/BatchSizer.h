@@ -0,0 +1,54 @@
+#ifndef SCIP_CLANG_BATCH_SIZER_H
+#define SCIP_CLANG_BATCH_SIZER_H
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+
+namespace scip_clang {
+
+// NOTE(def: tu-batching): Each TU needs two round trips between the
+// driver and a worker: one for semantic analysis and one for emitting
+// the index. For small TUs which only take ~100ms to index, the time
+// spent waiting for the driver to hand out the next TU is a noticeable
+// fraction of the total.
+//
+// So the Scheduler may send several SemanticAnalysis jobs to a worker
+// in a single IndexJobRequest. The worker still sends a separate
+// response for each job, and waits for the EmitIndex job for each TU,
+// so header claiming works the same as without batching. The worker
+// only skips waiting for the next SemanticAnalysis job.
+//
+// Timeouts still apply per TU; when a worker finishes a TU, the driver
+// starts the clock for the next job in its batch. If a worker is killed,
+// the remaining jobs in its batch are put back into the pending queue.
+class BatchSizer final {
+  /// Rough amount of work to hand out to a worker in one go. Large
+  /// enough to amortize IPC overhead for small TUs, while keeping load
+  /// imbalance near the end of indexing low.
+  constexpr static std::chrono::milliseconds TARGET_BATCH_DURATION{500};
+  /// Weight for the latest observation in the moving average.
+  constexpr static double SMOOTHING_FACTOR = 0.125;
+
+  size_t maxBatchSize;
+  /// Exponentially weighted moving average of the time taken by a TU,
+  /// from when its SemanticAnalysis job was started to when the driver
+  /// received the EmitIndex result. Unset until the first TU is done.
+  std::optional<double> averageTuMicros;
+
+public:
+  explicit BatchSizer(size_t maxBatchSize)
+      : maxBatchSize(maxBatchSize), averageTuMicros() {}
+  BatchSizer(BatchSizer &&) = default;
+  BatchSizer(const BatchSizer &) = delete;
+
+  void recordTuLatency(std::chrono::steady_clock::duration latency);
+
+  /// Number of SemanticAnalysis jobs (including the first one) to send
+  /// to the next idle worker.
+  size_t nextBatchSize(size_t numPendingJobs, size_t numIdleWorkers) const;
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_BATCH_SIZER_H
@@ -0,0 +1,129 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "indexer/BinaryCodec.h"
+
+namespace scip_clang {
+
+void BinaryWriter::writeVarint(uint64_t value) {
+  while (value >= 0x80) {
+    this->buffer.push_back(char(uint8_t(value) | 0x80));
+    value >>= 7;
+  }
+  this->buffer.push_back(char(uint8_t(value)));
+}
+
+void BinaryWriter::writeFixed64(uint64_t value) {
+  char bytes[sizeof(value)];
+  for (size_t i = 0; i < sizeof(value); ++i) {
+    bytes[i] = char(uint8_t(value >> (8 * i)));
+  }
+  this->buffer.append(bytes, sizeof(bytes));
+}
+
+void BinaryWriter::writeBytes(std::string_view bytes) {
+  this->writeVarint(bytes.size());
+  this->buffer.append(bytes.data(), bytes.size());
+}
+
+bool BinaryReader::readVarint(uint64_t &value) {
+  uint64_t result = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (this->offset >= this->data.size()) {
+      return false;
+    }
+    auto byte = uint8_t(this->data[this->offset]);
+    this->offset++;
+    result |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BinaryReader::readFixed64(uint64_t &value) {
+  if (this->data.size() - this->offset < sizeof(value)) {
+    return false;
+  }
+  uint64_t result = 0;
+  for (size_t i = 0; i < sizeof(value); ++i) {
+    result |= uint64_t(uint8_t(this->data[this->offset + i])) << (8 * i);
+  }
+  this->offset += sizeof(value);
+  value = result;
+  return true;
+}
+
+bool BinaryReader::readBytes(std::string_view &bytes) {
+  uint64_t size;
+  if (!this->readVarint(size)) {
+    return false;
+  }
+  if (this->data.size() - this->offset < size) {
+    return false;
+  }
+  bytes = this->data.substr(this->offset, size);
+  this->offset += size;
+  return true;
+}
+
+void writeBinaryHeader(std::string &buffer) {
+  buffer.append(BINARY_IPC_MAGIC, sizeof(BINARY_IPC_MAGIC));
+  buffer.push_back(char(BINARY_IPC_VERSION));
+}
+
+bool hasBinaryHeader(std::string_view buffer) {
+  return buffer.size() > sizeof(BINARY_IPC_MAGIC)
+         && std::memcmp(buffer.data(), BINARY_IPC_MAGIC,
+                        sizeof(BINARY_IPC_MAGIC))
+                == 0;
+}
+
+void encodeBinary(BinaryWriter &writer, const uint64_t &value) {
+  writer.writeVarint(value);
+}
+bool decodeBinary(BinaryReader &reader, uint64_t &value) {
+  return reader.readVarint(value);
+}
+
+void encodeBinary(BinaryWriter &writer, const uint32_t &value) {
+  writer.writeVarint(value);
+}
+bool decodeBinary(BinaryReader &reader, uint32_t &value) {
+  uint64_t v;
+  if (!reader.readVarint(v) || v > UINT32_MAX) {
+    return false;
+  }
+  value = uint32_t(v);
+  return true;
+}
+
+void encodeBinary(BinaryWriter &writer, const bool &value) {
+  writer.writeVarint(value ? 1 : 0);
+}
+bool decodeBinary(BinaryReader &reader, bool &value) {
+  uint64_t v;
+  if (!reader.readVarint(v) || v > 1) {
+    return false;
+  }
+  value = v == 1;
+  return true;
+}
+
+void encodeBinary(BinaryWriter &writer, const std::string &value) {
+  writer.writeBytes(value);
+}
+bool decodeBinary(BinaryReader &reader, std::string &value) {
+  std::string_view bytes;
+  if (!reader.readBytes(bytes)) {
+    return false;
+  }
+  value = std::string(bytes);
+  return true;
+}
+
+} // namespace scip_clang
@@ -0,0 +1,160 @@
+#ifndef SCIP_CLANG_BINARY_CODEC_H
+#define SCIP_CLANG_BINARY_CODEC_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace scip_clang {
+
+/// Appends a compact binary representation of values to a buffer.
+///
+/// Integers are written as LEB128 varints, except for hash values
+/// which are uniformly distributed (and hence don't benefit from
+/// variable-length encoding). Strings and sequences are prefixed
+/// with their length.
+class BinaryWriter final {
+  std::string &buffer;
+
+public:
+  explicit BinaryWriter(std::string &buffer) : buffer(buffer) {}
+
+  void writeVarint(uint64_t value);
+  void writeFixed64(uint64_t value);
+  void writeBytes(std::string_view bytes);
+};
+
+/// Reads values written by \c BinaryWriter.
+///
+/// All methods return false on truncated or malformed input,
+/// without advancing past the end of the buffer.
+class BinaryReader final {
+  std::string_view data;
+  size_t offset;
+
+public:
+  explicit BinaryReader(std::string_view data) : data(data), offset(0) {}
+
+  [[nodiscard]] bool readVarint(uint64_t &value);
+  [[nodiscard]] bool readFixed64(uint64_t &value);
+  /// The returned view points into the buffer passed to the constructor.
+  [[nodiscard]] bool readBytes(std::string_view &bytes);
+
+  bool atEnd() const {
+    return this->offset == this->data.size();
+  }
+};
+
+// NOTE(def: binary-ipc-header): Binary messages start with a NUL byte,
+// which can never start a valid JSON text, so that a receiver can accept
+// messages in either format without any additional coordination.
+constexpr static char BINARY_IPC_MAGIC[3] = {'\0', 'S', 'C'};
+
+/// Bump this whenever the binary encoding of any IPC message changes.
+constexpr static uint8_t BINARY_IPC_VERSION = 12;
+
+void writeBinaryHeader(std::string &buffer);
+
+bool hasBinaryHeader(std::string_view buffer);
+
+#define BINARY_SERIALIZABLE(T)                   \
+  void encodeBinary(BinaryWriter &, const T &); \
+  bool decodeBinary(BinaryReader &, T &);
+
+#define DERIVE_BINARY_SERIALIZE_1_NEWTYPE(_Type, _Field)     \
+  void encodeBinary(BinaryWriter &writer, const _Type &t) { \
+    encodeBinary(writer, t._Field);                         \
+  }                                                         \
+  bool decodeBinary(BinaryReader &reader, _Type &t) {       \
+    return decodeBinary(reader, t._Field);                  \
+  }
+
+#define DERIVE_BINARY_SERIALIZE_2(_Type, _Field1, _Field2)   \
+  void encodeBinary(BinaryWriter &writer, const _Type &t) { \
+    encodeBinary(writer, t._Field1);                        \
+    encodeBinary(writer, t._Field2);                        \
+  }                                                         \
+  bool decodeBinary(BinaryReader &reader, _Type &t) {       \
+    return decodeBinary(reader, t._Field1)                  \
+           && decodeBinary(reader, t._Field2);              \
+  }
+
+#define DERIVE_BINARY_SERIALIZE_3(_Type, _Field1, _Field2, _Field3) \
+  void encodeBinary(BinaryWriter &writer, const _Type &t) {         \
+    encodeBinary(writer, t._Field1);                                \
+    encodeBinary(writer, t._Field2);                                \
+    encodeBinary(writer, t._Field3);                                \
+  }                                                                 \
+  bool decodeBinary(BinaryReader &reader, _Type &t) {               \
+    return decodeBinary(reader, t._Field1)                          \
+           && decodeBinary(reader, t._Field2)                       \
+           && decodeBinary(reader, t._Field3);                      \
+  }
+
+#define DERIVE_BINARY_SERIALIZE_4(_Type, _Field1, _Field2, _Field3, _Field4) \
+  void encodeBinary(BinaryWriter &writer, const _Type &t) {                  \
+    encodeBinary(writer, t._Field1);                                         \
+    encodeBinary(writer, t._Field2);                                         \
+    encodeBinary(writer, t._Field3);                                         \
+    encodeBinary(writer, t._Field4);                                         \
+  }                                                                          \
+  bool decodeBinary(BinaryReader &reader, _Type &t) {                        \
+    return decodeBinary(reader, t._Field1)                                   \
+           && decodeBinary(reader, t._Field2)                                \
+           && decodeBinary(reader, t._Field3)                                \
+           && decodeBinary(reader, t._Field4);                               \
+  }
+
+#define DERIVE_BINARY_SERIALIZE_5(_Type, _Field1, _Field2, _Field3, _Field4, \
+                                  _Field5)                                   \
+  void encodeBinary(BinaryWriter &writer, const _Type &t) {                  \
+    encodeBinary(writer, t._Field1);                                         \
+    encodeBinary(writer, t._Field2);                                         \
+    encodeBinary(writer, t._Field3);                                         \
+    encodeBinary(writer, t._Field4);                                         \
+    encodeBinary(writer, t._Field5);                                         \
+  }                                                                          \
+  bool decodeBinary(BinaryReader &reader, _Type &t) {                        \
+    return decodeBinary(reader, t._Field1)                                   \
+           && decodeBinary(reader, t._Field2)                                \
+           && decodeBinary(reader, t._Field3)                                \
+           && decodeBinary(reader, t._Field4)                                \
+           && decodeBinary(reader, t._Field5);                               \
+  }
+
+BINARY_SERIALIZABLE(uint64_t)
+BINARY_SERIALIZABLE(uint32_t)
+BINARY_SERIALIZABLE(bool)
+BINARY_SERIALIZABLE(std::string)
+
+template <typename T>
+void encodeBinary(BinaryWriter &writer, const std::vector<T> &values) {
+  writer.writeVarint(values.size());
+  for (auto &value : values) {
+    encodeBinary(writer, value);
+  }
+}
+
+template <typename T>
+bool decodeBinary(BinaryReader &reader, std::vector<T> &values) {
+  uint64_t size;
+  if (!reader.readVarint(size)) {
+    return false;
+  }
+  values.clear();
+  // Don't trust size for reserving memory; a corrupted message could
+  // otherwise trigger a huge allocation.
+  for (uint64_t i = 0; i < size; ++i) {
+    T value{};
+    if (!decodeBinary(reader, value)) {
+      return false;
+    }
+    values.emplace_back(std::move(value));
+  }
+  return true;
+}
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_BINARY_CODEC_H
@@ -0,0 +1,77 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <signal.h>
+#endif
+
+#include "spdlog/spdlog.h"
+
+#include "indexer/Cancellation.h"
+
+namespace scip_clang {
+
+constexpr static uint32_t NO_TASK = UINT32_MAX;
+
+// Written from a signal handler, so this must be lock-free.
+static std::atomic<uint32_t> cancelledTaskId{NO_TASK};
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+static uint32_t currentTaskId = NO_TASK;
+
+#ifdef __linux__
+constexpr static int CANCELLATION_SIGNAL = SIGUSR1;
+
+static void handleCancellationSignal(int, siginfo_t *info, void *) {
+  // Ignore signals which were not sent by requestCancellation.
+  if (info->si_code == SI_QUEUE) {
+    cancelledTaskId.store(uint32_t(info->si_value.sival_int),
+                          std::memory_order_relaxed);
+  }
+}
+#endif
+
+void installCancellationHandler() {
+#ifdef __linux__
+  struct sigaction action {};
+  action.sa_sigaction = &handleCancellationSignal;
+  // Restart interrupted system calls, so that IPC code doesn't need
+  // to deal with EINTR.
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(CANCELLATION_SIGNAL, &action, nullptr) != 0) {
+    spdlog::warn("failed to install cancellation handler ({})",
+                 std::strerror(errno));
+  }
+#endif
+}
+
+bool requestCancellation(int pid, uint32_t taskId) {
+#ifdef __linux__
+  union sigval value {};
+  value.sival_int = int(taskId);
+  if (sigqueue(pid, CANCELLATION_SIGNAL, value) != 0) {
+    spdlog::warn("failed to send cancellation request to pid {} ({})", pid,
+                 std::strerror(errno));
+    return false;
+  }
+  return true;
+#else
+  (void)pid;
+  (void)taskId;
+  return false;
+#endif
+}
+
+void setCurrentTask(uint32_t taskId) {
+  currentTaskId = taskId;
+}
+
+bool isCurrentTaskCancelled() {
+  return currentTaskId != NO_TASK
+         && cancelledTaskId.load(std::memory_order_relaxed) == currentTaskId;
+}
+
+} // namespace scip_clang
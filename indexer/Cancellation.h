@@ -0,0 +1,49 @@
+#ifndef SCIP_CLANG_CANCELLATION_H
+#define SCIP_CLANG_CANCELLATION_H
+
+#include <cstdint>
+
+namespace scip_clang {
+
+// NOTE(def: soft-cancellation): Killing a worker whose job has timed
+// out throws away its warm state (e.g. interned paths and known header
+// claims), and the respawned worker has to pay the startup cost again.
+//
+// With --cancel-grace-period-seconds=N (Linux only), the driver first
+// asks the worker to cancel the job, by sending it a signal along with
+// the task ID (using sigqueue). The signal handler only records the
+// task ID. The worker checks for it whenever it makes progress (see
+// NOTE(ref: worker-heartbeats)), and unwinds cooperatively:
+// - While parsing, the AST consumer asks Clang to stop parsing.
+// - While traversing the AST, the traversal is stopped.
+// - After traversal, the shards are not written.
+// The worker then sends a response marking the job as cancelled, and
+// moves on to the next job. The driver skips the TU, same as when
+// the worker is killed.
+//
+// A worker which is stuck inside a single Clang call will not notice
+// the request, so if there is no response within N seconds, the driver
+// falls back to killing and respawning the worker.
+//
+// Requests for a task other than the one the worker is processing
+// (e.g. if the job completed just before the request arrived) are
+// ignored.
+
+/// Installs the signal handler for cancellation requests. Should only
+/// be called in workers.
+void installCancellationHandler();
+
+/// Asks the worker with \p pid to cancel the job(s) for \p taskId.
+/// Returns false if cancellation is not supported on this platform,
+/// or if the request could not be sent.
+bool requestCancellation(int pid, uint32_t taskId);
+
+/// Sets the task which later calls to \c isCurrentTaskCancelled check.
+void setCurrentTask(uint32_t taskId);
+
+/// Whether a cancellation request was received for the current task.
+bool isCurrentTaskCancelled();
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_CANCELLATION_H
@@ -0,0 +1,94 @@
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+
+#include "spdlog/spdlog.h"
+
+#include "indexer/ClaimBalancer.h"
+
+namespace scip_clang {
+
+ClaimBalancer::ClaimBalancer(
+    const IncludeSetCache &includeSets,
+    absl::FunctionRef<double(std::string_view)> costOf)
+    : includeSets(includeSets),
+      pendingIncluders(includeSets.pathCount(), 0), assignedCost(),
+      plannedTuCount(), targetCostPerTu(0.0), deferralCount(0) {
+  if (includeSets.size() == 0) {
+    return;
+  }
+  double totalCost = 0.0;
+  for (uint32_t pathId = 0; pathId < includeSets.pathCount(); ++pathId) {
+    totalCost += costOf(includeSets.path(pathId));
+  }
+  this->targetCostPerTu = totalCost / double(includeSets.size());
+  spdlog::debug("balancing header claims with target cost {:.0f} per TU",
+                this->targetCostPerTu);
+}
+
+// static
+double ClaimBalancer::fileCost(std::string_view absolutePath) {
+  std::error_code error;
+  auto size = std::filesystem::file_size(absolutePath, error);
+  return error ? 0.0 : double(size);
+}
+
+void ClaimBalancer::onTuQueued(std::string_view mainFile) {
+  auto *pathIds = this->includeSets.includeSet(mainFile);
+  if (!pathIds) {
+    return;
+  }
+  for (auto pathId : *pathIds) {
+    // Paths recorded during this run don't have a slot.
+    if (pathId < this->pendingIncluders.size()) {
+      this->pendingIncluders[pathId]++;
+    }
+  }
+}
+
+void ClaimBalancer::onTuAnalyzed(std::string_view mainFile) {
+  auto *pathIds = this->includeSets.includeSet(mainFile);
+  if (!pathIds) {
+    return;
+  }
+  for (auto pathId : *pathIds) {
+    // The entry may have been overwritten since the TU was queued,
+    // if the same main file is present multiple times.
+    if (pathId < this->pendingIncluders.size()
+        && this->pendingIncluders[pathId] > 0) {
+      this->pendingIncluders[pathId]--;
+    }
+  }
+}
+
+bool ClaimBalancer::shouldClaim(WorkerId workerId,
+                                std::string_view absolutePath, double cost) {
+  this->ensureWorker(workerId);
+  auto &assigned = this->assignedCost[workerId];
+  auto fairShare =
+      this->targetCostPerTu * double(this->plannedTuCount[workerId] + 1);
+  if (assigned + cost > fairShare) {
+    auto optPathId = this->includeSets.lookupPath(absolutePath);
+    if (optPathId && *optPathId < this->pendingIncluders.size()
+        && this->pendingIncluders[*optPathId] > 0) {
+      this->deferralCount++;
+      return false;
+    }
+  }
+  assigned += cost;
+  return true;
+}
+
+void ClaimBalancer::onTuPlanned(WorkerId workerId) {
+  this->ensureWorker(workerId);
+  this->plannedTuCount[workerId]++;
+}
+
+void ClaimBalancer::ensureWorker(WorkerId workerId) {
+  if (workerId >= this->assignedCost.size()) {
+    this->assignedCost.resize(workerId + 1, 0.0);
+    this->plannedTuCount.resize(workerId + 1, 0);
+  }
+}
+
+} // namespace scip_clang
@@ -0,0 +1,90 @@
+#ifndef SCIP_CLANG_CLAIM_BALANCER_H
+#define SCIP_CLANG_CLAIM_BALANCER_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+
+#include "indexer/IncludeSetCache.h"
+#include "indexer/IpcMessages.h"
+
+namespace scip_clang {
+
+// NOTE(def: balanced-header-claiming): By default, a (path, hash) pair
+// is claimed by the first TU which reports it, so the TUs which happen
+// to finish semantic analysis early end up emitting most of the shared
+// headers, and their EmitIndex jobs take much longer than those for
+// later TUs.
+//
+// With --balance-header-claims, the planner keeps track of the emit
+// cost assigned to each worker so far, using the size of a file as the
+// predicted cost of emitting it. A worker's fair share is the expected
+// cost per TU (computed from the include set cache, see
+// NOTE(ref: header-coverage-ordering)) times the number of TUs it has
+// been planned for. Once a worker goes over its share, further headers
+// are left unclaimed, so that a later TU which includes the same header
+// picks it up instead.
+//
+// A header is only deferred if, as per the cache, some TU which has been
+// queued but hasn't finished semantic analysis includes it, so the last
+// such TU always claims it regardless of load. Since the cache may be
+// stale, a deferred header may still never be claimed again; the number
+// of such headers is logged at the end of indexing.
+//
+// Claims are decided on the worker side with NOTE(ref: provisional-plans)
+// and NOTE(ref: shm-claim-table), so neither can be combined with this.
+
+class ClaimBalancer final {
+  const IncludeSetCache &includeSets;
+  /// Indexed by IncludeSetCache path ID; number of queued TUs which
+  /// include the path, and haven't finished semantic analysis yet.
+  std::vector<uint32_t> pendingIncluders;
+  /// Indexed by WorkerId; predicted cost of all claims so far.
+  std::vector<double> assignedCost;
+  /// Indexed by WorkerId; number of TUs planned so far.
+  std::vector<uint32_t> plannedTuCount;
+  double targetCostPerTu;
+  size_t deferralCount;
+
+public:
+  /// \p costOf should return the predicted cost of emitting a file,
+  /// given its absolute path.
+  ClaimBalancer(const IncludeSetCache &includeSets,
+                absl::FunctionRef<double(std::string_view)> costOf);
+  ClaimBalancer(ClaimBalancer &&) = default;
+  ClaimBalancer(const ClaimBalancer &) = delete;
+
+  /// Size of the file in bytes, or 0 if it cannot be determined.
+  static double fileCost(std::string_view absolutePath);
+
+  void onTuQueued(std::string_view mainFile);
+
+  /// Should be called before the semantic analysis result for \p mainFile
+  /// is planned, or if the TU will never be planned (e.g. due to a crash).
+  void onTuAnalyzed(std::string_view mainFile);
+
+  /// Returns false if the claim should be left for a later TU. Otherwise,
+  /// counts \p cost towards \p workerId's load.
+  bool shouldClaim(WorkerId workerId, std::string_view absolutePath,
+                   double cost);
+
+  /// Should be called once all claims for a TU have been made.
+  void onTuPlanned(WorkerId workerId);
+
+  size_t numDeferrals() const {
+    return this->deferralCount;
+  }
+
+  double targetCost() const {
+    return this->targetCostPerTu;
+  }
+
+private:
+  void ensureWorker(WorkerId workerId);
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_CLAIM_BALANCER_H
@@ -11,7 +11,10 @@
 namespace scip_clang {
 
 IpcOptions CliOptions::ipcOptions() const {
-  return IpcOptions{this->receiveTimeout, this->driverId, this->workerId};
+  return IpcOptions{this->receiveTimeout, this->driverId,
+                    this->workerId,       this->ipcCodec,
+                    this->ipcTransport,   this->ipcEventFds,
+                    this->heartbeatInterval};
 }
 
 HeaderFilter::HeaderFilter(std::string &&re) {
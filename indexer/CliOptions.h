@@ -17,22 +17,119 @@
 
 namespace scip_clang {
 
+/// Encoding used for messages sent over IPC.
+///
+/// Receivers accept either encoding; see NOTE(ref: binary-ipc-header).
+enum class IpcCodec {
+  Json,
+  Binary,
+};
+
+/// Mechanism used for moving messages between the driver and workers.
+enum class IpcTransport {
+  /// Boost message_queue; works on all platforms.
+  MessageQueue,
+  /// See NOTE(ref: shm-ring-transport); Linux only.
+  ShmRing,
+};
+
+/// Where workers write index shards for the driver to merge.
+enum class ShardStorage : uint8_t {
+  /// Files under the temporary output directory.
+  File,
+  /// POSIX shared memory objects; Linux only.
+  /// See NOTE(ref: shared-memory-shards).
+  SharedMemory,
+  /// One append-only log per worker.
+  /// See NOTE(ref: worker-shard-log).
+  WorkerLog,
+};
+
+/// Order in which the driver hands out TUs to workers.
+/// See NOTE(ref: job-ordering).
+enum class JobOrder {
+  /// Same order as the compilation database.
+  Fifo,
+  /// TUs which are expected to take the longest go first.
+  LongestFirst,
+  /// TUs covering the most headers not covered by earlier TUs go first.
+  /// See NOTE(ref: header-coverage-ordering).
+  HeaderCoverage,
+};
+
+/// What the driver does with TUs which are quarantined.
+/// See NOTE(ref: tu-quarantine).
+enum class QuarantinePolicy {
+  /// Index them after all other TUs, with a shorter timeout.
+  Defer,
+  /// Don't index them at all.
+  Skip,
+};
+
+/// How the driver starts worker processes.
+enum class WorkerSpawn {
+  /// Re-invoke the scip-clang executable for every worker.
+  Exec,
+  /// Fork workers from a pre-initialized process.
+  /// See NOTE(ref: worker-zygote).
+  Zygote,
+};
+
 struct IpcOptions {
   std::chrono::seconds receiveTimeout;
   std::string driverId;
   uint64_t workerId;
+  IpcCodec codec = IpcCodec::Json;
+  IpcTransport transport = IpcTransport::MessageQueue;
+  /// Only used with IpcTransport::ShmRing.
+  std::vector<int> eventFds;
+  /// Zero if heartbeats are disabled; see NOTE(ref: worker-heartbeats).
+  std::chrono::seconds heartbeatInterval = std::chrono::seconds(0);
 };
 
 struct CliOptions {
   std::string compdbPath;
   std::string scipClangExecutablePath;
   std::string temporaryOutputDir;
+  /// See NOTE(ref: indexing-journal).
+  bool resume;
   std::string indexOutputPath;
   std::string statsFilePath;
   bool showCompilerDiagonstics;
 
   std::chrono::seconds receiveTimeout;
+  std::chrono::seconds heartbeatInterval;
+  /// Zero if soft cancellation is disabled; see
+  /// NOTE(ref: soft-cancellation).
+  std::chrono::seconds cancelGracePeriod;
   uint32_t numWorkers;
+  /// See NOTE(ref: spare-workers).
+  uint32_t numSpareWorkers;
+  /// Zero if there is no budget; see NOTE(ref: memory-budget).
+  uint64_t memoryBudgetBytes;
+  /// See NOTE(ref: worker-autoscaling).
+  bool autoscaleWorkers;
+  /// Zero if workers are not recycled; see NOTE(ref: worker-recycling).
+  uint64_t recycleWorkerRssBytes;
+  bool trimMemoryBetweenTus;
+  WorkerSpawn workerSpawn;
+  IpcCodec ipcCodec;
+  IpcTransport ipcTransport;
+  ShardStorage shardStorage;
+  uint32_t maxTusPerBatch;
+  bool provisionalPlans;
+  bool shmClaimTable;
+  JobOrder jobOrder;
+  std::string jobCostHistoryPath;
+  std::string includeSetCachePath;
+  bool balanceHeaderClaims;
+  /// See NOTE(ref: in-process-workers).
+  bool inProcess;
+  /// Empty if there is no quarantine; see NOTE(ref: tu-quarantine).
+  std::string quarantineDbPath;
+  uint32_t quarantineRuns;
+  QuarantinePolicy quarantinePolicy;
+  std::chrono::seconds quarantineTimeout;
 
   spdlog::level::level_enum logLevel;
 
@@ -64,6 +161,9 @@ struct CliOptions {
   // itself when sending results, guaranteed to be unique within an
   // indexing job at a given instant.
   uint64_t workerId;
+  // File descriptors inherited from the driver for
+  // NOTE(ref: shm-ring-transport).
+  std::vector<int> ipcEventFds;
 
   IpcOptions ipcOptions() const;
 };
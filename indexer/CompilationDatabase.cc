@@ -3,6 +3,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "indexer/Enforce.h" // Defines ENFORCE used by rapidjson headers
@@ -130,6 +131,22 @@ ResourceDirResult static determineResourceDir(const std::string &compilerPath) {
 
 namespace scip_clang {
 namespace compdb {
+
+HashValue commandKey(const clang::tooling::CompileCommand &command) {
+  HashValue key{0};
+  // wyhash takes the length into account, so there is no need for
+  // separators between the strings.
+  auto mixString = [&key](std::string_view text) {
+    key.mix(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+  };
+  mixString(command.Directory);
+  mixString(command.Filename);
+  for (auto &arg : command.CommandLine) {
+    mixString(arg);
+  }
+  return key;
+}
+
 namespace {
 
 // Handler to validate a compilation database in a streaming fashion.
@@ -18,10 +18,15 @@
 #include "clang/Tooling/CompilationDatabase.h"
 
 #include "indexer/FileSystem.h"
+#include "indexer/Hash.h"
 
 namespace scip_clang {
 namespace compdb {
 
+/// Identifies a compile command across runs, e.g. for
+/// NOTE(ref: indexing-journal).
+HashValue commandKey(const clang::tooling::CompileCommand &command);
+
 struct ValidationOptions {
   bool checkDirectoryPathsAreAbsolute;
 };
@@ -0,0 +1,36 @@
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+#include "absl/algorithm/container.h"
+
+#include "indexer/ConcurrentClaimMap.h"
+
+namespace scip_clang {
+
+bool ConcurrentClaimMap::claim(AbsolutePathRef path, HashValue hashValue) {
+  auto pathView = path.asStringView();
+  auto &shard = this->shardFor(pathView);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.hashes.find(pathView);
+  if (it == shard.hashes.end()) {
+    shard.hashes[std::string(pathView)].push_back(hashValue);
+    return true;
+  }
+  auto &hashes = it->second;
+  if (absl::c_linear_search(hashes, hashValue)) {
+    return false;
+  }
+  hashes.push_back(hashValue);
+  return true;
+}
+
+size_t ConcurrentClaimMap::hashCount(AbsolutePathRef path) {
+  auto pathView = path.asStringView();
+  auto &shard = this->shardFor(pathView);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.hashes.find(pathView);
+  return it == shard.hashes.end() ? 0 : it->second.size();
+}
+
+} // namespace scip_clang
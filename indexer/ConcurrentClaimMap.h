@@ -0,0 +1,57 @@
+#ifndef SCIP_CLANG_CONCURRENT_CLAIM_MAP_H
+#define SCIP_CLANG_CONCURRENT_CLAIM_MAP_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/inlined_vector.h"
+
+#include "indexer/Hash.h"
+#include "indexer/Path.h"
+
+namespace scip_clang {
+
+/// Set of claimed (path, hash) pairs which several threads can claim
+/// pairs in at once. See NOTE(ref: in-process-workers).
+///
+/// Paths are split across shards, each with its own lock, so threads
+/// only contend when claiming paths in the same shard. All hashes for
+/// a path live in the same shard, so the number of hashes claimed for
+/// a path (which decides whether it is multiply indexed) is exact.
+class ConcurrentClaimMap final {
+  static constexpr size_t NUM_SHARDS = 64;
+
+  // Aligned to avoid false sharing between the locks of adjacent shards.
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    /// Keyed by absolute path. Most paths only have a single hash.
+    absl::flat_hash_map<std::string, absl::InlinedVector<HashValue, 1>>
+        hashes;
+  };
+  std::array<Shard, NUM_SHARDS> shards;
+
+public:
+  ConcurrentClaimMap() = default;
+  ConcurrentClaimMap(const ConcurrentClaimMap &) = delete;
+  ConcurrentClaimMap &operator=(const ConcurrentClaimMap &) = delete;
+
+  /// Returns true if (\p path, \p hashValue) wasn't claimed earlier.
+  bool claim(AbsolutePathRef path, HashValue hashValue);
+
+  /// Number of hashes claimed for \p path so far.
+  size_t hashCount(AbsolutePathRef path);
+
+private:
+  Shard &shardFor(std::string_view path) {
+    return this->shards[HashValue::forText(path) % NUM_SHARDS];
+  }
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_CONCURRENT_CLAIM_MAP_H
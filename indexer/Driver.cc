@@ -1,6 +1,8 @@
 #include <algorithm>
 #include <chrono>
 #include <compare>
+#include <csignal>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <deque>
@@ -9,6 +11,8 @@
 #include <ios>
 #include <iterator>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -30,24 +34,44 @@
 #include "spdlog/spdlog.h"
 
 #include "llvm/ADT/StringMap.h"
+#include "llvm/Support/thread.h"
 
 #include "scip/scip.pb.h"
 
+#include "indexer/Autoscaling.h"
+#include "indexer/BatchSizer.h"
+#include "indexer/Cancellation.h"
+#include "indexer/ClaimBalancer.h"
 #include "indexer/CliOptions.h"
 #include "indexer/Comparison.h"
 #include "indexer/CompilationDatabase.h"
+#include "indexer/ConcurrentClaimMap.h"
 #include "indexer/Driver.h"
 #include "indexer/FileSystem.h"
+#include "indexer/InProcessIndexMerger.h"
+#include "indexer/IncludeSetCache.h"
+#include "indexer/IndexingJournal.h"
+#include "indexer/IpcChunking.h"
 #include "indexer/IpcMessages.h"
+#include "indexer/JobCost.h"
 #include "indexer/JsonIpcQueue.h"
 #include "indexer/LlvmAdapter.h"
 #include "indexer/Logging.h"
+#include "indexer/MemoryBudget.h"
 #include "indexer/Path.h"
+#include "indexer/PathInterner.h"
+#include "indexer/Quarantine.h"
 #include "indexer/RAII.h"
 #include "indexer/ScipExtras.h"
+#include "indexer/ShardLog.h"
+#include "indexer/SharedMemoryShards.h"
+#include "indexer/ShmClaimTable.h"
+#include "indexer/ShmIpc.h"
 #include "indexer/Statistics.h"
 #include "indexer/Timer.h"
 #include "indexer/Version.h"
+#include "indexer/Worker.h"
+#include "indexer/Zygote.h"
 
 namespace boost_ip = boost::interprocess;
 
@@ -68,22 +92,32 @@ struct MessageQueues {
     }
     auto w2d = scip_clang::workerToDriverQueueName(driverId);
     boost_ip::message_queue::remove(w2d.c_str());
+#ifdef __linux__
+    for (WorkerId workerId = 0; workerId < numWorkers; workerId++) {
+      ShmRingSegment::removeIfPresent(
+          scip_clang::shmRingName(driverId, workerId));
+    }
+    ShmClaimTable::removeIfPresent(scip_clang::claimTableShmName(driverId));
+#endif
   }
 
   MessageQueues(std::string_view driverId, size_t numWorkers,
-                std::pair<size_t, size_t> elementSizes) {
+                std::pair<size_t, size_t> elementSizes, IpcCodec codec) {
     spdlog::debug("creating queues for IPC");
     for (WorkerId workerId = 0; workerId < numWorkers; workerId++) {
       auto d2w = scip_clang::driverToWorkerQueueName(driverId, workerId);
       driverToWorker.emplace_back(
           JsonIpcQueue(std::make_unique<boost_ip::message_queue>(
-              boost_ip::create_only, d2w.c_str(), 1, elementSizes.first)));
+                           boost_ip::create_only, d2w.c_str(), 1,
+                           elementSizes.first),
+                       codec));
     }
     auto w2d = scip_clang::workerToDriverQueueName(driverId);
     this->workerToDriver =
         JsonIpcQueue(std::make_unique<boost_ip::message_queue>(
-            boost_ip::create_only, w2d.c_str(), numWorkers,
-            elementSizes.second));
+                         boost_ip::create_only, w2d.c_str(), numWorkers,
+                         elementSizes.second),
+                     codec);
   }
 };
 
@@ -93,14 +127,51 @@ struct WorkerInfo {
   enum class Status {
     Busy,
     Idle,
+    /// Not handed any jobs; see NOTE(ref: spare-workers).
+    Spare,
   } status;
 
-  boost::process::child processHandle;
+  WorkerProcess processHandle;
 
+  // Used when status == Idle, or the time since which the worker has
+  // been waiting if status == Spare.
+  Instant idleStartTime;
+  // Used when status != Busy; time since which the worker process has
+  // been waiting for a request. Unlike idleStartTime, this is not reset
+  // when a spare worker is activated. Workers shut down if they don't
+  // receive a request for the receive timeout.
+  Instant waitingSince;
   // Used when status == Busy
   Instant startTime;
+  // Used when status == Busy; start time of the SemanticAnalysis job
+  // for the TU which is currently being processed.
+  Instant tuStartTime;
+  // Used when status == Busy; time of the latest heartbeat for the
+  // current job, or startTime if there hasn't been any.
+  // See NOTE(ref: worker-heartbeats).
+  Instant lastProgressTime;
+  // Used when status == Busy; phase reported by the latest heartbeat.
+  std::optional<WorkerPhase> phase;
+  // Used when status == Busy; set once the driver has asked the worker
+  // to cancel the current job. See NOTE(ref: soft-cancellation).
+  std::optional<Instant> cancelRequestTime;
   // Non-null when status == Busy
   std::optional<JobId> currentlyProcessing;
+  // SemanticAnalysis jobs which were sent to the worker along with
+  // an earlier job, but which it hasn't started yet.
+  // Only non-empty when status == Busy; see NOTE(ref: tu-batching).
+  std::deque<JobId> batchedJobs;
+  // Non-zero only when status == Busy; memory reserved for the current
+  // job and the rest of the batch. See NOTE(ref: memory-budget).
+  uint64_t reservedMemoryBytes;
+  // Set once the worker's RSS exceeds the limit; the worker is replaced
+  // once it becomes idle. See NOTE(ref: worker-recycling).
+  bool retireWhenIdle;
+  // Used when status == Busy; set if the driver gave up on the worker,
+  // e.g. because it didn't accept a request in time, or because its path
+  // IDs went out of sync. The worker is then killed as if it had timed
+  // out.
+  bool killRequested;
 
   WorkerInfo() = delete;
   WorkerInfo(WorkerInfo &&) = default;
@@ -108,9 +179,13 @@ struct WorkerInfo {
   WorkerInfo(const WorkerInfo &) = delete;
   WorkerInfo &operator=(const WorkerInfo &) = delete;
 
-  WorkerInfo(boost::process::child &&newWorker)
-      : status(Status::Idle), processHandle(std::move(newWorker)), startTime(),
-        currentlyProcessing() {}
+  WorkerInfo(WorkerProcess &&newWorker)
+      : status(Status::Idle), processHandle(std::move(newWorker)),
+        idleStartTime(std::chrono::steady_clock::now()),
+        waitingSince(idleStartTime), startTime(),
+        tuStartTime(), lastProgressTime(), phase(), cancelRequestTime(),
+        currentlyProcessing(), batchedJobs(), reservedMemoryBytes(0),
+        retireWhenIdle(false), killRequested(false) {}
 };
 
 struct DriverOptions {
@@ -121,7 +196,30 @@ struct DriverOptions {
   AbsolutePath statsFilePath;
   bool showCompilerDiagonstics;
   size_t numWorkers;
+  size_t numSpareWorkers;
+  uint64_t memoryBudgetBytes;
+  uint64_t recycleWorkerRssBytes;
+  bool trimMemoryBetweenTus;
+  WorkerSpawn workerSpawn;
   std::chrono::seconds receiveTimeout;
+  std::chrono::seconds heartbeatInterval;
+  std::chrono::seconds cancelGracePeriod;
+  IpcCodec ipcCodec;
+  IpcTransport ipcTransport;
+  ShardStorage shardStorage;
+  size_t maxTusPerBatch;
+  bool provisionalPlans;
+  bool shmClaimTable;
+  JobOrder jobOrder;
+  std::string jobCostHistoryPath;
+  std::string includeSetCachePath;
+  bool balanceHeaderClaims;
+  bool inProcess;
+  std::string quarantineDbPath;
+  uint32_t quarantineRuns;
+  QuarantinePolicy quarantinePolicy;
+  std::chrono::seconds quarantineTimeout;
+  bool autoscaleWorkers;
   bool deterministic;
   std::string preprocessorRecordHistoryFilterRegex;
   StdPath supplementaryOutputDir;
@@ -130,6 +228,7 @@ struct DriverOptions {
 
   StdPath temporaryOutputDir;
   bool deleteTemporaryOutputDir;
+  bool resume;
 
   std::vector<std::string> originalArgv;
 
@@ -138,7 +237,29 @@ struct DriverOptions {
         projectRootPath(AbsolutePath("/"), RootKind::Project), compdbPath(),
         indexOutputPath(), statsFilePath(),
         showCompilerDiagonstics(cliOpts.showCompilerDiagonstics),
-        numWorkers(cliOpts.numWorkers), receiveTimeout(cliOpts.receiveTimeout),
+        numWorkers(cliOpts.numWorkers),
+        numSpareWorkers(cliOpts.numSpareWorkers),
+        memoryBudgetBytes(cliOpts.memoryBudgetBytes),
+        recycleWorkerRssBytes(cliOpts.recycleWorkerRssBytes),
+        trimMemoryBetweenTus(cliOpts.trimMemoryBetweenTus),
+        workerSpawn(cliOpts.workerSpawn),
+        receiveTimeout(cliOpts.receiveTimeout),
+        heartbeatInterval(cliOpts.heartbeatInterval),
+        cancelGracePeriod(cliOpts.cancelGracePeriod),
+        ipcCodec(cliOpts.ipcCodec), ipcTransport(cliOpts.ipcTransport),
+        shardStorage(cliOpts.shardStorage),
+        maxTusPerBatch(cliOpts.maxTusPerBatch),
+        provisionalPlans(cliOpts.provisionalPlans),
+        shmClaimTable(cliOpts.shmClaimTable), jobOrder(cliOpts.jobOrder),
+        jobCostHistoryPath(cliOpts.jobCostHistoryPath),
+        includeSetCachePath(cliOpts.includeSetCachePath),
+        balanceHeaderClaims(cliOpts.balanceHeaderClaims),
+        inProcess(cliOpts.inProcess),
+        quarantineDbPath(cliOpts.quarantineDbPath),
+        quarantineRuns(cliOpts.quarantineRuns),
+        quarantinePolicy(cliOpts.quarantinePolicy),
+        quarantineTimeout(cliOpts.quarantineTimeout),
+        autoscaleWorkers(cliOpts.autoscaleWorkers),
         deterministic(cliOpts.deterministic),
         preprocessorRecordHistoryFilterRegex(
             cliOpts.preprocessorRecordHistoryFilterRegex),
@@ -146,6 +267,7 @@ struct DriverOptions {
         workerFault(cliOpts.workerFault), isTesting(cliOpts.isTesting),
         temporaryOutputDir(cliOpts.temporaryOutputDir),
         deleteTemporaryOutputDir(cliOpts.temporaryOutputDir.empty()),
+        resume(cliOpts.resume),
         originalArgv(cliOpts.originalArgv) {
     spdlog::debug("initializing driver options");
 
@@ -219,14 +341,51 @@ struct DriverOptions {
     makeDirs(this->temporaryOutputDir, "temporary output directory");
   }
 
-  void addWorkerOptions(std::vector<std::string> &args,
-                        WorkerId workerId) const {
+  /// See NOTE(ref: indexing-journal).
+  bool keepsJournal() const {
+    return !this->deleteTemporaryOutputDir && !this->inProcess
+           && this->shardStorage != ShardStorage::SharedMemory
+           && !this->provisionalPlans && !this->shmClaimTable;
+  }
+
+  void addWorkerOptions(std::vector<std::string> &args) const {
     args.push_back(fmt::format(
         "--log-level={}", spdlog::level::to_string_view(spdlog::get_level())));
     static_assert(std::is_same<decltype(this->receiveTimeout),
                                std::chrono::seconds>::value);
     args.push_back(fmt::format("--receive-timeout-seconds={}",
                                this->receiveTimeout.count()));
+    if (this->heartbeatInterval.count() > 0) {
+      args.push_back(fmt::format("--heartbeat-interval-seconds={}",
+                                 this->heartbeatInterval.count()));
+    }
+    switch (this->ipcCodec) {
+    case IpcCodec::Json:
+      args.push_back("--ipc-codec=json");
+      break;
+    case IpcCodec::Binary:
+      args.push_back("--ipc-codec=binary");
+      break;
+    }
+    switch (this->shardStorage) {
+    case ShardStorage::File:
+      break;
+    case ShardStorage::SharedMemory:
+      args.push_back("--shard-storage=shared-memory");
+      break;
+    case ShardStorage::WorkerLog:
+      args.push_back("--shard-storage=worker-log");
+      break;
+    }
+    if (this->provisionalPlans) {
+      args.push_back("--provisional-plans");
+    }
+    if (this->shmClaimTable) {
+      args.push_back("--shm-claim-table");
+    }
+    if (this->trimMemoryBetweenTus) {
+      args.push_back("--trim-memory-between-tus");
+    }
     if (this->deterministic) {
       args.push_back("--deterministic");
     }
@@ -236,15 +395,6 @@ struct DriverOptions {
     if (this->showCompilerDiagonstics) {
       args.push_back("--show-compiler-diagnostics");
     }
-    if (!this->preprocessorRecordHistoryFilterRegex.empty()) {
-      args.push_back(fmt::format("--preprocessor-record-history-filter={}",
-                                 this->preprocessorRecordHistoryFilterRegex));
-      auto logPath = this->supplementaryOutputDir;
-      logPath.append(
-          fmt::format("preprocessor-history-worker-{}.yaml", workerId));
-      args.push_back(
-          fmt::format("--preprocessor-history-log-path={}", logPath.c_str()));
-    }
     if (!this->workerFault.empty()) {
       args.push_back("--force-worker-fault=" + this->workerFault);
     }
@@ -252,6 +402,52 @@ struct DriverOptions {
     args.push_back(fmt::format("--temporary-output-dir={}",
                                this->temporaryOutputDir.c_str()));
   }
+
+  /// Options which differ across workers, so they cannot be passed to
+  /// the zygote; see NOTE(ref: worker-zygote).
+  void addPerWorkerOptions(std::vector<std::string> &args,
+                           WorkerId workerId) const {
+    if (!this->preprocessorRecordHistoryFilterRegex.empty()) {
+      args.push_back(fmt::format("--preprocessor-record-history-filter={}",
+                                 this->preprocessorRecordHistoryFilterRegex));
+      args.push_back(fmt::format("--preprocessor-history-log-path={}",
+                                 this->preprocessorHistoryLogPath(workerId)));
+    }
+  }
+
+  /// Counterpart of \c addWorkerOptions for NOTE(ref: in-process-workers).
+  WorkerOptions inProcessWorkerOptions(WorkerId workerId) const {
+    auto logPath = this->preprocessorRecordHistoryFilterRegex.empty()
+                       ? std::string()
+                       : this->preprocessorHistoryLogPath(workerId);
+    return WorkerOptions{this->projectRootPath,
+                         WorkerMode::InProcess,
+                         IpcOptions{},
+                         StdPath{},
+                         StdPath{},
+                         StdPath{},
+                         this->showCompilerDiagonstics,
+                         spdlog::get_level(),
+                         this->deterministic,
+                         !this->statsFilePath.asStringRef().empty(),
+                         PreprocessorHistoryRecordingOptions{
+                             this->preprocessorRecordHistoryFilterRegex,
+                             std::move(logPath), false, ""},
+                         this->temporaryOutputDir,
+                         this->shardStorage,
+                         false,
+                         false,
+                         false,
+                         ""};
+  }
+
+private:
+  std::string preprocessorHistoryLogPath(WorkerId workerId) const {
+    auto logPath = this->supplementaryOutputDir;
+    logPath.append(
+        fmt::format("preprocessor-history-worker-{}.yaml", workerId));
+    return logPath.string();
+  }
 };
 
 /// Type for indicating that a worker is not longer idle
@@ -268,62 +464,448 @@ struct LatestIdleWorkerId {
 /// Type that decides which files to emit symbols and occurrences for
 /// given a set of paths+hashes emitted by a worker.
 ///
-/// NOTE(def: header-recovery) We are assuming here that we will be
-/// normally be able to successfully index a large fraction of code,
-/// so don't complicate the code for fault tolerance. For example,
-/// right now, if we assigned a header to a specific worker, and
-/// that worker crashed, then the header would never be considered
-/// for indexing in the future.
+/// NOTE(def: header-recovery) If a worker crashes or times out while
+/// running an EmitIndex job, none of the files claimed for that TU
+/// end up in the index. To avoid losing headers which are shared with
+/// other TUs, the planner keeps track of the claims for each in-flight
+/// EmitIndex job. When the job is killed, the claims (except the one for
+/// the main file, which is the most likely culprit) are released, so
+/// that the next TU which reports one of those pairs claims it.
+///
+/// Once all other work is done, pairs which are still unclaimed are
+/// indexed by a recovery job, which runs the compile command of the
+/// killed TU again. Since all other pairs for it are already claimed,
+/// the recovery job only emits the released headers. There is at most
+/// one recovery job per TU, so a header which reliably crashes the
+/// worker doesn't keep it busy forever.
+///
+/// With --provisional-plans and --shm-claim-table, workers have already
+/// seen the claims, so they cannot be released, and recovery is skipped.
 ///
-/// In principle, we could maintain a list of jobs which involved
-/// that header, and later spin up new indexing jobs which forced
-/// indexing of that header. However, that would make the code more
-/// complex, so let's skip that for now.
+/// NOTE(def: provisional-plans): Normally, after semantic analysis,
+/// a worker sends the (path, hash) pairs for a TU to the driver and
+/// waits for the driver to decide which ones it should index, keeping
+/// the whole AST in memory in the meantime.
+///
+/// With --provisional-plans, the driver instead sends each worker the
+/// keys for pairs claimed since its last request (see headerClaimKey).
+/// The worker treats every pair it doesn't know to be claimed as its own,
+/// reports that provisional plan along with the semantic analysis result,
+/// and starts indexing right away. The driver doesn't send the EmitIndex
+/// job, but reconciles the plan when it processes the result:
+/// - Pairs claimed by other TUs in the meantime are not claimed again.
+///   Documents for such paths are dropped from the TU's shard when
+///   merging, as another TU is indexing them.
+/// - Pairs which the worker wrongly assumed to be claimed (only possible
+///   due to a hash collision for the key) are released, as the worker
+///   isn't indexing them.
 class FileIndexingPlanner {
-  absl::flat_hash_map<AbsolutePath, absl::flat_hash_set<HashValue>> hashesSoFar;
+  /// Global IDs for all paths reported by workers so far.
+  PathInterner globalPaths;
+  /// Maps worker-local path IDs to global path IDs, indexed by WorkerId.
+  ///
+  /// See NOTE(ref: path-interning).
+  std::vector<std::vector<PathId>> workerPathIds;
+  /// Indexed by global PathId.
+  std::vector<absl::flat_hash_set<HashValue>> hashesSoFar;
   const RootPath &projectRootPath;
 
+  /// Whether claimLog should be populated.
+  bool recordClaims;
+  /// Keys for all claimed (path, hash) pairs, in the order they were
+  /// claimed. See NOTE(ref: provisional-plans).
+  std::vector<HashValue> claimLog;
+  /// Indexed by WorkerId; number of claimLog entries sent to each worker.
+  std::vector<size_t> claimLogSentCount;
+
+  /// Number of claimed hashes keyed by hash of the absolute path.
+  /// Only set when using NOTE(ref: shm-claim-table).
+  std::optional<absl::flat_hash_map<uint64_t, uint32_t>> sharedClaimCounts;
+  bool sharedClaimTableOverflowed;
+
+  /// See NOTE(ref: balanced-header-claiming).
+  std::optional<ClaimBalancer> balancer;
+  /// Indexed by global PathId; predicted emit cost, or -1 if not computed.
+  std::vector<double> fileCosts;
+  /// (global PathId, hash) pairs left unclaimed by the balancer, which
+  /// no later TU has claimed so far.
+  absl::flat_hash_set<std::pair<uint32_t, HashValue>> deferredClaims;
+
+  using Claim = std::pair<PathId, HashValue>;
+  /// Claims for EmitIndex jobs which haven't completed yet, keyed by
+  /// task ID. See NOTE(ref: header-recovery).
+  absl::flat_hash_map<uint32_t, std::vector<Claim>> inFlightClaims;
+  /// Claims released after the EmitIndex job for a task was killed,
+  /// keyed by task ID.
+  absl::flat_hash_map<uint32_t, std::vector<Claim>> releasedClaims;
+
 public:
-  FileIndexingPlanner(const RootPath &projectRootPath)
-      : hashesSoFar(), projectRootPath(projectRootPath) {}
+  FileIndexingPlanner(const RootPath &projectRootPath, bool recordClaims)
+      : globalPaths(), workerPathIds(), hashesSoFar(),
+        projectRootPath(projectRootPath), recordClaims(recordClaims),
+        claimLog(), claimLogSentCount(), sharedClaimCounts(),
+        sharedClaimTableOverflowed(false), balancer(), fileCosts(),
+        deferredClaims(), inFlightClaims(), releasedClaims() {}
   FileIndexingPlanner(FileIndexingPlanner &&) = default;
   FileIndexingPlanner(const FileIndexingPlanner &) = delete;
 
-  void saveSemaResult(SemanticAnalysisJobResult &&semaResult,
-                      std::vector<PreprocessedFileInfo> &filesToBeIndexed) {
-    absl::flat_hash_set<HashValue> emptyHashSet{};
+  /// \p includeSets must outlive the planner.
+  void enableClaimBalancing(const IncludeSetCache &includeSets) {
+    ENFORCE(!this->recordClaims,
+            "claim balancing is incompatible with provisional plans");
+    this->balancer.emplace(includeSets, &ClaimBalancer::fileCost);
+  }
+
+  /// Returns null unless \c enableClaimBalancing was called.
+  ClaimBalancer *claimBalancer() {
+    return this->balancer.has_value() ? &this->balancer.value() : nullptr;
+  }
+
+  /// Should be called when a worker is (re)spawned, as the new process
+  /// will start assigning path IDs from scratch.
+  void resetWorkerPaths(WorkerId workerId) {
+    if (workerId < this->workerPathIds.size()) {
+      this->workerPathIds[workerId].clear();
+    }
+    if (workerId < this->claimLogSentCount.size()) {
+      this->claimLogSentCount[workerId] = 0;
+    }
+  }
+
+  /// \p filesToBeIndexed uses worker-local path IDs, same as \p semaResult.
+  ///
+  /// If \p semaResult has a provisional plan, \p filesToBeIndexed will be
+  /// a subset of it, and \p rejectedPaths will be filled with paths which
+  /// the worker is indexing but which were claimed by other TUs.
+  ///
+  /// If \p allPathIds is non-null, it is filled with the global IDs of
+  /// all files reported for the TU.
+  void saveSemaResult(WorkerId workerId, SemanticAnalysisJobResult &&semaResult,
+                      std::vector<PreprocessedFileInfo> &filesToBeIndexed,
+                      std::vector<AbsolutePath> &rejectedPaths,
+                      std::vector<PathId> *allPathIds) {
+    auto &localToGlobal = this->registerNewPaths(
+        workerId, semaResult.firstNewPathId, std::move(semaResult.newPaths));
+    auto globalPathIdFor = [&](PathId localPathId) -> std::optional<PathId> {
+      if (localPathId.value >= localToGlobal.size()) {
+        spdlog::warn("worker {} sent unknown path ID {}", workerId,
+                     localPathId.value);
+        return {};
+      }
+      return localToGlobal[localPathId.value];
+    };
     for (auto &fileInfoMulti : semaResult.illBehavedFiles) {
-      auto [it, _] = hashesSoFar.insert(
-          {AbsolutePath(std::move(fileInfoMulti.path)), emptyHashSet});
-      auto &[path, hashes] = *it;
+      auto optPathId = globalPathIdFor(fileInfoMulti.pathId);
+      if (!optPathId) {
+        continue;
+      }
+      if (allPathIds) {
+        allPathIds->push_back(*optPathId);
+      }
       for (auto hashValue : fileInfoMulti.hashValues) {
-        auto [_, inserted] = hashes.insert(hashValue);
-        if (inserted) {
-          filesToBeIndexed.push_back({path, hashValue}); // deliberate copy
+        if (this->claimForWorker(workerId, *optPathId, hashValue)) {
+          filesToBeIndexed.push_back({fileInfoMulti.pathId, hashValue});
         }
       }
     }
     for (auto &fileInfo : semaResult.wellBehavedFiles) {
-      auto [it, _] = hashesSoFar.insert(
-          {AbsolutePath(std::move(fileInfo.path)), emptyHashSet});
-      auto &[path, hashes] = *it;
-      auto [__, inserted] = hashes.insert(fileInfo.hashValue);
-      if (inserted) {
-        filesToBeIndexed.push_back(
-            {path, fileInfo.hashValue}); // deliberate copy
+      auto optPathId = globalPathIdFor(fileInfo.pathId);
+      if (!optPathId) {
+        continue;
+      }
+      if (allPathIds) {
+        allPathIds->push_back(*optPathId);
+      }
+      if (this->claimForWorker(workerId, *optPathId, fileInfo.hashValue)) {
+        filesToBeIndexed.push_back(fileInfo);
+      }
+    }
+    if (this->balancer) {
+      this->balancer->onTuPlanned(workerId);
+    }
+    if (semaResult.hasProvisionalPlan) {
+      this->reconcileProvisionalPlan(localToGlobal, semaResult.provisionalPlan,
+                                     filesToBeIndexed, rejectedPaths);
+    }
+  }
+
+  /// Appends keys for pairs claimed since the last call for \p workerId.
+  ///
+  /// See NOTE(ref: provisional-plans).
+  void takeNewClaims(WorkerId workerId, std::vector<HashValue> &newClaims) {
+    ENFORCE(this->recordClaims);
+    if (workerId >= this->claimLogSentCount.size()) {
+      this->claimLogSentCount.resize(workerId + 1, 0);
+    }
+    auto &sentCount = this->claimLogSentCount[workerId];
+    newClaims.insert(newClaims.end(), this->claimLog.begin() + sentCount,
+                     this->claimLog.end());
+    sentCount = this->claimLog.size();
+  }
+
+  /// Records the claims in \p filesToBeIndexed, which uses worker-local
+  /// path IDs, until \c completeClaims or \c releaseClaims is called.
+  ///
+  /// See NOTE(ref: header-recovery).
+  void trackClaims(uint32_t taskId, WorkerId workerId,
+                   const std::vector<PreprocessedFileInfo> &filesToBeIndexed) {
+    ENFORCE(workerId < this->workerPathIds.size());
+    auto &localToGlobal = this->workerPathIds[workerId];
+    auto &claims = this->inFlightClaims[taskId];
+    for (auto &fileInfo : filesToBeIndexed) {
+      ENFORCE(fileInfo.pathId.value < localToGlobal.size());
+      claims.emplace_back(localToGlobal[fileInfo.pathId.value],
+                          fileInfo.hashValue);
+    }
+  }
+
+  /// Returns the claims recorded by \c trackClaims for \p taskId.
+  std::vector<JournalClaim> trackedClaims(uint32_t taskId) const {
+    std::vector<JournalClaim> claims;
+    auto it = this->inFlightClaims.find(taskId);
+    if (it == this->inFlightClaims.end()) {
+      return claims;
+    }
+    for (auto &[pathId, hashValue] : it->second) {
+      claims.push_back(
+          JournalClaim{AbsolutePath(this->globalPath(pathId)), hashValue});
+    }
+    return claims;
+  }
+
+  void completeClaims(uint32_t taskId) {
+    this->inFlightClaims.erase(taskId);
+  }
+
+  /// Marks (\p path, \p hashValue) as claimed by a TU which was indexed
+  /// by an earlier run. See NOTE(ref: indexing-journal).
+  void restoreClaim(AbsolutePathRef path, HashValue hashValue) {
+    auto globalPathId = this->internGlobalPath(path);
+    this->hashesSoFar[globalPathId.value].insert(hashValue);
+  }
+
+  /// Releases claims made for \p taskId other than those for
+  /// \p mainFilePath, so that other TUs can claim them.
+  ///
+  /// Returns the number of released claims.
+  size_t releaseClaims(uint32_t taskId, std::string_view mainFilePath) {
+    auto it = this->inFlightClaims.find(taskId);
+    if (it == this->inFlightClaims.end()) {
+      return 0;
+    }
+    std::vector<Claim> released;
+    for (auto &[pathId, hashValue] : it->second) {
+      if (this->globalPath(pathId).asStringView() == mainFilePath) {
+        continue;
+      }
+      this->hashesSoFar[pathId.value].erase(hashValue);
+      released.emplace_back(pathId, hashValue);
+    }
+    this->inFlightClaims.erase(it);
+    auto numReleased = released.size();
+    if (!released.empty()) {
+      this->releasedClaims[taskId] = std::move(released);
+    }
+    return numReleased;
+  }
+
+  /// Returns the tasks for which some released claims haven't been
+  /// claimed by other TUs since, in increasing order, and forgets
+  /// about all released claims.
+  std::vector<uint32_t> takeTasksNeedingRecovery() {
+    std::vector<uint32_t> taskIds;
+    for (auto &[taskId, claims] : this->releasedClaims) {
+      size_t numUnclaimed = absl::c_count_if(claims, [&](const Claim &claim) {
+        return !this->hashesSoFar[claim.first.value].contains(claim.second);
+      });
+      if (numUnclaimed > 0) {
+        spdlog::info("{} of {} released headers for task {} were not claimed "
+                     "by other TUs",
+                     numUnclaimed, claims.size(), taskId);
+        taskIds.push_back(taskId);
       }
     }
+    this->releasedClaims.clear();
+    absl::c_sort(taskIds);
+    return taskIds;
+  }
+
+  /// Use claims from NOTE(ref: shm-claim-table) for isMultiplyIndexed,
+  /// as the planner itself doesn't see any paths in that case.
+  ///
+  /// If \p claimTableOverflowed is set, some claims are missing from
+  /// \p hashCounts, so every path is treated as multiply indexed.
+  void
+  useSharedClaimCounts(absl::flat_hash_map<uint64_t, uint32_t> &&hashCounts,
+                       bool claimTableOverflowed) {
+    this->sharedClaimCounts = std::move(hashCounts);
+    this->sharedClaimTableOverflowed = claimTableOverflowed;
+  }
+
+  AbsolutePathRef globalPath(PathId globalPathId) const {
+    return this->globalPaths.get(globalPathId).asRef();
   }
 
   bool isMultiplyIndexed(RootRelativePathRef relativePath) const {
     auto absPath = this->projectRootPath.makeAbsolute(relativePath);
-    auto it = this->hashesSoFar.find(absPath);
-    if (it == this->hashesSoFar.end()) {
+    if (this->sharedClaimCounts.has_value()) {
+      if (this->sharedClaimTableOverflowed) {
+        return true;
+      }
+      auto it = this->sharedClaimCounts->find(
+          HashValue::forText(absPath.asStringRef()));
+      return it != this->sharedClaimCounts->end() && it->second > 1;
+    }
+    auto optPathId = this->globalPaths.lookup(absPath.asRef());
+    if (!optPathId.has_value()) {
       ENFORCE(false, "found path '{}' with no recorded hashes",
               relativePath.asStringView());
       return false;
     }
-    return it->second.size() > 1;
+    return this->hashesSoFar[optPathId->value].size() > 1;
+  }
+
+  void logClaimBalancing() const {
+    if (!this->balancer) {
+      return;
+    }
+    spdlog::debug("deferred {} header claims to later TUs",
+                  this->balancer->numDeferrals());
+    if (!this->deferredClaims.empty()) {
+      spdlog::warn("{} headers were deferred to later TUs which didn't "
+                   "report them, so they were not indexed; the include set "
+                   "cache may be out of date",
+                   this->deferredClaims.size());
+    }
+  }
+
+private:
+  /// Like \c claim, but may leave the pair for a later TU.
+  ///
+  /// See NOTE(ref: balanced-header-claiming).
+  bool claimForWorker(WorkerId workerId, PathId globalPathId,
+                      HashValue hashValue) {
+    if (!this->balancer) {
+      return this->claim(globalPathId, hashValue);
+    }
+    if (this->hashesSoFar[globalPathId.value].contains(hashValue)) {
+      return false;
+    }
+    std::pair<uint32_t, HashValue> entry{globalPathId.value, hashValue};
+    auto path = this->globalPath(globalPathId).asStringView();
+    if (!this->balancer->shouldClaim(workerId, path,
+                                     this->fileCost(globalPathId))) {
+      this->deferredClaims.insert(entry);
+      return false;
+    }
+    this->deferredClaims.erase(entry);
+    return this->claim(globalPathId, hashValue);
+  }
+
+  double fileCost(PathId globalPathId) {
+    if (globalPathId.value >= this->fileCosts.size()) {
+      this->fileCosts.resize(globalPathId.value + 1, -1.0);
+    }
+    auto &cost = this->fileCosts[globalPathId.value];
+    if (cost < 0) {
+      cost = ClaimBalancer::fileCost(
+          this->globalPath(globalPathId).asStringView());
+    }
+    return cost;
+  }
+
+  /// Returns true if (\p globalPathId, \p hashValue) wasn't claimed earlier.
+  bool claim(PathId globalPathId, HashValue hashValue) {
+    auto &hashes = this->hashesSoFar[globalPathId.value];
+    auto [_, inserted] = hashes.insert(hashValue);
+    if (inserted && this->recordClaims) {
+      this->claimLog.push_back(scip_clang::headerClaimKey(
+          this->globalPaths.get(globalPathId).asRef(), hashValue));
+    }
+    return inserted;
+  }
+
+  void reconcileProvisionalPlan(
+      const std::vector<PathId> &localToGlobal,
+      const std::vector<PreprocessedFileInfo> &provisionalPlan,
+      std::vector<PreprocessedFileInfo> &filesToBeIndexed,
+      std::vector<AbsolutePath> &rejectedPaths) {
+    using Entry = std::pair<uint32_t, HashValue>;
+    absl::flat_hash_set<Entry> planned{}, assigned{};
+    for (auto &fileInfo : provisionalPlan) {
+      planned.insert({fileInfo.pathId.value, fileInfo.hashValue});
+    }
+    std::vector<PreprocessedFileInfo> confirmed{};
+    absl::flat_hash_set<uint32_t> confirmedPathIds{};
+    for (auto &fileInfo : filesToBeIndexed) {
+      Entry entry{fileInfo.pathId.value, fileInfo.hashValue};
+      assigned.insert(entry);
+      if (planned.contains(entry)) {
+        confirmed.push_back(fileInfo);
+        confirmedPathIds.insert(fileInfo.pathId.value);
+        continue;
+      }
+      auto globalPathId = localToGlobal[fileInfo.pathId.value];
+      spdlog::debug("releasing claim for '{}' not indexed by provisional plan",
+                    this->globalPaths.get(globalPathId).asStringRef());
+      this->hashesSoFar[globalPathId.value].erase(fileInfo.hashValue);
+    }
+    absl::flat_hash_set<uint32_t> rejectedPathIds{};
+    for (auto &fileInfo : provisionalPlan) {
+      auto localPathId = fileInfo.pathId.value;
+      // If some other hash for the same path was confirmed, the path
+      // is multiply indexed, and the documents will be merged anyways.
+      if (assigned.contains(Entry{localPathId, fileInfo.hashValue})
+          || confirmedPathIds.contains(localPathId)
+          || localPathId >= localToGlobal.size()) {
+        continue;
+      }
+      if (rejectedPathIds.insert(localPathId).second) {
+        rejectedPaths.emplace_back(
+            this->globalPaths.get(localToGlobal[localPathId]));
+      }
+    }
+    filesToBeIndexed = std::move(confirmed);
+  }
+
+  /// Returns false if \p firstNewPathId doesn't continue the path IDs
+  /// received from the worker so far, in which case the worker's path IDs
+  /// can't be mapped to global paths; the worker should be replaced.
+  bool pathIdsInSync(WorkerId workerId, PathId firstNewPathId) const {
+    size_t nextPathId = workerId < this->workerPathIds.size()
+                            ? this->workerPathIds[workerId].size()
+                            : 0;
+    if (firstNewPathId.value == nextPathId) {
+      return true;
+    }
+    spdlog::warn("worker {} path IDs out of sync: expected next ID {} but "
+                 "got {}",
+                 workerId, nextPathId, firstNewPathId.value);
+    return false;
+  }
+
+  const std::vector<PathId> &
+  registerNewPaths(WorkerId workerId, PathId firstNewPathId,
+                   std::vector<AbsolutePath> &&newPaths) {
+    if (workerId >= this->workerPathIds.size()) {
+      this->workerPathIds.resize(workerId + 1);
+    }
+    auto &localToGlobal = this->workerPathIds[workerId];
+    ENFORCE(firstNewPathId.value == localToGlobal.size(),
+            "worker {} path IDs out of sync: expected next ID {} but got {}",
+            workerId, localToGlobal.size(), firstNewPathId.value);
+    for (auto &path : newPaths) {
+      localToGlobal.push_back(this->internGlobalPath(path.asRef()));
+    }
+    return localToGlobal;
+  }
+
+  PathId internGlobalPath(AbsolutePathRef path) {
+    auto [globalPathId, _] = this->globalPaths.intern(path);
+    if (globalPathId.value >= this->hashesSoFar.size()) {
+      this->hashesSoFar.resize(globalPathId.value + 1);
+    }
+    return globalPathId;
   }
 };
 
@@ -333,6 +915,29 @@ class Scheduler final {
   /// Values are indexes into \c workers.
   std::deque<unsigned> idleWorkers;
 
+  /// NOTE(def: spare-workers): Respawning a worker after it is killed
+  /// (e.g. due to a crash leading to a timeout) takes a while, as the
+  /// new process needs to start up and connect to its queues before it
+  /// can start on a job. With --spare-workers=N, the driver spawns N
+  /// extra workers upfront, which are not handed any jobs. When a worker
+  /// is killed, a spare takes its place in the rotation immediately, and
+  /// the respawned process becomes a spare once it has started up.
+  ///
+  /// Workers shut down if they don't receive any request for the receive
+  /// timeout, so spares (and idle workers) which have been waiting for
+  /// a while are replaced with fresh processes.
+  ///
+  /// Values are indexes into \c workers, in the order in which they
+  /// should be used.
+  ///
+  /// Also holds workers parked by NOTE(ref: worker-autoscaling).
+  std::deque<unsigned> spareWorkers;
+  /// Number of workers which should be handed jobs; the rest are spares.
+  size_t targetActiveWorkers = 0;
+  /// Number of entries in spareWorkers for parked workers, which should
+  /// be handed jobs again once targetActiveWorkers goes up.
+  size_t numParkedWorkers = 0;
+
   /// Monotonically growing counter.
   uint32_t nextTaskId = 0;
   /// Monotonically growing map of all jobs that have been created so far.
@@ -356,32 +961,63 @@ class Scheduler final {
   /// ∀ j ∈ pendingJobs, |{w ∈ workers | w.currentlyProcessing == p}| == 1
   absl::flat_hash_set<JobId> wipJobs;
 
+  /// See NOTE(ref: tu-batching).
+  BatchSizer batchSizer;
+
+  /// See NOTE(ref: memory-budget).
+  MemoryBudget memoryBudget;
+  /// Jobs for TUs whose worker was likely killed by the OOM killer,
+  /// which are moved to pendingJobs once there are no other pending jobs.
+  /// Elements must be valid keys in allJobList.
+  std::deque<JobId> retryJobs;
+
+  /// How far ahead of a held-back job to look for jobs which fit in the
+  /// memory budget, to keep scheduling cheap with many pending jobs.
+  constexpr static size_t MAX_MEMORY_LOOKAHEAD = 256;
+
 public:
-  using Process = boost::process::child;
+  using Process = WorkerProcess;
+
+  Scheduler(size_t maxBatchSize, uint64_t memoryBudgetBytes)
+      : workers(), idleWorkers(), spareWorkers(), allJobList(), pendingJobs(),
+        wipJobs(), batchSizer(maxBatchSize), memoryBudget(memoryBudgetBytes),
+        retryJobs() {}
 
   const absl::flat_hash_map<JobId, IndexJob> &getJobMap() const {
     return this->allJobList;
   }
 
   void checkInvariants() const {
-    ENFORCE(
-        this->wipJobs.size() + this->idleWorkers.size() == this->workers.size(),
-        "wipJobs.size() ({}) + idleWorkers.size() ({}) != "
-        "workers.size() ({})",
-        this->wipJobs.size(), this->idleWorkers.size(), this->workers.size());
+    ENFORCE(this->wipJobs.size() + this->idleWorkers.size()
+                    + this->spareWorkers.size()
+                == this->workers.size(),
+            "wipJobs.size() ({}) + idleWorkers.size() ({}) + "
+            "spareWorkers.size() ({}) != workers.size() ({})",
+            this->wipJobs.size(), this->idleWorkers.size(),
+            this->spareWorkers.size(), this->workers.size());
   }
 
+  /// Spawns \p numWorkers workers which will be handed jobs, followed by
+  /// \p numSpareWorkers spares; see NOTE(ref: spare-workers).
+  ///
   /// \p spawn should only create the process; it should not call back
   /// into the Scheduler (to make reasoning about Scheduler state changes
   /// easier).
-  void initializeWorkers(size_t numWorkers,
+  void initializeWorkers(size_t numWorkers, size_t numSpareWorkers,
                          absl::FunctionRef<Process(WorkerId workerId)> spawn) {
     this->workers.clear();
-    this->workers.reserve(numWorkers);
-    for (size_t workerId = 0; workerId < numWorkers; ++workerId) {
-      boost::process::child worker = spawn(workerId);
+    this->workers.reserve(numWorkers + numSpareWorkers);
+    this->targetActiveWorkers = numWorkers;
+    for (size_t workerId = 0; workerId < numWorkers + numSpareWorkers;
+         ++workerId) {
+      Process worker = spawn(workerId);
       this->workers.emplace_back(WorkerInfo(std::move(worker)));
-      this->idleWorkers.push_back(workerId);
+      if (workerId < numWorkers) {
+        this->idleWorkers.push_back(workerId);
+      } else {
+        this->workers.back().status = WorkerInfo::Status::Spare;
+        this->spareWorkers.push_back(workerId);
+      }
     }
     this->checkInvariants();
   }
@@ -395,29 +1031,41 @@ public:
         return fmt::format("running semantic analysis for '{}'",
                            it->second.semanticAnalysis.command.Filename);
       case IndexJob::Kind::EmitIndex:
-        auto &fileInfos = it->second.emitIndex.filesToBeIndexed;
-        auto fileInfoIt = absl::c_find_if(
-            fileInfos, [](const PreprocessedFileInfo &fileInfo) -> bool {
-              auto &sv = fileInfo.path.asStringRef();
-              return sv.ends_with(".c") || sv.ends_with(".cc")
-                     || sv.ends_with(".cxx") || sv.ends_with(".cpp");
-            });
-        if (fileInfoIt != fileInfos.end()) {
-          return fmt::format("emitting an index for '{}'",
-                             fileInfoIt->path.asStringRef());
+        // The paths in EmitIndex jobs are worker-local IDs, so use
+        // the main file from the original job instead.
+        auto semaIt = this->allJobList.find(JobId::newTask(jobId.taskId()));
+        if (semaIt != this->allJobList.end()) {
+          return fmt::format(
+              "emitting an index for '{}'",
+              semaIt->second.semanticAnalysis.command.Filename);
         }
         return "emitting a shard";
       }
     }());
   }
 
-  /// Kills all workers which started before \p startedBefore and respawns them.
+  /// Kills all busy workers whose deadline (as per \p deadlineFor) is
+  /// before \p now, or for which \c requestKill was called, and respawns
+  /// them.
+  /// With a memory budget, busy workers which have exited on their own
+  /// are respawned too; see NOTE(ref: memory-budget).
+  ///
+  /// If the worker hasn't been asked to cancel its job yet, and
+  /// \p requestCancellation returns true, the worker is given more time
+  /// instead; see NOTE(ref: soft-cancellation).
   ///
-  /// \p killAndRespawn should not call back into the Scheduler (to make
-  /// reasoning about Scheduler state changes easier).
+  /// \p killAndRespawn is passed the job the worker was processing,
+  /// whether the worker had already exited, and whether the kill was
+  /// requested via \c requestKill. It should not call back into
+  /// the Scheduler (to make reasoning about Scheduler state changes
+  /// easier). Same for \p requestCancellation.
   void killLongRunningWorkersAndRespawn(
-      Instant startedBefore,
-      absl::FunctionRef<Process(Process &&, WorkerId)> killAndRespawn) {
+      Instant now, absl::FunctionRef<Instant(const WorkerInfo &)> deadlineFor,
+      absl::FunctionRef<bool(WorkerId, const WorkerInfo &)>
+          requestCancellation,
+      absl::FunctionRef<Process(Process &&, WorkerId, JobId, const IndexJob &,
+                                bool exited, bool killRequested)>
+          killAndRespawn) {
     this->checkInvariants();
     // NOTE: N_workers <= 500. On the fast path, this boils down to
     // N_workers indexing ops + integer comparisons, so it should be cheap.
@@ -425,25 +1073,176 @@ public:
       auto &workerInfo = this->workers[workerId];
       switch (workerInfo.status) {
       case WorkerInfo::Status::Idle:
+      case WorkerInfo::Status::Spare:
         continue;
-      case WorkerInfo::Status::Busy:
-        if (workerInfo.startTime < startedBefore) {
-          spdlog::info("killing worker {}, pid {}", workerId,
-                       workerInfo.processHandle.id());
+      case WorkerInfo::Status::Busy: {
+        // See NOTE(ref: memory-budget)
+        bool exited = this->memoryBudget.enabled()
+                      && !workerInfo.processHandle.running();
+        bool killRequested = workerInfo.killRequested;
+        if (exited || killRequested || deadlineFor(workerInfo) < now) {
+          if (!exited && !killRequested
+              && !workerInfo.cancelRequestTime.has_value()
+              && requestCancellation(workerId, workerInfo)) {
+            workerInfo.cancelRequestTime = now;
+            continue;
+          }
           auto oldJobId = workerInfo.currentlyProcessing.value();
           bool erased = this->wipJobs.erase(oldJobId);
           ENFORCE(erased, "*worker.currentlyProcessing was not marked WIP");
-          spdlog::warn("skipping job {} due to worker timeout",
-                       oldJobId.debugString());
+          if (exited) {
+            spdlog::warn("worker {}, pid {} exited while processing job {}",
+                         workerId, workerInfo.processHandle.id(),
+                         oldJobId.debugString());
+          } else if (killRequested) {
+            spdlog::info("replacing worker {}, pid {}", workerId,
+                         workerInfo.processHandle.id());
+            spdlog::warn("skipping job {} as its worker was replaced",
+                         oldJobId.debugString());
+          } else {
+            spdlog::info("killing worker {}, pid {}", workerId,
+                         workerInfo.processHandle.id());
+            spdlog::warn("skipping job {} due to worker timeout",
+                         oldJobId.debugString());
+          }
           this->logJobSkip(oldJobId);
+          // The worker never started on these, so let other workers
+          // pick them up, preserving the original order.
+          for (auto it = workerInfo.batchedJobs.rbegin();
+               it != workerInfo.batchedJobs.rend(); ++it) {
+            this->pendingJobs.push_front(*it);
+          }
+          this->releaseMemory(workerId);
+          auto jobIt = this->allJobList.find(oldJobId);
+          ENFORCE(jobIt != this->allJobList.end());
           auto newHandle =
-              killAndRespawn(std::move(workerInfo.processHandle), workerId);
+              killAndRespawn(std::move(workerInfo.processHandle), workerId,
+                             oldJobId, jobIt->second, exited, killRequested);
           workerInfo = WorkerInfo(std::move(newHandle));
-          this->idleWorkers.push_back(workerId);
+          if (this->spareWorkers.empty()) {
+            this->idleWorkers.push_back(workerId);
+          } else {
+            // See NOTE(ref: spare-workers)
+            auto spareWorkerId = this->activateSpareWorker();
+            spdlog::debug("worker {} taking over from a killed worker",
+                          spareWorkerId);
+            workerInfo.status = WorkerInfo::Status::Spare;
+            this->spareWorkers.push_back(workerId);
+          }
           this->checkInvariants();
         }
       }
+      }
+    }
+  }
+
+  /// Replaces idle and spare workers which have been waiting since
+  /// before \p waitingSince with fresh processes, so that jobs are never
+  /// sent to a worker which has shut down after the receive timeout.
+  /// See NOTE(ref: spare-workers).
+  ///
+  /// \p killAndRespawn should not call back into the Scheduler.
+  void recycleStaleWorkers(
+      Instant waitingSince,
+      absl::FunctionRef<Process(Process &&, WorkerId)> killAndRespawn) {
+    auto recycle = [&](unsigned workerId, WorkerInfo::Status status) {
+      auto &workerInfo = this->workers[workerId];
+      ENFORCE(workerInfo.status == status);
+      if (workerInfo.waitingSince >= waitingSince) {
+        return;
+      }
+      spdlog::debug("replacing {} worker {}",
+                    status == WorkerInfo::Status::Spare ? "spare" : "idle",
+                    workerId);
+      auto newHandle =
+          killAndRespawn(std::move(workerInfo.processHandle), workerId);
+      workerInfo = WorkerInfo(std::move(newHandle));
+      workerInfo.status = status;
+    };
+    for (auto workerId : this->idleWorkers) {
+      recycle(workerId, WorkerInfo::Status::Idle);
+    }
+    for (auto workerId : this->spareWorkers) {
+      recycle(workerId, WorkerInfo::Status::Spare);
+    }
+  }
+
+  /// See NOTE(ref: worker-recycling).
+  void markForRetirement(WorkerId workerId) {
+    this->workers[workerId].retireWhenIdle = true;
+  }
+
+  /// Replaces idle workers marked by \c markForRetirement with fresh
+  /// processes, returning the number of workers replaced. If there is
+  /// a spare worker, it takes over from the retired worker, and the
+  /// fresh process becomes a spare. See NOTE(ref: worker-recycling).
+  ///
+  /// \p retireAndRespawn should not call back into the Scheduler.
+  size_t retireIdleWorkers(
+      absl::FunctionRef<Process(Process &&, WorkerId)> retireAndRespawn) {
+    std::vector<unsigned> retiredWorkerIds;
+    for (auto workerId : this->idleWorkers) {
+      if (this->workers[workerId].retireWhenIdle) {
+        retiredWorkerIds.push_back(workerId);
+      }
+    }
+    for (auto workerId : retiredWorkerIds) {
+      auto &workerInfo = this->workers[workerId];
+      ENFORCE(workerInfo.status == WorkerInfo::Status::Idle);
+      ENFORCE(workerInfo.batchedJobs.empty());
+      auto it = absl::c_find(this->idleWorkers, workerId);
+      ENFORCE(it != this->idleWorkers.end());
+      this->idleWorkers.erase(it);
+      auto newHandle =
+          retireAndRespawn(std::move(workerInfo.processHandle), workerId);
+      workerInfo = WorkerInfo(std::move(newHandle));
+      if (this->spareWorkers.empty()) {
+        this->idleWorkers.push_back(workerId);
+      } else {
+        auto spareWorkerId = this->activateSpareWorker();
+        spdlog::debug("worker {} taking over from retired worker {}",
+                      spareWorkerId, workerId);
+        workerInfo.status = WorkerInfo::Status::Spare;
+        this->spareWorkers.push_back(workerId);
+      }
+    }
+    this->checkInvariants();
+    return retiredWorkerIds.size();
+  }
+
+  /// Earliest deadline (as per \p deadlineFor) across busy workers, if any.
+  std::optional<Instant> earliestDeadline(
+      absl::FunctionRef<Instant(const WorkerInfo &)> deadlineFor) const {
+    std::optional<Instant> earliest;
+    for (auto &workerInfo : this->workers) {
+      if (workerInfo.status != WorkerInfo::Status::Busy) {
+        continue;
+      }
+      auto deadline = deadlineFor(workerInfo);
+      if (!earliest || deadline < *earliest) {
+        earliest = deadline;
+      }
+    }
+    return earliest;
+  }
+
+  /// Heartbeats for jobs other than the one the worker is processing
+  /// (e.g. a job which has completed since) are ignored.
+  /// See NOTE(ref: worker-heartbeats).
+  void recordHeartbeat(WorkerId workerId, JobId jobId, WorkerPhase phase) {
+    if (workerId >= this->workers.size()) {
+      spdlog::warn("ignoring heartbeat from unknown worker {}", workerId);
+      return;
+    }
+    auto &workerInfo = this->workers[workerId];
+    if (workerInfo.status != WorkerInfo::Status::Busy
+        || workerInfo.currentlyProcessing != jobId) {
+      spdlog::debug("ignoring stale heartbeat from worker {} for job {}",
+                    workerId, jobId.debugString());
+      return;
     }
+    workerInfo.lastProgressTime = std::chrono::steady_clock::now();
+    workerInfo.phase = phase;
   }
 
   void waitForAllWorkers() {
@@ -452,11 +1251,106 @@ public:
     }
   }
 
-  void queueNewTask(IndexJob &&j) {
+  /// Makes the next \c killLongRunningWorkersAndRespawn kill the busy
+  /// worker and skip its job.
+  void requestKill(WorkerId workerId) {
+    auto &workerInfo = this->workers[workerId];
+    ENFORCE(workerInfo.status == WorkerInfo::Status::Busy);
+    workerInfo.killRequested = true;
+  }
+
+  bool anyKillRequested() const {
+    return absl::c_any_of(this->workers, [](const WorkerInfo &workerInfo) {
+      return workerInfo.status == WorkerInfo::Status::Busy
+             && workerInfo.killRequested;
+    });
+  }
+
+  /// Returns true if \p jobId is the job \p workerId is working on, i.e.
+  /// a response for it is not stale.
+  bool isCurrentJob(WorkerId workerId, JobId jobId) const {
+    return workerId < this->workers.size()
+           && this->workers[workerId].currentlyProcessing == jobId;
+  }
+
+  /// For workers which didn't accept a shutdown request in time.
+  void terminateWorker(WorkerId workerId) {
+    this->workers[workerId].processHandle.terminate();
+  }
+
+  JobId queueNewTask(IndexJob &&j) {
     auto jobId = JobId::newTask(this->nextTaskId);
     this->nextTaskId++;
     this->allJobList.insert({jobId, std::move(j)});
     this->pendingJobs.push_back(jobId);
+    return jobId;
+  }
+
+  /// Makes task IDs for new jobs start at \p taskId or later, so that
+  /// they don't clash with IDs from NOTE(ref: indexing-journal).
+  void reserveTaskIdsBelow(uint32_t taskId) {
+    this->nextTaskId = std::max(this->nextTaskId, taskId);
+  }
+
+  /// Like \c queueNewTask, but the job reserves the whole memory budget,
+  /// and is only queued once there are no other pending jobs.
+  /// See NOTE(ref: memory-budget).
+  JobId queueRetryTask(IndexJob &&j) {
+    auto jobId = JobId::newTask(this->nextTaskId);
+    this->nextTaskId++;
+    this->allJobList.insert({jobId, std::move(j)});
+    this->retryJobs.push_back(jobId);
+    this->memoryBudget.setExpectedBytes(jobId.taskId(),
+                                        this->memoryBudget.totalBytes());
+    return jobId;
+  }
+
+  /// Takes effect the next time the Scheduler hands out jobs.
+  /// See NOTE(ref: worker-autoscaling).
+  void setTargetActiveWorkers(size_t numWorkers) {
+    ENFORCE(numWorkers > 0);
+    this->targetActiveWorkers = numWorkers;
+  }
+
+  /// See NOTE(ref: memory-budget).
+  void setExpectedPeakRss(JobId jobId, uint64_t bytes) {
+    this->memoryBudget.setExpectedBytes(jobId.taskId(), bytes);
+  }
+
+  /// Removes the next pending job without assigning it to a worker
+  /// process. See NOTE(ref: in-process-workers).
+  std::optional<JobId> takePendingJob() {
+    if (this->pendingJobs.empty()) {
+      return {};
+    }
+    auto jobId = this->pendingJobs.front();
+    this->pendingJobs.pop_front();
+    return jobId;
+  }
+
+  /// \p computeOrder should return a permutation of indexes into the
+  /// commands for the pending jobs.
+  ///
+  /// See NOTE(ref: job-ordering).
+  void reorderPendingJobs(
+      absl::FunctionRef<std::vector<size_t>(
+          const std::vector<const clang::tooling::CompileCommand *> &)>
+          computeOrder) {
+    std::vector<const clang::tooling::CompileCommand *> commands;
+    commands.reserve(this->pendingJobs.size());
+    for (auto jobId : this->pendingJobs) {
+      auto it = this->allJobList.find(jobId);
+      ENFORCE(it != this->allJobList.end()
+              && it->second.kind == IndexJob::Kind::SemanticAnalysis);
+      commands.push_back(&it->second.semanticAnalysis.command);
+    }
+    auto order = computeOrder(commands);
+    ENFORCE(order.size() == commands.size());
+    std::deque<JobId> reorderedJobs;
+    for (auto i : order) {
+      reorderedJobs.push_back(this->pendingJobs[i]);
+    }
+    this->pendingJobs = std::move(reorderedJobs);
   }
 
   [[nodiscard]] IndexJobRequest
@@ -474,22 +1368,46 @@ public:
 
   [[nodiscard]] IndexJobRequest
   scheduleJobOnWorker(ToBeScheduledWorkerId &&workerId, JobId jobId) {
+    auto &workerInfo = this->workers[workerId.getValueNonConsuming()];
     ENFORCE(absl::c_find(this->idleWorkers, workerId.getValueNonConsuming())
             == this->idleWorkers.end());
     // TODO(ref: add-job-debug-helper) Print abbreviated job data here.
-    spdlog::debug("assigning jobId {} to worker {}", jobId.debugString(),
+    spdlog::debug("assigning jobId {} (+{} batched) to worker {}",
+                  jobId.debugString(), workerInfo.batchedJobs.size(),
                   workerId.getValueNonConsuming());
     ENFORCE(this->wipJobs.contains(jobId),
             "should've marked job WIP before scheduling");
     this->markWorkerBusy(std::move(workerId), jobId);
     auto it = this->allJobList.find(jobId);
     ENFORCE(it != this->allJobList.end(), "trying to assign unknown job");
-    return IndexJobRequest{it->first, it->second};
+    IndexJobRequest request{it->first, it->second, {}, {}};
+    for (auto batchedJobId : workerInfo.batchedJobs) {
+      auto batchedIt = this->allJobList.find(batchedJobId);
+      ENFORCE(batchedIt != this->allJobList.end()
+              && batchedIt->second.kind == IndexJob::Kind::SemanticAnalysis);
+      request.batch.push_back(BatchedSemanticAnalysisJob{
+          batchedJobId, batchedIt->second.semanticAnalysis});
+    }
+    return request;
   }
 
-  [[nodiscard]] LatestIdleWorkerId markCompleted(WorkerId workerId, JobId jobId,
-                                                 IndexJob::Kind responseKind) {
-    ENFORCE(this->workers[workerId].currentlyProcessing == jobId);
+  /// Returns null if \p jobId is not the worker's current job, e.g. if
+  /// the worker was killed after sending the result, but before it was
+  /// received. Like \c markCancelled.
+  [[nodiscard]] std::optional<LatestIdleWorkerId>
+  markCompleted(WorkerId workerId, JobId jobId, IndexJob::Kind responseKind) {
+    if (!this->isCurrentJob(workerId, jobId)) {
+      spdlog::debug("ignoring stale result for job {} from worker {}",
+                    jobId.debugString(), workerId);
+      return {};
+    }
+    if (responseKind == IndexJob::Kind::EmitIndex) {
+      this->batchSizer.recordTuLatency(std::chrono::steady_clock::now()
+                                       - this->workers[workerId].tuStartTime);
+      if (this->workers[workerId].batchedJobs.empty()) {
+        this->releaseMemory(workerId);
+      }
+    }
     this->markWorkerIdle(workerId);
     bool erased = wipJobs.erase(jobId);
     ENFORCE(erased, "received response for job not marked WIP");
@@ -497,16 +1415,67 @@ public:
     return LatestIdleWorkerId{workerId};
   }
 
+  /// Returns null if \p jobId is not the worker's current job, e.g. if
+  /// the worker was killed after it cancelled the job, but before the
+  /// response was received. See NOTE(ref: soft-cancellation).
+  [[nodiscard]] std::optional<LatestIdleWorkerId>
+  markCancelled(WorkerId workerId, JobId jobId) {
+    if (!this->isCurrentJob(workerId, jobId)) {
+      spdlog::debug("ignoring stale cancellation of job {} by worker {}",
+                    jobId.debugString(), workerId);
+      return {};
+    }
+    if (this->workers[workerId].batchedJobs.empty()) {
+      this->releaseMemory(workerId);
+    }
+    this->markWorkerIdle(workerId);
+    bool erased = this->wipJobs.erase(jobId);
+    ENFORCE(erased, "received cancellation for job not marked WIP");
+    spdlog::warn("skipping job {} due to worker timeout", jobId.debugString());
+    this->logJobSkip(jobId);
+    return LatestIdleWorkerId{workerId};
+  }
+
+  /// If the worker has jobs left over from an earlier batch, marks the
+  /// next one as being processed. The worker already has the job, so
+  /// there is nothing to send.
+  ///
+  /// See NOTE(ref: tu-batching).
+  void startNextBatchedJobIfAny(LatestIdleWorkerId workerId) {
+    auto &batchedJobs = this->workers[workerId.id].batchedJobs;
+    if (batchedJobs.empty()) {
+      return;
+    }
+    ENFORCE(!this->idleWorkers.empty());
+    ENFORCE(this->idleWorkers.front() == workerId.id);
+    this->idleWorkers.pop_front();
+    JobId nextJob = batchedJobs.front();
+    batchedJobs.pop_front();
+    auto [_, inserted] = this->wipJobs.insert(nextJob);
+    ENFORCE(inserted, "batched job was already marked WIP");
+    spdlog::debug("worker {} continuing with batched job {}", workerId.id,
+                  nextJob.debugString());
+    this->markWorkerBusy(ToBeScheduledWorkerId(std::move(workerId.id)),
+                         nextJob);
+  }
+
   /// Pre-condition: \p refillJobs should stay fixed at 0 once it reaches 0.
+  /// It may return 0 right away if all TUs were indexed by an earlier run
+  /// (see NOTE(ref: indexing-journal)), or if all remaining TUs were held
+  /// back for \p queueRecoveryJobs (see NOTE(ref: tu-quarantine)).
   void
-  runJobsTillCompletion(absl::FunctionRef<void()> processOneJobResult,
+  runJobsTillCompletion(absl::FunctionRef<void()> processJobResults,
                         absl::FunctionRef<size_t()> refillJobs,
+                        absl::FunctionRef<size_t()> queueRecoveryJobs,
                         absl::FunctionRef<void(ToBeScheduledWorkerId &&, JobId)>
                             assignJobToWorker) {
     this->checkInvariants();
     size_t refillCount = refillJobs();
-    ENFORCE(refillCount > 0);
-    ENFORCE(this->pendingJobs.size() == refillCount);
+    size_t numQueued = refillCount != 0 ? refillCount : queueRecoveryJobs();
+    if (numQueued == 0) {
+      return;
+    }
+    ENFORCE(this->pendingJobs.size() == numQueued);
     // NOTE(def: scheduling-invariant):
     // Jobs are refilled into the pending jobs list before WIP jobs are
     // marked as completed. This means that if there is at least one TU
@@ -514,77 +1483,283 @@ public:
     //   pendingJobs.size() != 0 && wipJobs.size() != 0
     while (true) {
       this->checkInvariants();
+      this->applyTargetActiveWorkers();
       if (this->pendingJobs.empty()) {
         if (this->wipJobs.empty()) {
-          break;
+          // See NOTE(ref: memory-budget) and NOTE(ref: header-recovery)
+          if (this->queueRetryJobs() == 0 && queueRecoveryJobs() == 0) {
+            break;
+          }
+          continue;
         } else if (refillCount != 0) {
           refillCount = refillJobs();
+        } else if (this->queueRetryJobs() != 0) {
+          continue;
         }
       } else if (!this->idleWorkers.empty()) {
         this->assignJobsToIdleWorkers(assignJobToWorker);
       }
       ENFORCE(!this->wipJobs.empty());
-      processOneJobResult();
+      processJobResults();
     }
     this->checkInvariants();
-    ENFORCE(this->idleWorkers.size() == this->workers.size(),
+    ENFORCE(this->wipJobs.empty(),
             "all workers should be idle after jobs have been completed");
+    this->logTailIdleTime();
   }
 
-private:
-  ToBeScheduledWorkerId claimIdleWorker() {
-    ENFORCE(!this->idleWorkers.empty());
-    WorkerId workerId = this->idleWorkers.front();
-    this->idleWorkers.pop_front();
-    return ToBeScheduledWorkerId(std::move(workerId));
+  /// Logs how long workers spent idle after running out of work, which
+  /// is what NOTE(ref: job-ordering) tries to reduce.
+  void logTailIdleTime() const {
+    if (this->workers.empty()) {
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration totalIdle{0};
+    Instant firstIdleStart = now;
+    for (auto &workerInfo : this->workers) {
+      if (workerInfo.status == WorkerInfo::Status::Spare) {
+        continue;
+      }
+      ENFORCE(workerInfo.status == WorkerInfo::Status::Idle);
+      totalIdle += now - workerInfo.idleStartTime;
+      firstIdleStart = std::min(firstIdleStart, workerInfo.idleStartTime);
+    }
+    using secs = std::chrono::duration<double>;
+    spdlog::info("tail idle time: {:.1f}s across {} workers (last TU "
+                 "finished {:.1f}s after the first worker ran out of work)",
+                 secs(totalIdle).count(), this->idleWorkers.size(),
+                 secs(now - firstIdleStart).count());
   }
 
-  void markWorkerIdle(WorkerId workerId) {
+private:
+  /// Moves the first spare worker into the rotation, ahead of other idle
+  /// workers, as it is already waiting for a job.
+  unsigned activateSpareWorker() {
+    ENFORCE(!this->spareWorkers.empty());
+    auto workerId = this->spareWorkers.front();
+    this->spareWorkers.pop_front();
     auto &workerInfo = this->workers[workerId];
-    ENFORCE(workerInfo.currentlyProcessing.has_value());
-    workerInfo.currentlyProcessing = {};
-    ENFORCE(workerInfo.status == WorkerInfo::Status::Busy);
+    ENFORCE(workerInfo.status == WorkerInfo::Status::Spare);
     workerInfo.status = WorkerInfo::Status::Idle;
+    workerInfo.idleStartTime = std::chrono::steady_clock::now();
     this->idleWorkers.push_front(workerId);
+    return workerId;
   }
 
-  void markWorkerBusy(ToBeScheduledWorkerId &&workerId, JobId newJobId) {
-    auto &nextWorkerInfo = this->workers[workerId.getValueAndConsume()];
-    ENFORCE(nextWorkerInfo.status == WorkerInfo::Status::Idle);
-    nextWorkerInfo.status = WorkerInfo::Status::Busy;
-    ENFORCE(!nextWorkerInfo.currentlyProcessing.has_value());
-    nextWorkerInfo.currentlyProcessing = {newJobId};
+  /// Parks idle workers or unparks spare workers so that the number of
+  /// workers which are handed jobs approaches targetActiveWorkers.
+  /// Busy workers are parked once they become idle.
+  ///
+  /// See NOTE(ref: worker-autoscaling).
+  void applyTargetActiveWorkers() {
+    auto numActive = this->workers.size() - this->spareWorkers.size();
+    while (numActive > this->targetActiveWorkers
+           && !this->idleWorkers.empty()) {
+      // Park the worker which has been idle for the longest time.
+      auto workerId = this->idleWorkers.back();
+      this->idleWorkers.pop_back();
+      auto &workerInfo = this->workers[workerId];
+      ENFORCE(workerInfo.status == WorkerInfo::Status::Idle);
+      ENFORCE(workerInfo.batchedJobs.empty());
+      workerInfo.status = WorkerInfo::Status::Spare;
+      this->spareWorkers.push_back(workerId);
+      this->numParkedWorkers++;
+      numActive--;
+      spdlog::debug("parked worker {}", workerId);
+    }
+    while (numActive < this->targetActiveWorkers
+           && this->numParkedWorkers > 0) {
+      auto workerId = this->activateSpareWorker();
+      this->numParkedWorkers--;
+      numActive++;
+      spdlog::debug("unparked worker {}", workerId);
+    }
+  }
+
+  /// Moves jobs from the retry lane to the pending jobs, returning the
+  /// number of jobs moved. See NOTE(ref: memory-budget).
+  size_t queueRetryJobs() {
+    auto numJobs = this->retryJobs.size();
+    for (auto jobId : this->retryJobs) {
+      this->pendingJobs.push_back(jobId);
+    }
+    this->retryJobs.clear();
+    return numJobs;
+  }
+
+  void releaseMemory(WorkerId workerId) {
+    auto &workerInfo = this->workers[workerId];
+    this->memoryBudget.release(workerInfo.reservedMemoryBytes);
+    workerInfo.reservedMemoryBytes = 0;
+  }
+
+  /// Returns the first pending job which can be started within the
+  /// memory budget, or \c pendingJobs.end() if there is none.
+  /// See NOTE(ref: memory-budget).
+  std::deque<JobId>::iterator nextStartableJob() {
+    auto it = this->pendingJobs.begin();
+    if (it == this->pendingJobs.end()
+        || this->memoryBudget.fits(this->memoryBudget.expectedBytesFor(*it))) {
+      return it;
+    }
+    auto heldBackBytes = this->memoryBudget.expectedBytesFor(*it);
+    auto end = this->pendingJobs.size() > MAX_MEMORY_LOOKAHEAD
+                   ? it + MAX_MEMORY_LOOKAHEAD
+                   : this->pendingJobs.end();
+    for (++it; it != end; ++it) {
+      if (this->memoryBudget.fits(heldBackBytes
+                                  + this->memoryBudget.expectedBytesFor(*it))) {
+        return it;
+      }
+    }
+    return this->pendingJobs.end();
+  }
+
+  ToBeScheduledWorkerId claimIdleWorker() {
+    ENFORCE(!this->idleWorkers.empty());
+    WorkerId workerId = this->idleWorkers.front();
+    this->idleWorkers.pop_front();
+    return ToBeScheduledWorkerId(std::move(workerId));
+  }
+
+  void markWorkerIdle(WorkerId workerId) {
+    auto &workerInfo = this->workers[workerId];
+    ENFORCE(workerInfo.currentlyProcessing.has_value());
+    workerInfo.currentlyProcessing = {};
+    ENFORCE(workerInfo.status == WorkerInfo::Status::Busy);
+    workerInfo.status = WorkerInfo::Status::Idle;
+    workerInfo.idleStartTime = std::chrono::steady_clock::now();
+    workerInfo.waitingSince = workerInfo.idleStartTime;
+    this->idleWorkers.push_front(workerId);
+  }
+
+  void markWorkerBusy(ToBeScheduledWorkerId &&workerId, JobId newJobId) {
+    auto &nextWorkerInfo = this->workers[workerId.getValueAndConsume()];
+    ENFORCE(nextWorkerInfo.status == WorkerInfo::Status::Idle);
+    nextWorkerInfo.status = WorkerInfo::Status::Busy;
+    ENFORCE(!nextWorkerInfo.currentlyProcessing.has_value());
+    nextWorkerInfo.currentlyProcessing = {newJobId};
     nextWorkerInfo.startTime = std::chrono::steady_clock::now();
+    nextWorkerInfo.lastProgressTime = nextWorkerInfo.startTime;
+    nextWorkerInfo.phase = {};
+    nextWorkerInfo.cancelRequestTime = {};
+    auto it = this->allJobList.find(newJobId);
+    ENFORCE(it != this->allJobList.end(), "trying to assign unknown job");
+    if (it->second.kind == IndexJob::Kind::SemanticAnalysis) {
+      nextWorkerInfo.tuStartTime = nextWorkerInfo.startTime;
+    }
   }
 
   void assignJobsToIdleWorkers(
       absl::FunctionRef<void(ToBeScheduledWorkerId &&, JobId)> assignJob) {
-    auto numJobsToAssign =
-        std::min(this->idleWorkers.size(), this->pendingJobs.size());
-    ENFORCE(numJobsToAssign >= 1, "no workers or pending jobs");
-    for (unsigned i = 0; i < numJobsToAssign; ++i) {
-      JobId nextJob = this->pendingJobs.front();
-      this->pendingJobs.pop_front();
+    ENFORCE(!this->idleWorkers.empty() && !this->pendingJobs.empty(),
+            "no workers or pending jobs");
+    while (!this->idleWorkers.empty() && !this->pendingJobs.empty()) {
+      auto jobIt = this->nextStartableJob();
+      if (jobIt == this->pendingJobs.end()) {
+        // Wait for busy workers to free up memory.
+        break;
+      }
+      auto batchSize = this->batchSizer.nextBatchSize(
+          this->pendingJobs.size(), this->idleWorkers.size());
+      JobId nextJob = *jobIt;
+      this->pendingJobs.erase(jobIt);
       auto [_, inserted] = this->wipJobs.insert(nextJob);
       ENFORCE(inserted, "job from pendingJobs was not already WIP");
       auto nextWorkerId = this->claimIdleWorker();
+      auto &workerInfo = this->workers[nextWorkerId.getValueNonConsuming()];
+      auto &batchedJobs = workerInfo.batchedJobs;
+      ENFORCE(batchedJobs.empty(), "idle worker has unfinished batch");
+      auto reservedBytes = this->memoryBudget.expectedBytesFor(nextJob);
+      while (batchedJobs.size() + 1 < batchSize && !this->pendingJobs.empty()
+             && this->memoryBudget.expectedBytesFor(this->pendingJobs.front())
+                    <= reservedBytes) {
+        batchedJobs.push_back(this->pendingJobs.front());
+        this->pendingJobs.pop_front();
+      }
+      this->memoryBudget.reserve(reservedBytes);
+      workerInfo.reservedMemoryBytes = reservedBytes;
       assignJob(std::move(nextWorkerId), nextJob);
       this->checkInvariants();
     }
   }
 };
 
+/// Where the driver can find the index shards for a single TU.
+struct ShardLocation {
+  uint32_t taskId;
+  WorkerId workerId;
+  ShardPaths paths;
+  /// Only valid if paths.storage == ShardStorage::WorkerLog.
+  ShardLogRecords logRecords;
+};
+
 /// Type responsible for administrative tasks like timeouts, progressively
 /// queueing jobs and killing misbehaving workers.
 class Driver {
   DriverOptions options;
   std::string id;
   MessageQueues queues;
+#ifdef __linux__
+  /// Non-null iff using NOTE(ref: shm-ring-transport).
+  std::unique_ptr<ShmRingDriverTransport> shmTransport;
+  /// Only used with shmTransport; JsonIpcQueue handles this otherwise.
+  IpcChunkAssembler shmChunkAssembler;
+  /// Non-null iff using NOTE(ref: shm-claim-table).
+  std::unique_ptr<ShmClaimTable> claimTable;
+#endif
+  /// Only set with --worker-spawn=zygote; see NOTE(ref: worker-zygote).
+  std::optional<Zygote> zygote;
   Scheduler scheduler;
   FileIndexingPlanner planner;
 
   std::vector<std::pair<JobId, IndexingStatistics>> allStatistics;
-  std::vector<ShardPaths> shardPaths;
+  /// Indexed by WorkerId; total time each worker spent blocked
+  /// waiting for an EmitIndex job after semantic analysis.
+  std::vector<uint64_t> planWaitTimeMicrosPerWorker;
+  std::vector<ShardLocation> shards;
+  /// Only used with NOTE(ref: in-process-workers).
+  ConcurrentClaimMap inProcessClaims;
+  std::optional<InProcessIndexMerger> inProcessMerger;
+  /// Absolute paths of documents to drop from each TU's shard, keyed by
+  /// task ID. See NOTE(ref: provisional-plans).
+  absl::flat_hash_map<uint32_t, absl::flat_hash_set<std::string>>
+      provisionallyRejectedPaths;
+  /// See NOTE(ref: header-coverage-ordering).
+  IncludeSetCache includeSetCache;
+  /// Loaded from --job-cost-history, if present. See NOTE(ref: job-ordering)
+  /// and NOTE(ref: worker-heartbeats).
+  JobCostModel jobCosts;
+  /// Task IDs for jobs queued by queueRecoveryJobs, which should not
+  /// be recovered again. See NOTE(ref: header-recovery).
+  absl::flat_hash_set<uint32_t> recoveryTaskIds;
+  /// Task IDs for jobs queued by queueOomRetry, which should not be
+  /// retried again. See NOTE(ref: memory-budget).
+  absl::flat_hash_set<uint32_t> retryTaskIds;
+  /// Task IDs for TUs after which the worker was retired.
+  /// See NOTE(ref: worker-recycling).
+  absl::flat_hash_set<uint32_t> recycledWorkerTaskIds;
+  size_t numRecycledWorkers = 0;
+  /// Only set with --autoscale-workers; see NOTE(ref: worker-autoscaling).
+  std::optional<WorkerAutoscaler> autoscaler;
+  ResourceMonitor resourceMonitor;
+  Instant nextAutoscaleTime;
+  /// Only set if the options allow for it; see
+  /// NOTE(ref: indexing-journal).
+  std::optional<IndexingJournal> journal;
+  /// Keys for compile commands indexed by an earlier run, which are
+  /// skipped when queueing jobs. Only non-empty with --resume.
+  absl::flat_hash_set<HashValue> resumedCommandKeys;
+  /// Statistics for TUs indexed by an earlier run, keyed by task ID.
+  std::vector<std::pair<uint32_t, StatsEntry>> resumedStatistics;
+  /// Only set with --quarantine-db; see NOTE(ref: tu-quarantine).
+  std::optional<Quarantine> quarantine;
+  /// Quarantined commands to be queued once all other work is done.
+  std::vector<clang::tooling::CompileCommand> deferredCommands;
+  /// Task IDs for jobs queued from deferredCommands.
+  absl::flat_hash_set<uint32_t> quarantinedTaskIds;
+  size_t numSkippedQuarantinedTus = 0;
 
   /// Total number of commands in the compilation database.
   size_t compdbCommandCount = 0;
@@ -595,13 +1770,86 @@ public:
   Driver &operator=(const Driver &) = delete;
 
   Driver(std::string driverId, DriverOptions &&options)
-      : options(std::move(options)), id(driverId), scheduler(),
-        planner(this->options.projectRootPath), shardPaths(), compdbParser() {
-    MessageQueues::deleteIfPresent(this->id, this->numWorkers());
-    this->queues = MessageQueues(this->id, this->numWorkers(),
-                                 {IPC_BUFFER_MAX_SIZE, IPC_BUFFER_MAX_SIZE});
+      : options(std::move(options)), id(driverId),
+        scheduler(this->options.maxTusPerBatch,
+                  this->options.memoryBudgetBytes),
+        planner(this->options.projectRootPath, this->options.provisionalPlans),
+        planWaitTimeMicrosPerWorker(this->totalWorkerCount(), 0), shards(),
+        inProcessClaims(), inProcessMerger(), provisionallyRejectedPaths(),
+        includeSetCache(), jobCosts(), recoveryTaskIds(), retryTaskIds(),
+        recycledWorkerTaskIds(), autoscaler(), resourceMonitor(),
+        nextAutoscaleTime(), journal(), resumedCommandKeys(),
+        resumedStatistics(), quarantine(), deferredCommands(),
+        quarantinedTaskIds(), compdbParser() {
+    MessageQueues::deleteIfPresent(this->id, this->totalWorkerCount());
+    this->removeLeftoverSharedMemoryShards();
+    if (!this->options.jobCostHistoryPath.empty()) {
+      this->jobCosts.loadHistory(this->options.jobCostHistoryPath);
+    }
+    if (!this->options.includeSetCachePath.empty()) {
+      this->includeSetCache.load(this->options.includeSetCachePath);
+    }
+    if (this->options.balanceHeaderClaims) {
+      this->planner.enableClaimBalancing(this->includeSetCache);
+    }
+    if (!this->options.quarantineDbPath.empty()) {
+      this->quarantine.emplace(this->options.quarantineRuns);
+      this->quarantine->load(this->options.quarantineDbPath);
+    }
+    if (this->options.shardStorage == ShardStorage::WorkerLog
+        && !this->options.resume) {
+      // Workers append to their logs, so clear out logs from earlier
+      // runs using the same temporary output directory.
+      for (WorkerId workerId = 0; workerId < this->totalWorkerCount();
+           workerId++) {
+        std::error_code error;
+        std::filesystem::remove(
+            scip_clang::shardLogPath(this->options.temporaryOutputDir,
+                                     workerId),
+            error);
+      }
+    }
+    this->openJournal();
+    if (this->options.inProcess) {
+      // No IPC needed; see NOTE(ref: in-process-workers).
+      return;
+    }
+    switch (this->options.ipcTransport) {
+    case IpcTransport::MessageQueue:
+      this->queues =
+          MessageQueues(this->id, this->totalWorkerCount(),
+                        {IPC_QUEUE_SLOT_SIZE, IPC_QUEUE_SLOT_SIZE},
+                        this->options.ipcCodec);
+      break;
+    case IpcTransport::ShmRing:
+#ifdef __linux__
+      spdlog::debug("creating shared memory rings for IPC");
+      this->shmTransport = std::make_unique<ShmRingDriverTransport>(
+          this->id, this->totalWorkerCount());
+      for (WorkerId workerId = 0; workerId < this->totalWorkerCount();
+           workerId++) {
+        this->queues.driverToWorker.emplace_back(
+            JsonIpcQueue(this->shmTransport->makeSender(
+                             workerId, SHM_RING_SEND_TIMEOUT),
+                         this->options.ipcCodec));
+      }
+#else
+      ENFORCE(false, "--ipc-transport=shm-ring should be rejected on non-Linux");
+#endif
+      break;
+    }
+    if (this->options.shmClaimTable) {
+#ifdef __linux__
+      this->claimTable =
+          ShmClaimTable::create(scip_clang::claimTableShmName(this->id),
+                                ShmClaimTable::DEFAULT_CAPACITY);
+#else
+      ENFORCE(false, "--shm-claim-table should be rejected on non-Linux");
+#endif
+    }
   }
   ~Driver() {
+    this->removeLeftoverSharedMemoryShards();
     if (this->options.deleteTemporaryOutputDir) {
       std::error_code error;
       std::filesystem::remove_all(this->options.temporaryOutputDir, error);
@@ -627,8 +1875,11 @@ public:
       perJobStats.emplace_back(
           jobId.taskId(),
           StatsEntry{it->second.semanticAnalysis.command.Filename,
-                     std::move(stats)});
+                     std::move(stats),
+                     this->recycledWorkerTaskIds.contains(jobId.taskId())});
     }
+    perJobStats.insert(perJobStats.end(), this->resumedStatistics.begin(),
+                       this->resumedStatistics.end());
     absl::c_sort(perJobStats, [](const auto &p1, const auto &p2) -> bool {
       ENFORCE(p1.first != p2.first,
               "got multiple StatEntry values for the same TU");
@@ -648,13 +1899,37 @@ public:
 
     TIME_IT(total, {
       auto compdbGuard = this->openCompilationDatabase();
-      this->spawnWorkers(compdbGuard);
-      TIME_IT(indexing,
-              numTus = this->runJobsTillCompletionAndShutdownWorkers());
+      if (this->options.inProcess) {
+        TIME_IT(indexing, numTus = this->runInProcessWorkers());
+      } else {
+        this->spawnWorkers(compdbGuard);
+        TIME_IT(indexing,
+                numTus = this->runJobsTillCompletionAndShutdownWorkers());
+      }
       TIME_IT(merging, this->emitScipIndex());
+      if (this->journal) {
+        // The index is complete, so there is nothing left to resume.
+        this->journal->remove();
+      }
       spdlog::debug("indexing complete; driver shutting down now, kthxbai");
     });
     this->emitStatsFile();
+    this->logPlanWaitTimes();
+    if (this->numRecycledWorkers > 0) {
+      spdlog::info("recycled workers {} times due to high RSS",
+                   this->numRecycledWorkers);
+    }
+    this->planner.logClaimBalancing();
+    if (!this->options.includeSetCachePath.empty()) {
+      this->includeSetCache.save(this->options.includeSetCachePath);
+    }
+    if (this->quarantine) {
+      if (this->numSkippedQuarantinedTus > 0) {
+        spdlog::info("skipped {} quarantined translation units",
+                     this->numSkippedQuarantinedTus);
+      }
+      this->quarantine->save(this->options.quarantineDbPath);
+    }
 
     using secs = std::chrono::seconds;
     fmt::print("Finished indexing {} translation units in {:.1f}s (indexing: "
@@ -664,6 +1939,79 @@ public:
   }
 
 private:
+  /// See NOTE(ref: indexing-journal).
+  void openJournal() {
+    if (!this->options.keepsJournal()) {
+      return;
+    }
+    auto &temporaryOutputDir = this->options.temporaryOutputDir;
+    auto projectRoot = this->options.projectRootPath.asRef().asStringView();
+    auto journalPath = IndexingJournal::pathIn(temporaryOutputDir);
+    std::vector<CompletedTu> entries{};
+    if (this->options.resume) {
+      for (auto &entry : IndexingJournal::load(journalPath, projectRoot)) {
+        if (!IndexingJournal::hasShards(entry, temporaryOutputDir)) {
+          spdlog::info("will index '{}' again, as its shards are missing",
+                       entry.mainFile);
+          continue;
+        }
+        this->restoreCompletedTu(entry);
+        entries.push_back(std::move(entry));
+      }
+      spdlog::info("resuming indexing; skipping {} translation units "
+                   "indexed by an earlier run",
+                   entries.size());
+    }
+    // Entries for missing shards are dropped, so that they are not
+    // mistaken for shards written later on in this run.
+    this->journal =
+        IndexingJournal::create(std::move(journalPath), projectRoot, entries);
+  }
+
+  void restoreCompletedTu(const CompletedTu &entry) {
+    this->resumedCommandKeys.insert(entry.commandKey);
+    for (auto &claim : entry.claims) {
+      this->planner.restoreClaim(claim.path.asRef(), claim.hashValue);
+    }
+    this->scheduler.reserveTaskIdsBelow(entry.taskId + 1);
+    this->shards.emplace_back(ShardLocation{entry.taskId, entry.workerId,
+                                            entry.shardPaths,
+                                            entry.shardLogRecords});
+    if (!this->options.statsFilePath.asStringRef().empty()) {
+      this->resumedStatistics.emplace_back(
+          entry.taskId, StatsEntry{entry.mainFile, entry.statistics, false});
+    }
+  }
+
+  void logPlanWaitTimes() const {
+    auto &waitTimes = this->planWaitTimeMicrosPerWorker;
+    auto maxIt = absl::c_max_element(waitTimes);
+    if (maxIt == waitTimes.end() || *maxIt == 0) {
+      return;
+    }
+    uint64_t totalMicros = 0;
+    for (WorkerId workerId = 0; workerId < waitTimes.size(); ++workerId) {
+      totalMicros += waitTimes[workerId];
+      spdlog::debug("worker {} spent {:.2f}s blocked waiting for plans",
+                    workerId, double(waitTimes[workerId]) / 1'000'000.0);
+    }
+    spdlog::info("workers spent {:.1f}s blocked waiting for plans "
+                 "(max {:.1f}s for worker {})",
+                 double(totalMicros) / 1'000'000.0,
+                 double(*maxIt) / 1'000'000.0, maxIt - waitTimes.begin());
+  }
+
+  /// Shards are normally removed while merging; this cleans up shards
+  /// written by jobs which were killed or never got merged.
+  void removeLeftoverSharedMemoryShards() const {
+#ifdef __linux__
+    if (this->options.shardStorage == ShardStorage::SharedMemory) {
+      scip_clang::removeSharedMemoryShardsWithPrefix(
+          scip_clang::shardShmNamePrefix(this->id));
+    }
+#endif
+  }
+
   void emitScipIndex() {
     auto &indexScipPath = this->options.indexOutputPath;
     std::ofstream outputStream(indexScipPath.asStringRef(),
@@ -675,11 +2023,29 @@ private:
       std::exit(EXIT_FAILURE);
     }
 
+    if (this->inProcessMerger.has_value()) {
+      LogTimerRAII timer("index merging");
+      auto &fullIndex = this->inProcessMerger->finish();
+      *fullIndex.mutable_metadata() = this->indexMetadata();
+      fullIndex.SerializeToOstream(&outputStream);
+      return;
+    }
     scip::Index fullIndex{};
     if (this->options.deterministic) {
       // Sorting before merging so that mergeShards can be const
       absl::c_sort(
-          this->shardPaths, [](const auto &paths1, const auto &paths2) -> bool {
+          this->shards,
+          [](const ShardLocation &s1, const ShardLocation &s2) -> bool {
+            if (s1.paths.storage == ShardStorage::WorkerLog
+                || s2.paths.storage == ShardStorage::WorkerLog) {
+              // Shards in worker logs don't have paths; each TU has
+              // exactly one EmitIndex result, so task IDs are unique.
+              ENFORCE(s1.taskId != s2.taskId,
+                      "2+ index parts have same task ID {}", s1.taskId);
+              return s1.taskId < s2.taskId;
+            }
+            auto &paths1 = s1.paths;
+            auto &paths2 = s2.paths;
             auto cmp = paths1.docsAndExternals <=> paths2.docsAndExternals;
             ENFORCE(cmp != 0, "2+ index parts have same path '{}'",
                     paths1.docsAndExternals.asStringRef());
@@ -689,13 +2055,17 @@ private:
             return cmp == std::strong_ordering::less;
           });
     }
+#ifdef __linux__
+    if (this->claimTable) {
+      this->planner.useSharedClaimCounts(this->claimTable->countHashesPerPath(),
+                                         this->claimTable->hasOverflowed());
+    }
+#endif
     this->mergeShards(fullIndex);
     fullIndex.SerializeToOstream(&outputStream);
   }
 
-  void mergeShards(scip::Index &fullIndex) const {
-    LogTimerRAII timer("index merging");
-
+  scip::Metadata indexMetadata() const {
     scip::ToolInfo toolInfo;
     toolInfo.set_name("scip-clang");
     toolInfo.set_version(scip_clang::version);
@@ -710,6 +2080,11 @@ private:
     metadata.set_version(scip::UnspecifiedProtocolVersion);
     metadata.set_text_document_encoding(scip::TextEncoding::UTF8);
     *metadata.mutable_tool_info() = std::move(toolInfo);
+    return metadata;
+  }
+
+  void mergeShards(scip::Index &fullIndex) const {
+    LogTimerRAII timer("index merging");
 
     // TODO(def: faster-index-merging): Right now, the index merging
     // implementation has the overhead of serializing + deserializing all data
@@ -724,11 +2099,34 @@ private:
     //
     // The implementation is also fully serial to avoid introducing
     // a dependency on a library with a concurrent hash table.
-    *fullIndex.mutable_metadata() = std::move(metadata);
+    *fullIndex.mutable_metadata() = this->indexMetadata();
+
+    // See NOTE(ref: worker-shard-log); each log is mapped once.
+    ShardLogReader logReader(this->options.temporaryOutputDir);
 
-    auto readIndexShard = [](const AbsolutePath &path,
-                             scip::Index &indexShard) -> bool {
+    auto readIndexShard = [&logReader](const ShardLocation &shard,
+                                       const AbsolutePath &path,
+                                       ShardLogRecord logRecord,
+                                       scip::Index &indexShard) -> bool {
       auto &shardPath = path.asStringRef();
+      switch (shard.paths.storage) {
+      case ShardStorage::WorkerLog:
+        return logReader.read(shard.workerId, logRecord, indexShard);
+      case ShardStorage::SharedMemory: {
+#ifdef __linux__
+        // Each shard is only read once, so free up the memory right away.
+        bool read =
+            scip_clang::readShardFromSharedMemory(shardPath, indexShard);
+        scip_clang::removeSharedMemoryShard(shardPath);
+        return read;
+#else
+        ENFORCE(false, "shared memory shards are only supported on Linux");
+        return false;
+#endif
+      }
+      case ShardStorage::File:
+        break;
+      }
       std::ifstream inputStream(shardPath,
                                 std::ios_base::in | std::ios_base::binary);
       if (inputStream.fail()) {
@@ -743,16 +2141,21 @@ private:
       return true;
     };
 
-    scip::IndexBuilder builder{fullIndex};
-    // TODO: Measure how much time this is taking and parallelize if too slow.
-    for (auto &paths : this->shardPaths) {
-      scip::Index indexShard;
-      if (!readIndexShard(paths.docsAndExternals, indexShard)) {
-        continue;
-      }
+    scip::IndexBuilder builder{fullIndex, /*incremental*/ false};
+    auto addDocsAndExternals = [&](uint32_t taskId,
+                                   scip::Index &&indexShard) -> void {
+      auto rejectedIt = this->provisionallyRejectedPaths.find(taskId);
       for (auto &doc : *indexShard.mutable_documents()) {
-        bool isMultiplyIndexed = this->planner.isMultiplyIndexed(
-            RootRelativePathRef{doc.relative_path(), RootKind::Project});
+        RootRelativePathRef docPath{doc.relative_path(), RootKind::Project};
+        if (rejectedIt != this->provisionallyRejectedPaths.end()
+            && rejectedIt->second.contains(
+                this->options.projectRootPath.makeAbsolute(docPath)
+                    .asStringRef())) {
+          // Some other TU claimed this file; see
+          // NOTE(ref: provisional-plans).
+          continue;
+        }
+        bool isMultiplyIndexed = this->planner.isMultiplyIndexed(docPath);
         builder.addDocument(std::move(doc), isMultiplyIndexed);
       }
       // See NOTE(ref: precondition-deterministic-ext-symbol-docs); in
@@ -762,19 +2165,32 @@ private:
       for (auto &extSym : *indexShard.mutable_external_symbols()) {
         builder.addExternalSymbol(std::move(extSym));
       }
+    };
+    // TODO: Measure how much time this is taking and parallelize if too slow.
+    for (auto &shard : this->shards) {
+      scip::Index indexShard;
+      if (!readIndexShard(shard, shard.paths.docsAndExternals,
+                          shard.logRecords.docsAndExternals, indexShard)) {
+        continue;
+      }
+      addDocsAndExternals(shard.taskId, std::move(indexShard));
     }
 
     auto symbolToInfoMap = builder.populateSymbolToInfoMap();
 
-    for (auto &paths : this->shardPaths) {
-      scip::Index indexShard;
-      if (!readIndexShard(paths.forwardDecls, indexShard)) {
-        continue;
-      }
+    auto addForwardDecls = [&](scip::Index &&indexShard) -> void {
       for (auto &forwardDeclSym : *indexShard.mutable_external_symbols()) {
         builder.addForwardDeclaration(*symbolToInfoMap,
                                       std::move(forwardDeclSym));
       }
+    };
+    for (auto &shard : this->shards) {
+      scip::Index indexShard;
+      if (!readIndexShard(shard, shard.paths.forwardDecls,
+                          shard.logRecords.forwardDecls, indexShard)) {
+        continue;
+      }
+      addForwardDecls(std::move(indexShard));
     }
 
     builder.finish(this->options.deterministic);
@@ -783,6 +2199,10 @@ private:
   size_t numWorkers() const {
     return this->options.numWorkers;
   }
+  /// Including spares; see NOTE(ref: spare-workers).
+  size_t totalWorkerCount() const {
+    return this->options.numWorkers + this->options.numSpareWorkers;
+  }
   const AbsolutePath &compdbPath() const {
     return this->options.compdbPath;
   }
@@ -794,45 +2214,419 @@ private:
   /// parameter is present to accidentally avoid flipping call order.
   void spawnWorkers(const FileGuard &_compdbToken) {
     (void)_compdbToken;
-    this->scheduler.initializeWorkers(
-        this->numWorkers(), [&](WorkerId workerId) -> Scheduler::Process {
-          return this->spawnWorker(workerId);
-        });
+    ManualTimer timer;
+    TIME_IT(timer, {
+      if (this->options.workerSpawn == WorkerSpawn::Zygote) {
+        this->zygote.emplace(this->workerArgs());
+      }
+      this->scheduler.initializeWorkers(
+          this->numWorkers(), this->options.numSpareWorkers,
+          [&](WorkerId workerId) -> Scheduler::Process {
+            return this->spawnWorker(workerId);
+          });
+    });
+    spdlog::debug("spawned {} workers in {:.1f}ms", this->totalWorkerCount(),
+                  timer.value<std::chrono::milliseconds>());
   }
 
   size_t refillCount() const {
-    return 2 * this->numWorkers();
+    // Keep enough jobs around for every worker to get a full batch.
+    return 2 * this->numWorkers() * this->options.maxTusPerBatch;
   }
 
   size_t refillJobs() {
     std::vector<clang::tooling::CompileCommand> commands{};
-    this->compdbParser.parseMore(commands);
+    while (true) {
+      this->compdbParser.parseMore(commands);
+      bool parsedAny = !commands.empty();
+      this->skipResumedCommands(commands);
+      this->deferQuarantinedCommands(commands);
+      // If everything parsed so far was skipped, keep going, as returning
+      // 0 would mean that there are no jobs left.
+      if (!commands.empty() || !parsedAny) {
+        break;
+      }
+    }
+    auto *balancer = this->planner.claimBalancer();
     for (auto &command : commands) {
-      this->scheduler.queueNewTask(
+      if (balancer) {
+        balancer->onTuQueued(command.Filename);
+      }
+      auto expectedPeakRss = this->expectedPeakRss(command.Filename);
+      auto jobId = this->scheduler.queueNewTask(
           IndexJob{IndexJob::Kind::SemanticAnalysis,
                    SemanticAnalysisJobDetails{std::move(command)},
                    EmitIndexJobDetails{}});
+      this->scheduler.setExpectedPeakRss(jobId, expectedPeakRss);
+    }
+    if (!commands.empty()) {
+      this->orderPendingJobs();
     }
     return commands.size();
   }
 
+  /// Drops commands indexed by an earlier run.
+  /// See NOTE(ref: indexing-journal).
+  void skipResumedCommands(
+      std::vector<clang::tooling::CompileCommand> &commands) const {
+    if (this->resumedCommandKeys.empty()) {
+      return;
+    }
+    auto isResumed = [&](const clang::tooling::CompileCommand &command) {
+      return this->resumedCommandKeys.contains(compdb::commandKey(command));
+    };
+    commands.erase(std::remove_if(commands.begin(), commands.end(), isResumed),
+                   commands.end());
+  }
+
+  /// Removes quarantined commands from \p commands, holding on to them
+  /// for \c queueDeferredJobs if they should be indexed later.
+  /// See NOTE(ref: tu-quarantine).
+  void deferQuarantinedCommands(
+      std::vector<clang::tooling::CompileCommand> &commands) {
+    if (!this->quarantine || this->quarantine->size() == 0) {
+      return;
+    }
+    auto isQuarantined = [&](clang::tooling::CompileCommand &command) {
+      auto *entry = this->quarantine->lookup(command);
+      if (!entry) {
+        return false;
+      }
+      switch (this->options.quarantinePolicy) {
+      case QuarantinePolicy::Defer:
+        spdlog::info("deferring quarantined '{}' (last failure: {})",
+                     command.Filename, entry->reason);
+        this->deferredCommands.push_back(std::move(command));
+        break;
+      case QuarantinePolicy::Skip:
+        spdlog::info("skipping quarantined '{}' (last failure: {})",
+                     command.Filename, entry->reason);
+        this->numSkippedQuarantinedTus++;
+        break;
+      }
+      return true;
+    };
+    commands.erase(
+        std::remove_if(commands.begin(), commands.end(), isQuarantined),
+        commands.end());
+  }
+
+  /// Returns the number of jobs queued. See NOTE(ref: tu-quarantine).
+  size_t queueDeferredJobs() {
+    auto *balancer = this->planner.claimBalancer();
+    for (auto &command : this->deferredCommands) {
+      if (balancer) {
+        balancer->onTuQueued(command.Filename);
+      }
+      auto expectedPeakRss = this->expectedPeakRss(command.Filename);
+      auto jobId = this->scheduler.queueNewTask(
+          IndexJob{IndexJob::Kind::SemanticAnalysis,
+                   SemanticAnalysisJobDetails{std::move(command)},
+                   EmitIndexJobDetails{}});
+      this->scheduler.setExpectedPeakRss(jobId, expectedPeakRss);
+      this->quarantinedTaskIds.insert(jobId.taskId());
+    }
+    auto numQueued = this->deferredCommands.size();
+    this->deferredCommands.clear();
+    return numQueued;
+  }
+
+  /// See NOTE(ref: tu-quarantine).
+  void recordFailure(uint32_t taskId, std::string_view reason) {
+    if (!this->quarantine) {
+      return;
+    }
+    auto &command = this->commandForTask(taskId);
+    spdlog::info("quarantining '{}', as it {}", command.Filename, reason);
+    this->quarantine->recordFailure(command, reason);
+  }
+
+  bool needsAllJobsUpfront() const {
+    return this->options.jobOrder != JobOrder::Fifo;
+  }
+
+  void orderPendingJobs() {
+    // If needsAllJobsUpfront(), the parser was initialized to return
+    // all commands in one go, so this only does work once.
+    switch (this->options.jobOrder) {
+    case JobOrder::Fifo:
+      return;
+    case JobOrder::LongestFirst: {
+      // See NOTE(ref: job-ordering)
+      this->scheduler.reorderPendingJobs(
+          [&](const auto &pendingCommands) -> std::vector<size_t> {
+            return this->jobCosts.longestFirstOrder(pendingCommands);
+          });
+      return;
+    }
+    case JobOrder::HeaderCoverage:
+      // See NOTE(ref: header-coverage-ordering)
+      this->scheduler.reorderPendingJobs(
+          [&](const auto &pendingCommands) -> std::vector<size_t> {
+            return this->includeSetCache.headerCoverageOrder(pendingCommands);
+          });
+      return;
+    }
+  }
+
+  const clang::tooling::CompileCommand &commandForTask(uint32_t taskId) {
+    auto &jobMap = this->scheduler.getJobMap();
+    auto it = jobMap.find(JobId::newTask(taskId));
+    ENFORCE(it != jobMap.end());
+    ENFORCE(it->second.kind == IndexJob::Kind::SemanticAnalysis);
+    return it->second.semanticAnalysis.command;
+  }
+
+  /// See NOTE(ref: header-recovery).
+  void releaseClaims(uint32_t taskId) {
+    auto &command = this->commandForTask(taskId);
+    std::filesystem::path mainFilePath(command.Filename);
+    if (mainFilePath.is_relative()) {
+      mainFilePath = std::filesystem::path(command.Directory) / mainFilePath;
+    }
+    auto numReleased = this->planner.releaseClaims(
+        taskId, mainFilePath.lexically_normal().string());
+    if (numReleased > 0) {
+      spdlog::info("released {} header claims for '{}' for indexing by "
+                   "other TUs",
+                   numReleased, command.Filename);
+    }
+  }
+
+  /// Returns 0 if there is no memory budget. See NOTE(ref: memory-budget).
+  uint64_t expectedPeakRss(std::string_view mainFile) const {
+    if (this->options.memoryBudgetBytes == 0) {
+      return 0;
+    }
+    if (auto bytes = this->jobCosts.historicalPeakRssBytesFor(mainFile)) {
+      return *bytes;
+    }
+    return this->options.memoryBudgetBytes / this->numWorkers();
+  }
+
+  /// Queues a retry for the TU for \p taskId, unless it is a retry
+  /// itself. See NOTE(ref: memory-budget).
+  void queueOomRetry(uint32_t taskId) {
+    auto command = this->commandForTask(taskId);
+    if (this->retryTaskIds.contains(taskId)) {
+      spdlog::warn("not retrying '{}' again", command.Filename);
+      return;
+    }
+    spdlog::info("will retry '{}' after other TUs, as its worker was "
+                 "likely killed for running out of memory",
+                 command.Filename);
+    if (auto *balancer = this->planner.claimBalancer()) {
+      balancer->onTuQueued(command.Filename);
+    }
+    auto jobId = this->scheduler.queueRetryTask(
+        IndexJob{IndexJob::Kind::SemanticAnalysis,
+                 SemanticAnalysisJobDetails{std::move(command)},
+                 EmitIndexJobDetails{}});
+    this->retryTaskIds.insert(jobId.taskId());
+  }
+
+  /// Returns the number of jobs queued. See NOTE(ref: header-recovery).
+  size_t queueRecoveryJobs() {
+    size_t numQueued = 0;
+    auto *balancer = this->planner.claimBalancer();
+    for (auto taskId : this->planner.takeTasksNeedingRecovery()) {
+      if (this->recoveryTaskIds.contains(taskId)) {
+        spdlog::warn("not retrying recovery job for '{}' again",
+                     this->commandForTask(taskId).Filename);
+        continue;
+      }
+      auto command = this->commandForTask(taskId);
+      spdlog::info("queueing recovery job for headers from '{}'",
+                   command.Filename);
+      if (balancer) {
+        balancer->onTuQueued(command.Filename);
+      }
+      auto expectedPeakRss = this->expectedPeakRss(command.Filename);
+      auto jobId = this->scheduler.queueNewTask(
+          IndexJob{IndexJob::Kind::SemanticAnalysis,
+                   SemanticAnalysisJobDetails{std::move(command)},
+                   EmitIndexJobDetails{}});
+      this->scheduler.setExpectedPeakRss(jobId, expectedPeakRss);
+      this->recoveryTaskIds.insert(jobId.taskId());
+      numQueued++;
+    }
+    return numQueued;
+  }
+
+  void recordIncludeSet(uint32_t taskId, const std::vector<PathId> &pathIds) {
+    auto &jobMap = this->scheduler.getJobMap();
+    auto it = jobMap.find(JobId::newTask(taskId));
+    ENFORCE(it != jobMap.end());
+    std::vector<std::string_view> paths;
+    paths.reserve(pathIds.size());
+    for (auto pathId : pathIds) {
+      paths.push_back(this->planner.globalPath(pathId).asStringView());
+    }
+    this->includeSetCache.record(it->second.semanticAnalysis.command.Filename,
+                                 paths);
+  }
+
   /// Returns the number of TUs processed
   unsigned runJobsTillCompletionAndShutdownWorkers() {
+    if (this->options.autoscaleWorkers) {
+      this->autoscaler.emplace(this->numWorkers());
+      this->resourceMonitor = ResourceMonitor::forCurrentProcess();
+      this->nextAutoscaleTime =
+          std::chrono::steady_clock::now() + AUTOSCALE_INTERVAL;
+    }
     unsigned numJobs = 0;
     this->scheduler.runJobsTillCompletion(
         [this, &numJobs]() -> void {
-          this->processOneJobResult();
-          numJobs++;
+          numJobs += this->processJobResults();
+          this->retireRecycledWorkers();
+          this->autoscaleIfDue();
         },
         [this]() -> size_t { return this->refillJobs(); },
+        [this]() -> size_t {
+          // Quarantined TUs may claim some of the released headers.
+          auto numDeferred = this->queueDeferredJobs();
+          return numDeferred > 0 ? numDeferred : this->queueRecoveryJobs();
+        },
         [this](ToBeScheduledWorkerId &&workerId, JobId jobId) -> void {
           this->assignJobToWorker(std::move(workerId), jobId);
         });
     this->shutdownAllWorkers();
     this->scheduler.waitForAllWorkers();
+    this->zygote.reset();
     return numJobs / 2; // Each TU has exactly 2 jobs.
   }
 
+  /// NOTE(def: in-process-workers): With --in-process, instead of spawning
+  /// worker processes, the driver runs --jobs threads, each with its own
+  /// Worker. After semantic analysis, a thread claims headers directly in
+  /// a ConcurrentClaimMap, and once the TU is done, hands its index over
+  /// to an InProcessIndexMerger, which merges it right away. So nothing is
+  /// sent over IPC, no shards are written, and the index for a TU is not
+  /// held in memory until all TUs are done.
+  ///
+  /// Threads only share a lock for taking the next job (refilling jobs
+  /// from the compilation database as needed) and recording statistics.
+  /// With --balance-header-claims or --include-set-cache, planning goes
+  /// through the FileIndexingPlanner under the same lock, as both need
+  /// a consistent view of all TUs planned so far.
+  ///
+  /// The downside is that a crash while indexing one TU takes down the
+  /// whole indexer, and a TU which gets stuck cannot be killed, so there
+  /// are no timeouts. This mode should only be used for codebases which
+  /// are known to index cleanly. Options which only make sense for
+  /// worker processes (IPC, shard storage, spares etc.) are ignored.
+  ///
+  /// Returns the number of TUs processed.
+  unsigned runInProcessWorkers() {
+    this->inProcessMerger.emplace(this->options.projectRootPath,
+                                  this->inProcessClaims,
+                                  this->options.deterministic);
+    bool usePlanner = this->planner.claimBalancer() != nullptr
+                      || !this->options.includeSetCachePath.empty();
+    // Guards the Scheduler and the compilation database parser, as well
+    // as the planner if usePlanner is set, and statistics.
+    std::mutex jobsMutex;
+    unsigned numTus = 0;
+    auto runWorker = [&](WorkerId workerId) -> void {
+      Worker worker(this->options.inProcessWorkerOptions(workerId));
+      // Indexed by the worker's path IDs; see NOTE(ref: path-interning).
+      std::vector<AbsolutePath> workerPaths;
+      while (true) {
+        JobId jobId;
+        SemanticAnalysisJobDetails details{};
+        {
+          std::lock_guard<std::mutex> lock(jobsMutex);
+          auto optJobId = this->scheduler.takePendingJob();
+          if (!optJobId.has_value() && this->refillJobs() > 0) {
+            optJobId = this->scheduler.takePendingJob();
+          }
+          if (!optJobId.has_value()) {
+            return;
+          }
+          jobId = *optJobId;
+          // Copy the command, as refilling can move jobs around.
+          details.command = this->commandForTask(jobId.taskId());
+        }
+        bool planned = false;
+        auto plan = [&](SemanticAnalysisJobResult &&semaResult,
+                        EmitIndexJobDetails &emitIndexDetails) -> bool {
+          ENFORCE(semaResult.firstNewPathId.value == workerPaths.size());
+          workerPaths.insert(workerPaths.end(), semaResult.newPaths.begin(),
+                             semaResult.newPaths.end());
+          auto &filesToBeIndexed = emitIndexDetails.filesToBeIndexed;
+          if (usePlanner) {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            std::vector<AbsolutePath> rejectedPaths{};
+            this->planEmitIndex(workerId, jobId.taskId(),
+                                std::move(semaResult), filesToBeIndexed,
+                                rejectedPaths);
+            // Only used for isMultiplyIndexed when merging.
+            for (auto &fileInfo : filesToBeIndexed) {
+              this->inProcessClaims.claim(
+                  workerPaths[fileInfo.pathId.value].asRef(),
+                  fileInfo.hashValue);
+            }
+          } else {
+            this->claimInProcess(workerPaths, semaResult, filesToBeIndexed);
+          }
+          planned = true;
+          return true;
+        };
+        TuIndexingOutput output{};
+        auto statistics =
+            worker.indexTranslationUnit(std::move(details), plan, output);
+        this->inProcessMerger->add(
+            jobId.taskId(), planned ? std::optional(std::move(output))
+                                    : std::nullopt);
+
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        numTus++;
+        this->planWaitTimeMicrosPerWorker[workerId] +=
+            statistics.planWaitTimeMicros;
+        if (!this->options.statsFilePath.asStringRef().empty()) {
+          this->allStatistics.emplace_back(jobId, statistics);
+        }
+      }
+    };
+
+    spdlog::debug("starting {} in-process workers", this->numWorkers());
+    std::vector<llvm::thread> threads;
+    threads.reserve(this->numWorkers());
+    for (WorkerId workerId = 0; workerId < this->numWorkers(); ++workerId) {
+      threads.emplace_back(runWorker, workerId);
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    return numTus;
+  }
+
+  /// Claims the files reported by \p semaResult in \c inProcessClaims,
+  /// adding the newly claimed ones to \p filesToBeIndexed. Safe to call
+  /// from multiple threads. See NOTE(ref: in-process-workers).
+  ///
+  /// \p workerPaths is indexed by the worker's path IDs.
+  void claimInProcess(const std::vector<AbsolutePath> &workerPaths,
+                      const SemanticAnalysisJobResult &semaResult,
+                      std::vector<PreprocessedFileInfo> &filesToBeIndexed) {
+    for (auto &fileInfoMulti : semaResult.illBehavedFiles) {
+      ENFORCE(fileInfoMulti.pathId.value < workerPaths.size());
+      auto path = workerPaths[fileInfoMulti.pathId.value].asRef();
+      for (auto hashValue : fileInfoMulti.hashValues) {
+        if (this->inProcessClaims.claim(path, hashValue)) {
+          filesToBeIndexed.push_back({fileInfoMulti.pathId, hashValue});
+        }
+      }
+    }
+    for (auto &fileInfo : semaResult.wellBehavedFiles) {
+      ENFORCE(fileInfo.pathId.value < workerPaths.size());
+      auto path = workerPaths[fileInfo.pathId.value].asRef();
+      if (this->inProcessClaims.claim(path, fileInfo.hashValue)) {
+        filesToBeIndexed.push_back(fileInfo);
+      }
+    }
+  }
+
   FileGuard openCompilationDatabase() {
     std::error_code error;
     StdPath compdbStdPath{this->compdbPath().asStringRef()};
@@ -847,80 +2641,593 @@ private:
 
     // FIXME(def: resource-dir-extra): If we're passed in a resource dir
     // as an extra argument, we should not pass it here.
-    this->compdbParser.initialize(compdbFile, this->refillCount(),
+    // See NOTE(ref: job-ordering); jobs can only be ordered
+    // if all of them are known upfront.
+    auto parseBatchSize =
+        this->needsAllJobsUpfront()
+            ? std::max(this->refillCount(), this->compdbCommandCount)
+            : this->refillCount();
+    this->compdbParser.initialize(compdbFile, parseBatchSize,
                                   !this->options.isTesting);
     return FileGuard(compdbFile.file);
   }
 
-  boost::process::child spawnWorker(WorkerId workerId) {
+  /// Arguments shared by all workers, which the zygote is started with.
+  /// See NOTE(ref: worker-zygote).
+  std::vector<std::string> workerArgs() const {
     std::vector<std::string> args;
     args.push_back(this->options.workerExecutablePath.asStringRef());
-    args.push_back("--worker-mode=ipc");
     args.push_back(fmt::format("--driver-id={}", this->id));
+    this->options.addWorkerOptions(args);
+    return args;
+  }
+
+  WorkerProcess spawnWorker(WorkerId workerId) {
+    if (this->zygote.has_value()) {
+      if (auto worker = this->zygote->forkWorker(workerId)) {
+        spdlog::debug("forked worker {} from zygote, pid = {}", workerId,
+                      worker->id());
+        return std::move(*worker);
+      }
+      spdlog::warn("failed to fork worker {} from zygote; spawning it "
+                   "from scratch instead",
+                   workerId);
+    }
+    auto args = this->workerArgs();
+    args.push_back("--worker-mode=ipc");
     args.push_back(fmt::format("--worker-id={}", workerId));
-    this->options.addWorkerOptions(args, workerId);
+    this->options.addPerWorkerOptions(args, workerId);
+#ifdef __linux__
+    if (this->shmTransport) {
+      this->shmTransport->resetWorker(workerId);
+      this->shmTransport->addWorkerArgs(workerId, args);
+    }
+#endif
 
     spdlog::debug("spawning worker with arguments: '{}'", fmt::join(args, " "));
 
+#ifdef __linux__
+    // Only let this worker inherit its own eventfds.
+    if (this->shmTransport) {
+      this->shmTransport->setInheritable(workerId, true);
+    }
+#endif
     boost::process::child worker(args, boost::process::std_out > stdout);
+#ifdef __linux__
+    if (this->shmTransport) {
+      this->shmTransport->setInheritable(workerId, false);
+    }
+#endif
     spdlog::debug("worker info running {}, pid = {}", worker.running(),
                   worker.id());
-    return worker;
+    return WorkerProcess(std::move(worker));
+  }
+
+  /// Number of heartbeat intervals a worker may stay silent for, on top
+  /// of the allowance based on the job's predicted cost.
+  constexpr static double MISSED_HEARTBEATS_ALLOWED = 4.0;
+  /// Fraction of the TU's historical time allowed between two heartbeats
+  /// while parsing or traversing, e.g. for a single expensive template
+  /// instantiation. Shards are written without any heartbeats in between,
+  /// so the full historical time is allowed for serialization.
+  constexpr static double PROGRESS_GAP_FRACTION = 0.25;
+  /// How often to check for workers which exited on their own, if there
+  /// is a memory budget. See NOTE(ref: memory-budget).
+  constexpr static std::chrono::seconds WORKER_EXIT_POLL_INTERVAL{1};
+  /// PSI readings are averaged over 10s, so deciding much more often
+  /// would mostly react to earlier decisions.
+  constexpr static std::chrono::seconds AUTOSCALE_INTERVAL{5};
+  /// Workers read requests as soon as they are idle, so a ring which stays
+  /// full for this long means the worker has hung or died.
+  /// See NOTE(ref: shm-ring-transport).
+  constexpr static std::chrono::seconds SHM_RING_SEND_TIMEOUT{10};
+  /// Idle workers exit right after receiving a shutdown request, so this
+  /// is only hit by workers which are stuck. See NOTE(ref: worker-recycling).
+  constexpr static std::chrono::seconds WORKER_SHUTDOWN_TIMEOUT{5};
+
+  /// See NOTE(ref: worker-autoscaling).
+  void autoscaleIfDue() {
+    if (!this->autoscaler.has_value()) {
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now < this->nextAutoscaleTime) {
+      return;
+    }
+    this->nextAutoscaleTime = now + AUTOSCALE_INTERVAL;
+    auto snapshot = this->resourceMonitor.read();
+    auto previous = this->autoscaler->activeWorkers();
+    std::string reason;
+    auto current = this->autoscaler->update(snapshot, reason);
+    if (current == previous) {
+      spdlog::debug("autoscaling: keeping {} active workers ({})", current,
+                    snapshot.debugString());
+      return;
+    }
+    spdlog::info("autoscaling: {} -> {} active workers due to {} ({})",
+                 previous, current, reason, snapshot.debugString());
+    this->scheduler.setTargetActiveWorkers(current);
+  }
+
+  /// Returns the time at which the driver should next check for timed
+  /// out or exited workers, or update the number of active workers.
+  std::optional<Instant> nextWorkerCheck() {
+    auto deadline = this->scheduler.earliestDeadline(
+        [this](const WorkerInfo &workerInfo) -> Instant {
+          return this->jobDeadline(workerInfo);
+        });
+    auto earliest = [&](Instant next) -> void {
+      deadline = deadline.has_value() ? std::min(*deadline, next) : next;
+    };
+    if (this->options.memoryBudgetBytes > 0) {
+      earliest(std::chrono::steady_clock::now() + WORKER_EXIT_POLL_INTERVAL);
+    }
+    if (this->autoscaler.has_value()) {
+      earliest(this->nextAutoscaleTime);
+    }
+    return deadline;
+  }
+
+  bool heartbeatsEnabled() const {
+    return this->options.heartbeatInterval.count() > 0;
+  }
+
+  bool softCancellationEnabled() const {
+    return this->options.cancelGracePeriod.count() > 0;
+  }
+
+  /// Time after which the job on a busy worker is considered hung, or
+  /// after which the worker is killed, if it has been asked to cancel
+  /// the job. See NOTE(ref: worker-heartbeats) and
+  /// NOTE(ref: soft-cancellation).
+  Instant jobDeadline(const WorkerInfo &workerInfo) {
+    if (workerInfo.cancelRequestTime.has_value()) {
+      return *workerInfo.cancelRequestTime + this->options.cancelGracePeriod;
+    }
+    auto deadline = this->progressDeadline(workerInfo);
+    auto taskId = workerInfo.currentlyProcessing.value().taskId();
+    if (this->quarantinedTaskIds.contains(taskId)) {
+      // See NOTE(ref: tu-quarantine)
+      deadline = std::min(deadline, workerInfo.startTime
+                                        + this->options.quarantineTimeout);
+    }
+    return deadline;
+  }
+
+  /// Like \c jobDeadline, but ignoring cancellation and quarantine.
+  Instant progressDeadline(const WorkerInfo &workerInfo) {
+    auto receiveTimeout = this->receiveTimeout();
+    if (!this->heartbeatsEnabled()) {
+      return workerInfo.startTime + receiveTimeout;
+    }
+    using secs = std::chrono::duration<double>;
+    auto taskId = workerInfo.currentlyProcessing.value().taskId();
+    auto historicalSeconds = this->jobCosts.historicalSecondsFor(
+        this->commandForTask(taskId).Filename);
+    if (!historicalSeconds.has_value()) {
+      // Without history, there is no telling how far apart heartbeats
+      // may legitimately be (e.g. Clang may be busy instantiating
+      // templates), so only kill workers which stop making progress
+      // for the full receive timeout.
+      return workerInfo.lastProgressTime + receiveTimeout;
+    }
+    auto phase = workerInfo.phase.value_or(WorkerPhase::Parsing);
+    secs allowance =
+        MISSED_HEARTBEATS_ALLOWED * secs(this->options.heartbeatInterval);
+    if (phase == WorkerPhase::Serialization) {
+      allowance += secs(*historicalSeconds);
+    } else {
+      allowance += PROGRESS_GAP_FRACTION * secs(*historicalSeconds);
+    }
+    allowance = std::min(allowance, secs(receiveTimeout));
+    return workerInfo.lastProgressTime
+           + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+               allowance);
+  }
+
+  /// Updates bookkeeping for a job which will never complete, because
+  /// the worker was killed or cancelled it.
+  void handleSkippedJob(JobId skippedJobId, const IndexJob &skippedJob) {
+    if (skippedJob.kind == IndexJob::Kind::EmitIndex) {
+      this->releaseClaims(skippedJobId.taskId());
+    }
+    auto *balancer = this->planner.claimBalancer();
+    if (balancer && skippedJob.kind == IndexJob::Kind::SemanticAnalysis) {
+      // The TU will never be planned, so later TUs shouldn't
+      // count on it for deferred headers.
+      balancer->onTuAnalyzed(skippedJob.semanticAnalysis.command.Filename);
+    }
   }
 
-  /// Kills all workers which started before \p startedBefore and respawns them.
-  void killLongRunningWorkersAndRespawn(Instant startedBefore) {
+  /// Kills all workers whose job is past its deadline and respawns them,
+  /// unless they can be asked to cancel the job instead.
+  void killLongRunningWorkersAndRespawn(Instant now) {
+    // TUs to retry, as their worker was likely killed by the OOM killer.
+    // These can't be queued from the callback, as it must not call back
+    // into the Scheduler. See NOTE(ref: memory-budget).
+    std::vector<uint32_t> oomKilledTaskIds;
     this->scheduler.killLongRunningWorkersAndRespawn(
-        startedBefore,
+        now,
+        [this](const WorkerInfo &workerInfo) -> Instant {
+          return this->jobDeadline(workerInfo);
+        },
+        [this](WorkerId workerId, const WorkerInfo &workerInfo) -> bool {
+          if (!this->softCancellationEnabled()) {
+            return false;
+          }
+          auto jobId = workerInfo.currentlyProcessing.value();
+          spdlog::info("asking worker {} to cancel job {}", workerId,
+                       jobId.debugString());
+          return scip_clang::requestCancellation(
+              int(workerInfo.processHandle.id()), jobId.taskId());
+        },
+        [&](Scheduler::Process &&oldHandle, WorkerId workerId,
+            JobId killedJobId, const IndexJob &killedJob, bool exited,
+            bool killRequested) -> Scheduler::Process {
+          // Without a memory budget, crashes are only noticed once the
+          // deadline has passed.
+          bool crashed = exited || !oldHandle.running();
+          // The OOM killer uses SIGKILL, which the worker cannot handle.
+          auto exitSignal =
+              crashed ? oldHandle.terminationSignal() : std::nullopt;
+          bool likelyOomKilled =
+              exited && (!exitSignal.has_value() || *exitSignal == SIGKILL);
+          oldHandle.terminate();
+          this->handleSkippedJob(killedJobId, killedJob);
+          auto taskId = killedJobId.taskId();
+          if (likelyOomKilled) {
+            oomKilledTaskIds.push_back(taskId);
+            // Only the retry counts; see NOTE(ref: tu-quarantine).
+            if (this->retryTaskIds.contains(taskId)) {
+              this->recordFailure(taskId, "ran out of memory");
+            }
+          } else if (crashed) {
+            this->recordFailure(
+                taskId, exitSignal.has_value()
+                            ? fmt::format("crashed with signal {}", *exitSignal)
+                            : std::string("crashed"));
+          } else if (!killRequested) {
+            // The TU isn't to blame if the driver gave up on the worker.
+            this->recordFailure(taskId, "timed out");
+          }
+          this->planner.resetWorkerPaths(workerId);
+          return this->spawnWorker(workerId);
+        });
+    for (auto taskId : oomKilledTaskIds) {
+      this->queueOomRetry(taskId);
+    }
+  }
+
+  /// Replaces idle workers, spares and parked workers well before they'd
+  /// time out waiting for a request; see NOTE(ref: spare-workers).
+  /// Idle workers may wait that long e.g. when jobs are held back by the
+  /// memory budget, or while other workers finish long TUs before
+  /// recovery jobs are queued. Should be called before assigning jobs.
+  void recycleStaleWorkers(Instant now) {
+    this->scheduler.recycleStaleWorkers(
+        now - this->receiveTimeout() / 2,
         [&](Scheduler::Process &&oldHandle,
             WorkerId workerId) -> Scheduler::Process {
           oldHandle.terminate();
+          this->planner.resetWorkerPaths(workerId);
           return this->spawnWorker(workerId);
         });
   }
 
+  /// See NOTE(ref: worker-recycling).
+  void checkWorkerRss(WorkerId workerId, uint32_t taskId,
+                      const IndexingStatistics &statistics) {
+    auto limit = this->options.recycleWorkerRssBytes;
+    if (limit == 0 || statistics.rssAfterBytes <= limit) {
+      return;
+    }
+    spdlog::debug("retiring worker {} after '{}' (RSS: {} MiB)", workerId,
+                  this->commandForTask(taskId).Filename,
+                  statistics.rssAfterBytes / (1024 * 1024));
+    this->scheduler.markForRetirement(workerId);
+    this->recycledWorkerTaskIds.insert(taskId);
+  }
+
+  /// See NOTE(ref: worker-recycling).
+  void retireRecycledWorkers() {
+    if (this->options.recycleWorkerRssBytes == 0) {
+      return;
+    }
+    this->numRecycledWorkers += this->scheduler.retireIdleWorkers(
+        [&](Scheduler::Process &&oldHandle,
+            WorkerId workerId) -> Scheduler::Process {
+          // The worker is idle, so let it shut down cleanly. Wait for it
+          // to exit before spawning the replacement, which reads from
+          // the same queue. If it is stuck, don't hold up other workers.
+          bool exited = this->queues.driverToWorker[workerId].send(
+                            IndexJobRequest{JobId::Shutdown(), {}, {}, {}})
+                        && oldHandle.waitFor(WORKER_SHUTDOWN_TIMEOUT);
+          if (!exited) {
+            spdlog::warn("killing worker {} as it did not shut down in time",
+                         workerId);
+            oldHandle.terminate();
+          }
+          this->planner.resetWorkerPaths(workerId);
+          return this->spawnWorker(workerId);
+        });
+  }
+
+  /// See NOTE(ref: soft-cancellation).
+  void processCancellation(const IndexJobResponse &response) {
+    auto latestIdleWorkerId =
+        this->scheduler.markCancelled(response.workerId, response.jobId);
+    if (!latestIdleWorkerId.has_value()) {
+      return;
+    }
+    auto &jobMap = this->scheduler.getJobMap();
+    auto it = jobMap.find(response.jobId);
+    ENFORCE(it != jobMap.end());
+    this->handleSkippedJob(response.jobId, it->second);
+    this->recordFailure(response.jobId.taskId(), "timed out");
+    // Unlike when the worker is killed, the worker carries on with
+    // the rest of its batch.
+    this->scheduler.startNextBatchedJobIfAny(*latestIdleWorkerId);
+  }
+
   void processSemanticAnalysisResult(SemanticAnalysisJobResult &&) {}
 
-  void processWorkerResponse(IndexJobResponse &&response) {
-    auto latestIdleWorkerId = this->scheduler.markCompleted(
+  /// Decides which files the TU for \p taskId should index, based on
+  /// the result of semantic analysis.
+  void planEmitIndex(WorkerId workerId, uint32_t taskId,
+                     SemanticAnalysisJobResult &&semaResult,
+                     std::vector<PreprocessedFileInfo> &filesToBeIndexed,
+                     std::vector<AbsolutePath> &rejectedPaths) {
+    if (auto *balancer = this->planner.claimBalancer()) {
+      balancer->onTuAnalyzed(this->commandForTask(taskId).Filename);
+    }
+    std::vector<PathId> allPathIds{};
+    bool recordIncludes = !this->options.includeSetCachePath.empty();
+    this->planner.saveSemaResult(workerId, std::move(semaResult),
+                                 filesToBeIndexed, rejectedPaths,
+                                 recordIncludes ? &allPathIds : nullptr);
+    if (recordIncludes) {
+      this->recordIncludeSet(taskId, allPathIds);
+    }
+  }
+
+  /// Checks a semantic analysis result before any planning, as claiming
+  /// headers with mismatched path IDs would silently index the wrong files.
+  bool pathIdsOutOfSync(const IndexJobResponse &response) const {
+    if (response.result.kind != IndexJob::Kind::SemanticAnalysis
+        || response.result.semanticAnalysis.claimedInSharedTable
+        || !this->scheduler.isCurrentJob(response.workerId, response.jobId)) {
+      return false;
+    }
+    return !this->planner.pathIdsInSync(
+        response.workerId, response.result.semanticAnalysis.firstNewPathId);
+  }
+
+  /// Returns false if the response was ignored, as it was cancelled,
+  /// stale, or from a worker whose path IDs went out of sync.
+  bool processWorkerResponse(IndexJobResponse &&response) {
+    if (response.cancelled) {
+      this->processCancellation(response);
+      return false;
+    }
+    if (this->pathIdsOutOfSync(response)) {
+      this->scheduler.requestKill(response.workerId);
+      return false;
+    }
+    // Stale results must be dropped before planning, as the worker's
+    // path IDs now belong to its replacement.
+    auto maybeLatestIdleWorkerId = this->scheduler.markCompleted(
         response.workerId, response.jobId, response.result.kind);
+    if (!maybeLatestIdleWorkerId.has_value()) {
+      return false;
+    }
+    auto latestIdleWorkerId = *maybeLatestIdleWorkerId;
     switch (response.result.kind) {
     case IndexJob::Kind::SemanticAnalysis: {
       auto &semaResult = response.result.semanticAnalysis;
+      bool hasProvisionalPlan = semaResult.hasProvisionalPlan;
+      bool claimedInSharedTable = semaResult.claimedInSharedTable;
       std::vector<PreprocessedFileInfo> filesToBeIndexed{};
-      this->planner.saveSemaResult(std::move(semaResult), filesToBeIndexed);
-      auto &queue = this->queues.driverToWorker[latestIdleWorkerId.id];
-      queue.send(this->scheduler.createSubtaskAndScheduleOnWorker(
+      std::vector<AbsolutePath> rejectedPaths{};
+      if (!claimedInSharedTable) {
+        this->planEmitIndex(response.workerId, response.jobId.taskId(),
+                            std::move(semaResult), filesToBeIndexed,
+                            rejectedPaths);
+        if (!this->options.provisionalPlans) {
+          this->planner.trackClaims(response.jobId.taskId(), response.workerId,
+                                    filesToBeIndexed);
+        }
+      }
+      auto emitIndexRequest = this->scheduler.createSubtaskAndScheduleOnWorker(
           latestIdleWorkerId, response.jobId,
           IndexJob{
               .kind = IndexJob::Kind::EmitIndex,
               .emitIndex = EmitIndexJobDetails{std::move(filesToBeIndexed)},
-          }));
+          });
+      if (hasProvisionalPlan || claimedInSharedTable) {
+        // The worker is already emitting the index, so there is nothing
+        // to send; see NOTE(ref: provisional-plans) and
+        // NOTE(ref: shm-claim-table).
+        if (!rejectedPaths.empty()) {
+          auto &rejected =
+              this->provisionallyRejectedPaths[response.jobId.taskId()];
+          for (auto &path : rejectedPaths) {
+            rejected.insert(path.asStringRef());
+          }
+        }
+        break;
+      }
+      this->sendToBusyWorker(latestIdleWorkerId.id, emitIndexRequest);
       break;
     }
     case IndexJob::Kind::EmitIndex: {
       auto &result = response.result.emitIndex;
+      if (this->journal) {
+        auto taskId = response.jobId.taskId();
+        auto &command = this->commandForTask(taskId);
+        this->journal->append(CompletedTu{
+            compdb::commandKey(command), command.Filename, taskId,
+            response.workerId, result.shardPaths, result.shardLogRecords,
+            result.statistics, this->planner.trackedClaims(taskId)});
+      }
+      this->planner.completeClaims(response.jobId.taskId());
+      if (this->quarantinedTaskIds.contains(response.jobId.taskId())) {
+        auto &command = this->commandForTask(response.jobId.taskId());
+        spdlog::info("'{}' was indexed successfully, so it is no longer "
+                     "quarantined",
+                     command.Filename);
+        this->quarantine->recordSuccess(command);
+      }
+      this->planWaitTimeMicrosPerWorker[response.workerId] +=
+          result.statistics.planWaitTimeMicros;
+      this->checkWorkerRss(response.workerId, response.jobId.taskId(),
+                           result.statistics);
       if (!this->options.statsFilePath.asStringRef().empty()) {
         this->allStatistics.emplace_back(response.jobId,
                                          std::move(result.statistics));
       }
-      this->shardPaths.emplace_back(std::move(result.shardPaths));
+      this->shards.emplace_back(ShardLocation{
+          response.jobId.taskId(), response.workerId,
+          std::move(result.shardPaths), result.shardLogRecords});
+      this->scheduler.startNextBatchedJobIfAny(latestIdleWorkerId);
       break;
     }
     }
+    return true;
+  }
+
+  /// Returns the number of responses processed.
+  unsigned processJobResults() {
+#ifdef __linux__
+    if (this->shmTransport) {
+      return this->processJobResultsFromShmRings();
+    }
+#endif
+    return this->processQueuedJobResults();
+  }
+
+  /// NOTE(def: sema-result-priority): A worker which has sent a semantic
+  /// analysis result is blocked (holding on to the full AST) until it
+  /// receives its EmitIndex job, whereas EmitIndex results only need
+  /// bookkeeping. So out of the responses received in one go, handle
+  /// SemanticAnalysis results first.
+  ///
+  /// Responses from the same worker must not be reordered; e.g. with
+  /// NOTE(ref: tu-batching), a worker sends the EmitIndex result for
+  /// one TU before the SemanticAnalysis result for the next one. So
+  /// responses are grouped into rounds, where round 2k (resp. 2k+1)
+  /// holds SemanticAnalysis (resp. EmitIndex) results preceded by k
+  /// EmitIndex results from the same worker. Cancelled jobs end the TU
+  /// just like EmitIndex results; see NOTE(ref: soft-cancellation).
+  ///
+  /// Heartbeats are handled after all results, as the results may move
+  /// a worker on to the job that a heartbeat is for.
+  ///
+  /// Returns the number of results processed, excluding heartbeats,
+  /// cancelled jobs and stale results.
+  unsigned processWorkerResponses(std::vector<IndexJobResponse> &&responses) {
+    std::vector<std::pair<size_t, size_t>> roundAndIndex;
+    roundAndIndex.reserve(responses.size());
+    absl::flat_hash_map<WorkerId, size_t> emitIndexCounts;
+    std::vector<size_t> heartbeatIndexes;
+    for (size_t i = 0; i < responses.size(); ++i) {
+      if (responses[i].heartbeat.has_value()) {
+        heartbeatIndexes.push_back(i);
+        continue;
+      }
+      auto &emitIndexCount = emitIndexCounts[responses[i].workerId];
+      bool endsTu = responses[i].cancelled
+                    || responses[i].result.kind == IndexJob::Kind::EmitIndex;
+      roundAndIndex.emplace_back(2 * emitIndexCount + size_t(endsTu), i);
+      emitIndexCount += size_t(endsTu);
+    }
+    absl::c_sort(roundAndIndex);
+    unsigned numResults = 0;
+    for (auto [_, i] : roundAndIndex) {
+      numResults +=
+          unsigned(this->processWorkerResponse(std::move(responses[i])));
+    }
+    for (auto i : heartbeatIndexes) {
+      auto &response = responses[i];
+      this->scheduler.recordHeartbeat(response.workerId, response.jobId,
+                                      *response.heartbeat);
+    }
+    return numResults;
+  }
+
+#ifdef __linux__
+  unsigned processJobResultsFromShmRings() {
+    // Instead of waking up periodically to check for timeouts, only
+    // wake up when the earliest deadline passes.
+    this->shmTransport->armTimer(this->nextWorkerCheck());
+
+    std::vector<std::pair<WorkerId, std::string>> messages;
+    bool timerExpired = false;
+    this->shmTransport->wait(messages, timerExpired);
+
+    std::vector<IndexJobResponse> responses;
+    for (auto &[workerId, frame] : messages) {
+      std::string_view buffer;
+      auto status = this->shmChunkAssembler.add(frame, buffer);
+      if (status == IpcChunkAssembler::Status::Incomplete) {
+        continue;
+      }
+      if (status == IpcChunkAssembler::Status::Malformed) {
+        spdlog::error("received malformed IPC chunk from worker {}", workerId);
+        continue;
+      }
+      IndexJobResponse response;
+      if (auto err = ipc::decodeMessage(buffer, response)) {
+        spdlog::error("received malformed message from worker {}: {}",
+                      workerId, llvm_ext::format(err));
+        continue;
+      }
+      spdlog::debug("received response from worker {}", response.workerId);
+      responses.push_back(std::move(response));
+    }
+    auto numProcessed = this->processWorkerResponses(std::move(responses));
+    auto now = std::chrono::steady_clock::now();
+    // Workers which the driver gave up on shouldn't wait until their
+    // deadline.
+    if (timerExpired || this->scheduler.anyKillRequested()) {
+      this->killLongRunningWorkersAndRespawn(now);
+    }
+    this->recycleStaleWorkers(now);
+    return numProcessed;
   }
+#endif
 
-  void processOneJobResult() {
+  unsigned processQueuedJobResults() {
     using namespace std::chrono_literals;
     auto workerTimeout = this->receiveTimeout();
+    bool waitForDeadline =
+        this->heartbeatsEnabled() || this->softCancellationEnabled()
+        || this->options.memoryBudgetBytes > 0 || this->autoscaler.has_value();
+    if (waitForDeadline) {
+      // Wake up in time for the earliest deadline, which may be much
+      // sooner than the receive timeout, or to check for workers which
+      // exited (see NOTE(ref: memory-budget)), or to autoscale (see
+      // NOTE(ref: worker-autoscaling)).
+      auto deadline = this->nextWorkerCheck();
+      if (deadline.has_value()) {
+        auto untilDeadline = std::chrono::ceil<std::chrono::seconds>(
+            *deadline - std::chrono::steady_clock::now());
+        workerTimeout = std::clamp(untilDeadline, 0s, workerTimeout);
+      }
+    }
 
+    std::vector<IndexJobResponse> responses;
     IndexJobResponse response;
     auto recvError =
         this->queues.workerToDriver.timedReceive(response, workerTimeout);
     if (recvError.isA<TimeoutError>()) {
-      spdlog::warn("timeout: no workers have responded yet");
-      // All workers which are working have been doing so for too long,
-      // because TimeoutError means we already exceeded the timeout limit.
+      if (waitForDeadline) {
+        // Some job's deadline may have passed, which is handled below.
+        spdlog::debug("timeout: no responses until the earliest deadline");
+      } else {
+        spdlog::warn("timeout: no workers have responded yet");
+        // All workers which are working have been doing so for too long,
+        // because TimeoutError means we already exceeded the timeout limit.
+      }
     } else if (recvError) {
       spdlog::error("received malformed message: {}",
                     llvm_ext::format(recvError));
@@ -929,24 +3236,65 @@ private:
       // TODO(def: add-job-debug-helper): Add a simplified debug representation
       // for printing jobs for debugging.
       spdlog::debug("received response from worker {}", response.workerId);
-      this->processWorkerResponse(std::move(response));
+      responses.push_back(std::move(response));
+      // Also pick up whatever else is already queued, so that it can
+      // be prioritized; see NOTE(ref: sema-result-priority). Bound the
+      // number of messages, so that timeouts are still checked regularly.
+      while (responses.size() < 4 * this->numWorkers()) {
+        IndexJobResponse nextResponse;
+        auto nextError =
+            this->queues.workerToDriver.timedReceive(nextResponse, 0s);
+        if (nextError.isA<TimeoutError>()) {
+          break;
+        } else if (nextError) {
+          spdlog::error("received malformed message: {}",
+                        llvm_ext::format(nextError));
+          continue;
+        }
+        spdlog::debug("received response from worker {}",
+                      nextResponse.workerId);
+        responses.push_back(std::move(nextResponse));
+      }
     }
+    auto numProcessed = this->processWorkerResponses(std::move(responses));
     auto now = std::chrono::steady_clock::now();
-    this->killLongRunningWorkersAndRespawn(now - workerTimeout);
+    this->killLongRunningWorkersAndRespawn(now);
+    this->recycleStaleWorkers(now);
+    return numProcessed;
   }
 
   // Assign a job to a specific worker. When this method is called,
   // the worker has already been "claimed", so it should not be in the
   // availableWorkers list.
   void assignJobToWorker(ToBeScheduledWorkerId &&workerId, JobId jobId) {
-    auto &queue = this->queues.driverToWorker[workerId.getValueNonConsuming()];
-    queue.send(this->scheduler.scheduleJobOnWorker(std::move(workerId), jobId));
+    auto workerIdValue = workerId.getValueNonConsuming();
+    auto request =
+        this->scheduler.scheduleJobOnWorker(std::move(workerId), jobId);
+    if (this->options.provisionalPlans) {
+      this->planner.takeNewClaims(workerIdValue, request.newHeaderClaims);
+    }
+    this->sendToBusyWorker(workerIdValue, request);
+  }
+
+  /// If the worker doesn't accept \p request in time, it is killed and
+  /// respawned on the next timeout check, and its job is skipped.
+  void sendToBusyWorker(WorkerId workerId, const IndexJobRequest &request) {
+    if (!this->queues.driverToWorker[workerId].send(request)) {
+      spdlog::warn("worker {} did not accept job {} in time", workerId,
+                   request.id.debugString());
+      this->scheduler.requestKill(workerId);
+    }
   }
 
   void shutdownAllWorkers() {
-    for (unsigned i = 0; i < this->numWorkers(); ++i) {
-      this->queues.driverToWorker[i].send(
-          IndexJobRequest{JobId::Shutdown(), {}});
+    for (unsigned i = 0; i < this->totalWorkerCount(); ++i) {
+      if (!this->queues.driverToWorker[i].send(
+              IndexJobRequest{JobId::Shutdown(), {}, {}, {}})) {
+        spdlog::warn("killing worker {} as it did not accept the shutdown "
+                     "request in time",
+                     i);
+        this->scheduler.terminateWorker(i);
+      }
     }
   }
 };
@@ -956,7 +3304,7 @@ private:
 int driverMain(CliOptions &&cliOptions) {
   auto driverId = cliOptions.driverId.empty() ? fmt::format("{}", ::getpid())
                                               : cliOptions.driverId;
-  size_t numWorkers = cliOptions.numWorkers;
+  size_t numWorkers = cliOptions.numWorkers + cliOptions.numSpareWorkers;
   BOOST_TRY {
     Driver driver(driverId, DriverOptions(driverId, std::move(cliOptions)));
     driver.run();
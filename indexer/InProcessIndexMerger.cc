@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+
+#include "indexer/InProcessIndexMerger.h"
+
+namespace scip_clang {
+
+InProcessIndexMerger::InProcessIndexMerger(const RootPath &projectRootPath,
+                                           ConcurrentClaimMap &claims,
+                                           bool deterministic)
+    : mutex(), fullIndex(), builder(this->fullIndex, /*incremental*/ true),
+      projectRootPath(projectRootPath), claims(claims),
+      deterministic(deterministic), pending(), nextTaskId(0),
+      forwardDecls() {}
+
+void InProcessIndexMerger::add(uint32_t taskId,
+                               std::optional<TuIndexingOutput> &&output) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (!this->deterministic) {
+    if (output.has_value()) {
+      this->merge(std::move(*output));
+    }
+    return;
+  }
+  this->pending.emplace(taskId, std::move(output));
+  for (auto it = this->pending.find(this->nextTaskId);
+       it != this->pending.end(); it = this->pending.find(this->nextTaskId)) {
+    if (it->second.has_value()) {
+      this->merge(std::move(*it->second));
+    }
+    this->pending.erase(it);
+    this->nextTaskId++;
+  }
+}
+
+scip::Index &InProcessIndexMerger::finish() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::vector<uint32_t> taskIds;
+  for (auto &[taskId, _] : this->pending) {
+    taskIds.push_back(taskId);
+  }
+  absl::c_sort(taskIds);
+  for (auto taskId : taskIds) {
+    auto &output = this->pending[taskId];
+    if (output.has_value()) {
+      this->merge(std::move(*output));
+    }
+  }
+  this->pending.clear();
+  auto symbolToInfoMap = this->builder.populateSymbolToInfoMap();
+  for (auto &index : this->forwardDecls) {
+    for (auto &forwardDeclSym : *index.mutable_external_symbols()) {
+      this->builder.addForwardDeclaration(*symbolToInfoMap,
+                                          std::move(forwardDeclSym));
+    }
+  }
+  this->forwardDecls.clear();
+  this->builder.finish(this->deterministic);
+  return this->fullIndex;
+}
+
+void InProcessIndexMerger::merge(TuIndexingOutput &&output) {
+  for (auto &doc : *output.docsAndExternals.mutable_documents()) {
+    auto docPath = this->projectRootPath.makeAbsolute(
+        RootRelativePathRef{doc.relative_path(), RootKind::Project});
+    // If another TU claims a different hash for the path later, the
+    // builder moves the document over then.
+    bool isMultiplyIndexed = this->claims.hashCount(docPath.asRef()) > 1;
+    this->builder.addDocument(std::move(doc), isMultiplyIndexed);
+  }
+  for (auto &extSym : *output.docsAndExternals.mutable_external_symbols()) {
+    this->builder.addExternalSymbol(std::move(extSym));
+  }
+  this->forwardDecls.push_back(std::move(output.forwardDecls));
+}
+
+} // namespace scip_clang
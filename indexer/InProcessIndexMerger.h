@@ -0,0 +1,61 @@
+#ifndef SCIP_CLANG_IN_PROCESS_INDEX_MERGER_H
+#define SCIP_CLANG_IN_PROCESS_INDEX_MERGER_H
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+
+#include "scip/scip.pb.h"
+
+#include "indexer/ConcurrentClaimMap.h"
+#include "indexer/Path.h"
+#include "indexer/ScipExtras.h"
+#include "indexer/Worker.h"
+
+namespace scip_clang {
+
+/// Merges the output for TUs indexed by NOTE(ref: in-process-workers)
+/// as soon as each TU is done, so that only the forward declarations
+/// (which are resolved against definitions from all TUs) are held until
+/// all TUs are done. Safe to call from multiple threads.
+///
+/// In deterministic mode, outputs are merged in task ID order, which is
+/// the order in which shards are merged otherwise, so outputs for TUs
+/// which finish early are held until all earlier TUs are done.
+class InProcessIndexMerger final {
+  std::mutex mutex;
+  scip::Index fullIndex;
+  scip::IndexBuilder builder;
+  const RootPath &projectRootPath;
+  /// Used for computing isMultiplyIndexed.
+  ConcurrentClaimMap &claims;
+  bool deterministic;
+  /// Only used in deterministic mode; outputs waiting for earlier tasks,
+  /// keyed by task ID. Unset for TUs which emitted no index.
+  absl::flat_hash_map<uint32_t, std::optional<TuIndexingOutput>> pending;
+  uint32_t nextTaskId;
+  std::vector<scip::Index> forwardDecls;
+
+public:
+  InProcessIndexMerger(const RootPath &projectRootPath,
+                       ConcurrentClaimMap &claims, bool deterministic);
+  InProcessIndexMerger(const InProcessIndexMerger &) = delete;
+  InProcessIndexMerger &operator=(const InProcessIndexMerger &) = delete;
+
+  /// \p output should be unset if the TU emitted no index, so that
+  /// later TUs are not held up in deterministic mode.
+  void add(uint32_t taskId, std::optional<TuIndexingOutput> &&output);
+
+  /// Should be called once all threads are done.
+  scip::Index &finish();
+
+private:
+  void merge(TuIndexingOutput &&output);
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_IN_PROCESS_INDEX_MERGER_H
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+#include "absl/container/flat_hash_map.h"
+#include "spdlog/spdlog.h"
+
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include "indexer/IncludeSetCache.h"
+#include "indexer/LlvmAdapter.h"
+
+namespace scip_clang {
+
+constexpr static int64_t INCLUDE_SET_CACHE_VERSION = 1;
+
+uint32_t IncludeSetCache::internPath(std::string_view path) {
+  auto [it, inserted] =
+      this->pathIds.try_emplace(std::string(path), this->paths.size());
+  if (inserted) {
+    this->paths.emplace_back(path);
+  }
+  return it->second;
+}
+
+void IncludeSetCache::load(std::string_view cachePath) {
+  auto bufferOrErr =
+      llvm::MemoryBuffer::getFile(llvm::Twine(cachePath), /*IsText*/ true);
+  if (!bufferOrErr) {
+    if (bufferOrErr.getError() != std::errc::no_such_file_or_directory) {
+      spdlog::warn("failed to read include set cache at '{}' ({})", cachePath,
+                   bufferOrErr.getError().message());
+    }
+    return;
+  }
+  auto valueOrErr = llvm::json::parse(bufferOrErr.get()->getBuffer());
+  if (auto err = valueOrErr.takeError()) {
+    spdlog::warn("ignoring malformed include set cache at '{}' ({})",
+                 cachePath, llvm_ext::format(err));
+    return;
+  }
+  auto warnMalformed = [&](std::string_view what) {
+    spdlog::warn("ignoring malformed include set cache at '{}' ({})",
+                 cachePath, what);
+  };
+  auto *root = valueOrErr->getAsObject();
+  if (!root) {
+    return warnMalformed("expected object");
+  }
+  auto version = root->getInteger("version");
+  if (!version || *version != INCLUDE_SET_CACHE_VERSION) {
+    return warnMalformed("unknown version");
+  }
+  auto *paths = root->getArray("paths");
+  auto *tus = root->getArray("translationUnits");
+  if (!paths || !tus) {
+    return warnMalformed("missing paths or translationUnits");
+  }
+  std::vector<uint32_t> fileIdToId;
+  fileIdToId.reserve(paths->size());
+  for (auto &pathValue : *paths) {
+    auto path = pathValue.getAsString();
+    if (!path) {
+      return warnMalformed("expected string path");
+    }
+    fileIdToId.push_back(this->internPath(llvm_ext::toStringView(*path)));
+  }
+  for (auto &tuValue : *tus) {
+    auto *tu = tuValue.getAsObject();
+    if (!tu) {
+      return warnMalformed("expected object for TU");
+    }
+    auto mainFile = tu->getString("mainFile");
+    auto *includes = tu->getArray("includes");
+    if (!mainFile || !includes) {
+      return warnMalformed("expected mainFile and includes for TU");
+    }
+    std::vector<uint32_t> ids;
+    ids.reserve(includes->size());
+    for (auto &includeValue : *includes) {
+      auto fileId = includeValue.getAsInteger();
+      if (!fileId || *fileId < 0 || size_t(*fileId) >= fileIdToId.size()) {
+        return warnMalformed("invalid path index");
+      }
+      ids.push_back(fileIdToId[*fileId]);
+    }
+    this->includesByMainFile[mainFile->str()] = std::move(ids);
+  }
+  spdlog::debug("loaded include sets for {} TUs from '{}'", this->size(),
+                cachePath);
+}
+
+void IncludeSetCache::save(std::string_view cachePath) const {
+  std::error_code error;
+  llvm::raw_fd_ostream out(cachePath, error);
+  if (error) {
+    spdlog::warn("failed to write include set cache to '{}' ({})", cachePath,
+                 error.message());
+    return;
+  }
+  llvm::json::OStream jsonStream(out);
+  jsonStream.object([&]() {
+    jsonStream.attribute("version", INCLUDE_SET_CACHE_VERSION);
+    jsonStream.attributeArray("paths", [&]() {
+      for (auto &path : this->paths) {
+        jsonStream.value(path);
+      }
+    });
+    jsonStream.attributeArray("translationUnits", [&]() {
+      for (auto &[mainFile, ids] : this->includesByMainFile) {
+        jsonStream.object([&]() {
+          jsonStream.attribute("mainFile", mainFile);
+          jsonStream.attributeArray("includes", [&]() {
+            for (auto id : ids) {
+              jsonStream.value(int64_t(id));
+            }
+          });
+        });
+      }
+    });
+  });
+  jsonStream.flush();
+}
+
+void IncludeSetCache::record(std::string_view mainFile,
+                             const std::vector<std::string_view> &files) {
+  std::vector<uint32_t> ids;
+  ids.reserve(files.size());
+  for (auto file : files) {
+    ids.push_back(this->internPath(file));
+  }
+  absl::c_sort(ids);
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  this->includesByMainFile[std::string(mainFile)] = std::move(ids);
+}
+
+std::optional<uint32_t>
+IncludeSetCache::lookupPath(std::string_view path) const {
+  auto it = this->pathIds.find(path);
+  if (it == this->pathIds.end()) {
+    return {};
+  }
+  return it->second;
+}
+
+const std::vector<uint32_t> *
+IncludeSetCache::includeSet(std::string_view mainFile) const {
+  auto it = this->includesByMainFile.find(mainFile);
+  if (it == this->includesByMainFile.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+std::vector<size_t> IncludeSetCache::headerCoverageOrder(
+    const std::vector<const clang::tooling::CompileCommand *> &commands)
+    const {
+  std::vector<std::vector<uint32_t>> sets;
+  sets.reserve(commands.size());
+  // IDs for spelled names are allocated after the cached paths, so that
+  // they never match a path from the cache.
+  absl::flat_hash_map<std::string, uint32_t> spelledIds;
+  std::vector<std::string> spelledIncludes;
+  size_t numCached = 0;
+  for (auto *command : commands) {
+    auto it = this->includesByMainFile.find(command->Filename);
+    if (it != this->includesByMainFile.end()) {
+      sets.push_back(it->second);
+      numCached++;
+      continue;
+    }
+    spelledIncludes.clear();
+    scip_clang::scanDirectIncludes(*command, spelledIncludes);
+    std::vector<uint32_t> ids;
+    for (auto &include : spelledIncludes) {
+      auto [idIt, _] = spelledIds.try_emplace(
+          include, uint32_t(this->paths.size() + spelledIds.size()));
+      ids.push_back(idIt->second);
+    }
+    absl::c_sort(ids);
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    sets.push_back(std::move(ids));
+  }
+  spdlog::debug("ordering {} TUs by header coverage ({} from cache)",
+                commands.size(), numCached);
+  return scip_clang::orderByCoverage(sets);
+}
+
+void scanDirectIncludes(const clang::tooling::CompileCommand &command,
+                        std::vector<std::string> &includes) {
+  std::filesystem::path mainFilePath(command.Filename);
+  if (mainFilePath.is_relative()) {
+    mainFilePath = std::filesystem::path(command.Directory) / mainFilePath;
+  }
+  std::ifstream in(mainFilePath);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::string_view rest(line);
+    auto skipSpaces = [&]() {
+      while (!rest.empty()
+             && std::isspace(static_cast<unsigned char>(rest[0]))) {
+        rest.remove_prefix(1);
+      }
+    };
+    skipSpaces();
+    if (!rest.starts_with('#')) {
+      continue;
+    }
+    rest.remove_prefix(1);
+    skipSpaces();
+    if (!rest.starts_with("include")) {
+      continue;
+    }
+    rest.remove_prefix(std::string_view("include").size());
+    skipSpaces();
+    if (rest.empty() || (rest[0] != '"' && rest[0] != '<')) {
+      continue; // e.g. #include_next, or a macro
+    }
+    char close = rest[0] == '"' ? '"' : '>';
+    auto end = rest.find(close, 1);
+    if (end == std::string_view::npos) {
+      continue;
+    }
+    includes.emplace_back(rest.substr(1, end - 1));
+  }
+}
+
+std::vector<size_t>
+orderByCoverage(const std::vector<std::vector<uint32_t>> &sets) {
+  uint32_t maxId = 0;
+  for (auto &set : sets) {
+    for (auto id : set) {
+      maxId = std::max(maxId, id);
+    }
+  }
+  std::vector<bool> covered(size_t(maxId) + 1, false);
+  auto uncoveredCount = [&](size_t i) -> size_t {
+    return absl::c_count_if(sets[i],
+                            [&](uint32_t id) -> bool { return !covered[id]; });
+  };
+
+  // Lazy greedy: the number of uncovered elements in a set only goes
+  // down over time, so a stale count is an upper bound. Whenever the
+  // recomputed count for the top entry is still at least as large as
+  // the next largest (stale) count, it's the best choice.
+  using Entry = std::pair<size_t, size_t>; // (count, index)
+  auto lowerPriority = [](const Entry &a, const Entry &b) -> bool {
+    if (a.first != b.first) {
+      return a.first < b.first;
+    }
+    return a.second > b.second;
+  };
+  std::priority_queue<Entry, std::vector<Entry>, decltype(lowerPriority)>
+      queue(lowerPriority);
+  for (size_t i = 0; i < sets.size(); ++i) {
+    queue.push({sets[i].size(), i});
+  }
+  std::vector<size_t> order;
+  order.reserve(sets.size());
+  while (!queue.empty()) {
+    auto [staleCount, index] = queue.top();
+    queue.pop();
+    auto count = uncoveredCount(index);
+    if (count < staleCount && !queue.empty()
+        && lowerPriority(Entry{count, index}, queue.top())) {
+      queue.push({count, index});
+      continue;
+    }
+    order.push_back(index);
+    for (auto id : sets[index]) {
+      covered[id] = true;
+    }
+  }
+  return order;
+}
+
+} // namespace scip_clang
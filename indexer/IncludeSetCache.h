@@ -0,0 +1,101 @@
+#ifndef SCIP_CLANG_INCLUDE_SET_CACHE_H
+#define SCIP_CLANG_INCLUDE_SET_CACHE_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+
+#include "clang/Tooling/CompilationDatabase.h"
+
+namespace scip_clang {
+
+// NOTE(def: header-coverage-ordering): A header is indexed by the
+// first TU which reports a given (path, hash) pair for it, so the order
+// of TUs decides how the work of emitting headers is spread out. If TUs
+// which include lots of shared headers go first, later TUs have much
+// less to emit, and the remaining work is easier to balance.
+//
+// With --job-order=header-coverage, the driver picks TUs greedily, so
+// that each TU covers as many headers not covered by earlier TUs as
+// possible (i.e. the standard greedy approximation for set cover).
+//
+// Include sets come from a cache written by earlier runs (see
+// --include-set-cache), which records all files reported by each TU
+// during semantic analysis. For TUs which are not in the cache, the
+// include set is estimated by scanning the main file for #include
+// directives, without running the preprocessor. Since those only have
+// spelled names, they are only compared against other spelled names.
+//
+// Like with NOTE(ref: job-ordering), all jobs need to be known upfront,
+// so the whole compilation database is parsed at the start.
+
+class IncludeSetCache final {
+  /// Paths for IDs used in includesByMainFile.
+  std::vector<std::string> paths;
+  absl::flat_hash_map<std::string, uint32_t> pathIds;
+  /// Keyed by the TU's main file, as present in the compilation database.
+  absl::flat_hash_map<std::string, std::vector<uint32_t>> includesByMainFile;
+
+public:
+  IncludeSetCache() : paths(), pathIds(), includesByMainFile() {}
+  IncludeSetCache(IncludeSetCache &&) = default;
+  IncludeSetCache(const IncludeSetCache &) = delete;
+
+  /// Reads a cache written by \c save, if present. Malformed caches are
+  /// ignored with a warning.
+  void load(std::string_view cachePath);
+
+  /// Logs a warning on failure.
+  void save(std::string_view cachePath) const;
+
+  /// Overwrites any earlier entry for \p mainFile.
+  void record(std::string_view mainFile,
+              const std::vector<std::string_view> &files);
+
+  size_t size() const {
+    return this->includesByMainFile.size();
+  }
+
+  /// Upper bound for path IDs returned by \c lookupPath and \c includeSet.
+  size_t pathCount() const {
+    return this->paths.size();
+  }
+
+  std::string_view path(uint32_t pathId) const {
+    return this->paths[pathId];
+  }
+
+  std::optional<uint32_t> lookupPath(std::string_view path) const;
+
+  /// Returns null if there is no entry for \p mainFile. The returned IDs
+  /// are sorted.
+  const std::vector<uint32_t> *includeSet(std::string_view mainFile) const;
+
+  /// Returns the order in which \p commands should be scheduled, as
+  /// indexes into \p commands.
+  std::vector<size_t> headerCoverageOrder(
+      const std::vector<const clang::tooling::CompileCommand *> &commands)
+      const;
+
+private:
+  uint32_t internPath(std::string_view path);
+};
+
+/// Appends the names of files included by \p command's main file,
+/// as spelled in #include directives. Conditional compilation is
+/// ignored, and includes spanning multiple lines are skipped.
+void scanDirectIncludes(const clang::tooling::CompileCommand &command,
+                        std::vector<std::string> &includes);
+
+/// Greedy set cover; returns a permutation of indexes into \p sets.
+/// Ties are broken in favor of lower indexes.
+std::vector<size_t>
+orderByCoverage(const std::vector<std::vector<uint32_t>> &sets);
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_INCLUDE_SET_CACHE_H
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "spdlog/fmt/fmt.h"
+#include "spdlog/spdlog.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "indexer/IndexingJournal.h"
+#include "indexer/LlvmAdapter.h"
+#include "indexer/ShardLog.h"
+
+namespace scip_clang {
+
+constexpr static int64_t INDEXING_JOURNAL_VERSION = 1;
+
+DERIVE_SERIALIZE_2(JournalClaim, path, hashValue)
+
+llvm::json::Value toJSON(const CompletedTu &entry) {
+  return llvm::json::Object{
+      {"commandKey", entry.commandKey},
+      {"mainFile", entry.mainFile},
+      {"taskId", int64_t(entry.taskId)},
+      {"workerId", entry.workerId},
+      {"shardPaths", entry.shardPaths},
+      {"shardLogRecords", entry.shardLogRecords},
+      {"statistics", entry.statistics},
+      {"claims", entry.claims},
+  };
+}
+
+bool fromJSON(const llvm::json::Value &value, CompletedTu &entry,
+              llvm::json::Path path) {
+  llvm::json::ObjectMapper mapper(value, path);
+  int64_t taskId;
+  if (!mapper || !mapper.map("taskId", taskId)) {
+    return false;
+  }
+  if (taskId < 0 || taskId >= int64_t(UINT32_MAX)) {
+    path.field("taskId").report("out of range");
+    return false;
+  }
+  entry.taskId = uint32_t(taskId);
+  return mapper.map("commandKey", entry.commandKey)
+         && mapper.map("mainFile", entry.mainFile)
+         && mapper.map("workerId", entry.workerId)
+         && mapper.map("shardPaths", entry.shardPaths)
+         && mapper.map("shardLogRecords", entry.shardLogRecords)
+         && mapper.map("statistics", entry.statistics)
+         && mapper.map("claims", entry.claims);
+}
+
+// static
+StdPath IndexingJournal::pathIn(const StdPath &temporaryOutputDir) {
+  return temporaryOutputDir / "indexing-journal.jsonl";
+}
+
+// static
+std::vector<CompletedTu>
+IndexingJournal::load(const StdPath &journalPath,
+                      std::string_view projectRootPath) {
+  auto bufferOrErr =
+      llvm::MemoryBuffer::getFile(journalPath.string(), /*IsText*/ true);
+  if (!bufferOrErr) {
+    spdlog::warn("failed to read indexing journal at '{}' ({}); "
+                 "indexing from scratch",
+                 journalPath.c_str(), bufferOrErr.getError().message());
+    return {};
+  }
+  llvm::SmallVector<llvm::StringRef, 0> lines;
+  bufferOrErr.get()->getBuffer().split(lines, '\n', /*MaxSplit*/ -1,
+                                       /*KeepEmpty*/ false);
+  if (lines.empty()) {
+    return {};
+  }
+  auto header = llvm::json::parse(lines.front());
+  if (!header) {
+    spdlog::warn("ignoring malformed indexing journal at '{}' ({})",
+                 journalPath.c_str(), llvm_ext::format(header.takeError()));
+    return {};
+  }
+  auto *headerObject = header->getAsObject();
+  if (!headerObject
+      || headerObject->getInteger("version") != INDEXING_JOURNAL_VERSION) {
+    spdlog::warn("ignoring indexing journal at '{}' from a different "
+                 "version of scip-clang",
+                 journalPath.c_str());
+    return {};
+  }
+  auto journalRoot = headerObject->getString("projectRoot");
+  if (!journalRoot || llvm_ext::toStringView(*journalRoot) != projectRootPath) {
+    spdlog::warn("ignoring indexing journal at '{}' for a different project "
+                 "root",
+                 journalPath.c_str());
+    return {};
+  }
+  std::vector<CompletedTu> entries;
+  for (size_t i = 1; i < lines.size(); ++i) {
+    bool isLastLine = i + 1 == lines.size();
+    auto valueOrErr = llvm::json::parse(lines[i]);
+    CompletedTu entry{};
+    std::string error;
+    if (!valueOrErr) {
+      error = llvm_ext::format(valueOrErr.takeError());
+    } else {
+      llvm::json::Path::Root root("journal");
+      if (!fromJSON(*valueOrErr, entry, root)) {
+        error = llvm_ext::format(root.getError());
+      }
+    }
+    if (error.empty()) {
+      entries.push_back(std::move(entry));
+    } else if (isLastLine) {
+      // Expected if the driver was killed while appending.
+      spdlog::debug("ignoring partially written last line in indexing "
+                    "journal ({})",
+                    error);
+    } else {
+      spdlog::warn("skipping malformed line {} in indexing journal at "
+                   "'{}' ({})",
+                   i + 1, journalPath.c_str(), error);
+    }
+  }
+  return entries;
+}
+
+// static
+bool IndexingJournal::hasShards(const CompletedTu &entry,
+                                const StdPath &temporaryOutputDir) {
+  std::error_code error;
+  switch (entry.shardPaths.storage) {
+  case ShardStorage::File:
+    for (auto *path : {&entry.shardPaths.docsAndExternals,
+                       &entry.shardPaths.forwardDecls}) {
+      if (!std::filesystem::exists(path->asStringRef(), error) || error) {
+        return false;
+      }
+    }
+    return true;
+  case ShardStorage::WorkerLog: {
+    auto logSize = std::filesystem::file_size(
+        scip_clang::shardLogPath(temporaryOutputDir, entry.workerId), error);
+    auto &records = entry.shardLogRecords;
+    return !error
+           && logSize >= std::max(
+                  scip_clang::shardLogRecordEnd(records.docsAndExternals),
+                  scip_clang::shardLogRecordEnd(records.forwardDecls));
+  }
+  case ShardStorage::SharedMemory:
+    // Shards are removed when the driver exits.
+    return false;
+  }
+  return false;
+}
+
+// static
+std::optional<IndexingJournal>
+IndexingJournal::create(StdPath journalPath, std::string_view projectRootPath,
+                        const std::vector<CompletedTu> &entries) {
+  // Write to a separate file first, so that a crash in the middle
+  // doesn't lose entries from the existing journal.
+  auto newPath = journalPath;
+  newPath += ".new";
+  std::error_code error;
+  {
+    llvm::raw_fd_ostream out(newPath.string(), error);
+    if (error) {
+      spdlog::warn("failed to create indexing journal at '{}' ({})",
+                   newPath.c_str(), error.message());
+      return {};
+    }
+    out << llvm::json::Value(llvm::json::Object{
+        {"version", INDEXING_JOURNAL_VERSION},
+        {"projectRoot", std::string(projectRootPath)},
+    }) << '\n';
+    for (auto &entry : entries) {
+      out << llvm::json::Value(entry) << '\n';
+    }
+    out.close();
+    if (out.has_error()) {
+      spdlog::warn("failed to write indexing journal at '{}' ({})",
+                   newPath.c_str(), out.error().message());
+      out.clear_error();
+      return {};
+    }
+  }
+  std::filesystem::rename(newPath, journalPath, error);
+  if (error) {
+    spdlog::warn("failed to move indexing journal to '{}' ({})",
+                 journalPath.c_str(), error.message());
+    return {};
+  }
+  IndexingJournal journal{std::move(journalPath)};
+  journal.stream.open(journal.path, std::ios_base::out | std::ios_base::app);
+  if (journal.stream.fail()) {
+    spdlog::warn("failed to open indexing journal at '{}' for appending",
+                 journal.path.c_str());
+    return {};
+  }
+  return journal;
+}
+
+void IndexingJournal::append(const CompletedTu &entry) {
+  std::string line;
+  llvm::raw_string_ostream lineStream(line);
+  lineStream << llvm::json::Value(entry) << '\n';
+  lineStream.flush();
+  // Flush right away, so that the entry survives the driver being killed.
+  this->stream << line << std::flush;
+  if (this->stream.fail()) {
+    spdlog::warn("failed to append to indexing journal at '{}'",
+                 this->path.c_str());
+    this->stream.clear();
+  }
+}
+
+void IndexingJournal::remove() {
+  this->stream.close();
+  std::error_code error;
+  std::filesystem::remove(this->path, error);
+  if (error) {
+    spdlog::warn("failed to remove indexing journal at '{}' ({})",
+                 this->path.c_str(), error.message());
+  }
+}
+
+} // namespace scip_clang
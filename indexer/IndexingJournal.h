@@ -0,0 +1,112 @@
+#ifndef SCIP_CLANG_INDEXING_JOURNAL_H
+#define SCIP_CLANG_INDEXING_JOURNAL_H
+
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "indexer/Derive.h"
+#include "indexer/FileSystem.h"
+#include "indexer/Hash.h"
+#include "indexer/IpcMessages.h"
+#include "indexer/Path.h"
+
+namespace scip_clang {
+
+// NOTE(def: indexing-journal): Indexing a large codebase can take hours,
+// and everything the driver knows about completed TUs (where their
+// shards are, and which headers they claimed) only lives in memory.
+//
+// So when --temporary-output-dir is passed explicitly (otherwise the
+// directory is deleted on exit anyways), the driver appends one line of
+// JSON to a journal in that directory for every TU whose EmitIndex
+// result it has processed. Each entry holds a key for the compile
+// command, the shard locations, the statistics for the TU, and the
+// (path, hash) pairs which the TU claimed. Lines are flushed right away,
+// so that they survive the driver being killed, and a line which was
+// only partially written is ignored when reading the journal.
+//
+// With --resume, the driver reads the journal before starting, and for
+// each entry whose shards are still present, restores the claims and
+// the shard location, and skips the compile command when queueing jobs.
+// Task IDs for new jobs start after the ones in the journal, so that
+// shard names don't clash. The remaining TUs are indexed as usual, and
+// all shards are merged at the end. The journal is deleted once the
+// index has been written.
+//
+// The journal is not written with --in-process (there are no shards),
+// --shard-storage=shared-memory (shards don't outlive the driver), or
+// --provisional-plans and --shm-claim-table (the driver doesn't know
+// the exact claims for each TU).
+
+/// A (path, hash) pair claimed by a completed TU.
+struct JournalClaim {
+  AbsolutePath path;
+  HashValue hashValue;
+};
+SERIALIZABLE(JournalClaim)
+
+/// A TU whose shards were received by the driver.
+struct CompletedTu {
+  /// See \c compdb::commandKey.
+  HashValue commandKey;
+  /// As present in the compilation database.
+  std::string mainFile;
+  uint32_t taskId;
+  WorkerId workerId;
+  ShardPaths shardPaths;
+  /// Only valid if shardPaths.storage == ShardStorage::WorkerLog.
+  ShardLogRecords shardLogRecords;
+  IndexingStatistics statistics;
+  std::vector<JournalClaim> claims;
+};
+SERIALIZABLE(CompletedTu)
+
+class IndexingJournal final {
+  StdPath path;
+  std::ofstream stream;
+
+  explicit IndexingJournal(StdPath &&path) : path(std::move(path)), stream() {}
+
+public:
+  IndexingJournal(IndexingJournal &&) = default;
+  IndexingJournal &operator=(IndexingJournal &&) = default;
+  IndexingJournal(const IndexingJournal &) = delete;
+  IndexingJournal &operator=(const IndexingJournal &) = delete;
+
+  static StdPath pathIn(const StdPath &temporaryOutputDir);
+
+  /// Reads the entries written by an earlier run. Returns an empty list
+  /// (with a warning) if the journal is missing, or was written by a
+  /// different version or for a different \p projectRootPath.
+  /// A truncated or malformed last line is ignored.
+  static std::vector<CompletedTu> load(const StdPath &journalPath,
+                                       std::string_view projectRootPath);
+
+  /// Checks that the shards for \p entry are still present in
+  /// \p temporaryOutputDir, and that shards in worker logs were
+  /// fully written.
+  static bool hasShards(const CompletedTu &entry,
+                        const StdPath &temporaryOutputDir);
+
+  /// Starts a new journal at \p journalPath, replacing any existing one,
+  /// with \p entries as the initial contents. Logs a warning and returns
+  /// null on failure.
+  static std::optional<IndexingJournal>
+  create(StdPath journalPath, std::string_view projectRootPath,
+         const std::vector<CompletedTu> &entries);
+
+  /// Logs a warning on failure; a missing entry only means more work
+  /// when resuming.
+  void append(const CompletedTu &entry);
+
+  /// Should be called once the index has been written.
+  void remove();
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_INDEXING_JOURNAL_H
@@ -0,0 +1,49 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "spdlog/spdlog.h"
+
+#include "indexer/IpcChannel.h"
+
+namespace scip_clang {
+
+bool MessageQueueChannel::send(std::string_view message) {
+  this->queue->send(message.data(), message.size(), 1);
+  return true;
+}
+
+static boost::posix_time::ptime fromNow(uint64_t durationMillis) {
+  // Boost internally uses a spin-sleep loop which compares the passed end
+  // instant against the current instant in UTC.
+  // https://sourcegraph.com/github.com/boostorg/interprocess@4403b201bef142f07cdc43f67bf6477da5e07fe3/-/blob/include/boost/interprocess/sync/spin/condition.hpp?L171
+  // So use universal_time here instead of local_time.
+  auto now = boost::posix_time::microsec_clock::universal_time();
+  auto after = now + boost::posix_time::milliseconds(durationMillis);
+  // Hint: Use boost::posix_time::to_simple_string to debug if needed.
+  return after;
+}
+
+bool MessageQueueChannel::timedReceive(std::string &message,
+                                       uint64_t waitMillis) {
+  if (this->readBuffer.empty()) {
+    this->readBuffer.resize(this->queue->get_max_msg_size());
+  }
+  size_t recvCount;
+  unsigned recvPriority;
+  spdlog::debug("will wait for atmost {}ms", waitMillis);
+  if (this->queue->timed_receive(this->readBuffer.data(),
+                                 this->readBuffer.size(), recvCount,
+                                 recvPriority, fromNow(waitMillis))) {
+    message.assign(this->readBuffer.data(), recvCount);
+    return true;
+  }
+  return false;
+}
+
+size_t MessageQueueChannel::maxMessageSize() const {
+  return this->queue->get_max_msg_size();
+}
+
+} // namespace scip_clang
@@ -0,0 +1,55 @@
+#ifndef SCIP_CLANG_IPC_CHANNEL_H
+#define SCIP_CLANG_IPC_CHANNEL_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcovered-switch-default"
+#include "boost/interprocess/ipc/message_queue.hpp"
+#pragma clang diagnostic pop
+
+namespace scip_clang {
+
+/// Transport for moving already-encoded messages between processes.
+///
+/// Each channel is used in a single direction; the encoding of
+/// messages is handled by \c JsonIpcQueue.
+class IpcChannel {
+public:
+  virtual ~IpcChannel() = default;
+
+  /// Returns false if the receiver didn't make room for \p message in
+  /// time, e.g. because it hung or crashed. Channels without a send
+  /// timeout block until there is room, and always return true.
+  virtual bool send(std::string_view message) = 0;
+
+  /// Returns false if no message was received within \p waitMillis.
+  virtual bool timedReceive(std::string &message, uint64_t waitMillis) = 0;
+
+  /// Larger messages need to be split; see NOTE(ref: ipc-chunking).
+  virtual size_t maxMessageSize() const = 0;
+};
+
+/// Channel backed by a Boost message_queue, which works on all platforms.
+class MessageQueueChannel final : public IpcChannel {
+  std::unique_ptr<boost::interprocess::message_queue> queue;
+  /// Allocated on first receive and reused after that.
+  std::vector<char> readBuffer;
+
+public:
+  explicit MessageQueueChannel(
+      std::unique_ptr<boost::interprocess::message_queue> queue)
+      : queue(std::move(queue)), readBuffer() {}
+
+  bool send(std::string_view message) override;
+  bool timedReceive(std::string &message, uint64_t waitMillis) override;
+  size_t maxMessageSize() const override;
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_IPC_CHANNEL_H
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "spdlog/spdlog.h"
+
+#include "indexer/BinaryCodec.h"
+#include "indexer/Enforce.h"
+#include "indexer/IpcChunking.h"
+
+namespace scip_clang {
+
+static bool isChunkFrame(std::string_view frame) {
+  return frame.size() > sizeof(IPC_CHUNK_MAGIC)
+         && std::memcmp(frame.data(), IPC_CHUNK_MAGIC, sizeof(IPC_CHUNK_MAGIC))
+                == 0;
+}
+
+void forEachIpcFrame(std::string_view message, size_t maxFrameSize,
+                     uint64_t senderId, uint64_t messageId,
+                     absl::FunctionRef<void(std::string_view)> sendFrame) {
+  if (message.size() <= maxFrameSize) {
+    sendFrame(message);
+    return;
+  }
+  ENFORCE(maxFrameSize > 2 * IPC_CHUNK_HEADER_MAX_SIZE,
+          "frame size {} is too small for chunking", maxFrameSize);
+  size_t payloadSize = maxFrameSize - IPC_CHUNK_HEADER_MAX_SIZE;
+  uint64_t chunkCount = (message.size() + payloadSize - 1) / payloadSize;
+  std::string frame;
+  frame.reserve(maxFrameSize);
+  for (uint64_t index = 0; index < chunkCount; ++index) {
+    frame.clear();
+    frame.append(IPC_CHUNK_MAGIC, sizeof(IPC_CHUNK_MAGIC));
+    BinaryWriter writer(frame);
+    writer.writeVarint(senderId);
+    writer.writeVarint(messageId);
+    writer.writeVarint(index);
+    writer.writeVarint(chunkCount);
+    writer.writeBytes(message.substr(index * payloadSize, payloadSize));
+    ENFORCE(frame.size() <= maxFrameSize);
+    sendFrame(frame);
+  }
+}
+
+IpcChunkAssembler::Status IpcChunkAssembler::add(std::string_view frame,
+                                                 std::string_view &message) {
+  if (!isChunkFrame(frame)) {
+    message = frame;
+    return Status::Complete;
+  }
+  BinaryReader reader(frame.substr(sizeof(IPC_CHUNK_MAGIC)));
+  uint64_t senderId, messageId, index, chunkCount;
+  std::string_view payload;
+  if (!reader.readVarint(senderId) || !reader.readVarint(messageId)
+      || !reader.readVarint(index) || !reader.readVarint(chunkCount)
+      || !reader.readBytes(payload) || !reader.atEnd() || index >= chunkCount) {
+    return Status::Malformed;
+  }
+  if (index == 0) {
+    auto &partial = this->partialMessages[senderId];
+    if (!partial.buffer.empty()) {
+      spdlog::warn("discarding incomplete message {} from sender {}",
+                   partial.messageId, senderId);
+    }
+    partial.messageId = messageId;
+    partial.nextIndex = 0;
+    partial.chunkCount = chunkCount;
+    partial.buffer.clear();
+  }
+  auto it = this->partialMessages.find(senderId);
+  if (it == this->partialMessages.end()) {
+    spdlog::warn("discarding chunk {}/{} of message {} from sender {} "
+                 "without a preceding first chunk",
+                 index, chunkCount, messageId, senderId);
+    return Status::Incomplete;
+  }
+  auto &partial = it->second;
+  if (partial.messageId != messageId || partial.nextIndex != index
+      || partial.chunkCount != chunkCount) {
+    spdlog::warn("discarding out-of-sequence chunk {}/{} of message {} "
+                 "from sender {}",
+                 index, chunkCount, messageId, senderId);
+    this->partialMessages.erase(it);
+    return Status::Incomplete;
+  }
+  partial.buffer.append(payload);
+  partial.nextIndex++;
+  if (partial.nextIndex < partial.chunkCount) {
+    return Status::Incomplete;
+  }
+  std::swap(this->assembled, partial.buffer);
+  this->partialMessages.erase(it);
+  message = this->assembled;
+  return Status::Complete;
+}
+
+} // namespace scip_clang
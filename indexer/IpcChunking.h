@@ -0,0 +1,66 @@
+#ifndef SCIP_CLANG_IPC_CHUNKING_H
+#define SCIP_CLANG_IPC_CHUNKING_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/functional/function_ref.h"
+
+namespace scip_clang {
+
+// NOTE(def: ipc-chunking): Messages larger than what an IpcChannel can
+// carry in one go are split into chunk frames. Like binary messages
+// (see NOTE(ref: binary-ipc-header)), chunk frames start with a NUL
+// byte followed by a distinct marker, so receivers can tell them
+// apart from whole messages without any extra coordination.
+//
+// Each frame carries the sender ID, a per-sender message ID and the
+// chunk's position. Chunks from the same sender arrive in order
+// (both transports are FIFO per sender), but chunks from different
+// senders may be interleaved on the shared worker->driver queue.
+constexpr static char IPC_CHUNK_MAGIC[3] = {'\0', 'S', 'K'};
+
+/// Upper bound on the size of a chunk frame's header.
+constexpr static size_t IPC_CHUNK_HEADER_MAX_SIZE = 64;
+
+/// Calls \p sendFrame once with \p message if it fits in \p maxFrameSize,
+/// or with a sequence of chunk frames otherwise.
+void forEachIpcFrame(std::string_view message, size_t maxFrameSize,
+                     uint64_t senderId, uint64_t messageId,
+                     absl::FunctionRef<void(std::string_view)> sendFrame);
+
+/// Reassembles messages split by \c forEachIpcFrame.
+class IpcChunkAssembler final {
+  struct PartialMessage {
+    uint64_t messageId;
+    uint64_t nextIndex;
+    uint64_t chunkCount;
+    std::string buffer;
+  };
+  absl::flat_hash_map<uint64_t, PartialMessage> partialMessages;
+  /// Reused across completed messages to avoid reallocating.
+  std::string assembled;
+
+public:
+  enum class Status {
+    Complete,
+    Incomplete,
+    Malformed,
+  };
+
+  /// If \p frame completes a message (or is a whole message by itself),
+  /// returns Complete and sets \p message to a view which is valid until
+  /// the next call to \c add or until \p frame is modified.
+  ///
+  /// A chunk which doesn't continue the sender's in-progress message
+  /// (e.g. because a worker crashed midway and was respawned) discards
+  /// the partial message. The first chunk of a message always starts
+  /// afresh.
+  Status add(std::string_view frame, std::string_view &message);
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_IPC_CHUNKING_H
@@ -6,6 +6,7 @@
 
 #include "llvm/Support/JSON.h"
 
+#include "indexer/BinaryCodec.h"
 #include "indexer/Comparison.h"
 #include "indexer/Derive.h"
 #include "indexer/IpcMessages.h"
@@ -41,6 +42,25 @@ std::string workerToDriverQueueName(std::string_view driverId) {
   return fmt::format("scip-clang-{}-worker-send", driverId);
 }
 
+std::string shmRingName(std::string_view driverId, WorkerId workerId) {
+  // shm_open requires a leading slash and no other slashes.
+  return fmt::format("/scip-clang-{}-worker-{}-ring", driverId, workerId);
+}
+
+std::string claimTableShmName(std::string_view driverId) {
+  return fmt::format("/scip-clang-{}-header-claims", driverId);
+}
+
+std::string shardShmNamePrefix(std::string_view driverId) {
+  return fmt::format("scip-clang-{}-shard-", driverId);
+}
+
+std::string shardShmName(std::string_view driverId, uint32_t taskId,
+                         WorkerId workerId, std::string_view kind) {
+  return fmt::format("/{}job-{}-worker-{}-{}", shardShmNamePrefix(driverId),
+                     taskId, workerId, kind);
+}
+
 llvm::json::Value JobId::toJSON(const JobId &jobId) {
   return llvm::json::Value(jobId.to64Bit());
 }
@@ -89,6 +109,64 @@ bool fromJSON(const llvm::json::Value &jsonValue, IndexJob::Kind &t,
   return false;
 }
 
+llvm::json::Value toJSON(const ShardStorage &storage) {
+  switch (storage) {
+  case ShardStorage::File:
+    return llvm::json::Value("File");
+  case ShardStorage::SharedMemory:
+    return llvm::json::Value("SharedMemory");
+  case ShardStorage::WorkerLog:
+    return llvm::json::Value("WorkerLog");
+  }
+}
+
+bool fromJSON(const llvm::json::Value &jsonValue, ShardStorage &t,
+              llvm::json::Path path) {
+  if (auto s = jsonValue.getAsString()) {
+    if (s.value() == "File") {
+      t = ShardStorage::File;
+      return true;
+    } else if (s.value() == "SharedMemory") {
+      t = ShardStorage::SharedMemory;
+      return true;
+    } else if (s.value() == "WorkerLog") {
+      t = ShardStorage::WorkerLog;
+      return true;
+    }
+  }
+  path.report("expected File, SharedMemory or WorkerLog for ShardStorage");
+  return false;
+}
+
+llvm::json::Value toJSON(const WorkerPhase &phase) {
+  switch (phase) {
+  case WorkerPhase::Parsing:
+    return llvm::json::Value("Parsing");
+  case WorkerPhase::Traversal:
+    return llvm::json::Value("Traversal");
+  case WorkerPhase::Serialization:
+    return llvm::json::Value("Serialization");
+  }
+}
+
+bool fromJSON(const llvm::json::Value &jsonValue, WorkerPhase &t,
+              llvm::json::Path path) {
+  if (auto s = jsonValue.getAsString()) {
+    if (s.value() == "Parsing") {
+      t = WorkerPhase::Parsing;
+      return true;
+    } else if (s.value() == "Traversal") {
+      t = WorkerPhase::Traversal;
+      return true;
+    } else if (s.value() == "Serialization") {
+      t = WorkerPhase::Serialization;
+      return true;
+    }
+  }
+  path.report("expected Parsing, Traversal or Serialization for WorkerPhase");
+  return false;
+}
+
 template <typename IJ> llvm::json::Value toJSONIndexJob(const IJ &job) {
   llvm::json::Value details("");
   switch (job.kind) {
@@ -147,34 +225,291 @@ bool fromJSON(const llvm::json::Value &jsonValue, HashValue &h,
   return false;
 }
 
-DERIVE_SERIALIZE_1_NEWTYPE(scip_clang::IndexingStatistics, totalTimeMicros)
+DERIVE_SERIALIZE_5(scip_clang::IndexingStatistics, totalTimeMicros,
+                   planWaitTimeMicros, peakRssBytes, rssAfterBytes,
+                   trimmedBytes)
 DERIVE_SERIALIZE_1_NEWTYPE(scip_clang::EmitIndexJobDetails, filesToBeIndexed)
 DERIVE_SERIALIZE_1_NEWTYPE(scip_clang::IpcTestMessage, content)
 DERIVE_SERIALIZE_1_NEWTYPE(scip_clang::SemanticAnalysisJobDetails, command)
 
-DERIVE_SERIALIZE_2(scip_clang::ShardPaths, docsAndExternals, forwardDecls)
-DERIVE_SERIALIZE_2(scip_clang::EmitIndexJobResult, statistics, shardPaths)
-DERIVE_SERIALIZE_2(scip_clang::PreprocessedFileInfo, path, hashValue)
-DERIVE_SERIALIZE_2(scip_clang::PreprocessedFileInfoMulti, path, hashValues)
-DERIVE_SERIALIZE_2(scip_clang::IndexJobRequest, id, job)
-DERIVE_SERIALIZE_2(scip_clang::SemanticAnalysisJobResult, wellBehavedFiles,
-                   illBehavedFiles)
+DERIVE_SERIALIZE_3(scip_clang::ShardPaths, docsAndExternals, forwardDecls,
+                   storage)
+DERIVE_SERIALIZE_2(scip_clang::ShardLogRecord, offset, length)
+DERIVE_SERIALIZE_2(scip_clang::ShardLogRecords, docsAndExternals, forwardDecls)
+DERIVE_SERIALIZE_3(scip_clang::EmitIndexJobResult, statistics, shardPaths,
+                   shardLogRecords)
+DERIVE_SERIALIZE_2(scip_clang::PreprocessedFileInfo, pathId, hashValue)
+DERIVE_SERIALIZE_2(scip_clang::PreprocessedFileInfoMulti, pathId, hashValues)
+DERIVE_SERIALIZE_2(scip_clang::BatchedSemanticAnalysisJob, id, details)
+DERIVE_SERIALIZE_4(scip_clang::IndexJobRequest, id, job, batch,
+                   newHeaderClaims)
+
+llvm::json::Value toJSON(const PathId &pathId) {
+  return llvm::json::Value(pathId.value);
+}
+bool fromJSON(const llvm::json::Value &jsonValue, PathId &pathId,
+              llvm::json::Path path) {
+  if (auto v = jsonValue.getAsUINT64(); v && v.value() <= UINT32_MAX) {
+    pathId.value = uint32_t(v.value());
+    return true;
+  }
+  path.report("expected uint32_t for PathId");
+  return false;
+}
+
+llvm::json::Value toJSON(const SemanticAnalysisJobResult &r) {
+  return llvm::json::Object{
+      {"firstNewPathId", r.firstNewPathId},
+      {"newPaths", r.newPaths},
+      {"wellBehavedFiles", r.wellBehavedFiles},
+      {"illBehavedFiles", r.illBehavedFiles},
+      {"hasProvisionalPlan", r.hasProvisionalPlan},
+      {"provisionalPlan", r.provisionalPlan},
+      {"claimedInSharedTable", r.claimedInSharedTable},
+  };
+}
+bool fromJSON(const llvm::json::Value &jsonValue, SemanticAnalysisJobResult &r,
+              llvm::json::Path path) {
+  llvm::json::ObjectMapper mapper(jsonValue, path);
+  return mapper && mapper.map("firstNewPathId", r.firstNewPathId)
+         && mapper.map("newPaths", r.newPaths)
+         && mapper.map("wellBehavedFiles", r.wellBehavedFiles)
+         && mapper.map("illBehavedFiles", r.illBehavedFiles)
+         && mapper.map("hasProvisionalPlan", r.hasProvisionalPlan)
+         && mapper.map("provisionalPlan", r.provisionalPlan)
+         && mapper.map("claimedInSharedTable", r.claimedInSharedTable);
+}
+
+void JobId::encodeBinary(BinaryWriter &writer, const JobId &jobId) {
+  writer.writeVarint(jobId.to64Bit());
+}
+void encodeBinary(BinaryWriter &writer, const JobId &jobId) {
+  JobId::encodeBinary(writer, jobId);
+}
+bool JobId::decodeBinary(BinaryReader &reader, JobId &jobId) {
+  uint64_t v;
+  if (!reader.readVarint(v)) {
+    return false;
+  }
+  jobId = JobId::from64Bit(v);
+  return true;
+}
+bool decodeBinary(BinaryReader &reader, JobId &jobId) {
+  return JobId::decodeBinary(reader, jobId);
+}
+
+void encodeBinary(BinaryWriter &writer,
+                  const clang::tooling::CompileCommand &cc) {
+  encodeBinary(writer, cc.Directory);
+  encodeBinary(writer, cc.Filename);
+  encodeBinary(writer, cc.Output);
+  encodeBinary(writer, cc.CommandLine);
+}
+bool decodeBinary(BinaryReader &reader, clang::tooling::CompileCommand &cc) {
+  return decodeBinary(reader, cc.Directory)
+         && decodeBinary(reader, cc.Filename)
+         && decodeBinary(reader, cc.Output)
+         && decodeBinary(reader, cc.CommandLine);
+}
+
+void encodeBinary(BinaryWriter &writer, const AbsolutePath &path) {
+  writer.writeBytes(path.asStringRef());
+}
+bool decodeBinary(BinaryReader &reader, AbsolutePath &path) {
+  std::string_view bytes;
+  if (!reader.readBytes(bytes)) {
+    return false;
+  }
+  if (bytes.empty()) { // Default-constructed paths are allowed in messages
+    path = AbsolutePath();
+    return true;
+  }
+  auto optRef = AbsolutePathRef::tryFrom(bytes);
+  if (!optRef.has_value()) {
+    return false;
+  }
+  path = AbsolutePath(optRef.value());
+  return true;
+}
+
+void encodeBinary(BinaryWriter &writer, const HashValue &h) {
+  writer.writeFixed64(h.rawValue);
+}
+bool decodeBinary(BinaryReader &reader, HashValue &h) {
+  return reader.readFixed64(h.rawValue);
+}
+
+void encodeBinary(BinaryWriter &writer, const IndexJob::Kind &kind) {
+  writer.writeVarint(uint64_t(kind));
+}
+bool decodeBinary(BinaryReader &reader, IndexJob::Kind &kind) {
+  uint64_t v;
+  if (!reader.readVarint(v)) {
+    return false;
+  }
+  switch (IndexJob::Kind(v)) {
+  case IndexJob::Kind::SemanticAnalysis:
+  case IndexJob::Kind::EmitIndex:
+    kind = IndexJob::Kind(v);
+    return true;
+  }
+  return false;
+}
+
+void encodeBinary(BinaryWriter &writer, const ShardStorage &storage) {
+  writer.writeVarint(uint64_t(storage));
+}
+bool decodeBinary(BinaryReader &reader, ShardStorage &storage) {
+  uint64_t v;
+  if (!reader.readVarint(v) || v > UINT8_MAX) {
+    return false;
+  }
+  switch (ShardStorage(v)) {
+  case ShardStorage::File:
+  case ShardStorage::SharedMemory:
+  case ShardStorage::WorkerLog:
+    storage = ShardStorage(v);
+    return true;
+  }
+  return false;
+}
+
+void encodeBinary(BinaryWriter &writer, const WorkerPhase &phase) {
+  writer.writeVarint(uint64_t(phase));
+}
+bool decodeBinary(BinaryReader &reader, WorkerPhase &phase) {
+  uint64_t v;
+  if (!reader.readVarint(v) || v > UINT8_MAX) {
+    return false;
+  }
+  switch (WorkerPhase(v)) {
+  case WorkerPhase::Parsing:
+  case WorkerPhase::Traversal:
+  case WorkerPhase::Serialization:
+    phase = WorkerPhase(v);
+    return true;
+  }
+  return false;
+}
+
+template <typename IJ>
+void encodeBinaryIndexJob(BinaryWriter &writer, const IJ &job) {
+  encodeBinary(writer, job.kind);
+  switch (job.kind) {
+  case IndexJob::Kind::SemanticAnalysis:
+    encodeBinary(writer, job.semanticAnalysis);
+    break;
+  case IndexJob::Kind::EmitIndex:
+    encodeBinary(writer, job.emitIndex);
+    break;
+  }
+}
+template <typename IJ>
+bool decodeBinaryIndexJob(BinaryReader &reader, IJ &job) {
+  if (!decodeBinary(reader, job.kind)) {
+    return false;
+  }
+  switch (job.kind) {
+  case IndexJob::Kind::SemanticAnalysis:
+    return decodeBinary(reader, job.semanticAnalysis);
+  case IndexJob::Kind::EmitIndex:
+    return decodeBinary(reader, job.emitIndex);
+  }
+  return false;
+}
+
+void encodeBinary(BinaryWriter &writer, const IndexJob &job) {
+  encodeBinaryIndexJob(writer, job);
+}
+bool decodeBinary(BinaryReader &reader, IndexJob &job) {
+  return decodeBinaryIndexJob(reader, job);
+}
+void encodeBinary(BinaryWriter &writer, const IndexJobResult &job) {
+  encodeBinaryIndexJob(writer, job);
+}
+bool decodeBinary(BinaryReader &reader, IndexJobResult &job) {
+  return decodeBinaryIndexJob(reader, job);
+}
+
+DERIVE_BINARY_SERIALIZE_5(scip_clang::IndexingStatistics, totalTimeMicros,
+                          planWaitTimeMicros, peakRssBytes, rssAfterBytes,
+                          trimmedBytes)
+DERIVE_BINARY_SERIALIZE_1_NEWTYPE(scip_clang::EmitIndexJobDetails,
+                                  filesToBeIndexed)
+DERIVE_BINARY_SERIALIZE_1_NEWTYPE(scip_clang::IpcTestMessage, content)
+DERIVE_BINARY_SERIALIZE_1_NEWTYPE(scip_clang::SemanticAnalysisJobDetails,
+                                  command)
+
+DERIVE_BINARY_SERIALIZE_3(scip_clang::ShardPaths, docsAndExternals,
+                          forwardDecls, storage)
+DERIVE_BINARY_SERIALIZE_2(scip_clang::ShardLogRecord, offset, length)
+DERIVE_BINARY_SERIALIZE_2(scip_clang::ShardLogRecords, docsAndExternals,
+                          forwardDecls)
+DERIVE_BINARY_SERIALIZE_3(scip_clang::EmitIndexJobResult, statistics,
+                          shardPaths, shardLogRecords)
+DERIVE_BINARY_SERIALIZE_2(scip_clang::PreprocessedFileInfo, pathId,
+                          hashValue)
+DERIVE_BINARY_SERIALIZE_2(scip_clang::PreprocessedFileInfoMulti, pathId,
+                          hashValues)
+DERIVE_BINARY_SERIALIZE_2(scip_clang::BatchedSemanticAnalysisJob, id,
+                          details)
+DERIVE_BINARY_SERIALIZE_4(scip_clang::IndexJobRequest, id, job, batch,
+                          newHeaderClaims)
+DERIVE_BINARY_SERIALIZE_1_NEWTYPE(scip_clang::PathId, value)
+
+void encodeBinary(BinaryWriter &writer, const SemanticAnalysisJobResult &r) {
+  encodeBinary(writer, r.firstNewPathId);
+  encodeBinary(writer, r.newPaths);
+  encodeBinary(writer, r.wellBehavedFiles);
+  encodeBinary(writer, r.illBehavedFiles);
+  encodeBinary(writer, r.hasProvisionalPlan);
+  encodeBinary(writer, r.provisionalPlan);
+  encodeBinary(writer, r.claimedInSharedTable);
+}
+bool decodeBinary(BinaryReader &reader, SemanticAnalysisJobResult &r) {
+  return decodeBinary(reader, r.firstNewPathId)
+         && decodeBinary(reader, r.newPaths)
+         && decodeBinary(reader, r.wellBehavedFiles)
+         && decodeBinary(reader, r.illBehavedFiles)
+         && decodeBinary(reader, r.hasProvisionalPlan)
+         && decodeBinary(reader, r.provisionalPlan)
+         && decodeBinary(reader, r.claimedInSharedTable);
+}
 
 std::strong_ordering operator<=>(const PreprocessedFileInfo &lhs,
                                  const PreprocessedFileInfo &rhs) {
   CMP_EXPR(lhs.hashValue, rhs.hashValue);
-  CMP_EXPR(lhs.path, rhs.path);
+  CMP_EXPR(lhs.pathId, rhs.pathId);
   return std::strong_ordering::equal;
 }
 
+HashValue headerClaimKey(AbsolutePathRef path, HashValue hashValue) {
+  auto pathText = path.asStringView();
+  HashValue key{hashValue.rawValue};
+  key.mix(reinterpret_cast<const uint8_t *>(pathText.data()), pathText.size());
+  return key;
+}
+
 std::strong_ordering operator<=>(const PreprocessedFileInfoMulti &lhs,
                                  const PreprocessedFileInfoMulti &rhs) {
-  CMP_EXPR(lhs.path, rhs.path);
+  CMP_EXPR(lhs.pathId, rhs.pathId);
   CMP_RANGE(lhs.hashValues, rhs.hashValues);
   return std::strong_ordering::equal;
 }
 
+// Heartbeats and cancelled jobs don't have a meaningful result,
+// so it is omitted.
+
 llvm::json::Value toJSON(const IndexJobResponse &r) {
+  if (r.heartbeat.has_value()) {
+    return llvm::json::Object{{"workerId", r.workerId},
+                              {"jobId", r.jobId},
+                              {"heartbeat", *r.heartbeat}};
+  }
+  if (r.cancelled) {
+    return llvm::json::Object{
+        {"workerId", r.workerId}, {"jobId", r.jobId}, {"cancelled", true}};
+  }
   return llvm::json::Object{
       {"workerId", r.workerId}, {"jobId", r.jobId}, {"result", r.result}};
 }
@@ -182,8 +517,62 @@ llvm::json::Value toJSON(const IndexJobResponse &r) {
 bool fromJSON(const llvm::json::Value &value, IndexJobResponse &r,
               llvm::json::Path path) {
   llvm::json::ObjectMapper mapper(value, path);
-  return mapper && mapper.map("workerId", r.workerId)
-         && mapper.map("jobId", r.jobId) && mapper.map("result", r.result);
+  if (!mapper || !mapper.map("workerId", r.workerId)
+      || !mapper.map("jobId", r.jobId)) {
+    return false;
+  }
+  r.heartbeat = {};
+  r.cancelled = false;
+  auto *object = value.getAsObject();
+  if (object && object->get("heartbeat")) {
+    WorkerPhase phase;
+    if (!mapper.map("heartbeat", phase)) {
+      return false;
+    }
+    r.heartbeat = phase;
+    return true;
+  }
+  if (object && object->get("cancelled")) {
+    return mapper.map("cancelled", r.cancelled);
+  }
+  return mapper.map("result", r.result);
+}
+
+void encodeBinary(BinaryWriter &writer, const IndexJobResponse &r) {
+  encodeBinary(writer, r.workerId);
+  encodeBinary(writer, r.jobId);
+  encodeBinary(writer, r.heartbeat.has_value());
+  if (r.heartbeat.has_value()) {
+    encodeBinary(writer, *r.heartbeat);
+    return;
+  }
+  encodeBinary(writer, r.cancelled);
+  if (r.cancelled) {
+    return;
+  }
+  encodeBinary(writer, r.result);
+}
+
+bool decodeBinary(BinaryReader &reader, IndexJobResponse &r) {
+  bool isHeartbeat;
+  if (!decodeBinary(reader, r.workerId) || !decodeBinary(reader, r.jobId)
+      || !decodeBinary(reader, isHeartbeat)) {
+    return false;
+  }
+  r.heartbeat = {};
+  r.cancelled = false;
+  if (isHeartbeat) {
+    WorkerPhase phase;
+    if (!decodeBinary(reader, phase)) {
+      return false;
+    }
+    r.heartbeat = phase;
+    return true;
+  }
+  if (!decodeBinary(reader, r.cancelled)) {
+    return false;
+  }
+  return r.cancelled || decodeBinary(reader, r.result);
 }
 
 } // namespace scip_clang
@@ -4,15 +4,19 @@
 #include <chrono>
 #include <compare>
 #include <cstdint>
+#include <optional>
 #include <string>
 #include <string_view>
 
 #include "clang/Tooling/CompilationDatabase.h"
 #include "llvm/Support/JSON.h"
 
+#include "indexer/BinaryCodec.h"
+#include "indexer/CliOptions.h"
 #include "indexer/Derive.h"
 #include "indexer/Hash.h"
 #include "indexer/Path.h"
+#include "indexer/PathInterner.h"
 
 namespace scip_clang {
 
@@ -21,6 +25,15 @@ using WorkerId = uint64_t;
 std::string driverToWorkerQueueName(std::string_view driverId,
                                     WorkerId workerId);
 std::string workerToDriverQueueName(std::string_view driverId);
+/// Name of the shared memory segment for NOTE(ref: shm-ring-transport).
+std::string shmRingName(std::string_view driverId, WorkerId workerId);
+/// Name of the shared memory object for NOTE(ref: shm-claim-table).
+std::string claimTableShmName(std::string_view driverId);
+/// Common prefix (without the leading slash) for all shards stored
+/// in shared memory; see NOTE(ref: shared-memory-shards).
+std::string shardShmNamePrefix(std::string_view driverId);
+std::string shardShmName(std::string_view driverId, uint32_t taskId,
+                         WorkerId workerId, std::string_view kind);
 
 class JobId {
   // Corresponds 1-1 with an entry in a compilation database.
@@ -66,15 +79,19 @@ public:
 
   static llvm::json::Value toJSON(const JobId &);
   static bool fromJSON(const llvm::json::Value &, JobId &, llvm::json::Path);
+  static void encodeBinary(BinaryWriter &, const JobId &);
+  static bool decodeBinary(BinaryReader &, JobId &);
 
   std::string debugString() const;
 };
 SERIALIZABLE(JobId)
+BINARY_SERIALIZABLE(JobId)
 
 struct SemanticAnalysisJobDetails {
   clang::tooling::CompileCommand command;
 };
 SERIALIZABLE(SemanticAnalysisJobDetails)
+BINARY_SERIALIZABLE(SemanticAnalysisJobDetails)
 
 } // namespace scip_clang
 
@@ -84,28 +101,43 @@ SERIALIZABLE(clang::tooling::CompileCommand) // Not implemented upstream 😕
 
 namespace scip_clang {
 
+BINARY_SERIALIZABLE(clang::tooling::CompileCommand)
+BINARY_SERIALIZABLE(AbsolutePath)
+SERIALIZABLE(PathId)
+BINARY_SERIALIZABLE(PathId)
+
+// NOTE: PathId values in messages are worker-local;
+// see NOTE(ref: path-interning).
+
 struct PreprocessedFileInfo {
-  AbsolutePath path;
+  PathId pathId;
   HashValue hashValue;
 
   friend std::strong_ordering operator<=>(const PreprocessedFileInfo &lhs,
                                           const PreprocessedFileInfo &rhs);
 };
 SERIALIZABLE(PreprocessedFileInfo)
+BINARY_SERIALIZABLE(PreprocessedFileInfo)
+
+/// Key identifying a (path, hash) pair which has been claimed for
+/// indexing by some TU; see NOTE(ref: provisional-plans).
+HashValue headerClaimKey(AbsolutePathRef path, HashValue hashValue);
 
 struct PreprocessedFileInfoMulti {
-  AbsolutePath path;
+  PathId pathId;
   std::vector<HashValue> hashValues;
 
   friend std::strong_ordering operator<=>(const PreprocessedFileInfoMulti &lhs,
                                           const PreprocessedFileInfoMulti &rhs);
 };
 SERIALIZABLE(PreprocessedFileInfoMulti)
+BINARY_SERIALIZABLE(PreprocessedFileInfoMulti)
 
 struct EmitIndexJobDetails {
   std::vector<PreprocessedFileInfo> filesToBeIndexed;
 };
 SERIALIZABLE(EmitIndexJobDetails)
+BINARY_SERIALIZABLE(EmitIndexJobDetails)
 
 // NOTE(def: avoiding-unions):
 // I'm avoiding using tagged unions because writing constructors
@@ -124,19 +156,51 @@ struct IndexJob {
   // See also NOTE(ref: avoiding-unions)
 };
 SERIALIZABLE(IndexJob::Kind)
+BINARY_SERIALIZABLE(IndexJob::Kind)
 SERIALIZABLE(IndexJob)
+BINARY_SERIALIZABLE(IndexJob)
+
+/// See NOTE(ref: tu-batching).
+struct BatchedSemanticAnalysisJob {
+  JobId id;
+  SemanticAnalysisJobDetails details;
+};
+SERIALIZABLE(BatchedSemanticAnalysisJob)
+BINARY_SERIALIZABLE(BatchedSemanticAnalysisJob)
 
 struct IndexJobRequest {
   JobId id;
   IndexJob job;
+  /// Only non-empty if job.kind == SemanticAnalysis. The worker should
+  /// process these in order after \c job, responding for each one as if
+  /// it had been sent in a separate request.
+  std::vector<BatchedSemanticAnalysisJob> batch;
+  /// Keys for (path, hash) pairs claimed since the last request sent
+  /// to this worker. Only used with NOTE(ref: provisional-plans).
+  std::vector<HashValue> newHeaderClaims;
 };
 SERIALIZABLE(IndexJobRequest)
+BINARY_SERIALIZABLE(IndexJobRequest)
 
 SERIALIZABLE(HashValue)
+BINARY_SERIALIZABLE(HashValue)
 
 struct SemanticAnalysisJobResult {
+  /// The ID assigned to newPaths[0] by the worker.
+  PathId firstNewPathId;
+  /// Paths which have not been sent to the driver previously,
+  /// in increasing order of their IDs.
+  std::vector<AbsolutePath> newPaths;
   std::vector<PreprocessedFileInfo> wellBehavedFiles;
   std::vector<PreprocessedFileInfoMulti> illBehavedFiles;
+  /// If set, the worker did not wait for an EmitIndex job, and is
+  /// indexing \c provisionalPlan instead of waiting for the driver's
+  /// plan. See NOTE(ref: provisional-plans).
+  bool hasProvisionalPlan = false;
+  std::vector<PreprocessedFileInfo> provisionalPlan;
+  /// If set, the worker claimed files to index in the shared claim table,
+  /// and all other fields are empty. See NOTE(ref: shm-claim-table).
+  bool claimedInSharedTable = false;
 
   // clang-format off
   SemanticAnalysisJobResult() = default;
@@ -147,23 +211,64 @@ struct SemanticAnalysisJobResult {
   // clang-format on
 };
 SERIALIZABLE(SemanticAnalysisJobResult)
+BINARY_SERIALIZABLE(SemanticAnalysisJobResult)
 
 struct IndexingStatistics {
   uint64_t totalTimeMicros;
+  /// Time spent blocked after semantic analysis, waiting for the driver
+  /// to decide which files to index. Included in totalTimeMicros.
+  uint64_t planWaitTimeMicros;
+  /// Peak RSS of the worker while processing the TU, or 0 if unknown.
+  /// See NOTE(ref: memory-budget).
+  uint64_t peakRssBytes;
+  /// RSS of the worker once it is done with the TU (after trimming, if
+  /// any), or 0 if unknown. See NOTE(ref: worker-recycling).
+  uint64_t rssAfterBytes;
+  /// Decrease in RSS due to trimming free memory after the TU.
+  uint64_t trimmedBytes;
 };
 SERIALIZABLE(IndexingStatistics)
+BINARY_SERIALIZABLE(IndexingStatistics)
+
+SERIALIZABLE(ShardStorage)
+BINARY_SERIALIZABLE(ShardStorage)
 
 struct ShardPaths {
+  /// For ShardStorage::SharedMemory, these are the names of the
+  /// shared memory objects (which also start with a '/').
+  /// For ShardStorage::WorkerLog, these are empty.
   AbsolutePath docsAndExternals;
   AbsolutePath forwardDecls;
+  ShardStorage storage;
 };
 SERIALIZABLE(ShardPaths)
+BINARY_SERIALIZABLE(ShardPaths)
+
+/// See NOTE(ref: worker-shard-log).
+struct ShardLogRecord {
+  /// Offset of the record's length prefix in the log.
+  uint64_t offset;
+  /// Length of the serialized shard, excluding the prefix.
+  uint64_t length;
+};
+SERIALIZABLE(ShardLogRecord)
+BINARY_SERIALIZABLE(ShardLogRecord)
+
+struct ShardLogRecords {
+  ShardLogRecord docsAndExternals;
+  ShardLogRecord forwardDecls;
+};
+SERIALIZABLE(ShardLogRecords)
+BINARY_SERIALIZABLE(ShardLogRecords)
 
 struct EmitIndexJobResult {
   IndexingStatistics statistics;
   ShardPaths shardPaths;
+  /// Only valid if shardPaths.storage == ShardStorage::WorkerLog.
+  ShardLogRecords shardLogRecords;
 };
 SERIALIZABLE(EmitIndexJobResult)
+BINARY_SERIALIZABLE(EmitIndexJobResult)
 
 struct IndexJobResult {
   IndexJob::Kind kind;
@@ -172,18 +277,52 @@ struct IndexJobResult {
   // See also: NOTE(ref: avoiding-unions)
 };
 SERIALIZABLE(IndexJobResult)
+BINARY_SERIALIZABLE(IndexJobResult)
+
+/// NOTE(def: worker-heartbeats): With --heartbeat-interval-seconds, workers
+/// send a heartbeat whenever they start a new phase of a job, and while
+/// making progress within a phase (e.g. entering a header or visiting a
+/// declaration), at most once per interval. There is no separate thread
+/// for sending heartbeats, so a worker which is stuck (e.g. in an infinite
+/// loop inside Clang) goes silent.
+///
+/// The driver kills a worker once it has been silent for longer than
+/// a limit based on the phase and the time taken by the TU in the
+/// --job-cost-history, but never longer than the receive timeout.
+/// TUs without history get the full receive timeout between heartbeats.
+/// Workers which keep making progress are not killed.
+enum class WorkerPhase : uint8_t {
+  /// Running the preprocessor and semantic analysis, which are interleaved
+  /// by Clang.
+  Parsing,
+  /// Traversing the AST and building the index for the TU.
+  Traversal,
+  /// Writing out the shards for the TU.
+  Serialization,
+};
+SERIALIZABLE(WorkerPhase)
+BINARY_SERIALIZABLE(WorkerPhase)
 
 struct IndexJobResponse {
   WorkerId workerId;
   JobId jobId;
   IndexJobResult result;
+  /// If set, this is a progress update for an in-progress job, and
+  /// \c result should be ignored. See NOTE(ref: worker-heartbeats).
+  std::optional<WorkerPhase> heartbeat;
+  /// If true, the worker stopped working on the job at the driver's
+  /// request, and \c result should be ignored.
+  /// See NOTE(ref: soft-cancellation).
+  bool cancelled;
 };
 SERIALIZABLE(IndexJobResponse)
+BINARY_SERIALIZABLE(IndexJobResponse)
 
 struct IpcTestMessage {
   std::string content;
 };
 SERIALIZABLE(IpcTestMessage)
+BINARY_SERIALIZABLE(IpcTestMessage)
 
 } // namespace scip_clang
 
@@ -0,0 +1,122 @@
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+#include "spdlog/spdlog.h"
+
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include "indexer/JobCost.h"
+#include "indexer/Statistics.h"
+
+namespace scip_clang {
+
+// Arguments are mostly include paths and macro definitions, which tend
+// to correlate with how much code is pulled in through headers.
+constexpr static double BYTES_PER_ARGUMENT = 4096.0;
+
+// Used if no TUs have history; only the relative order matters then.
+constexpr static double DEFAULT_SECONDS_PER_UNIT = 1.0 / (1024.0 * 1024.0);
+
+void JobCostModel::loadHistory(std::string_view statsFilePath) {
+  std::vector<StatsEntry> entries;
+  std::string error;
+  if (!StatsEntry::readAll(statsFilePath, entries, error)) {
+    spdlog::warn("failed to read job cost history from '{}' ({}); falling "
+                 "back to estimates for all TUs",
+                 statsFilePath, error);
+    return;
+  }
+  for (auto &entry : entries) {
+    this->historicalSeconds[entry.path] =
+        double(entry.stats.totalTimeMicros) / 1'000'000.0;
+    if (entry.stats.peakRssBytes > 0) {
+      this->historicalPeakRssBytes[entry.path] = entry.stats.peakRssBytes;
+    }
+  }
+  spdlog::debug("loaded job cost history for {} TUs",
+                this->historicalSeconds.size());
+}
+
+std::optional<double>
+JobCostModel::historicalSecondsFor(std::string_view mainFile) const {
+  auto it = this->historicalSeconds.find(mainFile);
+  if (it == this->historicalSeconds.end()) {
+    return {};
+  }
+  return it->second;
+}
+
+std::optional<uint64_t>
+JobCostModel::historicalPeakRssBytesFor(std::string_view mainFile) const {
+  auto it = this->historicalPeakRssBytes.find(mainFile);
+  if (it == this->historicalPeakRssBytes.end()) {
+    return {};
+  }
+  return it->second;
+}
+
+// static
+double
+JobCostModel::heuristicCost(const clang::tooling::CompileCommand &command) {
+  std::filesystem::path mainFilePath(command.Filename);
+  if (mainFilePath.is_relative()) {
+    mainFilePath = std::filesystem::path(command.Directory) / mainFilePath;
+  }
+  std::error_code error;
+  auto fileSize = std::filesystem::file_size(mainFilePath, error);
+  if (error) {
+    fileSize = 0;
+  }
+  return double(fileSize) + BYTES_PER_ARGUMENT * command.CommandLine.size();
+}
+
+std::vector<double> JobCostModel::estimateSeconds(
+    const std::vector<const clang::tooling::CompileCommand *> &commands)
+    const {
+  std::vector<double> costs(commands.size(), -1.0);
+  std::vector<double> heuristicCosts(commands.size(), 0.0);
+  double totalHistorySeconds = 0.0, totalHistoryHeuristic = 0.0;
+  size_t numWithHistory = 0;
+  for (size_t i = 0; i < commands.size(); ++i) {
+    heuristicCosts[i] = JobCostModel::heuristicCost(*commands[i]);
+    auto it = this->historicalSeconds.find(commands[i]->Filename);
+    if (it != this->historicalSeconds.end()) {
+      costs[i] = it->second;
+      totalHistorySeconds += it->second;
+      totalHistoryHeuristic += heuristicCosts[i];
+      numWithHistory++;
+    }
+  }
+  auto secondsPerUnit = (totalHistorySeconds > 0 && totalHistoryHeuristic > 0)
+                            ? totalHistorySeconds / totalHistoryHeuristic
+                            : DEFAULT_SECONDS_PER_UNIT;
+  for (size_t i = 0; i < commands.size(); ++i) {
+    if (costs[i] < 0) {
+      costs[i] = heuristicCosts[i] * secondsPerUnit;
+    }
+  }
+  spdlog::debug("estimated costs for {} TUs ({} with history)",
+                commands.size(), numWithHistory);
+  return costs;
+}
+
+std::vector<size_t> JobCostModel::longestFirstOrder(
+    const std::vector<const clang::tooling::CompileCommand *> &commands)
+    const {
+  auto costs = this->estimateSeconds(commands);
+  std::vector<size_t> order(commands.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  absl::c_stable_sort(
+      order, [&](size_t i, size_t j) -> bool { return costs[i] > costs[j]; });
+  return order;
+}
+
+} // namespace scip_clang
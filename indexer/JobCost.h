@@ -0,0 +1,77 @@
+#ifndef SCIP_CLANG_JOB_COST_H
+#define SCIP_CLANG_JOB_COST_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+
+#include "clang/Tooling/CompilationDatabase.h"
+
+namespace scip_clang {
+
+// NOTE(def: job-ordering): By default, the driver hands out TUs in the
+// same order as the compilation database, parsing it incrementally.
+// If a few large TUs happen to be near the end, most workers sit idle
+// while those finish.
+//
+// With --job-order=longest-first, the driver instead reads the whole
+// compilation database upfront, and hands out the TUs which are expected
+// to take the longest first, so that the TUs finishing last are short.
+//
+// Costs are taken from the statistics file of an earlier run, passed
+// via --job-cost-history. For TUs which are not present there, the cost
+// is estimated from the size of the main file and the number of
+// arguments, scaled so that estimates are comparable to the timings
+// for TUs which do have history.
+//
+// To measure the effect, the driver logs the "tail idle time", i.e.
+// the total time workers spent idle after running out of work, at the
+// end of indexing.
+
+class JobCostModel final {
+  /// Keyed by the TU's main file, as recorded in the statistics file.
+  absl::flat_hash_map<std::string, double> historicalSeconds;
+  /// Same keys as historicalSeconds, but only for TUs with a known
+  /// peak RSS. See NOTE(ref: memory-budget).
+  absl::flat_hash_map<std::string, uint64_t> historicalPeakRssBytes;
+
+public:
+  JobCostModel() : historicalSeconds(), historicalPeakRssBytes() {}
+
+  /// Reads a file written by --print-statistics-path. On failure,
+  /// logs a warning and falls back to estimates for all TUs.
+  void loadHistory(std::string_view statsFilePath);
+
+  /// Returns the time taken by the TU for \p mainFile in the earlier run,
+  /// if present.
+  std::optional<double> historicalSecondsFor(std::string_view mainFile) const;
+
+  /// Returns the peak RSS of the worker while processing the TU for
+  /// \p mainFile in the earlier run, if present.
+  std::optional<uint64_t>
+  historicalPeakRssBytesFor(std::string_view mainFile) const;
+
+  /// Returns the expected cost (in seconds) for each of \p commands,
+  /// in the same order.
+  std::vector<double> estimateSeconds(
+      const std::vector<const clang::tooling::CompileCommand *> &commands)
+      const;
+
+  /// Returns indexes into \p commands in decreasing order of expected
+  /// cost, keeping the original order for TUs with equal cost.
+  std::vector<size_t> longestFirstOrder(
+      const std::vector<const clang::tooling::CompileCommand *> &commands)
+      const;
+
+  /// Unscaled estimate based on the main file size and argument count,
+  /// for TUs without any history.
+  static double heuristicCost(const clang::tooling::CompileCommand &);
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_JOB_COST_H
@@ -1,7 +1,10 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
-#include "boost/date_time/posix_time/posix_time.hpp"
 #include "spdlog/spdlog.h"
 
 #include "llvm/Support/Error.h"
@@ -11,56 +14,94 @@
 #include "indexer/CliOptions.h"
 #include "indexer/JsonIpcQueue.h"
 #include "indexer/LlvmAdapter.h"
+#include "indexer/ShmIpc.h"
 
 namespace scip_clang {
 
 char TimeoutError::ID = 0;
 
-void JsonIpcQueue::sendValue(const llvm::json::Value &jsonValue) {
-  auto buffer = llvm_ext::format(jsonValue);
-  this->queue->send(buffer.c_str(), buffer.size(), 1);
-  if (buffer.size() > IPC_BUFFER_MAX_SIZE) {
-    spdlog::warn("previous message exceeded IPC_BUFFER_MAX_SIZE: {}...{}",
-                 buffer.substr(0, 25), buffer.substr(buffer.size() - 25, 25));
+llvm::Error ipc::makeBinaryDecodeError(std::string_view buffer) {
+  if (buffer.size() > sizeof(BINARY_IPC_MAGIC)
+      && uint8_t(buffer[sizeof(BINARY_IPC_MAGIC)]) != BINARY_IPC_VERSION) {
+    return llvm::createStringError(
+        std::errc::protocol_not_supported,
+        "unsupported binary IPC version %u (expected %u)",
+        unsigned(uint8_t(buffer[sizeof(BINARY_IPC_MAGIC)])),
+        unsigned(BINARY_IPC_VERSION));
   }
+  return llvm::createStringError(std::errc::bad_message,
+                                 "malformed binary IPC message (%zu bytes)",
+                                 buffer.size());
 }
 
-static boost::posix_time::ptime fromNow(uint64_t durationMillis) {
-  // Boost internally uses a spin-sleep loop which compares the passed end
-  // instant against the current instant in UTC.
-  // https://sourcegraph.com/github.com/boostorg/interprocess@4403b201bef142f07cdc43f67bf6477da5e07fe3/-/blob/include/boost/interprocess/sync/spin/condition.hpp?L171
-  // So use universal_time here instead of local_time.
-  auto now = boost::posix_time::microsec_clock::universal_time();
-  auto after = now + boost::posix_time::milliseconds(durationMillis);
-  // Hint: Use boost::posix_time::to_simple_string to debug if needed.
-  return after;
+bool JsonIpcQueue::sendBuffer(std::string_view buffer) {
+  auto maxFrameSize = this->channel->maxMessageSize();
+  if (buffer.size() > maxFrameSize) {
+    spdlog::debug("splitting message of {} bytes into chunks", buffer.size());
+  }
+  // Once a frame fails, skip the rest of the chunks; the receiver drops
+  // partial messages anyways.
+  bool sent = true;
+  scip_clang::forEachIpcFrame(buffer, maxFrameSize, this->senderId,
+                              this->nextMessageId,
+                              [&](std::string_view frame) {
+                                sent = sent && this->channel->send(frame);
+                              });
+  this->nextMessageId++;
+  return sent;
 }
 
-llvm::Expected<llvm::json::Value>
+llvm::Expected<std::string_view>
 JsonIpcQueue::timedReceive(uint64_t waitMillis) {
-  std::vector<char> readBuffer;
-  readBuffer.resize(IPC_BUFFER_MAX_SIZE);
-  size_t recvCount;
-  unsigned recvPriority;
-  spdlog::debug("will wait for atmost {}ms", waitMillis);
-  if (this->queue->timed_receive(readBuffer.data(), readBuffer.size(),
-                                 recvCount, recvPriority,
-                                 fromNow(waitMillis))) {
-    return llvm::json::parse(std::string_view(readBuffer.data(), recvCount));
+  using namespace std::chrono;
+  auto deadline = steady_clock::now() + milliseconds(waitMillis);
+  while (true) {
+    auto remaining = std::max(
+        int64_t(0),
+        int64_t(duration_cast<milliseconds>(deadline - steady_clock::now())
+                    .count()));
+    if (!this->channel->timedReceive(this->receiveBuffer, remaining)) {
+      return llvm::make_error<TimeoutError>();
+    }
+    std::string_view message;
+    switch (this->assembler.add(this->receiveBuffer, message)) {
+    case IpcChunkAssembler::Status::Complete:
+      return message;
+    case IpcChunkAssembler::Status::Incomplete:
+      continue;
+    case IpcChunkAssembler::Status::Malformed:
+      return llvm::createStringError(std::errc::bad_message,
+                                     "malformed IPC chunk (%zu bytes)",
+                                     this->receiveBuffer.size());
+    }
   }
-  return llvm::make_error<TimeoutError>();
 }
 
 MessageQueuePair MessageQueuePair::forWorker(const IpcOptions &ipcOptions) {
+#ifdef __linux__
+  if (ipcOptions.transport == IpcTransport::ShmRing) {
+    auto [d2w, w2d] = scip_clang::openShmRingChannelsForWorker(ipcOptions);
+    MessageQueuePair mqp;
+    mqp.driverToWorker = JsonIpcQueue(std::move(d2w), ipcOptions.codec);
+    mqp.workerToDriver =
+        JsonIpcQueue(std::move(w2d), ipcOptions.codec, ipcOptions.workerId);
+    return mqp;
+  }
+#endif
   auto d2w = scip_clang::driverToWorkerQueueName(ipcOptions.driverId,
                                                  ipcOptions.workerId);
   auto w2d = scip_clang::workerToDriverQueueName(ipcOptions.driverId);
   namespace boost_ip = boost::interprocess;
   MessageQueuePair mqp;
-  mqp.driverToWorker = JsonIpcQueue(std::make_unique<boost_ip::message_queue>(
-      boost_ip::open_only, d2w.c_str()));
-  mqp.workerToDriver = JsonIpcQueue(std::make_unique<boost_ip::message_queue>(
-      boost_ip::open_only, w2d.c_str()));
+  mqp.driverToWorker = JsonIpcQueue(
+      std::make_unique<boost_ip::message_queue>(boost_ip::open_only,
+                                                d2w.c_str()),
+      ipcOptions.codec);
+  // The worker->driver queue is shared, so tag chunks with the worker ID.
+  mqp.workerToDriver = JsonIpcQueue(
+      std::make_unique<boost_ip::message_queue>(boost_ip::open_only,
+                                                w2d.c_str()),
+      ipcOptions.codec, ipcOptions.workerId);
   return mqp;
 }
 
@@ -2,19 +2,21 @@
 #define SCIP_CLANG_JSON_IPC_QUEUE_H
 
 #include <chrono>
+#include <string>
+#include <string_view>
 #include <system_error>
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcovered-switch-default"
-#include "boost/interprocess/ipc/message_queue.hpp"
-#pragma clang diagnostic pop
-
 #include "llvm/ADT/Optional.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/JSON.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "indexer/BinaryCodec.h"
+#include "indexer/CliOptions.h"
+#include "indexer/IpcChannel.h"
+#include "indexer/IpcChunking.h"
 #include "indexer/IpcMessages.h"
+#include "indexer/LlvmAdapter.h"
 
 namespace scip_clang {
 
@@ -28,25 +30,89 @@ struct TimeoutError : public llvm::ErrorInfo<TimeoutError> {
   }
 };
 
-// I think 1MB should be enough to hold any CLI invocations.
-constexpr static size_t IPC_BUFFER_MAX_SIZE = 1 * 1024 * 1024;
+// Sized for typical messages rather than the worst case, since larger
+// messages are split into chunks; see NOTE(ref: ipc-chunking).
+// Boost reserves numSlots * IPC_QUEUE_SLOT_SIZE bytes of shared memory
+// upfront for each queue.
+constexpr static size_t IPC_QUEUE_SLOT_SIZE = 64 * 1024;
+
+namespace ipc {
+
+/// Serialize \p t into a self-describing buffer using \p codec.
+template <typename T> std::string encodeMessage(IpcCodec codec, const T &t) {
+  switch (codec) {
+  case IpcCodec::Json:
+    return llvm_ext::format(llvm::json::Value(t));
+  case IpcCodec::Binary: {
+    std::string buffer;
+    writeBinaryHeader(buffer);
+    BinaryWriter writer(buffer);
+    encodeBinary(writer, t);
+    return buffer;
+  }
+  }
+}
+
+llvm::Error makeBinaryDecodeError(std::string_view buffer);
+
+/// Deserialize a buffer created by \c encodeMessage with either codec.
+template <typename T> llvm::Error decodeMessage(std::string_view buffer, T &t) {
+  if (hasBinaryHeader(buffer)) {
+    BinaryReader reader(buffer.substr(sizeof(BINARY_IPC_MAGIC) + 1));
+    if (uint8_t(buffer[sizeof(BINARY_IPC_MAGIC)]) == BINARY_IPC_VERSION
+        && decodeBinary(reader, t) && reader.atEnd()) {
+      return llvm::Error::success();
+    }
+    return ipc::makeBinaryDecodeError(buffer);
+  }
+  auto valueOrErr = llvm::json::parse(buffer);
+  if (auto err = valueOrErr.takeError()) {
+    return err;
+  }
+  llvm::json::Path::Root root("ipc-message");
+  if (scip_clang::fromJSON(*valueOrErr, t, root)) {
+    return llvm::Error::success();
+  }
+  return root.getError();
+}
+
+} // namespace ipc
 
 class JsonIpcQueue final {
-  std::unique_ptr<boost::interprocess::message_queue> queue;
+  std::unique_ptr<IpcChannel> channel;
+  IpcCodec codec;
 
-  void sendValue(const llvm::json::Value &t);
+  /// Identifies the sending side of chunked messages; only needs
+  /// to be unique when multiple processes send to the same queue.
+  uint64_t senderId;
+  uint64_t nextMessageId;
 
-  // Tries to wait for waitMillis; if that succeeds, then attempts to parse the
-  // result.
-  llvm::Expected<llvm::json::Value> timedReceive(uint64_t waitMillis);
+  /// Reused across receives to avoid reallocating.
+  std::string receiveBuffer;
+  IpcChunkAssembler assembler;
 
-public:
-  JsonIpcQueue() : queue() {}
-  JsonIpcQueue(std::unique_ptr<boost::interprocess::message_queue> queue)
-      : queue(std::move(queue)) {}
+  bool sendBuffer(std::string_view buffer);
+
+  // Tries to wait for waitMillis, returning the raw message on success.
+  // The returned view is valid until the next receive.
+  llvm::Expected<std::string_view> timedReceive(uint64_t waitMillis);
 
-  template <typename T> void send(const T &t) {
-    this->sendValue(llvm::json::Value(t));
+public:
+  JsonIpcQueue()
+      : channel(), codec(IpcCodec::Json), senderId(0), nextMessageId(0) {}
+  JsonIpcQueue(std::unique_ptr<IpcChannel> channel, IpcCodec codec,
+               uint64_t senderId = 0)
+      : channel(std::move(channel)), codec(codec), senderId(senderId),
+        nextMessageId(0) {}
+  JsonIpcQueue(std::unique_ptr<boost::interprocess::message_queue> queue,
+               IpcCodec codec = IpcCodec::Json, uint64_t senderId = 0)
+      : channel(std::make_unique<MessageQueueChannel>(std::move(queue))),
+        codec(codec), senderId(senderId), nextMessageId(0) {}
+
+  /// Returns false if the message could not be sent in time;
+  /// see \c IpcChannel::send.
+  template <typename T> bool send(const T &t) {
+    return this->sendBuffer(ipc::encodeMessage(this->codec, t));
   }
 
   enum class ReceiveStatus {
@@ -60,20 +126,14 @@ public:
     auto durationMillis =
         std::chrono::duration_cast<std::chrono::milliseconds>(waitDuration)
             .count();
-    auto valueOrErr = this->timedReceive(durationMillis);
-    if (auto err = valueOrErr.takeError()) {
+    auto bufferOrErr = this->timedReceive(durationMillis);
+    if (auto err = bufferOrErr.takeError()) {
       return err;
     }
-    llvm::json::Path::Root root("ipc-message");
-    if (scip_clang::fromJSON(*valueOrErr, t, root)) {
-      return llvm::Error::success();
-    }
-    return root.getError();
+    return ipc::decodeMessage(*bufferOrErr, t);
   }
 };
 
-struct IpcOptions;
-
 // Type representing the driver<->worker queues.
 //
 // This type doesn't have a forDriver static method because
@@ -0,0 +1,32 @@
+#include "indexer/Enforce.h"
+#include "indexer/MemoryBudget.h"
+
+namespace scip_clang {
+
+void MemoryBudget::setExpectedBytes(uint32_t taskId, uint64_t bytes) {
+  if (!this->enabled()) {
+    return;
+  }
+  this->expectedBytes[taskId] = bytes;
+}
+
+uint64_t MemoryBudget::expectedBytesFor(JobId jobId) const {
+  auto it = this->expectedBytes.find(jobId.taskId());
+  return it == this->expectedBytes.end() ? 0 : it->second;
+}
+
+bool MemoryBudget::fits(uint64_t bytes) const {
+  return !this->enabled() || this->reservedBytes == 0
+         || this->reservedBytes + bytes <= this->budgetBytes;
+}
+
+void MemoryBudget::reserve(uint64_t bytes) {
+  this->reservedBytes += bytes;
+}
+
+void MemoryBudget::release(uint64_t bytes) {
+  ENFORCE(bytes <= this->reservedBytes);
+  this->reservedBytes -= bytes;
+}
+
+} // namespace scip_clang
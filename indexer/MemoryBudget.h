@@ -0,0 +1,88 @@
+#ifndef SCIP_CLANG_MEMORY_BUDGET_H
+#define SCIP_CLANG_MEMORY_BUDGET_H
+
+#include <cstdint>
+
+#include "absl/container/flat_hash_map.h"
+
+#include "indexer/IpcMessages.h"
+
+namespace scip_clang {
+
+// NOTE(def: memory-budget): Running one worker per core can run out of
+// memory when several TUs with a high peak RSS (e.g. due to heavy
+// template instantiation) happen to be indexed at the same time, at
+// which point the OOM killer starts killing workers.
+//
+// With --memory-budget-mb=N, each TU has an expected peak RSS, and the
+// Scheduler only starts a TU if the expected usage of all the TUs in
+// progress still fits in N MiB. Workers measure the peak RSS for each
+// TU (resetting the high-water mark before starting on it) and report
+// it in IndexingStatistics, so it ends up in the statistics file.
+// Passing that file to a later run via --job-cost-history provides the
+// expectations; TUs without history are expected to need an equal
+// share of the budget per worker.
+//
+// Pending jobs are considered in order. If the first one doesn't fit,
+// it is held back, and later jobs are only started if they fit
+// alongside it, so that heavy TUs are not starved by lighter ones.
+// If no TU is in progress, the next job is started regardless, so a TU
+// expected to need more than the whole budget still runs (on its own).
+// A worker keeps its reservation until it finishes its batch (see
+// NOTE(ref: tu-batching)), so batches only contain TUs expected to need
+// no more than the first one.
+//
+// With a budget, the driver also checks whether busy workers have
+// exited on their own. If a worker was killed by SIGKILL, which is what
+// the OOM killer uses, its TU is retried instead of being skipped.
+// Retries are only queued once all other jobs have been handed out,
+// and reserve the whole budget, so they run one at a time. Each TU is
+// retried at most once. If the exit status is unavailable (e.g. if
+// the zygote exited early; see NOTE(ref: worker-zygote)), any
+// unexpected exit is treated as a possible OOM kill.
+class MemoryBudget final {
+  /// Zero if there is no budget.
+  uint64_t budgetBytes;
+  /// Sum of reservations across busy workers.
+  uint64_t reservedBytes;
+  /// Expected peak RSS for TUs, keyed by task ID.
+  absl::flat_hash_map<uint32_t, uint64_t> expectedBytes;
+
+public:
+  explicit MemoryBudget(uint64_t budgetBytes)
+      : budgetBytes(budgetBytes), reservedBytes(0), expectedBytes() {}
+  MemoryBudget(MemoryBudget &&) = default;
+  MemoryBudget(const MemoryBudget &) = delete;
+
+  bool enabled() const {
+    return this->budgetBytes > 0;
+  }
+
+  uint64_t totalBytes() const {
+    return this->budgetBytes;
+  }
+
+  /// Sum of reservations across busy workers.
+  uint64_t usedBytes() const {
+    return this->reservedBytes;
+  }
+
+  /// No-op if there is no budget.
+  void setExpectedBytes(uint32_t taskId, uint64_t bytes);
+
+  /// Returns 0 for TUs without an expectation, which includes all TUs
+  /// if there is no budget.
+  uint64_t expectedBytesFor(JobId jobId) const;
+
+  /// Whether a TU expected to need \p bytes can be started now.
+  bool fits(uint64_t bytes) const;
+
+  void reserve(uint64_t bytes);
+
+  /// \p bytes must not exceed the sum of the current reservations.
+  void release(uint64_t bytes);
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_MEMORY_BUDGET_H
@@ -0,0 +1,89 @@
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/strip.h"
+
+#include "indexer/MemoryUsage.h"
+
+namespace scip_clang {
+
+bool resetPeakRss() {
+#ifdef __linux__
+  // See clear_refs in https://docs.kernel.org/filesystems/proc.html
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+  clearRefs.flush();
+  return !clearRefs.fail();
+#else
+  return false;
+#endif
+}
+
+#ifdef __linux__
+/// Returns the value of a field like VmRSS from /proc/self/status,
+/// or 0 if it is not present.
+static uint64_t procStatusBytes(std::string_view field) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    std::string_view value = line;
+    if (!absl::ConsumePrefix(&value, field)
+        || !absl::ConsumePrefix(&value, ":")) {
+      continue;
+    }
+    value = absl::StripAsciiWhitespace(value);
+    uint64_t kibibytes;
+    if (!absl::ConsumeSuffix(&value, "kB")
+        || !absl::SimpleAtoi(absl::StripAsciiWhitespace(value), &kibibytes)) {
+      return 0;
+    }
+    return kibibytes * 1024;
+  }
+  return 0;
+}
+#endif
+
+uint64_t peakRssBytes() {
+#ifdef __linux__
+  // Unlike ru_maxrss, VmHWM is reset by resetPeakRss.
+  if (auto bytes = scip_clang::procStatusBytes("VmHWM"); bytes > 0) {
+    return bytes;
+  }
+#endif
+  struct rusage usage {};
+  if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return uint64_t(usage.ru_maxrss);
+#else
+  return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+uint64_t currentRssBytes() {
+#ifdef __linux__
+  return scip_clang::procStatusBytes("VmRSS");
+#else
+  return 0;
+#endif
+}
+
+bool trimFreeMemory() {
+#if defined(__GLIBC__)
+  ::malloc_trim(0);
+  return true;
+#else
+  return false;
+#endif
+}
+
+} // namespace scip_clang
@@ -0,0 +1,51 @@
+#ifndef SCIP_CLANG_MEMORY_USAGE_H
+#define SCIP_CLANG_MEMORY_USAGE_H
+
+#include <cstdint>
+
+namespace scip_clang {
+
+/// Resets the peak RSS of the current process to the current RSS, so
+/// that a later call to \c peakRssBytes only covers the work done in
+/// between. Returns false if this is not supported (it needs Linux 4.0+),
+/// in which case the peak covers the whole lifetime of the process.
+///
+/// Not meaningful if multiple threads are doing work concurrently.
+bool resetPeakRss();
+
+/// Returns the peak RSS (in bytes) since the last successful call to
+/// \c resetPeakRss, or since the process started. Returns 0 if it
+/// could not be determined.
+uint64_t peakRssBytes();
+
+/// Returns the current RSS (in bytes), or 0 if it could not be determined.
+uint64_t currentRssBytes();
+
+// NOTE(def: worker-recycling): Workers process TU after TU, and even
+// though the AST and the index for each TU are freed once it is done,
+// the RSS of a long-lived worker tends to creep up, as fragmentation
+// keeps the allocator from returning memory to the OS.
+//
+// With --trim-memory-between-tus, workers call \c trimFreeMemory after
+// every TU, once everything allocated for the TU has been freed.
+//
+// With --recycle-worker-rss-mb=N, the driver retires a worker once the
+// RSS it reports after a TU exceeds N MiB. A retired worker finishes
+// the rest of its batch (see NOTE(ref: tu-batching)), and is then asked
+// to shut down and respawned. If there is a spare worker (see
+// NOTE(ref: spare-workers)), it takes the retired worker's place right
+// away, and the respawned process becomes a spare instead.
+//
+// The RSS after each TU, the memory released by trimming, and which
+// TUs led to their worker being retired, are all recorded in the
+// statistics file.
+
+/// Returns memory which the allocator is holding on to, but which is not
+/// in use, to the OS. Returns false if this is not supported (it needs
+/// glibc).
+/// See NOTE(ref: worker-recycling).
+bool trimFreeMemory();
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_MEMORY_USAGE_H
@@ -0,0 +1,33 @@
+#include <utility>
+
+#include "indexer/Enforce.h"
+#include "indexer/PathInterner.h"
+
+namespace scip_clang {
+
+std::pair<PathId, bool> PathInterner::intern(AbsolutePathRef path) {
+  auto it = this->ids.find(path);
+  if (it != this->ids.end()) {
+    return {it->second, false};
+  }
+  ENFORCE(this->paths.size() < UINT32_MAX, "too many paths to intern");
+  PathId newId{uint32_t(this->paths.size())};
+  this->paths.emplace_back(path);
+  this->ids.emplace(this->paths.back().asRef(), newId);
+  return {newId, true};
+}
+
+std::optional<PathId> PathInterner::lookup(AbsolutePathRef path) const {
+  auto it = this->ids.find(path);
+  if (it == this->ids.end()) {
+    return {};
+  }
+  return it->second;
+}
+
+const AbsolutePath &PathInterner::get(PathId id) const {
+  ENFORCE(id.value < this->paths.size(), "unknown PathId {}", id.value);
+  return this->paths[id.value];
+}
+
+} // namespace scip_clang
@@ -0,0 +1,66 @@
+#ifndef SCIP_CLANG_PATH_INTERNER_H
+#define SCIP_CLANG_PATH_INTERNER_H
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+
+#include "indexer/Derive.h"
+#include "indexer/Path.h"
+
+namespace scip_clang {
+
+/// Dense integer ID for a path, used to avoid sending the same
+/// paths over and over again over IPC.
+///
+/// IDs are only meaningful relative to the \c PathInterner which
+/// created them; see NOTE(ref: path-interning).
+struct PathId {
+  uint32_t value;
+
+  DERIVE_HASH_1(PathId, self.value)
+  DERIVE_CMP_ALL(PathId)
+};
+
+/// NOTE(def: path-interning): Each worker maintains its own interner,
+/// and assigns IDs to paths in the order in which it first sees them.
+/// Paths which were not sent to the driver previously are sent along
+/// with the semantic analysis result (see
+/// \c SemanticAnalysisJobResult::newPaths), after which the worker and
+/// the driver both refer to the path by its worker-local ID.
+///
+/// The driver maintains a global interner and a per-worker table for
+/// translating worker-local IDs to global IDs. When a worker is
+/// respawned, the driver discards the table for the old worker process.
+class PathInterner final {
+  /// std::deque instead of std::vector so that the keys in \c ids,
+  /// which point into the stored paths, remain valid on insertion.
+  std::deque<AbsolutePath> paths;
+  absl::flat_hash_map<AbsolutePathRef, PathId> ids;
+
+public:
+  PathInterner() = default;
+  PathInterner(PathInterner &&) = default;
+  PathInterner &operator=(PathInterner &&) = default;
+  PathInterner(const PathInterner &) = delete;
+  PathInterner &operator=(const PathInterner &) = delete;
+
+  /// Returns the ID for \p path, assigning a new one if necessary.
+  /// The second value is true iff a new ID was assigned.
+  std::pair<PathId, bool> intern(AbsolutePathRef path);
+
+  std::optional<PathId> lookup(AbsolutePathRef path) const;
+
+  const AbsolutePath &get(PathId id) const;
+
+  size_t size() const {
+    return this->paths.size();
+  }
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_PATH_INTERNER_H
@@ -0,0 +1,200 @@
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "spdlog/spdlog.h"
+
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include "indexer/CompilationDatabase.h"
+#include "indexer/LlvmAdapter.h"
+#include "indexer/Quarantine.h"
+
+namespace scip_clang {
+
+constexpr static int64_t QUARANTINE_DB_VERSION = 1;
+
+void Quarantine::load(std::string_view dbPath) {
+  auto bufferOrErr =
+      llvm::MemoryBuffer::getFile(llvm::Twine(dbPath), /*IsText*/ true);
+  if (!bufferOrErr) {
+    if (bufferOrErr.getError() != std::errc::no_such_file_or_directory) {
+      spdlog::warn("failed to read quarantine database at '{}' ({})", dbPath,
+                   bufferOrErr.getError().message());
+    }
+    return;
+  }
+  auto valueOrErr = llvm::json::parse(bufferOrErr.get()->getBuffer());
+  if (auto err = valueOrErr.takeError()) {
+    spdlog::warn("ignoring malformed quarantine database at '{}' ({})",
+                 dbPath, llvm_ext::format(err));
+    return;
+  }
+  auto warnMalformed = [&](std::string_view what) {
+    spdlog::warn("ignoring malformed quarantine database at '{}' ({})",
+                 dbPath, what);
+  };
+  auto *root = valueOrErr->getAsObject();
+  if (!root) {
+    return warnMalformed("expected object");
+  }
+  auto version = root->getInteger("version");
+  if (!version || *version != QUARANTINE_DB_VERSION) {
+    return warnMalformed("unknown version");
+  }
+  auto lastRun = root->getInteger("lastRun");
+  auto *tus = root->getArray("translationUnits");
+  if (!lastRun || *lastRun < 0 || !tus) {
+    return warnMalformed("missing lastRun or translationUnits");
+  }
+  decltype(this->entries) entries;
+  for (auto &tuValue : *tus) {
+    auto *tu = tuValue.getAsObject();
+    if (!tu) {
+      return warnMalformed("expected object for TU");
+    }
+    // Hashes use the full 64-bit range, unlike getInteger.
+    auto getHash = [&](llvm::StringRef key, HashValue &hashValue) -> bool {
+      auto *value = tu->get(key);
+      if (!value) {
+        return false;
+      }
+      auto rawValue = value->getAsUINT64();
+      if (!rawValue) {
+        return false;
+      }
+      hashValue = HashValue{*rawValue};
+      return true;
+    };
+    HashValue commandKey, mainFileHash;
+    auto mainFile = tu->getString("mainFile");
+    auto reason = tu->getString("reason");
+    auto lastFailedRun = tu->getInteger("lastFailedRun");
+    auto numFailures = tu->getInteger("numFailures");
+    if (!getHash("commandKey", commandKey)
+        || !getHash("mainFileHash", mainFileHash) || !mainFile || !reason
+        || !lastFailedRun || *lastFailedRun < 0 || !numFailures
+        || *numFailures < 0) {
+      return warnMalformed("missing or invalid fields for TU");
+    }
+    entries[commandKey] =
+        QuarantineEntry{mainFile->str(), mainFileHash, reason->str(),
+                        uint64_t(*lastFailedRun), uint64_t(*numFailures)};
+  }
+  this->entries = std::move(entries);
+  this->currentRun = uint64_t(*lastRun) + 1;
+  spdlog::debug("loaded {} quarantined TUs from '{}'", this->size(), dbPath);
+}
+
+void Quarantine::save(std::string_view dbPath) const {
+  // Write to a separate file first, so that a crash in the middle
+  // doesn't lose entries from the existing database.
+  auto newPath = std::string(dbPath) + ".new";
+  std::error_code error;
+  {
+    llvm::raw_fd_ostream out(newPath, error);
+    if (error) {
+      spdlog::warn("failed to write quarantine database to '{}' ({})",
+                   newPath, error.message());
+      return;
+    }
+    llvm::json::OStream jsonStream(out);
+    jsonStream.object([&]() {
+      jsonStream.attribute("version", QUARANTINE_DB_VERSION);
+      jsonStream.attribute("lastRun", int64_t(this->currentRun));
+      jsonStream.attributeArray("translationUnits", [&]() {
+        for (auto &[commandKey, entry] : this->entries) {
+          if (this->currentRun + 1 - entry.lastFailedRun > this->maxRuns) {
+            continue;
+          }
+          jsonStream.object([&]() {
+            jsonStream.attribute("commandKey", commandKey.rawValue);
+            jsonStream.attribute("mainFileHash", entry.mainFileHash.rawValue);
+            jsonStream.attribute("mainFile", entry.mainFile);
+            jsonStream.attribute("reason", entry.reason);
+            jsonStream.attribute("lastFailedRun",
+                                 int64_t(entry.lastFailedRun));
+            jsonStream.attribute("numFailures", int64_t(entry.numFailures));
+          });
+        }
+      });
+    });
+    jsonStream.flush();
+    out.close();
+    if (out.has_error()) {
+      spdlog::warn("failed to write quarantine database to '{}' ({})",
+                   newPath, out.error().message());
+      out.clear_error();
+      return;
+    }
+  }
+  std::filesystem::rename(newPath, std::string(dbPath), error);
+  if (error) {
+    spdlog::warn("failed to move quarantine database to '{}' ({})", dbPath,
+                 error.message());
+  }
+}
+
+const QuarantineEntry *
+Quarantine::lookup(const clang::tooling::CompileCommand &command) {
+  auto it = this->entries.find(compdb::commandKey(command));
+  if (it == this->entries.end()) {
+    return nullptr;
+  }
+  auto &entry = it->second;
+  if (this->currentRun - entry.lastFailedRun > this->maxRuns) {
+    spdlog::debug("quarantine for '{}' has expired", entry.mainFile);
+    this->entries.erase(it);
+    return nullptr;
+  }
+  if (Quarantine::mainFileHash(command) != entry.mainFileHash) {
+    spdlog::info("'{}' changed since it was quarantined, so it will be "
+                 "indexed as usual",
+                 entry.mainFile);
+    this->entries.erase(it);
+    return nullptr;
+  }
+  return &entry;
+}
+
+void Quarantine::recordFailure(const clang::tooling::CompileCommand &command,
+                               std::string_view reason) {
+  auto &entry = this->entries[compdb::commandKey(command)];
+  entry.mainFile = command.Filename;
+  entry.mainFileHash = Quarantine::mainFileHash(command);
+  entry.reason = std::string(reason);
+  if (entry.lastFailedRun != this->currentRun) {
+    // A TU may fail more than once in a single run, e.g. due to
+    // NOTE(ref: header-recovery); only count it once.
+    entry.numFailures++;
+  }
+  entry.lastFailedRun = this->currentRun;
+}
+
+void Quarantine::recordSuccess(const clang::tooling::CompileCommand &command) {
+  this->entries.erase(compdb::commandKey(command));
+}
+
+// static
+HashValue
+Quarantine::mainFileHash(const clang::tooling::CompileCommand &command) {
+  std::filesystem::path path(command.Filename);
+  if (path.is_relative()) {
+    path = std::filesystem::path(command.Directory) / path;
+  }
+  auto bufferOrErr = llvm::MemoryBuffer::getFile(
+      path.string(), /*IsText*/ false, /*RequiresNullTerminator*/ false);
+  if (!bufferOrErr) {
+    return HashValue{0};
+  }
+  return HashValue{HashValue::forText(
+      llvm_ext::toStringView(bufferOrErr.get()->getBuffer()))};
+}
+
+} // namespace scip_clang
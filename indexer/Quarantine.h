@@ -0,0 +1,94 @@
+#ifndef SCIP_CLANG_QUARANTINE_H
+#define SCIP_CLANG_QUARANTINE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "absl/container/flat_hash_map.h"
+
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include "indexer/Hash.h"
+
+namespace scip_clang {
+
+// NOTE(def: tu-quarantine): A TU which crashes its worker or hangs costs
+// up to --receive-timeout-seconds of a worker's time plus a respawn, and
+// it usually does so again on every run, until either scip-clang or the
+// code is fixed.
+//
+// With --quarantine-db, the driver remembers such TUs across runs. The
+// database is a JSON file, keyed by compdb::commandKey, and each entry
+// records the latest reason (crash, timeout or running out of memory),
+// a hash of the main file's contents, and the run in which the TU last
+// failed. A TU is quarantined if it failed in any of the last
+// --quarantine-runs runs, and the hash of its main file is unchanged.
+// Changing the command or the main file expires the entry right away.
+// Changes which only affect headers don't, but the entry still expires
+// once the TU has not failed for --quarantine-runs runs.
+//
+// With --quarantine-policy=defer (the default), quarantined TUs are
+// queued after all other TUs, with a timeout of
+// --quarantine-timeout-seconds instead of --receive-timeout-seconds.
+// A quarantined TU which is indexed successfully leaves the quarantine.
+// With --quarantine-policy=skip, quarantined TUs are not indexed at all.
+//
+// TUs whose worker was likely killed for running out of memory are only
+// recorded if the retry fails too; see NOTE(ref: memory-budget).
+
+struct QuarantineEntry {
+  std::string mainFile;
+  /// See \c Quarantine::mainFileHash.
+  HashValue mainFileHash;
+  /// Short description of the latest failure, e.g. "timed out".
+  std::string reason;
+  /// Number of the latest run in which the TU failed.
+  uint64_t lastFailedRun;
+  uint64_t numFailures;
+};
+
+class Quarantine final {
+  /// A TU stays quarantined for this many runs after failing.
+  uint64_t maxRuns;
+  /// Number of the current run, counting all runs using the same
+  /// database.
+  uint64_t currentRun;
+  /// Keyed by compdb::commandKey.
+  absl::flat_hash_map<HashValue, QuarantineEntry> entries;
+
+public:
+  explicit Quarantine(uint32_t maxRuns)
+      : maxRuns(maxRuns), currentRun(1), entries() {}
+  Quarantine(Quarantine &&) = default;
+  Quarantine(const Quarantine &) = delete;
+
+  /// Reads a database written by \c save, if present. Malformed databases
+  /// are ignored with a warning.
+  void load(std::string_view dbPath);
+
+  /// Leaves out entries which would no longer apply in the next run.
+  /// Logs a warning on failure.
+  void save(std::string_view dbPath) const;
+
+  /// Returns null if \p command is not quarantined, dropping its entry
+  /// if it has expired.
+  const QuarantineEntry *lookup(const clang::tooling::CompileCommand &command);
+
+  void recordFailure(const clang::tooling::CompileCommand &command,
+                     std::string_view reason);
+
+  void recordSuccess(const clang::tooling::CompileCommand &command);
+
+  size_t size() const {
+    return this->entries.size();
+  }
+
+  /// Hash of the contents of the main file for \p command, or 0 if
+  /// it could not be read.
+  static HashValue mainFileHash(const clang::tooling::CompileCommand &command);
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_QUARANTINE_H
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <compare>
 #include <iterator>
 #include <memory>
+#include <optional>
 #include <string>
 #include <tuple>
 #include <utility>
@@ -171,9 +173,13 @@ RootRelativePath::RootRelativePath(std::string &&value)
   ENFORCE(llvm::sys::path::is_relative(this->value));
 }
 
-IndexBuilder::IndexBuilder(scip::Index &fullIndex)
+IndexBuilder::IndexBuilder(scip::Index &fullIndex, bool incremental)
     : fullIndex(fullIndex), multiplyIndexed(), externalSymbols(),
-      _bomb(BOMB_INIT("IndexBuilder")) {}
+      singlyIndexed(), numPromoted(0), _bomb(BOMB_INIT("IndexBuilder")) {
+  if (incremental) {
+    this->singlyIndexed.emplace();
+  }
+}
 
 void IndexBuilder::addDocument(scip::Document &&doc, bool isMultiplyIndexed) {
   ENFORCE(!doc.relative_path().empty());
@@ -181,9 +187,17 @@ void IndexBuilder::addDocument(scip::Document &&doc, bool isMultiplyIndexed) {
     RootRelativePath docPath{std::string(doc.relative_path())};
     auto it = this->multiplyIndexed.find(docPath);
     if (it == this->multiplyIndexed.end()) {
+      std::unique_ptr<DocumentBuilder> docBuilder;
+      if (auto earlierDoc = this->takeSinglyIndexed(docPath)) {
+        // Keep the earlier document first, same as if it had been known
+        // to be multiply indexed all along.
+        docBuilder = std::make_unique<DocumentBuilder>(std::move(*earlierDoc));
+        docBuilder->merge(std::move(doc));
+      } else {
+        docBuilder = std::make_unique<DocumentBuilder>(std::move(doc));
+      }
       this->multiplyIndexed.insert(
-          {std::move(docPath),
-           std::make_unique<DocumentBuilder>(std::move(doc))});
+          {std::move(docPath), std::move(docBuilder)});
     } else {
       auto &docBuilder = it->second;
       docBuilder->merge(std::move(doc));
@@ -194,10 +208,36 @@ void IndexBuilder::addDocument(scip::Document &&doc, bool isMultiplyIndexed) {
             "Document with path '{}' found in multiplyIndexed map despite "
             "!isMultiplyIndexed",
             doc.relative_path());
+    if (this->singlyIndexed.has_value()) {
+      auto [_, inserted] = this->singlyIndexed->emplace(
+          RootRelativePath{std::string(doc.relative_path())},
+          this->fullIndex.documents_size());
+      ENFORCE(inserted,
+              "2+ documents with path '{}' despite !isMultiplyIndexed",
+              doc.relative_path());
+    }
     *this->fullIndex.add_documents() = std::move(doc);
   }
 }
 
+std::optional<scip::Document>
+IndexBuilder::takeSinglyIndexed(const RootRelativePath &docPath) {
+  if (!this->singlyIndexed.has_value()) {
+    return {};
+  }
+  auto it = this->singlyIndexed->find(docPath);
+  if (it == this->singlyIndexed->end()) {
+    return {};
+  }
+  auto &slot = *this->fullIndex.mutable_documents(it->second);
+  scip::Document doc{std::move(slot)};
+  // Empty slots are removed in finish.
+  slot.Clear();
+  this->singlyIndexed->erase(it);
+  this->numPromoted++;
+  return doc;
+}
+
 void IndexBuilder::addExternalSymbolUnchecked(
     SymbolName &&name, scip::SymbolInformation &&extSym) {
   std::vector<std::string> docs{};
@@ -292,6 +332,16 @@ void IndexBuilder::addForwardDeclaration(
 void IndexBuilder::finish(bool deterministic) {
   this->_bomb.defuse();
 
+  if (this->numPromoted > 0) {
+    // Keep the relative order of the remaining documents.
+    auto *docs = this->fullIndex.mutable_documents();
+    docs->erase(std::remove_if(docs->begin(), docs->end(),
+                               [](const scip::Document &doc) -> bool {
+                                 return doc.relative_path().empty();
+                               }),
+                docs->end());
+  }
+
   this->fullIndex.mutable_documents()->Reserve(this->multiplyIndexed.size());
   scip_clang::extractTransform(
       std::move(this->multiplyIndexed), deterministic,
@@ -4,6 +4,7 @@
 #include <compare>
 #include <iterator>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -169,11 +170,23 @@ class IndexBuilder final {
       multiplyIndexed;
   absl::flat_hash_map<SymbolName, std::unique_ptr<SymbolInformationBuilder>>
       externalSymbols;
+  /// Only set if documents may be added before it is known whether they
+  /// will be multiply indexed. Maps paths of documents added with
+  /// !isMultiplyIndexed to their index in fullIndex.documents(), so that
+  /// they can be moved into multiplyIndexed if another document for the
+  /// same path shows up later.
+  std::optional<absl::flat_hash_map<RootRelativePath, int>> singlyIndexed;
+  /// Number of documents moved from fullIndex into multiplyIndexed,
+  /// leaving an empty slot behind.
+  size_t numPromoted;
 
   scip_clang::Bomb _bomb;
 
 public:
-  IndexBuilder(scip::Index &fullIndex);
+  /// If \p incremental is set, \c addDocument may be called with
+  /// !isMultiplyIndexed for a path which later turns out to be multiply
+  /// indexed, at the cost of tracking the paths of all documents.
+  IndexBuilder(scip::Index &fullIndex, bool incremental);
   void addDocument(scip::Document &&doc, bool isMultiplyIndexed);
   void addExternalSymbol(scip::SymbolInformation &&extSym);
 
@@ -187,6 +200,11 @@ public:
 private:
   void addExternalSymbolUnchecked(SymbolName &&,
                                   scip::SymbolInformation &&symWithoutName);
+
+  /// Moves the document for \p docPath out of fullIndex, if it was
+  /// added with !isMultiplyIndexed.
+  std::optional<scip::Document>
+  takeSinglyIndexed(const RootRelativePath &docPath);
 };
 
 } // namespace scip
@@ -0,0 +1,108 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <system_error>
+
+#include "spdlog/fmt/fmt.h"
+#include "spdlog/spdlog.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "scip/scip.pb.h"
+
+#include "indexer/ShardLog.h"
+
+namespace scip_clang {
+
+constexpr static size_t RECORD_HEADER_SIZE = sizeof(uint64_t);
+
+StdPath shardLogPath(const StdPath &temporaryOutputDir, WorkerId workerId) {
+  return temporaryOutputDir / fmt::format("worker-{}-shards.log", workerId);
+}
+
+uint64_t shardLogRecordEnd(ShardLogRecord record) {
+  return record.offset + RECORD_HEADER_SIZE + record.length;
+}
+
+ShardLogRecord ShardLogWriter::append(const scip::Index &index) {
+  if (!this->stream.is_open()) {
+    std::error_code error;
+    auto existingSize = std::filesystem::file_size(this->path, error);
+    this->endOffset = error ? 0 : existingSize;
+    this->stream.open(this->path, std::ios_base::out | std::ios_base::binary
+                                      | std::ios_base::app);
+    if (this->stream.fail()) {
+      spdlog::error("failed to open shard log at '{}' ({})",
+                    this->path.c_str(), std::strerror(errno));
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  uint64_t length = index.ByteSizeLong();
+  char header[RECORD_HEADER_SIZE];
+  for (size_t i = 0; i < RECORD_HEADER_SIZE; ++i) {
+    header[i] = char(uint8_t(length >> (8 * i)));
+  }
+  this->stream.write(header, RECORD_HEADER_SIZE);
+  if (!index.SerializeToOstream(&this->stream) || this->stream.fail()) {
+    spdlog::error("failed to append shard to log at '{}' ({})",
+                  this->path.c_str(), std::strerror(errno));
+    std::exit(EXIT_FAILURE);
+  }
+  ShardLogRecord record{this->endOffset, length};
+  this->endOffset += RECORD_HEADER_SIZE + length;
+  return record;
+}
+
+void ShardLogWriter::flush() {
+  this->stream.flush();
+}
+
+bool ShardLogReader::read(WorkerId workerId, ShardLogRecord record,
+                          scip::Index &index) {
+  auto it = this->logs.find(workerId);
+  if (it == this->logs.end()) {
+    auto path = shardLogPath(this->temporaryOutputDir, workerId);
+    auto bufferOrErr = llvm::MemoryBuffer::getFile(
+        path.string(), /*IsText*/ false, /*RequiresNullTerminator*/ false);
+    if (!bufferOrErr) {
+      spdlog::warn("failed to open shard log at '{}' ({})", path.c_str(),
+                   bufferOrErr.getError().message());
+      this->logs.emplace(workerId, nullptr);
+      return false;
+    }
+    it = this->logs.emplace(workerId, std::move(bufferOrErr.get())).first;
+  }
+  if (!it->second) {
+    return false;
+  }
+  auto data = it->second->getBuffer();
+  if (record.offset > data.size()
+      || data.size() - record.offset < RECORD_HEADER_SIZE + record.length) {
+    spdlog::warn("shard at offset {} in log for worker {} is out of bounds",
+                 record.offset, workerId);
+    return false;
+  }
+  uint64_t length = 0;
+  for (size_t i = 0; i < RECORD_HEADER_SIZE; ++i) {
+    length |= uint64_t(uint8_t(data[record.offset + i])) << (8 * i);
+  }
+  if (length != record.length) {
+    spdlog::warn("shard at offset {} in log for worker {} has length {} but "
+                 "expected {}",
+                 record.offset, workerId, length, record.length);
+    return false;
+  }
+  if (!index.ParseFromArray(data.data() + record.offset + RECORD_HEADER_SIZE,
+                            int(length))) {
+    spdlog::warn("failed to parse shard at offset {} in log for worker {}",
+                 record.offset, workerId);
+    return false;
+  }
+  return true;
+}
+
+} // namespace scip_clang
@@ -0,0 +1,67 @@
+#ifndef SCIP_CLANG_SHARD_LOG_H
+#define SCIP_CLANG_SHARD_LOG_H
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <optional>
+
+#include "absl/container/flat_hash_map.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "indexer/FileSystem.h"
+#include "indexer/IpcMessages.h"
+
+namespace scip {
+class Index;
+}
+
+namespace scip_clang {
+
+// NOTE(def: worker-shard-log): With --shard-storage=worker-log, each
+// worker appends its shards to a single log file in the temporary
+// output directory, instead of creating two files per TU.
+//
+// Each record is an 8-byte little-endian length followed by the
+// serialized shard, and workers report (offset, length) pairs to the
+// driver. The driver maps each log once when merging.
+//
+// A worker which is respawned after a crash or a timeout keeps
+// appending to the same log. Any partially written record from the
+// previous process is simply never referenced.
+
+StdPath shardLogPath(const StdPath &temporaryOutputDir, WorkerId workerId);
+
+/// Offset just past the end of \p record in the log.
+uint64_t shardLogRecordEnd(ShardLogRecord record);
+
+class ShardLogWriter final {
+  StdPath path;
+  std::ofstream stream;
+  uint64_t endOffset;
+
+public:
+  explicit ShardLogWriter(StdPath &&path)
+      : path(std::move(path)), stream(), endOffset(0) {}
+
+  /// Exits if the log can't be written to.
+  ShardLogRecord append(const scip::Index &index);
+
+  void flush();
+};
+
+class ShardLogReader final {
+  StdPath temporaryOutputDir;
+  /// Null values mark logs which failed to open, to avoid repeated warnings.
+  absl::flat_hash_map<WorkerId, std::unique_ptr<llvm::MemoryBuffer>> logs;
+
+public:
+  explicit ShardLogReader(StdPath temporaryOutputDir)
+      : temporaryOutputDir(std::move(temporaryOutputDir)), logs() {}
+
+  bool read(WorkerId workerId, ShardLogRecord record, scip::Index &index);
+};
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_SHARD_LOG_H
@@ -0,0 +1,156 @@
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "spdlog/spdlog.h"
+
+#include "scip/scip.pb.h"
+
+#include "indexer/SharedMemoryShards.h"
+
+namespace scip_clang {
+
+// Leave headroom for the compiler and other processes on the machine;
+// running out of memory is much worse than writing a few more files.
+constexpr static uint64_t MIN_FREE_MEMORY_AFTER_SHARD = 1024 * 1024 * 1024;
+
+constexpr static const char *SHM_MOUNT_POINT = "/dev/shm";
+
+static std::optional<uint64_t> availableMemoryBytes() {
+  std::ifstream meminfo("/proc/meminfo");
+  std::string key;
+  uint64_t valueKiB;
+  std::string unit;
+  while (meminfo >> key >> valueKiB >> unit) {
+    if (key == "MemAvailable:") {
+      return valueKiB * 1024;
+    }
+  }
+  return {};
+}
+
+static bool hasRoomForShard(uint64_t size) {
+  struct statvfs shmStats;
+  if (::statvfs(SHM_MOUNT_POINT, &shmStats) == 0
+      && uint64_t(shmStats.f_bavail) * shmStats.f_frsize < size) {
+    return false;
+  }
+  auto available = availableMemoryBytes();
+  return !available.has_value()
+         || *available >= size + MIN_FREE_MEMORY_AFTER_SHARD;
+}
+
+bool writeShardToSharedMemory(const std::string &name,
+                              const scip::Index &index) {
+  auto size = index.ByteSizeLong();
+  if (!hasRoomForShard(size)) {
+    spdlog::debug("not enough free memory for {}-byte shard; using a file",
+                  size);
+    return false;
+  }
+  int fd = ::shm_open(name.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    spdlog::warn("failed to create shared memory object {} ({})", name,
+                 std::strerror(errno));
+    return false;
+  }
+  auto fail = [&](const char *what) -> bool {
+    spdlog::warn("{} failed for shared memory object {} ({})", what, name,
+                 std::strerror(errno));
+    ::close(fd);
+    ::shm_unlink(name.c_str());
+    return false;
+  };
+  if (size == 0) {
+    ::close(fd);
+    return true;
+  }
+  // Reserve the pages upfront; writing through the mapping into a full
+  // tmpfs would raise SIGBUS instead of returning an error.
+  if (int err = ::posix_fallocate(fd, 0, off_t(size)); err != 0) {
+    errno = err;
+    return fail("posix_fallocate");
+  }
+  void *data =
+      ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    return fail("mmap");
+  }
+  bool serialized = index.SerializeToArray(data, int(size));
+  ::munmap(data, size);
+  if (!serialized) {
+    errno = EINVAL;
+    return fail("serialization");
+  }
+  ::close(fd);
+  return true;
+}
+
+bool readShardFromSharedMemory(const std::string &name, scip::Index &index) {
+  int fd = ::shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0) {
+    spdlog::warn("failed to open shard in shared memory at '{}' ({})", name,
+                 std::strerror(errno));
+    return false;
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0) {
+    spdlog::warn("failed to stat shard in shared memory at '{}' ({})", name,
+                 std::strerror(errno));
+    ::close(fd);
+    return false;
+  }
+  auto size = size_t(info.st_size);
+  if (size == 0) {
+    ::close(fd);
+    index.Clear();
+    return true;
+  }
+  void *data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    spdlog::warn("failed to map shard in shared memory at '{}' ({})", name,
+                 std::strerror(errno));
+    return false;
+  }
+  bool parsed = index.ParseFromArray(data, int(size));
+  ::munmap(data, size);
+  if (!parsed) {
+    spdlog::warn("failed to parse shard in shared memory at '{}'", name);
+  }
+  return parsed;
+}
+
+void removeSharedMemoryShard(const std::string &name) {
+  ::shm_unlink(name.c_str());
+}
+
+void removeSharedMemoryShardsWithPrefix(std::string_view namePrefix) {
+  std::error_code error;
+  for (auto &entry :
+       std::filesystem::directory_iterator(SHM_MOUNT_POINT, error)) {
+    auto filename = entry.path().filename().string();
+    if (std::string_view(filename).starts_with(namePrefix)) {
+      ::shm_unlink(("/" + filename).c_str());
+    }
+  }
+}
+
+} // namespace scip_clang
+
+#endif // __linux__
@@ -0,0 +1,46 @@
+#ifndef SCIP_CLANG_SHARED_MEMORY_SHARDS_H
+#define SCIP_CLANG_SHARED_MEMORY_SHARDS_H
+
+// NOTE(def: shared-memory-shards): With --shard-storage=shared-memory,
+// workers serialize each index shard directly into a POSIX shared
+// memory object instead of a file under the temporary output directory,
+// and report the object's name to the driver. The driver maps the
+// object, parses the shard in-place, and unlinks it once it's done.
+//
+// Shared memory objects are backed by RAM (tmpfs), so workers fall
+// back to files for a shard when available memory is running low,
+// or if creating the object fails for any other reason.
+//
+// Objects are named using a per-driver prefix (see shardShmNamePrefix),
+// so that the driver can sweep away objects written by workers which
+// were killed before reporting them.
+
+#ifdef __linux__
+
+#include <string>
+#include <string_view>
+
+namespace scip {
+class Index;
+}
+
+namespace scip_clang {
+
+/// Returns false if there wasn't enough free memory or the object
+/// couldn't be written. No object is left behind on failure.
+bool writeShardToSharedMemory(const std::string &name,
+                              const scip::Index &index);
+
+/// Returns false if the object is missing or couldn't be parsed.
+bool readShardFromSharedMemory(const std::string &name, scip::Index &index);
+
+void removeSharedMemoryShard(const std::string &name);
+
+/// Remove all shards whose names start with \p namePrefix.
+void removeSharedMemoryShardsWithPrefix(std::string_view namePrefix);
+
+} // namespace scip_clang
+
+#endif // __linux__
+
+#endif // SCIP_CLANG_SHARED_MEMORY_SHARDS_H
@@ -0,0 +1,189 @@
+#ifdef __linux__
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "spdlog/fmt/fmt.h"
+#include "spdlog/spdlog.h"
+
+#include "indexer/Enforce.h"
+#include "indexer/IpcMessages.h"
+#include "indexer/ShmClaimTable.h"
+
+namespace scip_clang {
+
+constexpr static uint64_t SHM_CLAIM_TABLE_MAGIC = 0x5343'4c41'494d'5331;
+constexpr static uint64_t EMPTY_KEY = 0;
+
+struct ShmClaimTableHeader {
+  uint64_t magic;
+  uint64_t capacity;
+  /// Number of filled slots; used to stop claiming before probe
+  /// sequences get too long.
+  std::atomic<uint64_t> size;
+  /// Set once a claim fails because the table is full.
+  std::atomic<bool> overflowed;
+};
+
+struct ShmClaimTableSlot {
+  std::atomic<uint64_t> key;
+  std::atomic<uint64_t> pathHash;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "lock-free atomics are required for sharing across processes");
+
+// Page-aligned so that the slots start on a fresh page.
+constexpr static size_t SLOTS_OFFSET = 4096;
+
+static size_t mappedSizeFor(uint64_t capacity) {
+  return SLOTS_OFFSET + capacity * sizeof(ShmClaimTableSlot);
+}
+
+[[noreturn]] static void exitWithErrno(std::string_view what) {
+  spdlog::error("{} failed: {}", what, std::strerror(errno));
+  std::exit(EXIT_FAILURE);
+}
+
+static uint8_t *mapOrExit(int fd, size_t size) {
+  void *base =
+      ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    exitWithErrno("mmap for header claim table");
+  }
+  return static_cast<uint8_t *>(base);
+}
+
+ShmClaimTable::~ShmClaimTable() {
+  ::munmap(this->base, this->mappedSize);
+  if (this->isOwner) {
+    ::shm_unlink(this->name.c_str());
+  }
+}
+
+std::unique_ptr<ShmClaimTable> ShmClaimTable::create(std::string &&name,
+                                                     uint64_t capacity) {
+  ENFORCE(capacity > 0 && (capacity & (capacity - 1)) == 0,
+          "capacity must be a power of 2");
+  int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    exitWithErrno(fmt::format("shm_open({})", name));
+  }
+  auto size = mappedSizeFor(capacity);
+  // ftruncate zero-fills, so all slots start out empty.
+  if (::ftruncate(fd, size) != 0) {
+    exitWithErrno("ftruncate for header claim table");
+  }
+  auto *bytes = mapOrExit(fd, size);
+  new (bytes)
+      ShmClaimTableHeader{SHM_CLAIM_TABLE_MAGIC, capacity, {0}, {false}};
+  return std::unique_ptr<ShmClaimTable>(
+      new ShmClaimTable(std::move(name), bytes, size, /*isOwner*/ true));
+}
+
+std::unique_ptr<ShmClaimTable> ShmClaimTable::open(std::string &&name) {
+  int fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0) {
+    exitWithErrno(fmt::format("shm_open({})", name));
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0 || size_t(info.st_size) < SLOTS_OFFSET) {
+    spdlog::error("header claim table {} has unexpected size", name);
+    std::exit(EXIT_FAILURE);
+  }
+  auto size = size_t(info.st_size);
+  auto *bytes = mapOrExit(fd, size);
+  auto *header = reinterpret_cast<ShmClaimTableHeader *>(bytes);
+  if (header->magic != SHM_CLAIM_TABLE_MAGIC
+      || mappedSizeFor(header->capacity) != size) {
+    spdlog::error("header claim table {} is corrupted", name);
+    std::exit(EXIT_FAILURE);
+  }
+  return std::unique_ptr<ShmClaimTable>(
+      new ShmClaimTable(std::move(name), bytes, size, /*isOwner*/ false));
+}
+
+void ShmClaimTable::removeIfPresent(const std::string &name) {
+  ::shm_unlink(name.c_str());
+}
+
+ShmClaimTableHeader &ShmClaimTable::header() const {
+  return *reinterpret_cast<ShmClaimTableHeader *>(this->base);
+}
+
+ShmClaimTableSlot *ShmClaimTable::slots() const {
+  return reinterpret_cast<ShmClaimTableSlot *>(this->base + SLOTS_OFFSET);
+}
+
+ShmClaimTable::ClaimStatus ShmClaimTable::claim(AbsolutePathRef path,
+                                                HashValue hashValue) {
+  auto key = scip_clang::headerClaimKey(path, hashValue).rawValue;
+  if (key == EMPTY_KEY) {
+    key = 1;
+  }
+  auto &header = this->header();
+  auto capacity = header.capacity;
+  auto mask = capacity - 1;
+  auto *slots = this->slots();
+  for (uint64_t i = 0, index = key & mask; i < capacity;
+       ++i, index = (index + 1) & mask) {
+    auto &slot = slots[index];
+    auto current = slot.key.load(std::memory_order_acquire);
+    if (current == EMPTY_KEY) {
+      // Keep the load factor at most 3/4, so that probe sequences
+      // for both hits and misses stay short.
+      if (header.size.load(std::memory_order_relaxed) >= capacity / 4 * 3) {
+        break;
+      }
+      if (slot.key.compare_exchange_strong(current, key,
+                                           std::memory_order_acq_rel)) {
+        slot.pathHash.store(HashValue::forText(path.asStringView()),
+                            std::memory_order_release);
+        header.size.fetch_add(1, std::memory_order_relaxed);
+        return ClaimStatus::Claimed;
+      }
+      // Another process filled the slot first; current now holds its key.
+    }
+    if (current == key) {
+      return ClaimStatus::AlreadyClaimed;
+    }
+  }
+  header.overflowed.store(true, std::memory_order_relaxed);
+  return ClaimStatus::Full;
+}
+
+bool ShmClaimTable::hasOverflowed() const {
+  return this->header().overflowed.load(std::memory_order_acquire);
+}
+
+absl::flat_hash_map<uint64_t, uint32_t>
+ShmClaimTable::countHashesPerPath() const {
+  absl::flat_hash_map<uint64_t, uint32_t> counts{};
+  auto capacity = this->header().capacity;
+  auto *slots = this->slots();
+  for (uint64_t i = 0; i < capacity; ++i) {
+    auto &slot = slots[i];
+    if (slot.key.load(std::memory_order_acquire) != EMPTY_KEY) {
+      counts[slot.pathHash.load(std::memory_order_acquire)]++;
+    }
+  }
+  return counts;
+}
+
+} // namespace scip_clang
+
+#endif // __linux__
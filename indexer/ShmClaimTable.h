@@ -0,0 +1,94 @@
+#ifndef SCIP_CLANG_SHM_CLAIM_TABLE_H
+#define SCIP_CLANG_SHM_CLAIM_TABLE_H
+
+// NOTE(def: shm-claim-table): With --shm-claim-table, the set of claimed
+// (path, hash) pairs, i.e. the files some TU has been assigned to index,
+// lives in a shared memory object created by the driver, instead
+// of in the driver's FileIndexingPlanner. After semantic analysis, a
+// worker claims pairs directly in the table using compare-and-swap,
+// and starts indexing right away, without a round-trip to the driver.
+//
+// The table is an open-addressing hash table with linear probing. Each
+// slot holds a key (see headerClaimKey) and a hash of the absolute path.
+// Slots are only ever filled in, never cleared, so a CAS on the key from
+// empty to the claimed key is all that is needed for a claim to be
+// exclusive. The path hash is written after the key; it is only read by
+// the driver for computing isMultiplyIndexed once all workers are done.
+//
+// The object is sized using ftruncate, so pages which are never touched
+// don't take up any memory. If the table gets too full, workers index
+// the remaining pairs without claiming them instead of failing; the
+// driver then conservatively treats every document as potentially
+// being emitted by more than one TU when merging.
+
+#ifdef __linux__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+
+#include "indexer/Hash.h"
+#include "indexer/Path.h"
+
+namespace scip_clang {
+
+struct ShmClaimTableHeader;
+struct ShmClaimTableSlot;
+
+class ShmClaimTable final {
+  std::string name;
+  uint8_t *base;
+  size_t mappedSize;
+  bool isOwner;
+
+  ShmClaimTable(std::string &&name, uint8_t *base, size_t mappedSize,
+                bool isOwner)
+      : name(std::move(name)), base(base), mappedSize(mappedSize),
+        isOwner(isOwner) {}
+
+public:
+  /// Number of slots used by the driver; must be a power of 2.
+  static constexpr uint64_t DEFAULT_CAPACITY = uint64_t(1) << 22;
+
+  ShmClaimTable(const ShmClaimTable &) = delete;
+  ShmClaimTable &operator=(const ShmClaimTable &) = delete;
+  ~ShmClaimTable();
+
+  /// Called by the driver. Exits on failure.
+  static std::unique_ptr<ShmClaimTable> create(std::string &&name,
+                                               uint64_t capacity);
+  /// Called by workers. Exits on failure.
+  static std::unique_ptr<ShmClaimTable> open(std::string &&name);
+  static void removeIfPresent(const std::string &name);
+
+  enum class ClaimStatus {
+    Claimed,
+    AlreadyClaimed,
+    /// The table is too full to record more claims.
+    Full,
+  };
+
+  /// Safe to call concurrently from multiple processes.
+  ClaimStatus claim(AbsolutePathRef path, HashValue hashValue);
+
+  /// Returns the number of claimed hashes for each path, keyed by
+  /// \c HashValue::forText of the absolute path.
+  ///
+  /// Should only be called once no workers are running.
+  absl::flat_hash_map<uint64_t, uint32_t> countHashesPerPath() const;
+
+  /// Whether any call to \c claim returned \c ClaimStatus::Full.
+  bool hasOverflowed() const;
+
+private:
+  ShmClaimTableHeader &header() const;
+  ShmClaimTableSlot *slots() const;
+};
+
+} // namespace scip_clang
+
+#endif // __linux__
+
+#endif // SCIP_CLANG_SHM_CLAIM_TABLE_H
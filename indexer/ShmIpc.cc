@@ -0,0 +1,459 @@
+#ifdef __linux__
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "spdlog/fmt/fmt.h"
+#include "spdlog/spdlog.h"
+
+#include "indexer/CliOptions.h"
+#include "indexer/Enforce.h"
+#include "indexer/IpcMessages.h"
+#include "indexer/ShmIpc.h"
+
+namespace scip_clang {
+
+constexpr static uint64_t SHM_RING_CAPACITY = 1024 * 1024;
+// Larger messages are chunked (see NOTE(ref: ipc-chunking)); keep frames
+// small enough that the writer can make progress while the reader is
+// still copying out a previous frame.
+constexpr static size_t SHM_RING_MAX_FRAME_SIZE = SHM_RING_CAPACITY / 4;
+static_assert((SHM_RING_CAPACITY & (SHM_RING_CAPACITY - 1)) == 0,
+              "ring capacity must be a power of 2 for cheap wrap-around");
+
+// Positions increase monotonically and are only reduced modulo the
+// capacity when indexing into the data, so that a full ring can be
+// distinguished from an empty one.
+struct ShmRingHeader {
+  alignas(64) std::atomic<uint64_t> readPos;
+  alignas(64) std::atomic<uint64_t> writePos;
+  // Set by the writer before blocking on the space eventfd, so that the
+  // reader only needs to signal it when somebody is actually waiting.
+  alignas(64) std::atomic<bool> writerWaiting;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "atomics in shared memory must not rely on process-local locks");
+
+constexpr static size_t SHM_RING_STRIDE = sizeof(ShmRingHeader)
+                                          + SHM_RING_CAPACITY;
+constexpr static size_t SHM_SEGMENT_SIZE = 2 * SHM_RING_STRIDE;
+
+constexpr static uint64_t TIMER_KEY = UINT64_MAX;
+
+[[noreturn]] static void exitWithErrno(std::string_view what) {
+  spdlog::error("{} failed: {}", what, std::strerror(errno));
+  std::exit(EXIT_FAILURE);
+}
+
+static void signalEventFd(int fd) {
+  uint64_t one = 1;
+  while (::write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+static void clearEventFd(int fd) {
+  uint64_t counter;
+  while (::read(fd, &counter, sizeof(counter)) < 0 && errno == EINTR) {
+  }
+}
+
+/// Returns false if the timeout expired before \p fd became readable.
+static bool waitForEventFd(int fd, int timeoutMillis) {
+  pollfd pfd{.fd = fd, .events = POLLIN, .revents = 0};
+  int ready = ::poll(&pfd, 1, timeoutMillis);
+  if (ready <= 0) {
+    return false; // Timeout or EINTR; callers re-check the ring anyways.
+  }
+  clearEventFd(fd);
+  return true;
+}
+
+ShmRingSegment::~ShmRingSegment() {
+  ::munmap(this->base, SHM_SEGMENT_SIZE);
+  if (this->isOwner) {
+    ::shm_unlink(this->name.c_str());
+  }
+}
+
+std::shared_ptr<ShmRingSegment> ShmRingSegment::create(std::string &&name) {
+  int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    exitWithErrno(fmt::format("shm_open({})", name));
+  }
+  if (::ftruncate(fd, SHM_SEGMENT_SIZE) != 0) {
+    exitWithErrno("ftruncate for shared memory ring");
+  }
+  void *base = ::mmap(nullptr, SHM_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    exitWithErrno("mmap for shared memory ring");
+  }
+  auto *bytes = static_cast<uint8_t *>(base);
+  new (bytes) ShmRingHeader{};
+  new (bytes + SHM_RING_STRIDE) ShmRingHeader{};
+  return std::shared_ptr<ShmRingSegment>(
+      new ShmRingSegment(std::move(name), bytes, /*isOwner*/ true));
+}
+
+std::shared_ptr<ShmRingSegment> ShmRingSegment::open(std::string &&name) {
+  int fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0) {
+    exitWithErrno(fmt::format("shm_open({})", name));
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0 || size_t(info.st_size) != SHM_SEGMENT_SIZE) {
+    spdlog::error("shared memory segment {} has unexpected size", name);
+    std::exit(EXIT_FAILURE);
+  }
+  void *base = ::mmap(nullptr, SHM_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    exitWithErrno("mmap for shared memory ring");
+  }
+  return std::shared_ptr<ShmRingSegment>(new ShmRingSegment(
+      std::move(name), static_cast<uint8_t *>(base), /*isOwner*/ false));
+}
+
+void ShmRingSegment::removeIfPresent(const std::string &name) {
+  ::shm_unlink(name.c_str());
+}
+
+ShmRingHeader &ShmRingSegment::header(ShmRingDirection direction) {
+  return *reinterpret_cast<ShmRingHeader *>(
+      this->base + size_t(direction) * SHM_RING_STRIDE);
+}
+
+uint8_t *ShmRingSegment::data(ShmRingDirection direction) {
+  return this->base + size_t(direction) * SHM_RING_STRIDE
+         + sizeof(ShmRingHeader);
+}
+
+void ShmRingSegment::reset() {
+  for (auto direction :
+       {ShmRingDirection::DriverToWorker, ShmRingDirection::WorkerToDriver}) {
+    auto &header = this->header(direction);
+    header.readPos.store(0);
+    header.writePos.store(0);
+    header.writerWaiting.store(false);
+  }
+}
+
+ShmRingEventFds ShmRingEventFds::create() {
+  ShmRingEventFds eventFds;
+  for (auto &fd : eventFds.fds) {
+    // Non-blocking so that clearing a counter never blocks; waiting
+    // is always done via poll/epoll.
+    fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0) {
+      exitWithErrno("eventfd");
+    }
+  }
+  return eventFds;
+}
+
+std::optional<ShmRingEventFds>
+ShmRingEventFds::fromVector(const std::vector<int> &fds) {
+  ShmRingEventFds eventFds;
+  if (fds.size() != eventFds.fds.size()) {
+    return {};
+  }
+  for (size_t i = 0; i < fds.size(); ++i) {
+    if (fds[i] < 0) {
+      return {};
+    }
+    eventFds.fds[i] = fds[i];
+  }
+  return eventFds;
+}
+
+std::string ShmRingEventFds::toCliValue() const {
+  return fmt::format("{}", fmt::join(this->fds, ","));
+}
+
+void ShmRingEventFds::setInheritable(bool inheritable) const {
+  for (auto fd : this->fds) {
+    int flags = ::fcntl(fd, F_GETFD);
+    ENFORCE(flags >= 0);
+    flags = inheritable ? (flags & ~FD_CLOEXEC) : (flags | FD_CLOEXEC);
+    ENFORCE(::fcntl(fd, F_SETFD, flags) == 0);
+  }
+}
+
+void ShmRingEventFds::drain() const {
+  for (auto fd : this->fds) {
+    clearEventFd(fd);
+  }
+}
+
+void ShmRingEventFds::closeAll() {
+  for (auto &fd : this->fds) {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+}
+
+bool ShmRingChannel::send(std::string_view message) {
+  auto &header = this->segment->header(this->direction);
+  auto *data = this->segment->data(this->direction);
+  uint64_t needed = sizeof(uint32_t) + message.size();
+  ENFORCE(message.size() <= SHM_RING_MAX_FRAME_SIZE,
+          "message of {} bytes should've been split into chunks",
+          message.size());
+  uint64_t writePos = header.writePos.load(std::memory_order_relaxed);
+  auto hasSpace = [&]() -> bool {
+    uint64_t readPos = header.readPos.load(std::memory_order_seq_cst);
+    return SHM_RING_CAPACITY - (writePos - readPos) >= needed;
+  };
+  using namespace std::chrono;
+  std::optional<steady_clock::time_point> deadline;
+  if (this->sendTimeout.has_value()) {
+    deadline = steady_clock::now() + *this->sendTimeout;
+  }
+  while (!hasSpace()) {
+    // Announce that we're waiting before re-checking, so that the reader
+    // either sees the flag or we see the space it just freed up.
+    header.writerWaiting.store(true, std::memory_order_seq_cst);
+    if (hasSpace()) {
+      header.writerWaiting.store(false, std::memory_order_relaxed);
+      break;
+    }
+    int waitMillis = -1;
+    if (deadline.has_value()) {
+      auto now = steady_clock::now();
+      if (now >= *deadline) {
+        return false;
+      }
+      // Round up, like timedReceive.
+      auto remaining = duration_cast<milliseconds>(*deadline - now).count();
+      waitMillis = int(std::min<int64_t>(remaining + 1, INT32_MAX));
+    }
+    waitForEventFd(this->spaceFd, waitMillis);
+  }
+  auto copyIn = [&](uint64_t pos, const void *src, size_t size) {
+    size_t start = pos & (SHM_RING_CAPACITY - 1);
+    size_t firstPart = std::min(size, size_t(SHM_RING_CAPACITY - start));
+    std::memcpy(data + start, src, firstPart);
+    std::memcpy(data, static_cast<const uint8_t *>(src) + firstPart,
+                size - firstPart);
+  };
+  uint32_t size = uint32_t(message.size());
+  copyIn(writePos, &size, sizeof(size));
+  copyIn(writePos + sizeof(size), message.data(), message.size());
+  header.writePos.store(writePos + needed, std::memory_order_release);
+  signalEventFd(this->dataFd);
+  return true;
+}
+
+size_t ShmRingChannel::maxMessageSize() const {
+  return SHM_RING_MAX_FRAME_SIZE;
+}
+
+bool ShmRingChannel::tryReceive(std::string &message) {
+  auto &header = this->segment->header(this->direction);
+  auto *data = this->segment->data(this->direction);
+  uint64_t readPos = header.readPos.load(std::memory_order_relaxed);
+  uint64_t writePos = header.writePos.load(std::memory_order_acquire);
+  if (readPos == writePos) {
+    return false;
+  }
+  auto copyOut = [&](void *dst, uint64_t pos, size_t size) {
+    size_t start = pos & (SHM_RING_CAPACITY - 1);
+    size_t firstPart = std::min(size, size_t(SHM_RING_CAPACITY - start));
+    std::memcpy(dst, data + start, firstPart);
+    std::memcpy(static_cast<uint8_t *>(dst) + firstPart, data,
+                size - firstPart);
+  };
+  uint32_t size;
+  copyOut(&size, readPos, sizeof(size));
+  ENFORCE(writePos - readPos >= sizeof(size) + size,
+          "partially written message in shared memory ring");
+  message.resize(size);
+  copyOut(message.data(), readPos + sizeof(size), size);
+  header.readPos.store(readPos + sizeof(size) + size,
+                       std::memory_order_seq_cst);
+  if (header.writerWaiting.exchange(false, std::memory_order_seq_cst)) {
+    signalEventFd(this->spaceFd);
+  }
+  return true;
+}
+
+bool ShmRingChannel::timedReceive(std::string &message, uint64_t waitMillis) {
+  using namespace std::chrono;
+  auto deadline = steady_clock::now() + milliseconds(waitMillis);
+  while (true) {
+    if (this->tryReceive(message)) {
+      return true;
+    }
+    auto now = steady_clock::now();
+    if (now >= deadline) {
+      return false;
+    }
+    // Round up so that we don't spin with a zero timeout near the deadline.
+    auto remaining = duration_cast<milliseconds>(deadline - now).count() + 1;
+    waitForEventFd(this->dataFd, int(std::min<int64_t>(remaining, INT32_MAX)));
+  }
+}
+
+std::pair<std::unique_ptr<IpcChannel>, std::unique_ptr<IpcChannel>>
+openShmRingChannelsForWorker(const IpcOptions &ipcOptions) {
+  auto eventFds = ShmRingEventFds::fromVector(ipcOptions.eventFds);
+  if (!eventFds) {
+    spdlog::error("expected {} eventfds for shm-ring transport but got '{}'",
+                  size_t(ShmRingEventFds::Count),
+                  fmt::join(ipcOptions.eventFds, ","));
+    std::exit(EXIT_FAILURE);
+  }
+  // The driver only makes these inheritable while spawning us; don't
+  // leak them into any processes we might spawn.
+  eventFds->setInheritable(false);
+  auto segment = ShmRingSegment::open(
+      shmRingName(ipcOptions.driverId, ipcOptions.workerId));
+  return {std::make_unique<ShmRingChannel>(
+              segment, ShmRingDirection::DriverToWorker, *eventFds),
+          std::make_unique<ShmRingChannel>(
+              segment, ShmRingDirection::WorkerToDriver, *eventFds)};
+}
+
+ShmRingDriverTransport::ShmRingDriverTransport(std::string_view driverId,
+                                               size_t numWorkers) {
+  this->epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+  if (this->epollFd < 0) {
+    exitWithErrno("epoll_create1");
+  }
+  this->timerFd =
+      ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (this->timerFd < 0) {
+    exitWithErrno("timerfd_create");
+  }
+  auto watch = [&](int fd, uint64_t key) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = key;
+    if (::epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      exitWithErrno("epoll_ctl");
+    }
+  };
+  watch(this->timerFd, TIMER_KEY);
+  for (size_t workerId = 0; workerId < numWorkers; ++workerId) {
+    auto segment = ShmRingSegment::create(shmRingName(driverId, workerId));
+    auto eventFds = ShmRingEventFds::create();
+    this->receivers.emplace_back(segment, ShmRingDirection::WorkerToDriver,
+                                 eventFds);
+    watch(eventFds.dataFd(ShmRingDirection::WorkerToDriver), workerId);
+    this->segments.emplace_back(std::move(segment));
+    this->eventFds.emplace_back(eventFds);
+  }
+}
+
+ShmRingDriverTransport::~ShmRingDriverTransport() {
+  for (auto &eventFds : this->eventFds) {
+    eventFds.closeAll();
+  }
+  ::close(this->timerFd);
+  ::close(this->epollFd);
+}
+
+std::unique_ptr<IpcChannel>
+ShmRingDriverTransport::makeSender(uint64_t workerId,
+                                   std::chrono::milliseconds sendTimeout) {
+  return std::make_unique<ShmRingChannel>(
+      this->segments[workerId], ShmRingDirection::DriverToWorker,
+      this->eventFds[workerId], sendTimeout);
+}
+
+void ShmRingDriverTransport::resetWorker(uint64_t workerId) {
+  // Any half-delivered messages belong to the previous incarnation
+  // of the worker, which has already been killed.
+  this->segments[workerId]->reset();
+  this->eventFds[workerId].drain();
+}
+
+void ShmRingDriverTransport::addWorkerArgs(
+    uint64_t workerId, std::vector<std::string> &args) const {
+  args.push_back("--ipc-transport=shm-ring");
+  args.push_back(
+      fmt::format("--ipc-eventfds={}", this->eventFds[workerId].toCliValue()));
+}
+
+void ShmRingDriverTransport::setInheritable(uint64_t workerId,
+                                            bool inheritable) const {
+  this->eventFds[workerId].setInheritable(inheritable);
+}
+
+void ShmRingDriverTransport::armTimer(std::optional<Instant> deadline) {
+  itimerspec spec{};
+  if (deadline.has_value()) {
+    // steady_clock is CLOCK_MONOTONIC on Linux, so the deadline can be
+    // passed as an absolute time. A deadline in the past fires immediately.
+    auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          deadline->time_since_epoch())
+                          .count();
+    sinceEpoch = std::max<int64_t>(sinceEpoch, 1); // 0 would disarm
+    spec.it_value.tv_sec = sinceEpoch / 1'000'000'000;
+    spec.it_value.tv_nsec = sinceEpoch % 1'000'000'000;
+  }
+  if (::timerfd_settime(this->timerFd, TFD_TIMER_ABSTIME, &spec, nullptr)
+      != 0) {
+    exitWithErrno("timerfd_settime");
+  }
+}
+
+void ShmRingDriverTransport::wait(
+    std::vector<std::pair<uint64_t, std::string>> &messages,
+    bool &timerExpired) {
+  timerExpired = false;
+  epoll_event events[32];
+  int numReady;
+  do {
+    numReady = ::epoll_wait(this->epollFd, events, std::size(events), -1);
+  } while (numReady < 0 && errno == EINTR);
+  if (numReady < 0) {
+    exitWithErrno("epoll_wait");
+  }
+  for (int i = 0; i < numReady; ++i) {
+    auto key = events[i].data.u64;
+    if (key == TIMER_KEY) {
+      clearEventFd(this->timerFd);
+      timerExpired = true;
+      continue;
+    }
+    // Clear the counter before draining, so that a message written
+    // concurrently with draining results in a fresh wakeup.
+    clearEventFd(this->eventFds[key].dataFd(ShmRingDirection::WorkerToDriver));
+    std::string message;
+    while (this->receivers[key].tryReceive(message)) {
+      messages.emplace_back(key, std::move(message));
+    }
+  }
+}
+
+} // namespace scip_clang
+
+#endif // __linux__
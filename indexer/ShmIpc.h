@@ -0,0 +1,179 @@
+#ifndef SCIP_CLANG_SHM_IPC_H
+#define SCIP_CLANG_SHM_IPC_H
+
+// NOTE(def: shm-ring-transport): Linux-only alternative to Boost's
+// message_queue, selected using --ipc-transport=shm-ring.
+//
+// Each worker gets its own shared memory segment holding two
+// single-producer single-consumer byte rings (one per direction),
+// along with eventfds for signaling when data or free space
+// becomes available. The eventfds are created by the driver and
+// inherited by the worker when it is spawned.
+//
+// The driver waits on the worker->driver eventfds for all workers
+// using a single epoll instance, along with a timerfd which is armed
+// to fire when the oldest running job exceeds the receive timeout.
+//
+// Compared to message_queue, this avoids Boost's spin-sleep loop
+// when waiting, avoids contention between workers on a single shared
+// queue, and avoids periodically waking up the driver just to check
+// for timeouts.
+
+#ifdef __linux__
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "indexer/IpcChannel.h"
+
+namespace scip_clang {
+
+struct IpcOptions;
+
+enum class ShmRingDirection : uint8_t {
+  DriverToWorker = 0,
+  WorkerToDriver = 1,
+};
+
+struct ShmRingHeader;
+
+/// Shared memory segment holding the rings for a single worker.
+class ShmRingSegment final {
+  std::string name;
+  uint8_t *base;
+  bool isOwner;
+
+  ShmRingSegment(std::string &&name, uint8_t *base, bool isOwner)
+      : name(std::move(name)), base(base), isOwner(isOwner) {}
+
+public:
+  ShmRingSegment(const ShmRingSegment &) = delete;
+  ShmRingSegment &operator=(const ShmRingSegment &) = delete;
+  ~ShmRingSegment();
+
+  /// Called by the driver. Exits on failure.
+  static std::shared_ptr<ShmRingSegment> create(std::string &&name);
+  /// Called by the worker. Exits on failure.
+  static std::shared_ptr<ShmRingSegment> open(std::string &&name);
+  static void removeIfPresent(const std::string &name);
+
+  ShmRingHeader &header(ShmRingDirection);
+  uint8_t *data(ShmRingDirection);
+
+  /// Discard any pending messages in both directions.
+  ///
+  /// Only safe to call when there is no process at the other end
+  /// (e.g. before spawning a worker).
+  void reset();
+};
+
+/// The set of eventfds used for a single worker.
+struct ShmRingEventFds {
+  enum Index : size_t {
+    DriverToWorkerData = 0,
+    DriverToWorkerSpace,
+    WorkerToDriverData,
+    WorkerToDriverSpace,
+    Count,
+  };
+  std::array<int, Index::Count> fds;
+
+  /// Exits on failure.
+  static ShmRingEventFds create();
+  static std::optional<ShmRingEventFds> fromVector(const std::vector<int> &);
+
+  std::string toCliValue() const;
+  void setInheritable(bool inheritable) const;
+  /// Reset all counters to zero.
+  void drain() const;
+  void closeAll();
+
+  int dataFd(ShmRingDirection direction) const {
+    return this->fds[direction == ShmRingDirection::DriverToWorker
+                         ? DriverToWorkerData
+                         : WorkerToDriverData];
+  }
+  int spaceFd(ShmRingDirection direction) const {
+    return this->fds[direction == ShmRingDirection::DriverToWorker
+                         ? DriverToWorkerSpace
+                         : WorkerToDriverSpace];
+  }
+};
+
+class ShmRingChannel final : public IpcChannel {
+  std::shared_ptr<ShmRingSegment> segment;
+  ShmRingDirection direction;
+  int dataFd;
+  int spaceFd;
+  /// How long \c send waits for the reader to make room, if bounded.
+  std::optional<std::chrono::milliseconds> sendTimeout;
+
+public:
+  ShmRingChannel(
+      std::shared_ptr<ShmRingSegment> segment, ShmRingDirection direction,
+      const ShmRingEventFds &eventFds,
+      std::optional<std::chrono::milliseconds> sendTimeout = std::nullopt)
+      : segment(std::move(segment)), direction(direction),
+        dataFd(eventFds.dataFd(direction)),
+        spaceFd(eventFds.spaceFd(direction)), sendTimeout(sendTimeout) {}
+
+  bool send(std::string_view message) override;
+  bool timedReceive(std::string &message, uint64_t waitMillis) override;
+  size_t maxMessageSize() const override;
+
+  /// Non-blocking version of \c timedReceive.
+  bool tryReceive(std::string &message);
+};
+
+/// Create the channels for a worker, returned as
+/// (driver->worker, worker->driver). Exits on failure.
+std::pair<std::unique_ptr<IpcChannel>, std::unique_ptr<IpcChannel>>
+openShmRingChannelsForWorker(const IpcOptions &);
+
+/// Driver-side state for the shared memory transport.
+class ShmRingDriverTransport final {
+  std::vector<std::shared_ptr<ShmRingSegment>> segments;
+  std::vector<ShmRingEventFds> eventFds;
+  std::vector<ShmRingChannel> receivers;
+  int epollFd;
+  int timerFd;
+
+public:
+  using Instant = std::chrono::steady_clock::time_point;
+
+  ShmRingDriverTransport(std::string_view driverId, size_t numWorkers);
+  ShmRingDriverTransport(const ShmRingDriverTransport &) = delete;
+  ShmRingDriverTransport &operator=(const ShmRingDriverTransport &) = delete;
+  ~ShmRingDriverTransport();
+
+  /// The driver handles timeouts on the same thread, so sends give up
+  /// after \p sendTimeout instead of blocking on a hung or dead worker.
+  std::unique_ptr<IpcChannel> makeSender(uint64_t workerId,
+                                         std::chrono::milliseconds sendTimeout);
+
+  /// Should be called right before (re)spawning a worker.
+  void resetWorker(uint64_t workerId);
+  void addWorkerArgs(uint64_t workerId, std::vector<std::string> &args) const;
+  /// The worker's eventfds should only be inheritable while spawning it.
+  void setInheritable(uint64_t workerId, bool inheritable) const;
+
+  /// Arm the timer to fire at \p deadline, or disarm it if unset.
+  void armTimer(std::optional<Instant> deadline);
+
+  /// Block until at least one message is available, or the timer fires.
+  void wait(std::vector<std::pair<uint64_t, std::string>> &messages,
+            bool &timerExpired);
+};
+
+} // namespace scip_clang
+
+#endif // __linux__
+
+#endif // SCIP_CLANG_SHM_IPC_H
@@ -1,8 +1,11 @@
+#include <string>
 #include <string_view>
 #include <vector>
 
 #include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
 
+#include "indexer/LlvmAdapter.h"
 #include "indexer/Statistics.h"
 
 namespace scip_clang {
@@ -14,9 +17,45 @@ llvm::json::Value toJSON(const StatsEntry &entry) {
       {"stats",
        llvm::json::Object{
            {"total_time_s", double(stats.totalTimeMicros) / 1'000'000.0},
+           {"plan_wait_time_s",
+            double(stats.planWaitTimeMicros) / 1'000'000.0},
+           {"peak_rss_bytes", int64_t(stats.peakRssBytes)},
+           {"rss_after_bytes", int64_t(stats.rssAfterBytes)},
+           {"trimmed_bytes", int64_t(stats.trimmedBytes)},
+           {"worker_recycled", entry.workerRecycled},
        }}};
 }
 
+bool fromJSON(const llvm::json::Value &value, StatsEntry &entry,
+              llvm::json::Path path) {
+  llvm::json::ObjectMapper mapper(value, path);
+  if (!mapper || !mapper.map("filepath", entry.path)) {
+    return false;
+  }
+  auto *object = value.getAsObject();
+  auto *stats = object->getObject("stats");
+  if (!stats) {
+    path.field("stats").report("expected object");
+    return false;
+  }
+  auto toMicros = [](auto seconds) -> uint64_t {
+    return seconds ? uint64_t(*seconds * 1'000'000.0) : 0;
+  };
+  // Older files may not have all the fields, so don't fail on those.
+  entry.stats.totalTimeMicros = toMicros(stats->getNumber("total_time_s"));
+  entry.stats.planWaitTimeMicros =
+      toMicros(stats->getNumber("plan_wait_time_s"));
+  auto toBytes = [&](llvm::StringRef key) -> uint64_t {
+    auto bytes = stats->getInteger(key);
+    return (bytes && *bytes > 0) ? uint64_t(*bytes) : 0;
+  };
+  entry.stats.peakRssBytes = toBytes("peak_rss_bytes");
+  entry.stats.rssAfterBytes = toBytes("rss_after_bytes");
+  entry.stats.trimmedBytes = toBytes("trimmed_bytes");
+  entry.workerRecycled = stats->getBoolean("worker_recycled").value_or(false);
+  return true;
+}
+
 // static
 void StatsEntry::emitAll(std::vector<StatsEntry> &&stats,
                          std::string_view path) {
@@ -32,4 +71,26 @@ void StatsEntry::emitAll(std::vector<StatsEntry> &&stats,
   jsonStream.flush();
 }
 
+// static
+bool StatsEntry::readAll(std::string_view path, std::vector<StatsEntry> &stats,
+                         std::string &error) {
+  auto bufferOrErr =
+      llvm::MemoryBuffer::getFile(llvm::Twine(path), /*IsText*/ true);
+  if (!bufferOrErr) {
+    error = bufferOrErr.getError().message();
+    return false;
+  }
+  auto valueOrErr = llvm::json::parse(bufferOrErr.get()->getBuffer());
+  if (auto err = valueOrErr.takeError()) {
+    error = llvm_ext::format(err);
+    return false;
+  }
+  llvm::json::Path::Root root("stats");
+  if (!fromJSON(*valueOrErr, stats, root)) {
+    error = llvm_ext::format(root.getError());
+    return false;
+  }
+  return true;
+}
+
 } // namespace scip_clang
\ No newline at end of file
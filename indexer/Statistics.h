@@ -10,11 +10,21 @@ namespace scip_clang {
 struct StatsEntry {
   std::string path;
   IndexingStatistics stats;
+  /// Whether the worker was retired after this TU; only set by the
+  /// driver. See NOTE(ref: worker-recycling).
+  bool workerRecycled = false;
 
   static void emitAll(std::vector<StatsEntry> &&stats, std::string_view path);
+
+  /// Reads a file written by \c emitAll, returning false and setting
+  /// \p error on failure.
+  static bool readAll(std::string_view path, std::vector<StatsEntry> &stats,
+                      std::string &error);
 };
 
 llvm::json::Value toJSON(const StatsEntry &entry);
+bool fromJSON(const llvm::json::Value &value, StatsEntry &entry,
+              llvm::json::Path path);
 
 } // namespace scip_clang
 
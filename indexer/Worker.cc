@@ -1,6 +1,7 @@
 #include <chrono>
 #include <compare>
 #include <cstdlib>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <ios>
@@ -36,6 +37,7 @@
 #include "scip/scip.pb.h"
 
 #include "indexer/AbslExtras.h"
+#include "indexer/Cancellation.h"
 #include "indexer/CliOptions.h"
 #include "indexer/Comparison.h"
 #include "indexer/CompilationDatabase.h"
@@ -49,8 +51,11 @@
 #include "indexer/JsonIpcQueue.h"
 #include "indexer/LlvmAdapter.h"
 #include "indexer/Logging.h"
+#include "indexer/MemoryUsage.h"
 #include "indexer/Path.h"
+#include "indexer/PathInterner.h"
 #include "indexer/ScipExtras.h"
+#include "indexer/SharedMemoryShards.h"
 #include "indexer/Statistics.h"
 #include "indexer/SymbolFormatter.h"
 #include "indexer/Timer.h"
@@ -183,6 +188,11 @@ struct IndexerPreprocessorOptions {
 
   // Sort for deterministic output while running the preprocessor.
   bool deterministic;
+
+  // Persists across TUs; see NOTE(ref: path-interning).
+  PathInterner *pathInterner;
+
+  ProgressReporter *progress;
 };
 
 // Small wrapper type for YAML serialization.
@@ -381,24 +391,45 @@ public:
         clangIdLookupMap.insert(absPathRef, hashValue, fileId);
       }
     }
+    std::vector<std::pair<AbsolutePathRef,
+                          const absl::flat_hash_map<HashValue, clang::FileID> *>>
+        pathsAndHashes;
     clangIdLookupMap.forEachPathAndHash(
         [&](AbsolutePathRef absPathRef,
             const absl::flat_hash_map<HashValue, clang::FileID> &map) {
-          if (map.size() == 1) {
-            for (auto &[hashValue, fileId] : map) {
-              result.wellBehavedFiles.emplace_back(
-                  PreprocessedFileInfo{AbsolutePath{absPathRef}, hashValue});
-            }
-          } else {
-            std::vector<HashValue> hashes;
-            hashes.reserve(map.size());
-            for (auto &[hashValue, fileId] : map) {
-              hashes.push_back(hashValue);
-            }
-            result.illBehavedFiles.emplace_back(PreprocessedFileInfoMulti{
-                AbsolutePath{absPathRef}, std::move(hashes)});
-          }
+          pathsAndHashes.emplace_back(absPathRef, &map);
         });
+    if (this->options.deterministic) {
+      // Sort before interning so that PathId values are deterministic.
+      absl::c_sort(pathsAndHashes, [](const auto &p1, const auto &p2) -> bool {
+        return p1.first.asStringView() < p2.first.asStringView();
+      });
+    }
+    auto &pathInterner = *this->options.pathInterner;
+    result.firstNewPathId = PathId{uint32_t(pathInterner.size())};
+    for (auto &[absPathRef, map] : pathsAndHashes) {
+      auto [pathId, isNewPath] = pathInterner.intern(absPathRef);
+      if (isNewPath) {
+        result.newPaths.emplace_back(absPathRef);
+      }
+      if (map->size() == 1) {
+        for (auto &[hashValue, fileId] : *map) {
+          result.wellBehavedFiles.emplace_back(
+              PreprocessedFileInfo{pathId, hashValue});
+        }
+      } else {
+        std::vector<HashValue> hashes;
+        hashes.reserve(map->size());
+        for (auto &[hashValue, fileId] : *map) {
+          hashes.push_back(hashValue);
+        }
+        if (this->options.deterministic) {
+          absl::c_sort(hashes);
+        }
+        result.illBehavedFiles.emplace_back(
+            PreprocessedFileInfoMulti{pathId, std::move(hashes)});
+      }
+    }
     if (this->options.deterministic) {
       absl::c_sort(result.wellBehavedFiles);
       absl::c_sort(result.illBehavedFiles);
@@ -520,6 +551,7 @@ public:
       ENFORCE(sourceLoc.isFileID(), "EnterFile called on a non-FileID");
       auto enteredFileId = this->sourceManager.getFileID(sourceLoc);
       this->enterFile(enteredFileId);
+      this->options.progress->tick();
       break;
     }
     }
@@ -532,6 +564,7 @@ public:
     ENFORCE(macroDirective != nullptr);
     auto *macroInfo = macroDirective->getMacroInfo();
     this->macroIndexer.saveDefinition(macroNameToken, macroInfo);
+    this->options.progress->tick();
     // FIXME: Mix the macro definition into the running hash
   }
 
@@ -557,6 +590,7 @@ public:
     // TODO: Handle macro arguments
     // Q: How/when should we use the SourceRange argument
     this->macroIndexer.saveReference(macroNameToken, macroDefinition);
+    this->options.progress->tick();
     // FIXME: Mix the expands into the running hash
   }
 
@@ -775,13 +809,24 @@ class IndexerAstVisitor : public clang::RecursiveASTVisitor<IndexerAstVisitor> {
   bool deterministic;
 
   TuIndexer &tuIndexer;
+  ProgressReporter &progress;
 
 public:
   IndexerAstVisitor(const StableFileIdMap &pathMap,
                     FileIdsToBeIndexedSet &&toBeIndexed, bool deterministic,
-                    TuIndexer &tuIndexer)
+                    TuIndexer &tuIndexer, ProgressReporter &progress)
       : stableFileIdMap(pathMap), toBeIndexed(std::move(toBeIndexed)),
-        deterministic(deterministic), tuIndexer(tuIndexer) {}
+        deterministic(deterministic), tuIndexer(tuIndexer),
+        progress(progress) {}
+
+  bool TraverseDecl(clang::Decl *decl) {
+    // See NOTE(ref: soft-cancellation)
+    if (scip_clang::isCurrentTaskCancelled()) {
+      return false;
+    }
+    this->progress.tick();
+    return Base::TraverseDecl(decl);
+  }
 
   // See clang/include/clang/Basic/DeclNodes.td for list of declarations.
 
@@ -907,6 +952,8 @@ struct IndexerAstConsumerOptions {
   RootPath buildRootPath;
   WorkerCallback getEmitIndexDetails;
   bool deterministic;
+  const PathInterner *pathInterner;
+  ProgressReporter *progress;
 };
 
 class IndexerAstConsumer : public clang::SemaConsumer {
@@ -923,7 +970,31 @@ public:
       : options(options), preprocessorWrapper(preprocessorWrapper),
         sema(nullptr), tuIndexingOutput(tuIndexingOutput) {}
 
+  bool HandleTopLevelDecl(clang::DeclGroupRef) override {
+    this->options.progress->tick();
+    // Returning false stops parsing; see NOTE(ref: soft-cancellation).
+    return !scip_clang::isCurrentTaskCancelled();
+  }
+
+  void HandleCXXImplicitFunctionInstantiation(clang::FunctionDecl *) override {
+    this->options.progress->tick();
+  }
+
+  // HandleTopLevelDecl is only called once a top-level declaration has
+  // been fully parsed, which may take arbitrarily long for a namespace,
+  // so also tick for the definitions inside it.
+  void HandleInlineFunctionDefinition(clang::FunctionDecl *) override {
+    this->options.progress->tick();
+  }
+
+  void HandleTagDeclDefinition(clang::TagDecl *) override {
+    this->options.progress->tick();
+  }
+
   void HandleTranslationUnit(clang::ASTContext &astContext) override {
+    if (scip_clang::isCurrentTaskCancelled()) {
+      return; // See NOTE(ref: soft-cancellation)
+    }
     // NOTE(ref: preprocessor-traversal-ordering): The call order is
     // 1. The preprocessor wrapper finishes running.
     // 2. This function is called.
@@ -946,6 +1017,7 @@ public:
     if (!shouldEmitIndex) {
       return;
     }
+    this->options.progress->enterPhase(WorkerPhase::Traversal);
 
     StableFileIdMap stableFileIdMap{this->options.projectRootPath,
                                     this->options.buildRootPath};
@@ -967,8 +1039,12 @@ public:
                                 stableFileIdMap, tuIndexer);
 
     IndexerAstVisitor visitor{stableFileIdMap, std::move(toBeIndexed),
-                              this->options.deterministic, tuIndexer};
+                              this->options.deterministic, tuIndexer,
+                              *this->options.progress};
     visitor.TraverseAST(astContext);
+    if (scip_clang::isCurrentTaskCancelled()) {
+      return; // See NOTE(ref: soft-cancellation)
+    }
 
     visitor.writeIndex(std::move(symbolFormatter), std::move(macroIndexer),
                        this->tuIndexingOutput);
@@ -1004,8 +1080,14 @@ private:
       }
     }
 
+    auto &pathInterner = *this->options.pathInterner;
     for (auto &fileInfo : emitIndexDetails.filesToBeIndexed) {
-      auto absPathRef = fileInfo.path.asRef();
+      if (fileInfo.pathId.value >= pathInterner.size()) {
+        spdlog::warn("received unknown path ID {} from Driver",
+                     fileInfo.pathId.value);
+        continue;
+      }
+      auto absPathRef = pathInterner.get(fileInfo.pathId).asRef();
       auto optFileId = clangIdLookupMap.lookup(absPathRef, fileInfo.hashValue);
       if (!optFileId.has_value()) {
         spdlog::debug(
@@ -1143,16 +1225,42 @@ WorkerOptions WorkerOptions::fromCliOptions(const CliOptions &cliOptions) {
                            cliOptions.preprocessorRecordHistoryFilterRegex,
                            cliOptions.preprocessorHistoryLogPath, false, ""},
                        cliOptions.temporaryOutputDir,
+                       cliOptions.shardStorage,
+                       cliOptions.provisionalPlans,
+                       cliOptions.shmClaimTable,
+                       cliOptions.trimMemoryBetweenTus,
                        cliOptions.workerFault};
 }
 
 Worker::Worker(WorkerOptions &&options)
     : options(std::move(options)), messageQueues(), compileCommands(),
-      commandIndex(0), recorder(), statistics() {
+      commandIndex(0), recorder(), statistics(), pathInterner(), shardLog(),
+      knownHeaderClaims() {
   switch (this->options.mode) {
   case WorkerMode::Ipc:
     this->messageQueues = std::make_unique<MessageQueuePair>(
         MessageQueuePair::forWorker(this->options.ipcOptions));
+    if (this->options.shardStorage == ShardStorage::WorkerLog) {
+      this->shardLog.emplace(scip_clang::shardLogPath(
+          this->options.temporaryOutputDir, this->options.ipcOptions.workerId));
+    }
+#ifdef __linux__
+    if (this->options.shmClaimTable) {
+      this->claimTable = ShmClaimTable::open(
+          scip_clang::claimTableShmName(this->options.ipcOptions.driverId));
+    }
+#endif
+    scip_clang::installCancellationHandler();
+    if (this->options.ipcOptions.heartbeatInterval.count() > 0) {
+      this->progress = ProgressReporter(
+          [this](WorkerPhase phase) {
+            this->messageQueues->workerToDriver.send(
+                IndexJobResponse{this->ipcOptions().workerId,
+                                 this->currentJobId, IndexJobResult{}, phase,
+                                 false});
+          },
+          this->options.ipcOptions.heartbeatInterval);
+    }
     break;
   case WorkerMode::Compdb: {
     auto compdbFile = compdb::CompilationDatabaseFile::openAndExitOnErrors(
@@ -1166,6 +1274,7 @@ Worker::Worker(WorkerOptions &&options)
     break;
   }
   case WorkerMode::Testing:
+  case WorkerMode::InProcess:
     break;
   }
 
@@ -1231,10 +1340,10 @@ void Worker::processTranslationUnit(SemanticAnalysisJobDetails &&job,
   IndexerPreprocessorOptions preprocessorOptions{
       this->options.projectRootPath,
       this->recorder.has_value() ? &this->recorder->second : nullptr,
-      this->options.deterministic};
+      this->options.deterministic, &this->pathInterner, &this->progress};
   IndexerAstConsumerOptions astConsumerOptions{
       this->options.projectRootPath, buildRootPath, std::move(workerCallback),
-      this->options.deterministic};
+      this->options.deterministic, &this->pathInterner, &this->progress};
   auto frontendActionFactory = IndexerFrontendActionFactory(
       preprocessorOptions, astConsumerOptions, tuIndexingOutput);
 
@@ -1254,6 +1363,30 @@ void Worker::processTranslationUnit(SemanticAnalysisJobDetails &&job,
   }
 }
 
+IndexingStatistics
+Worker::indexTranslationUnit(SemanticAnalysisJobDetails &&job,
+                             WorkerCallback plan,
+                             TuIndexingOutput &tuIndexingOutput) {
+  ENFORCE(this->options.mode == WorkerMode::InProcess);
+  ManualTimer indexingTimer{}, planWaitTimer{};
+  indexingTimer.start();
+  auto callback = [&](SemanticAnalysisJobResult &&semaResult,
+                      EmitIndexJobDetails &emitIndexDetails) -> bool {
+    bool shouldIndex;
+    TIME_IT(planWaitTimer,
+            shouldIndex = plan(std::move(semaResult), emitIndexDetails));
+    return shouldIndex;
+  };
+  this->processTranslationUnit(std::move(job), callback, tuIndexingOutput);
+  this->flushStreams();
+  indexingTimer.stop();
+  // Other threads are indexing TUs in the same process, so the peak
+  // RSS of the process says nothing about this TU.
+  return IndexingStatistics{
+      uint64_t(indexingTimer.value<std::chrono::microseconds>()),
+      uint64_t(planWaitTimer.value<std::chrono::microseconds>()), 0, 0, 0};
+}
+
 void Worker::emitIndex(scip::Index &&scipIndex, const StdPath &outputPath) {
   std::ofstream outputStream(outputPath, std::ios_base::out
                                              | std::ios_base::binary
@@ -1266,10 +1399,42 @@ void Worker::emitIndex(scip::Index &&scipIndex, const StdPath &outputPath) {
   scipIndex.SerializeToOstream(&outputStream);
 }
 
+bool Worker::emitShardsToSharedMemory(JobId emitIndexRequestId,
+                                      const TuIndexingOutput &tuIndexingOutput,
+                                      ShardPaths &shardPaths) {
+#ifdef __linux__
+  auto &ipcOptions = this->ipcOptions();
+  auto docsName =
+      scip_clang::shardShmName(ipcOptions.driverId, emitIndexRequestId.taskId(),
+                               ipcOptions.workerId, "docs_and_externals");
+  auto forwardDeclsName =
+      scip_clang::shardShmName(ipcOptions.driverId, emitIndexRequestId.taskId(),
+                               ipcOptions.workerId, "forward_decls");
+  if (!scip_clang::writeShardToSharedMemory(
+          docsName, tuIndexingOutput.docsAndExternals)) {
+    return false;
+  }
+  if (!scip_clang::writeShardToSharedMemory(forwardDeclsName,
+                                            tuIndexingOutput.forwardDecls)) {
+    scip_clang::removeSharedMemoryShard(docsName);
+    return false;
+  }
+  shardPaths = ShardPaths{AbsolutePath{std::move(docsName)},
+                          AbsolutePath{std::move(forwardDeclsName)},
+                          ShardStorage::SharedMemory};
+  return true;
+#else
+  (void)emitIndexRequestId;
+  (void)tuIndexingOutput;
+  (void)shardPaths;
+  return false;
+#endif
+}
+
 void Worker::sendResult(JobId requestId, IndexJobResult &&result) {
   ENFORCE(this->options.mode == WorkerMode::Ipc);
   this->messageQueues->workerToDriver.send(IndexJobResponse{
-      this->ipcOptions().workerId, requestId, std::move(result)});
+      this->ipcOptions().workerId, requestId, std::move(result), {}, false});
   this->flushStreams();
 }
 
@@ -1277,6 +1442,8 @@ Worker::ReceiveStatus Worker::processTranslationUnitAndRespond(
     IndexJobRequest &&semanticAnalysisRequest) {
   ManualTimer indexingTimer{};
   indexingTimer.start();
+  // See NOTE(ref: memory-budget)
+  scip_clang::resetPeakRss();
 
   SemanticAnalysisJobResult semaResult{};
   auto semaRequestId = semanticAnalysisRequest.id;
@@ -1290,6 +1457,7 @@ Worker::ReceiveStatus Worker::processTranslationUnitAndRespond(
        &callbackInvoked](SemanticAnalysisJobResult &&semaResult,
                          EmitIndexJobDetails &emitIndexDetails) -> bool {
     callbackInvoked++;
+    this->statistics.planWaitTimeMicros = 0;
     if (this->options.mode == WorkerMode::Compdb) {
       for (auto &fileInfo : semaResult.wellBehavedFiles) {
         emitIndexDetails.filesToBeIndexed.emplace_back(std::move(fileInfo));
@@ -1297,22 +1465,50 @@ Worker::ReceiveStatus Worker::processTranslationUnitAndRespond(
       for (auto &fileInfoMulti : semaResult.illBehavedFiles) {
         for (auto &hashValue : fileInfoMulti.hashValues) {
           emitIndexDetails.filesToBeIndexed.emplace_back(
-              PreprocessedFileInfo{fileInfoMulti.path, hashValue});
+              PreprocessedFileInfo{fileInfoMulti.pathId, hashValue});
         }
       }
       return true;
     }
+    if (this->options.provisionalPlans || this->options.shmClaimTable) {
+      // See NOTE(ref: provisional-plans) and NOTE(ref: shm-claim-table);
+      // the driver creates the EmitIndex job on its side, without sending
+      // it over.
+      this->computeLocalPlan(semaResult, emitIndexDetails.filesToBeIndexed);
+      if (this->options.shmClaimTable) {
+        // The driver doesn't need to know anything about the files,
+        // so avoid sending (and decoding) all the paths and hashes.
+        semaResult = SemanticAnalysisJobResult{};
+        semaResult.claimedInSharedTable = true;
+      } else {
+        semaResult.hasProvisionalPlan = true;
+        semaResult.provisionalPlan = emitIndexDetails.filesToBeIndexed;
+      }
+      this->sendResult(
+          semaRequestId,
+          IndexJobResult{.kind = IndexJob::Kind::SemanticAnalysis,
+                         .semanticAnalysis = std::move(semaResult)});
+      innerStatus = ReceiveStatus::OK;
+      emitIndexRequestId = semaRequestId.nextSubtask();
+      this->currentJobId = emitIndexRequestId;
+      return true;
+    }
     this->sendResult(semaRequestId,
                      IndexJobResult{.kind = IndexJob::Kind::SemanticAnalysis,
                                     .semanticAnalysis = std::move(semaResult)});
     IndexJobRequest emitIndexRequest{};
-    innerStatus = this->waitForRequest(emitIndexRequest);
+    ManualTimer planWaitTimer{};
+    TIME_IT(planWaitTimer,
+            innerStatus = this->waitForRequest(emitIndexRequest));
+    this->statistics.planWaitTimeMicros =
+        uint64_t(planWaitTimer.value<std::chrono::microseconds>());
     if (innerStatus != ReceiveStatus::OK) {
       return false;
     }
     ENFORCE(emitIndexRequest.job.kind == IndexJob::Kind::EmitIndex);
     emitIndexDetails = std::move(emitIndexRequest.job.emitIndex);
     emitIndexRequestId = emitIndexRequest.id;
+    this->currentJobId = emitIndexRequestId;
     return true;
   };
   TuIndexingOutput tuIndexingOutput{};
@@ -1320,21 +1516,40 @@ Worker::ReceiveStatus Worker::processTranslationUnitAndRespond(
 
   scip_clang::exceptionContext =
       fmt::format("processing {}", semaDetails.command.Filename);
+  this->currentJobId = semaRequestId;
+  scip_clang::setCurrentTask(semaRequestId.taskId());
+  this->progress.enterPhase(WorkerPhase::Parsing);
   this->processTranslationUnit(std::move(semaDetails), callback,
                                tuIndexingOutput);
   scip_clang::exceptionContext = "";
 
-  ENFORCE(callbackInvoked == 1,
+  // Parsing may be stopped before the callback is invoked.
+  bool cancelled = scip_clang::isCurrentTaskCancelled();
+  ENFORCE(callbackInvoked == 1 || (cancelled && callbackInvoked == 0),
           "callbackInvoked = {} for TU with main file '{}'", callbackInvoked,
           tuMainFilePath);
-  if (innerStatus != ReceiveStatus::OK) {
+  if (callbackInvoked == 1 && innerStatus != ReceiveStatus::OK) {
     return innerStatus;
   }
+  if (cancelled) {
+    // See NOTE(ref: soft-cancellation)
+    spdlog::info("cancelled job {} for '{}'", this->currentJobId.debugString(),
+                 tuMainFilePath);
+    if (this->options.mode == WorkerMode::Ipc) {
+      this->messageQueues->workerToDriver.send(
+          IndexJobResponse{this->ipcOptions().workerId, this->currentJobId,
+                           IndexJobResult{}, {}, true});
+      this->flushStreams();
+    }
+    return ReceiveStatus::OK;
+  }
 
   auto stopTimer = [&]() -> void {
     indexingTimer.stop();
     this->statistics.totalTimeMicros =
         uint64_t(indexingTimer.value<std::chrono::microseconds>());
+    this->statistics.peakRssBytes = scip_clang::peakRssBytes();
+    this->finishTranslationUnit(std::move(tuIndexingOutput));
   };
 
   if (this->options.mode == WorkerMode::Compdb) {
@@ -1342,29 +1557,48 @@ Worker::ReceiveStatus Worker::processTranslationUnitAndRespond(
     this->emitIndex(std::move(tuIndexingOutput.docsAndExternals), outputPath);
     stopTimer();
     if (!this->options.statsFilePath.empty()) {
-      StatsEntry::emitAll({StatsEntry{tuMainFilePath, this->statistics}},
-                          this->options.statsFilePath.c_str());
+      StatsEntry::emitAll(
+          {StatsEntry{tuMainFilePath, this->statistics, false}},
+          this->options.statsFilePath.c_str());
     }
     return ReceiveStatus::OK;
   }
 
-  StdPath prefix =
-      this->options.temporaryOutputDir
-      / fmt::format("job-{}-worker-{}", emitIndexRequestId.taskId(),
-                    this->ipcOptions().workerId);
-  StdPath docsAndExternalsOutputPath =
-      prefix.concat("-docs_and_externals.shard.scip");
-  StdPath forwardDeclsOutputPath = prefix.concat("-forward_decls.shard.scip");
-  this->emitIndex(std::move(tuIndexingOutput.docsAndExternals),
-                  docsAndExternalsOutputPath);
-  this->emitIndex(std::move(tuIndexingOutput.forwardDecls),
-                  forwardDeclsOutputPath);
+  this->progress.enterPhase(WorkerPhase::Serialization);
+  ShardPaths shardPaths;
+  ShardLogRecords shardLogRecords{};
+  if (this->shardLog.has_value()) {
+    shardLogRecords.docsAndExternals =
+        this->shardLog->append(tuIndexingOutput.docsAndExternals);
+    shardLogRecords.forwardDecls =
+        this->shardLog->append(tuIndexingOutput.forwardDecls);
+    // Flush before responding, so that the records survive even if
+    // this worker is killed later.
+    this->shardLog->flush();
+    shardPaths.storage = ShardStorage::WorkerLog;
+  } else if (this->options.shardStorage != ShardStorage::SharedMemory
+             || !this->emitShardsToSharedMemory(
+                 emitIndexRequestId, tuIndexingOutput, shardPaths)) {
+    StdPath prefix =
+        this->options.temporaryOutputDir
+        / fmt::format("job-{}-worker-{}", emitIndexRequestId.taskId(),
+                      this->ipcOptions().workerId);
+    StdPath docsAndExternalsOutputPath =
+        prefix.concat("-docs_and_externals.shard.scip");
+    StdPath forwardDeclsOutputPath =
+        prefix.concat("-forward_decls.shard.scip");
+    this->emitIndex(std::move(tuIndexingOutput.docsAndExternals),
+                    docsAndExternalsOutputPath);
+    this->emitIndex(std::move(tuIndexingOutput.forwardDecls),
+                    forwardDeclsOutputPath);
+    shardPaths = ShardPaths{AbsolutePath{docsAndExternalsOutputPath.string()},
+                            AbsolutePath{forwardDeclsOutputPath.string()},
+                            ShardStorage::File};
+  }
   stopTimer();
 
-  EmitIndexJobResult emitIndexResult{
-      this->statistics,
-      ShardPaths{AbsolutePath{docsAndExternalsOutputPath.string()},
-                 AbsolutePath{forwardDeclsOutputPath.string()}}};
+  EmitIndexJobResult emitIndexResult{this->statistics, std::move(shardPaths),
+                                     shardLogRecords};
 
   this->sendResult(emitIndexRequestId,
                    IndexJobResult{.kind = IndexJob::Kind::EmitIndex,
@@ -1372,6 +1606,21 @@ Worker::ReceiveStatus Worker::processTranslationUnitAndRespond(
   return Worker::ReceiveStatus::OK;
 }
 
+void Worker::finishTranslationUnit(TuIndexingOutput &&tuIndexingOutput) {
+  // The AST is gone by now, so this is the last of the TU's memory.
+  tuIndexingOutput = TuIndexingOutput{};
+  this->statistics.trimmedBytes = 0;
+  if (this->options.trimMemoryBetweenTus) {
+    auto rssBeforeTrim = scip_clang::currentRssBytes();
+    if (scip_clang::trimFreeMemory()) {
+      auto rssAfterTrim = scip_clang::currentRssBytes();
+      this->statistics.trimmedBytes =
+          rssBeforeTrim > rssAfterTrim ? rssBeforeTrim - rssAfterTrim : 0;
+    }
+  }
+  this->statistics.rssAfterBytes = scip_clang::currentRssBytes();
+}
+
 void Worker::flushStreams() {
   if (this->recorder) {
     this->recorder->first->flush();
@@ -1447,15 +1696,63 @@ Worker::ReceiveStatus Worker::waitForRequest(IndexJobRequest &request) {
     spdlog::debug("shutting down");
     return Status::Shutdown;
   }
+  this->knownHeaderClaims.insert(request.newHeaderClaims.begin(),
+                                 request.newHeaderClaims.end());
   spdlog::debug("received job {}", request.id.debugString());
   this->triggerFaultIfApplicable();
   return Status::OK;
 }
 
+void Worker::computeLocalPlan(const SemanticAnalysisJobResult &semaResult,
+                              std::vector<PreprocessedFileInfo> &plan) {
+  auto claimIfUnknown = [&](PathId pathId, HashValue hashValue) {
+    if (pathId.value >= this->pathInterner.size()) {
+      return;
+    }
+    auto path = this->pathInterner.get(pathId).asRef();
+#ifdef __linux__
+    if (this->claimTable) {
+      switch (this->claimTable->claim(path, hashValue)) {
+      case ShmClaimTable::ClaimStatus::AlreadyClaimed:
+        return;
+      case ShmClaimTable::ClaimStatus::Full:
+        if (!this->warnedAboutFullClaimTable) {
+          this->warnedAboutFullClaimTable = true;
+          spdlog::warn("header claim table is full; some headers may be "
+                       "indexed more than once");
+        }
+        [[fallthrough]];
+      case ShmClaimTable::ClaimStatus::Claimed:
+        plan.push_back(PreprocessedFileInfo{pathId, hashValue});
+        return;
+      }
+    }
+#endif
+    auto key = scip_clang::headerClaimKey(path, hashValue);
+    // Also record our own claims, so that later TUs processed by this
+    // worker don't index the same files again.
+    auto [_, inserted] = this->knownHeaderClaims.insert(key);
+    if (inserted) {
+      plan.push_back(PreprocessedFileInfo{pathId, hashValue});
+    }
+  };
+  // Same order as FileIndexingPlanner::saveSemaResult.
+  for (auto &fileInfoMulti : semaResult.illBehavedFiles) {
+    for (auto hashValue : fileInfoMulti.hashValues) {
+      claimIfUnknown(fileInfoMulti.pathId, hashValue);
+    }
+  }
+  for (auto &fileInfo : semaResult.wellBehavedFiles) {
+    claimIfUnknown(fileInfo.pathId, fileInfo.hashValue);
+  }
+}
+
 void Worker::run() {
   ENFORCE(this->options.mode != WorkerMode::Testing,
           "tests typically call method individually");
   [&]() {
+    // See NOTE(ref: tu-batching)
+    std::deque<BatchedSemanticAnalysisJob> batchedJobs;
     while (true) {
       IndexJobRequest request{};
       using Status = Worker::ReceiveStatus;
@@ -1469,8 +1766,20 @@ void Worker::run() {
   case Status::OK:               \
     break;                       \
   }
-      CHECK_STATUS(this->waitForRequest(request));
-      ENFORCE(request.job.kind == IndexJob::Kind::SemanticAnalysis);
+      if (batchedJobs.empty()) {
+        CHECK_STATUS(this->waitForRequest(request));
+        ENFORCE(request.job.kind == IndexJob::Kind::SemanticAnalysis);
+        batchedJobs.assign(std::make_move_iterator(request.batch.begin()),
+                           std::make_move_iterator(request.batch.end()));
+        request.batch.clear();
+      } else {
+        auto &batchedJob = batchedJobs.front();
+        request.id = batchedJob.id;
+        request.job = IndexJob{
+            .kind = IndexJob::Kind::SemanticAnalysis,
+            .semanticAnalysis = std::move(batchedJob.details)};
+        batchedJobs.pop_front();
+      }
       CHECK_STATUS(this->processTranslationUnitAndRespond(std::move(request)));
     }
   }();
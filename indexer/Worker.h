@@ -1,12 +1,16 @@
 #ifndef SCIP_CLANG_WORKER_H
 #define SCIP_CLANG_WORKER_H
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_set.h"
 #include "absl/functional/function_ref.h"
 #include "spdlog/fwd.h"
 
@@ -21,6 +25,9 @@
 #include "indexer/IpcMessages.h"
 #include "indexer/JsonIpcQueue.h"
 #include "indexer/Path.h"
+#include "indexer/PathInterner.h"
+#include "indexer/ShardLog.h"
+#include "indexer/ShmClaimTable.h"
 
 namespace scip_clang {
 
@@ -46,6 +53,9 @@ enum class WorkerMode {
   Compdb,
   /// The worker will have methods called by testing code.
   Testing,
+  /// The worker runs on a thread inside the driver process.
+  /// See NOTE(ref: in-process-workers).
+  InProcess,
 };
 
 struct WorkerOptions {
@@ -64,6 +74,11 @@ struct WorkerOptions {
   bool measureStatistics;
   PreprocessorHistoryRecordingOptions recordingOptions;
   StdPath temporaryOutputDir;
+  ShardStorage shardStorage;
+  bool provisionalPlans;
+  bool shmClaimTable;
+  /// See NOTE(ref: worker-recycling).
+  bool trimMemoryBetweenTus;
   std::string workerFault;
 
   // This is a static method instead of a constructor so that the
@@ -88,10 +103,59 @@ struct TuIndexingOutput {
   scip::Index forwardDecls;
 
   TuIndexingOutput() = default;
+  TuIndexingOutput(TuIndexingOutput &&) = default;
+  TuIndexingOutput &operator=(TuIndexingOutput &&) = default;
   TuIndexingOutput(const TuIndexingOutput &) = delete;
   TuIndexingOutput &operator=(const TuIndexingOutput &) = delete;
 };
 
+/// Sends heartbeats for NOTE(ref: worker-heartbeats).
+class ProgressReporter final {
+  /// Null if heartbeats are disabled.
+  std::function<void(WorkerPhase)> sendHeartbeat;
+  std::chrono::steady_clock::duration interval;
+  std::chrono::steady_clock::time_point lastSent;
+  WorkerPhase phase;
+
+public:
+  ProgressReporter()
+      : sendHeartbeat(), interval(), lastSent(), phase(WorkerPhase::Parsing) {}
+  ProgressReporter(std::function<void(WorkerPhase)> &&sendHeartbeat,
+                   std::chrono::steady_clock::duration interval)
+      : sendHeartbeat(std::move(sendHeartbeat)), interval(interval),
+        lastSent(), phase(WorkerPhase::Parsing) {}
+
+  /// Always sends a heartbeat, if enabled.
+  void enterPhase(WorkerPhase newPhase) {
+    this->phase = newPhase;
+    this->send();
+  }
+
+  /// Should be called whenever some progress is made. Sends a heartbeat
+  /// if none was sent for the past interval.
+  ///
+  /// The clock is checked on every call; skipping checks based on a tick
+  /// count would delay heartbeats indefinitely when ticks are sparse
+  /// (e.g. while parsing a single large namespace).
+  void tick() {
+    if (!this->sendHeartbeat) {
+      return;
+    }
+    if (std::chrono::steady_clock::now() - this->lastSent >= this->interval) {
+      this->send();
+    }
+  }
+
+private:
+  void send() {
+    if (!this->sendHeartbeat) {
+      return;
+    }
+    this->sendHeartbeat(this->phase);
+    this->lastSent = std::chrono::steady_clock::now();
+  }
+};
+
 class Worker final {
   WorkerOptions options;
 
@@ -114,10 +178,42 @@ class Worker final {
 
   IndexingStatistics statistics;
 
+  /// See NOTE(ref: path-interning).
+  PathInterner pathInterner;
+
+  /// Set iff options.mode == Ipc and
+  /// options.shardStorage == ShardStorage::WorkerLog
+  std::optional<ShardLogWriter> shardLog;
+
+  /// (path, hash) pairs known to have been claimed by some TU, either
+  /// as reported by the driver, or by this worker's own provisional plans.
+  ///
+  /// Only used if options.provisionalPlans is set.
+  /// See NOTE(ref: provisional-plans).
+  absl::flat_hash_set<HashValue> knownHeaderClaims;
+
+#ifdef __linux__
+  /// Non-null iff options.mode == Ipc and options.shmClaimTable is set.
+  /// See NOTE(ref: shm-claim-table).
+  std::unique_ptr<ShmClaimTable> claimTable;
+  bool warnedAboutFullClaimTable = false;
+#endif
+
+  /// Job for which heartbeats are sent; see NOTE(ref: worker-heartbeats).
+  JobId currentJobId;
+  ProgressReporter progress;
+
 public:
   Worker(WorkerOptions &&options);
   void run();
 
+  /// Indexes a TU on the calling thread, calling \p plan after semantic
+  /// analysis to decide which files to index. Only valid if
+  /// options.mode == InProcess; see NOTE(ref: in-process-workers).
+  IndexingStatistics indexTranslationUnit(SemanticAnalysisJobDetails &&,
+                                          WorkerCallback plan,
+                                          TuIndexingOutput &);
+
 private:
   const IpcOptions &ipcOptions() const;
 
@@ -129,11 +225,24 @@ private:
   };
 
   ReceiveStatus waitForRequest(IndexJobRequest &);
+  /// Decide which files to index without waiting for the driver, either
+  /// using NOTE(ref: provisional-plans) or NOTE(ref: shm-claim-table).
+  void computeLocalPlan(const SemanticAnalysisJobResult &,
+                        std::vector<PreprocessedFileInfo> &plan);
   void sendResult(JobId, IndexJobResult &&);
 
   ReceiveStatus
   processTranslationUnitAndRespond(IndexJobRequest &&semanticAnalysisRequest);
   void emitIndex(scip::Index &&scipIndex, const StdPath &outputPath);
+  /// Called once the worker is done with a TU, to free what is left of
+  /// the index, and give freed memory back to the OS if requested.
+  /// Records the RSS afterwards in \c statistics.
+  /// See NOTE(ref: worker-recycling).
+  void finishTranslationUnit(TuIndexingOutput &&);
+  /// Returns false if the caller should fall back to writing files.
+  bool emitShardsToSharedMemory(JobId emitIndexRequestId,
+                                const TuIndexingOutput &tuIndexingOutput,
+                                ShardPaths &shardPaths);
 
   ReceiveStatus processRequest(IndexJobRequest &&, IndexJobResult &);
   void triggerFaultIfApplicable() const;
@@ -0,0 +1,300 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <string_view>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "spdlog/fmt/fmt.h"
+#include "spdlog/spdlog.h"
+
+#include "boost/process/io.hpp"
+
+#include "indexer/Zygote.h"
+
+namespace scip_clang {
+
+static int openPidfd(pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  return int(::syscall(SYS_pidfd_open, pid, 0));
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static int pidfdSendSignal(int pidfd, int signal) {
+#if defined(__linux__) && defined(SYS_pidfd_send_signal)
+  return int(::syscall(SYS_pidfd_send_signal, pidfd, signal, nullptr, 0));
+#else
+  (void)pidfd;
+  (void)signal;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// static
+WorkerProcess WorkerProcess::forkedBy(Zygote &zygote, pid_t pid) {
+  // The zygote doesn't reap the worker until asked to, so the PID
+  // still refers to the worker here, even if it has already exited.
+  int pidfd = scip_clang::openPidfd(pid);
+  if (pidfd < 0 && errno != ENOSYS) {
+    spdlog::warn("failed to open pidfd for worker with pid {} ({})", pid,
+                 std::strerror(errno));
+  }
+  WorkerProcess process{boost::process::child()};
+  process.forked = Forked{&zygote, pid, pidfd, std::nullopt};
+  return process;
+}
+
+WorkerProcess::WorkerProcess(WorkerProcess &&other)
+    : child(std::move(other.child)),
+      forked(std::exchange(other.forked, std::nullopt)) {}
+
+WorkerProcess &WorkerProcess::operator=(WorkerProcess &&other) {
+  if (this != &other) {
+    this->closePidfd();
+    this->child = std::move(other.child);
+    this->forked = std::exchange(other.forked, std::nullopt);
+  }
+  return *this;
+}
+
+WorkerProcess::~WorkerProcess() {
+  this->closePidfd();
+}
+
+void WorkerProcess::closePidfd() {
+  if (this->forked.has_value() && this->forked->pidfd >= 0) {
+    ::close(this->forked->pidfd);
+    this->forked->pidfd = -1;
+  }
+}
+
+pid_t WorkerProcess::id() const {
+  return this->forked.has_value() ? this->forked->pid : this->child.id();
+}
+
+bool WorkerProcess::running() {
+  if (!this->forked.has_value()) {
+    return this->child.running();
+  }
+  return !this->reapForked(/*block*/ false);
+}
+
+bool WorkerProcess::reapForked(bool block) {
+  auto &forked = *this->forked;
+  if (forked.waitStatus.has_value()) {
+    return true;
+  }
+  if (forked.pidfd >= 0) {
+    // The pidfd becomes readable once the worker has exited, after
+    // which the zygote can reap it without blocking.
+    struct pollfd pollFd = {forked.pidfd, POLLIN, 0};
+    int ready;
+    do {
+      ready = ::poll(&pollFd, 1, block ? -1 : 0);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0 && !block) {
+      return false;
+    }
+    block = true;
+  }
+  auto waitStatus = forked.zygote->reapWorker(forked.pid, block);
+  if (!waitStatus.has_value()) {
+    return false;
+  }
+  forked.waitStatus = *waitStatus;
+  this->closePidfd();
+  return true;
+}
+
+std::optional<int> WorkerProcess::terminationSignal() {
+  int status;
+  if (this->forked.has_value()) {
+    if (!this->reapForked(/*block*/ false) || *this->forked->waitStatus < 0) {
+      return {};
+    }
+    status = *this->forked->waitStatus;
+  } else {
+    if (this->child.running()) {
+      return {};
+    }
+    // running() stores the raw status from waitpid once the child exits.
+    status = this->child.native_exit_code();
+  }
+  if (!WIFSIGNALED(status)) {
+    return {};
+  }
+  return WTERMSIG(status);
+}
+
+void WorkerProcess::terminate() {
+  if (!this->forked.has_value()) {
+    this->child.terminate();
+    return;
+  }
+  auto &forked = *this->forked;
+  if (forked.waitStatus.has_value()) {
+    return;
+  }
+  // Until the zygote reaps the worker, its PID cannot be reused, so
+  // even without a pidfd, this cannot kill an unrelated process.
+  int result = forked.pidfd >= 0
+                   ? scip_clang::pidfdSendSignal(forked.pidfd, SIGKILL)
+                   : ::kill(forked.pid, SIGKILL);
+  if (result != 0 && errno != ESRCH) {
+    spdlog::warn("failed to kill worker with pid {} ({})", forked.pid,
+                 std::strerror(errno));
+    return;
+  }
+  this->wait();
+}
+
+void WorkerProcess::wait() {
+  if (!this->forked.has_value()) {
+    this->child.wait();
+    return;
+  }
+  this->reapForked(/*block*/ true);
+}
+
+bool WorkerProcess::waitFor(std::chrono::milliseconds timeout) {
+  using namespace std::chrono_literals;
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (this->running()) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(5ms);
+  }
+  return true;
+}
+
+Zygote::Zygote(std::vector<std::string> &&args)
+    : requests(), replies(), process() {
+  args.push_back("--worker-mode=zygote");
+  spdlog::debug("spawning zygote with arguments: '{}'", fmt::join(args, " "));
+  this->process =
+      boost::process::child(args, boost::process::std_in < this->requests,
+                            boost::process::std_out > this->replies);
+  // Otherwise, workers spawned later on by the driver would inherit
+  // the write end, and the zygote would not see the driver closing it.
+  ::fcntl(this->requests.pipe().native_sink(), F_SETFD, FD_CLOEXEC);
+  ::fcntl(this->replies.pipe().native_source(), F_SETFD, FD_CLOEXEC);
+}
+
+Zygote::~Zygote() {
+  this->requests.flush();
+  this->requests.pipe().close();
+  this->process.wait();
+}
+
+std::optional<int64_t> Zygote::request(std::string_view command,
+                                       int64_t arg) {
+  this->requests << command << ' ' << arg << std::endl;
+  std::string line;
+  int64_t reply;
+  if (!std::getline(this->replies, line) || !absl::SimpleAtoi(line, &reply)) {
+    spdlog::warn("zygote exited unexpectedly");
+    return {};
+  }
+  return reply;
+}
+
+std::optional<WorkerProcess> Zygote::forkWorker(WorkerId workerId) {
+  auto pid = this->request("fork", int64_t(workerId));
+  if (!pid.has_value() || *pid <= 0) {
+    return {};
+  }
+  return WorkerProcess::forkedBy(*this, pid_t(*pid));
+}
+
+std::optional<int> Zygote::reapWorker(pid_t pid, bool block) {
+  auto waitStatus = this->request(block ? "wait" : "poll", pid);
+  if (!waitStatus.has_value()) {
+    return -1;
+  }
+  if (*waitStatus == -1) {
+    return {};
+  }
+  return *waitStatus < 0 ? -1 : int(*waitStatus);
+}
+
+static void redirectStdio() {
+  // The zygote's stdout is used for replies to the driver, so send any
+  // output from the worker to stderr instead. The worker doesn't need
+  // stdin either.
+  ::dup2(STDERR_FILENO, STDOUT_FILENO);
+  int devNull = ::open("/dev/null", O_RDONLY);
+  if (devNull >= 0) {
+    ::dup2(devNull, STDIN_FILENO);
+    ::close(devNull);
+  }
+}
+
+std::optional<WorkerId> zygoteMain() {
+  // Forked workers are not reaped until the driver asks for it, so
+  // their PIDs stay reserved; see NOTE(ref: worker-zygote).
+  spdlog::debug("zygote ready to fork workers");
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::pair<std::string_view, std::string_view> request =
+        absl::StrSplit(line, absl::MaxSplits(' ', 1));
+    auto [command, argText] = request;
+    int64_t arg;
+    if (!absl::SimpleAtoi(argText, &arg) || arg < 0
+        || (command != "fork" && command != "poll" && command != "wait")) {
+      spdlog::warn("ignoring malformed zygote request '{}'", line);
+      std::cout << -2 << std::endl;
+      continue;
+    }
+    if (command == "fork") {
+      pid_t pid = ::fork();
+      if (pid == 0) {
+        scip_clang::redirectStdio();
+        return WorkerId(arg);
+      }
+      if (pid < 0) {
+        spdlog::warn("failed to fork worker {} ({})", arg,
+                     std::strerror(errno));
+      }
+      std::cout << pid << std::endl;
+      continue;
+    }
+    int waitStatus;
+    pid_t result;
+    do {
+      result = ::waitpid(pid_t(arg), &waitStatus,
+                         command == "poll" ? WNOHANG : 0);
+    } while (result < 0 && errno == EINTR);
+    if (result < 0) {
+      spdlog::warn("failed to reap worker with pid {} ({})", arg,
+                   std::strerror(errno));
+      std::cout << -2 << std::endl;
+    } else if (result == 0) {
+      std::cout << -1 << std::endl;
+    } else {
+      std::cout << waitStatus << std::endl;
+    }
+  }
+  spdlog::debug("zygote shutting down");
+  return {};
+}
+
+} // namespace scip_clang
@@ -0,0 +1,150 @@
+#ifndef SCIP_CLANG_ZYGOTE_H
+#define SCIP_CLANG_ZYGOTE_H
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+#include "boost/process/child.hpp"
+#include "boost/process/pipe.hpp"
+
+#include "indexer/IpcMessages.h"
+
+namespace scip_clang {
+
+// NOTE(def: worker-zygote): By default, every worker re-invokes the
+// scip-clang executable, so it has to pay for loading and relocating
+// the (large) binary, running static initializers for LLVM, setting up
+// the symbolizer, parsing CLI options and initializing logging, before
+// it can open its queues. This adds up when there are many workers,
+// and when workers are respawned after crashes or timeouts.
+//
+// With --worker-spawn=zygote, the driver instead starts a single
+// "zygote" process with the same options as a worker, minus the
+// worker ID. After initialization, the zygote waits for requests from
+// the driver. For each request, it forks a worker, which only needs
+// to open its queues before it can start processing jobs. The same
+// zygote is used for the initial workers as well as for respawns.
+//
+// The protocol is line-based: the driver writes requests to the
+// zygote's stdin, and the zygote replies to each one on its stdout.
+// - 'fork <worker ID>': The zygote replies with the PID of the forked
+//   worker, or -1 if forking failed, in which case the driver falls
+//   back to exec-ing a worker.
+// - 'poll <PID>' and 'wait <PID>': The zygote reaps the worker, and
+//   replies with its raw wait status, or -2 if that failed. For 'poll',
+//   it replies with -1 instead if the worker is still running.
+// The zygote exits once its stdin is closed.
+//
+// Forked workers are children of the zygote, not the driver, so the
+// driver cannot wait on them directly. The zygote only reaps a worker
+// when the driver asks it to, so until then, the worker's PID cannot
+// be reused, even if the worker has exited. On Linux, the driver opens
+// a pidfd for each forked worker, which it uses to check whether the
+// worker has exited and to kill it, and only asks the zygote to reap
+// the worker once it has exited. Elsewhere (or if the kernel does not
+// support pidfds), the driver polls the zygote instead. This way, the
+// driver gets the exit status of forked workers too, and never signals
+// an unrelated process; see WorkerProcess.
+//
+// Since only the forking thread survives a fork, the zygote must not
+// start any threads before forking. Workers forked from the zygote do
+// not inherit any file descriptors from the driver, so this cannot be
+// combined with --ipc-transport=shm-ring.
+
+class Zygote;
+
+/// Handle for a worker process, which is either a child process of the
+/// driver, or forked by the zygote.
+class WorkerProcess final {
+  boost::process::child child;
+
+  struct Forked {
+    /// Must outlive the worker process handle.
+    Zygote *zygote;
+    pid_t pid;
+    /// -1 if pidfds are not supported.
+    int pidfd;
+    /// Set once the zygote has reaped the worker. -1 if the zygote
+    /// could not get the exit status.
+    std::optional<int> waitStatus;
+  };
+  /// Only set for workers forked by the zygote.
+  std::optional<Forked> forked;
+
+public:
+  WorkerProcess() = delete;
+  WorkerProcess(WorkerProcess &&);
+  WorkerProcess &operator=(WorkerProcess &&);
+  WorkerProcess(const WorkerProcess &) = delete;
+  WorkerProcess &operator=(const WorkerProcess &) = delete;
+  ~WorkerProcess();
+
+  explicit WorkerProcess(boost::process::child &&child)
+      : child(std::move(child)), forked() {}
+
+  static WorkerProcess forkedBy(Zygote &zygote, pid_t pid);
+
+  pid_t id() const;
+  bool running();
+  /// Returns the signal which killed the worker, if it has exited due
+  /// to a signal.
+  std::optional<int> terminationSignal();
+  /// Kills the worker and waits for it to exit.
+  void terminate();
+  void wait();
+  /// Returns false if the worker is still running after \p timeout.
+  bool waitFor(std::chrono::milliseconds timeout);
+
+private:
+  /// Returns true if the zygote has reaped the forked worker.
+  bool reapForked(bool block);
+  void closePidfd();
+};
+
+/// Driver-side handle for the zygote process.
+class Zygote final {
+  boost::process::opstream requests;
+  boost::process::ipstream replies;
+  boost::process::child process;
+
+public:
+  /// \p args should be the arguments for a worker, except for the
+  /// worker mode and the worker ID.
+  explicit Zygote(std::vector<std::string> &&args);
+  Zygote(const Zygote &) = delete;
+  Zygote &operator=(const Zygote &) = delete;
+
+  /// Closes the connection, which makes the zygote exit, and waits
+  /// for it. Already forked workers keep running.
+  ~Zygote();
+
+  /// Returns \c std::nullopt if the zygote failed to fork a worker.
+  std::optional<WorkerProcess> forkWorker(WorkerId workerId);
+
+  /// Reaps a worker forked by the zygote, waiting for it to exit first
+  /// if \p block is set. Returns the raw wait status, -1 if it could
+  /// not be obtained, or \c std::nullopt if the worker is still running.
+  std::optional<int> reapWorker(pid_t pid, bool block);
+
+private:
+  /// Returns \c std::nullopt if the zygote has exited.
+  std::optional<int64_t> request(std::string_view command, int64_t arg);
+};
+
+/// Runs the request loop of the zygote.
+///
+/// In forked workers, this returns the worker ID passed by the driver;
+/// the caller should then finish initialization (e.g. the logger name
+/// depends on the worker ID) and run \c workerMain. In the zygote
+/// itself, this returns \c std::nullopt once the driver has closed the
+/// connection.
+std::optional<WorkerId> zygoteMain();
+
+} // namespace scip_clang
+
+#endif // SCIP_CLANG_ZYGOTE_H
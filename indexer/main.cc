@@ -17,6 +17,7 @@
 #include "indexer/Enforce.h"
 #include "indexer/Version.h"
 #include "indexer/Worker.h"
+#include "indexer/Zygote.h"
 
 static scip_clang::CliOptions parseArguments(int argc, char *argv[]) {
   scip_clang::CliOptions cliOptions{};
@@ -49,6 +50,15 @@ static scip_clang::CliOptions parseArguments(int argc, char *argv[]) {
     "Store temporary files under a specific directory instead of using system APIs."
     "If set, this directory will not be deleted after indexing is complete.",
     cxxopts::value<std::string>(cliOptions.temporaryOutputDir));
+  parser.add_options("")(
+    "resume",
+    "Continue an indexing run which was interrupted, skipping translation units"
+    " which it already indexed, based on a journal in --temporary-output-dir."
+    " Requires passing the same --temporary-output-dir as the earlier run."
+    " The journal is only written when --temporary-output-dir is passed, and"
+    " not with --in-process, --shard-storage=shared-memory, --provisional-plans"
+    " or --shm-claim-table.",
+    cxxopts::value<bool>(cliOptions.resume));
   parser.add_options("")(
     "show-compiler-diagnostics",
     "Show Clang diagnostics triggered when running semantic analysis."
@@ -67,6 +77,178 @@ static scip_clang::CliOptions parseArguments(int argc, char *argv[]) {
     "receive-timeout-seconds",
     "How long should the driver wait for a worker before marking it as timed out?",
     cxxopts::value<uint32_t>()->default_value("300"));
+  parser.add_options("Advanced")(
+    "heartbeat-interval-seconds",
+    "How often should workers report progress to the driver? If non-zero,"
+    " a worker is only killed once it stops making progress for a while"
+    " (depending on what it is doing and how long the translation unit took"
+    " in --job-cost-history), instead of after --receive-timeout-seconds."
+    " Use 0 to disable heartbeats.",
+    cxxopts::value<uint32_t>()->default_value("0"));
+  parser.add_options("Advanced")(
+    "cancel-grace-period-seconds",
+    "[Linux only] If non-zero, when a worker times out, first ask it to"
+    " cancel the translation unit and move on to the next one, and only"
+    " kill the worker if it hasn't done so after this many seconds."
+    " Use 0 to always kill workers right away.",
+    cxxopts::value<uint32_t>()->default_value("0"));
+  parser.add_options("Advanced")(
+    "ipc-codec",
+    "Encoding for messages exchanged between the driver and workers."
+    " One of 'json' or 'binary'. The binary encoding is more compact and"
+    " cheaper to encode and decode, whereas JSON is easier to debug.",
+    cxxopts::value<std::string>()->default_value("json"));
+  parser.add_options("Advanced")(
+    "ipc-transport",
+    "Mechanism for exchanging messages between the driver and workers."
+    " One of 'message-queue' or 'shm-ring'. 'shm-ring' uses per-worker"
+    " shared memory rings with eventfd/epoll based waiting, and is only"
+    " supported on Linux.",
+    cxxopts::value<std::string>()->default_value("message-queue"));
+  parser.add_options("Advanced")(
+    "shard-storage",
+    "Where workers should write index shards for the driver to merge."
+    " One of 'file', 'shared-memory' or 'worker-log'. With 'shared-memory',"
+    " shards are kept in RAM instead of the temporary output directory,"
+    " falling back to files when available memory is low ('shared-memory'"
+    " is only supported on Linux). With 'worker-log', each worker appends"
+    " its shards to a single file instead of creating 2 files per TU.",
+    cxxopts::value<std::string>()->default_value("file"));
+  parser.add_options("Advanced")(
+    "max-tus-per-batch",
+    "Upper bound on how many translation units are sent to a worker in one go."
+    " The actual number adapts to how long translation units take to index,"
+    " so that small translation units are not dominated by IPC overhead."
+    " Use 1 to disable batching.",
+    cxxopts::value<uint32_t>(cliOptions.maxTusPerBatch)->default_value("8"));
+  parser.add_options("Advanced")(
+    "spare-workers",
+    "How many extra worker processes to keep waiting, so that one can take"
+    " over immediately when a worker is killed (e.g. after a crash), instead"
+    " of waiting for a replacement to start up. Spares are not counted"
+    " towards --jobs, as they don't do any work until they are needed.",
+    cxxopts::value<uint32_t>(cliOptions.numSpareWorkers)->default_value("0"));
+  parser.add_options("Advanced")(
+    "memory-budget-mb",
+    "If non-zero, only start indexing a translation unit once its expected"
+    " peak memory usage fits in this many MiB, alongside the translation units"
+    " which are already being indexed. Expected usage is taken from"
+    " --job-cost-history, falling back to an equal share of the budget per"
+    " worker. Translation units whose worker is killed (e.g. by the OOM"
+    " killer) are retried once at the end, one at a time."
+    " Use 0 to disable the budget.",
+    cxxopts::value<uint64_t>()->default_value("0"));
+  parser.add_options("Advanced")(
+    "autoscale-workers",
+    "[Linux only] Periodically adjust how many of the --jobs workers are"
+    " active, based on the CPU quota and memory limit of the cgroup that"
+    " scip-clang is running in, and on CPU and memory pressure (PSI)."
+    " Workers are shrunk when memory or CPU is contended, and grown back (up"
+    " to --jobs) when there is headroom. Each change is logged.",
+    cxxopts::value<bool>(cliOptions.autoscaleWorkers));
+  parser.add_options("Advanced")(
+    "recycle-worker-rss-mb",
+    "If non-zero, replace a worker with a fresh process once its RSS after"
+    " finishing a translation unit exceeds this many MiB, to get rid of"
+    " memory lost to allocator fragmentation. If there are --spare-workers,"
+    " a spare takes over right away. Use 0 to never recycle workers.",
+    cxxopts::value<uint64_t>()->default_value("0"));
+  parser.add_options("Advanced")(
+    "trim-memory-between-tus",
+    "Make workers return free memory to the OS after every translation"
+    " unit (using malloc_trim). Has no effect in builds which don't use"
+    " glibc.",
+    cxxopts::value<bool>(cliOptions.trimMemoryBetweenTus));
+  parser.add_options("Advanced")(
+    "worker-spawn",
+    "How worker processes are started. One of 'exec' or 'zygote'. With"
+    " 'exec', every worker re-invokes scip-clang from scratch. With 'zygote',"
+    " a single pre-initialized process forks workers on request, which makes"
+    " starting and respawning workers cheaper. 'zygote' cannot be combined"
+    " with --ipc-transport=shm-ring or --preprocessor-record-history-filter.",
+    cxxopts::value<std::string>()->default_value("exec"));
+  parser.add_options("Advanced")(
+    "in-process",
+    "Index translation units on --jobs threads inside a single process,"
+    " instead of spawning worker processes. This avoids IPC and temporary"
+    " files, but a crash in any translation unit aborts indexing, and"
+    " translation units which take too long are not timed out."
+    " Options related to worker processes are ignored.",
+    cxxopts::value<bool>(cliOptions.inProcess));
+  parser.add_options("Advanced")(
+    "quarantine-db",
+    "Path to a file recording translation units which crashed, timed out or"
+    " ran out of memory in earlier runs. It is read at startup (if present)"
+    " and updated at the end. Translation units which failed in any of the"
+    " last --quarantine-runs runs are handled as per --quarantine-policy,"
+    " unless the compile command or the contents of the main file changed."
+    " Cannot be combined with --in-process.",
+    cxxopts::value<std::string>(cliOptions.quarantineDbPath));
+  parser.add_options("Advanced")(
+    "quarantine-runs",
+    "How many runs a translation unit stays quarantined for after failing.",
+    cxxopts::value<uint32_t>(cliOptions.quarantineRuns)->default_value("3"));
+  parser.add_options("Advanced")(
+    "quarantine-policy",
+    "What to do with quarantined translation units. One of 'defer' or 'skip'."
+    " With 'defer', they are indexed after all other translation units, with"
+    " --quarantine-timeout-seconds as the timeout. With 'skip', they are not"
+    " indexed at all.",
+    cxxopts::value<std::string>()->default_value("defer"));
+  parser.add_options("Advanced")(
+    "quarantine-timeout-seconds",
+    "Timeout for indexing a quarantined translation unit with"
+    " --quarantine-policy=defer, if lower than the usual timeout.",
+    cxxopts::value<uint32_t>()->default_value("60"));
+  parser.add_options("Advanced")(
+    "provisional-plans",
+    "Let workers decide which headers to index based on a summary of headers"
+    " already claimed by other workers, instead of waiting for the driver"
+    " after semantic analysis. The driver reconciles the plans afterwards.",
+    cxxopts::value<bool>(cliOptions.provisionalPlans));
+  parser.add_options("Advanced")(
+    "shm-claim-table",
+    "Let workers claim headers to index in a lock-free table in shared memory"
+    " created by the driver, instead of waiting for the driver after semantic"
+    " analysis. Only supported on Linux; cannot be combined with"
+    " --provisional-plans.",
+    cxxopts::value<bool>(cliOptions.shmClaimTable));
+  parser.add_options("Advanced")(
+    "job-order",
+    "Order in which translation units are handed out to workers."
+    " One of 'fifo' (compilation database order), 'longest-first' or"
+    " 'header-coverage'. With the latter two, the whole compilation database"
+    " is read upfront. With 'longest-first', translation units expected to"
+    " take the longest are indexed first, reducing the time workers spend"
+    " idle near the end. With 'header-coverage', translation units which"
+    " include the most headers not included by earlier ones go first, so that"
+    " later translation units have fewer headers to emit; see also"
+    " --include-set-cache.",
+    cxxopts::value<std::string>()->default_value("fifo"));
+  parser.add_options("Advanced")(
+    "job-cost-history",
+    "Path to a file written by --print-statistics-path in an earlier run,"
+    " used for estimating how long translation units take with"
+    " --job-order=longest-first and --heartbeat-interval-seconds, and how"
+    " much memory they need with --memory-budget-mb."
+    " Translation units which are not present are estimated based on file"
+    " size and number of arguments.",
+    cxxopts::value<std::string>(cliOptions.jobCostHistoryPath));
+  parser.add_options("Advanced")(
+    "include-set-cache",
+    "Path to a file recording the headers used by each translation unit."
+    " It is read at startup (if present) for --job-order=header-coverage,"
+    " and updated at the end of indexing. Translation units which are not"
+    " present are estimated by scanning for #include directives.",
+    cxxopts::value<std::string>(cliOptions.includeSetCachePath));
+  parser.add_options("Advanced")(
+    "balance-header-claims",
+    "Spread out the work of emitting headers across translation units, by"
+    " letting a translation unit leave some headers to be indexed by a later"
+    " one if the worker has been assigned more than its share of work."
+    " Requires --include-set-cache; cannot be combined with"
+    " --provisional-plans or --shm-claim-table.",
+    cxxopts::value<bool>(cliOptions.balanceHeaderClaims));
   parser.add_options("Advanced")(
     "deterministic",
     "Try to run everything in a deterministic fashion as much as possible."
@@ -99,7 +281,7 @@ static scip_clang::CliOptions parseArguments(int argc, char *argv[]) {
   parser.add_options("Internal")(
     "worker-mode",
     "[worker-only] Spawn an indexing worker instead of invoking the driver directly."
-    " One of 'ipc', 'compdb' or 'testing'.",
+    " One of 'ipc', 'compdb', 'testing' or 'zygote'.",
     cxxopts::value<std::string>(cliOptions.workerMode)->default_value(""));
   parser.add_options("Internal")(
     "driver-id",
@@ -111,6 +293,11 @@ static scip_clang::CliOptions parseArguments(int argc, char *argv[]) {
     "worker-id",
     "[worker-only] An opaque ID for the worker itself.",
     cxxopts::value<uint64_t>(cliOptions.workerId));
+  parser.add_options("Internal")(
+    "ipc-eventfds",
+    "[worker-only] Comma-separated eventfds inherited from the driver,"
+    " used with --ipc-transport=shm-ring.",
+    cxxopts::value<std::vector<int>>(cliOptions.ipcEventFds));
   parser.add_options("Testing")(
     "force-worker-fault",
     "One of 'crash', 'sleep' or 'spin'."
@@ -166,13 +353,215 @@ static scip_clang::CliOptions parseArguments(int argc, char *argv[]) {
 
   if (!cliOptions.workerMode.empty() && cliOptions.workerMode != "ipc"
       && cliOptions.workerMode != "compdb"
-      && cliOptions.workerMode != "testing") {
-    spdlog::error("--worker-mode must be 'ipc', 'compdb' or 'testing'");
+      && cliOptions.workerMode != "testing"
+      && cliOptions.workerMode != "zygote") {
+    spdlog::error(
+        "--worker-mode must be 'ipc', 'compdb', 'testing' or 'zygote'");
     std::exit(EXIT_FAILURE);
   }
 
   cliOptions.receiveTimeout =
       std::chrono::seconds(result["receive-timeout-seconds"].as<uint32_t>());
+  cliOptions.heartbeatInterval = std::chrono::seconds(
+      result["heartbeat-interval-seconds"].as<uint32_t>());
+  cliOptions.cancelGracePeriod = std::chrono::seconds(
+      result["cancel-grace-period-seconds"].as<uint32_t>());
+#ifndef __linux__
+  if (cliOptions.cancelGracePeriod.count() > 0) {
+    spdlog::error("--cancel-grace-period-seconds is only supported on Linux");
+    std::exit(EXIT_FAILURE);
+  }
+#endif
+  cliOptions.memoryBudgetBytes =
+      result["memory-budget-mb"].as<uint64_t>() * 1024 * 1024;
+  cliOptions.recycleWorkerRssBytes =
+      result["recycle-worker-rss-mb"].as<uint64_t>() * 1024 * 1024;
+#ifndef __linux__
+  if (cliOptions.autoscaleWorkers) {
+    spdlog::error("--autoscale-workers is only supported on Linux");
+    std::exit(EXIT_FAILURE);
+  }
+#endif
+
+  auto ipcCodec = result["ipc-codec"].as<std::string>();
+  if (ipcCodec == "json") {
+    cliOptions.ipcCodec = scip_clang::IpcCodec::Json;
+  } else if (ipcCodec == "binary") {
+    cliOptions.ipcCodec = scip_clang::IpcCodec::Binary;
+  } else {
+    spdlog::error("--ipc-codec must be 'json' or 'binary'");
+    std::exit(EXIT_FAILURE);
+  }
+
+  auto ipcTransport = result["ipc-transport"].as<std::string>();
+  if (ipcTransport == "message-queue") {
+    cliOptions.ipcTransport = scip_clang::IpcTransport::MessageQueue;
+  } else if (ipcTransport == "shm-ring") {
+#ifdef __linux__
+    cliOptions.ipcTransport = scip_clang::IpcTransport::ShmRing;
+#else
+    spdlog::error("--ipc-transport=shm-ring is only supported on Linux");
+    std::exit(EXIT_FAILURE);
+#endif
+  } else {
+    spdlog::error("--ipc-transport must be 'message-queue' or 'shm-ring'");
+    std::exit(EXIT_FAILURE);
+  }
+
+  auto shardStorage = result["shard-storage"].as<std::string>();
+  if (shardStorage == "file") {
+    cliOptions.shardStorage = scip_clang::ShardStorage::File;
+  } else if (shardStorage == "shared-memory") {
+#ifdef __linux__
+    cliOptions.shardStorage = scip_clang::ShardStorage::SharedMemory;
+#else
+    spdlog::error("--shard-storage=shared-memory is only supported on Linux");
+    std::exit(EXIT_FAILURE);
+#endif
+  } else if (shardStorage == "worker-log") {
+    cliOptions.shardStorage = scip_clang::ShardStorage::WorkerLog;
+  } else {
+    spdlog::error(
+        "--shard-storage must be 'file', 'shared-memory' or 'worker-log'");
+    std::exit(EXIT_FAILURE);
+  }
+
+  auto workerSpawn = result["worker-spawn"].as<std::string>();
+  if (workerSpawn == "exec") {
+    cliOptions.workerSpawn = scip_clang::WorkerSpawn::Exec;
+  } else if (workerSpawn == "zygote") {
+    cliOptions.workerSpawn = scip_clang::WorkerSpawn::Zygote;
+    // See NOTE(ref: worker-zygote)
+    if (cliOptions.ipcTransport == scip_clang::IpcTransport::ShmRing) {
+      spdlog::error("--worker-spawn=zygote cannot be combined with "
+                    "--ipc-transport=shm-ring");
+      std::exit(EXIT_FAILURE);
+    }
+    // The log path is different for every worker.
+    if (!cliOptions.preprocessorRecordHistoryFilterRegex.empty()) {
+      spdlog::error("--worker-spawn=zygote cannot be combined with "
+                    "--preprocessor-record-history-filter");
+      std::exit(EXIT_FAILURE);
+    }
+  } else {
+    spdlog::error("--worker-spawn must be 'exec' or 'zygote'");
+    std::exit(EXIT_FAILURE);
+  }
+
+  if (cliOptions.maxTusPerBatch == 0) {
+    spdlog::error("--max-tus-per-batch must be at least 1");
+    std::exit(EXIT_FAILURE);
+  }
+
+  auto jobOrder = result["job-order"].as<std::string>();
+  if (jobOrder == "fifo") {
+    cliOptions.jobOrder = scip_clang::JobOrder::Fifo;
+  } else if (jobOrder == "longest-first") {
+    cliOptions.jobOrder = scip_clang::JobOrder::LongestFirst;
+  } else if (jobOrder == "header-coverage") {
+    cliOptions.jobOrder = scip_clang::JobOrder::HeaderCoverage;
+  } else {
+    spdlog::error("--job-order must be 'fifo', 'longest-first' or "
+                  "'header-coverage'");
+    std::exit(EXIT_FAILURE);
+  }
+  if (!cliOptions.jobCostHistoryPath.empty()
+      && cliOptions.jobOrder != scip_clang::JobOrder::LongestFirst
+      && cliOptions.heartbeatInterval.count() == 0
+      && cliOptions.memoryBudgetBytes == 0) {
+    spdlog::warn("--job-cost-history is only used with "
+                 "--job-order=longest-first, --heartbeat-interval-seconds or "
+                 "--memory-budget-mb");
+  }
+  if (!cliOptions.includeSetCachePath.empty() && cliOptions.shmClaimTable) {
+    spdlog::warn("--include-set-cache will not be updated with "
+                 "--shm-claim-table, as the driver doesn't see the headers");
+  }
+
+  if (cliOptions.balanceHeaderClaims) {
+    if (cliOptions.includeSetCachePath.empty()) {
+      spdlog::error("--balance-header-claims requires --include-set-cache");
+      std::exit(EXIT_FAILURE);
+    }
+    if (cliOptions.provisionalPlans || cliOptions.shmClaimTable) {
+      spdlog::error("--balance-header-claims cannot be combined with "
+                    "--provisional-plans or --shm-claim-table");
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  if (cliOptions.inProcess
+      && (cliOptions.provisionalPlans || cliOptions.shmClaimTable)) {
+    // Threads share the planner, so there is nothing to coordinate.
+    spdlog::error("--in-process cannot be combined with --provisional-plans "
+                  "or --shm-claim-table");
+    std::exit(EXIT_FAILURE);
+  }
+  if (cliOptions.inProcess && cliOptions.memoryBudgetBytes > 0) {
+    // Threads share one process, so per-TU memory usage is unknown.
+    spdlog::error("--in-process cannot be combined with --memory-budget-mb");
+    std::exit(EXIT_FAILURE);
+  }
+  if (cliOptions.inProcess && cliOptions.autoscaleWorkers) {
+    spdlog::error("--in-process cannot be combined with --autoscale-workers");
+    std::exit(EXIT_FAILURE);
+  }
+  if (cliOptions.inProcess && cliOptions.recycleWorkerRssBytes > 0) {
+    // Threads share one heap, so there is no worker to recycle.
+    spdlog::error(
+        "--in-process cannot be combined with --recycle-worker-rss-mb");
+    std::exit(EXIT_FAILURE);
+  }
+
+  auto quarantinePolicy = result["quarantine-policy"].as<std::string>();
+  if (quarantinePolicy == "defer") {
+    cliOptions.quarantinePolicy = scip_clang::QuarantinePolicy::Defer;
+  } else if (quarantinePolicy == "skip") {
+    cliOptions.quarantinePolicy = scip_clang::QuarantinePolicy::Skip;
+  } else {
+    spdlog::error("--quarantine-policy must be 'defer' or 'skip'");
+    std::exit(EXIT_FAILURE);
+  }
+  cliOptions.quarantineTimeout = std::chrono::seconds(
+      result["quarantine-timeout-seconds"].as<uint32_t>());
+  if (cliOptions.quarantineRuns == 0) {
+    spdlog::error("--quarantine-runs must be at least 1");
+    std::exit(EXIT_FAILURE);
+  }
+  if (cliOptions.inProcess && !cliOptions.quarantineDbPath.empty()) {
+    // A crash takes down the driver too, so there is nothing to record.
+    spdlog::error("--in-process cannot be combined with --quarantine-db");
+    std::exit(EXIT_FAILURE);
+  }
+
+  if (cliOptions.resume) {
+    if (cliOptions.temporaryOutputDir.empty()) {
+      spdlog::error("--resume requires --temporary-output-dir");
+      std::exit(EXIT_FAILURE);
+    }
+    // See NOTE(ref: indexing-journal) for why there is no journal.
+    if (cliOptions.inProcess || cliOptions.provisionalPlans
+        || cliOptions.shmClaimTable
+        || cliOptions.shardStorage == scip_clang::ShardStorage::SharedMemory) {
+      spdlog::error("--resume cannot be combined with --in-process, "
+                    "--provisional-plans, --shm-claim-table or "
+                    "--shard-storage=shared-memory");
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  if (cliOptions.shmClaimTable) {
+#ifdef __linux__
+    if (cliOptions.provisionalPlans) {
+      spdlog::error(
+          "--shm-claim-table cannot be combined with --provisional-plans");
+      std::exit(EXIT_FAILURE);
+    }
+#else
+    spdlog::error("--shm-claim-table is only supported on Linux");
+    std::exit(EXIT_FAILURE);
+#endif
+  }
 
   cliOptions.isTesting = result["testing"].count() > 0;
 
@@ -199,11 +588,25 @@ static void initializeGlobalLogger(std::string name,
 int main(int argc, char *argv[]) {
   scip_clang::initializeSymbolizer(argv[0]);
   auto cliOptions = parseArguments(argc, argv);
+  bool forTesting = !cliOptions.workerFault.empty();
+  if (cliOptions.workerMode == "zygote") {
+    initializeGlobalLogger("zygote", cliOptions.logLevel, forTesting);
+    auto workerId = scip_clang::zygoteMain();
+    if (!workerId.has_value()) {
+      return EXIT_SUCCESS;
+    }
+    // Forked worker; see NOTE(ref: worker-zygote).
+    cliOptions.workerMode = "ipc";
+    cliOptions.workerId = *workerId;
+    spdlog::drop_all();
+    initializeGlobalLogger(fmt::format("worker {}", cliOptions.workerId),
+                           cliOptions.logLevel, forTesting);
+    return scip_clang::workerMain(std::move(cliOptions));
+  }
   bool isWorker = !cliOptions.workerMode.empty();
   auto loggerName =
       isWorker ? fmt::format("worker {}", cliOptions.workerId) : "driver";
-  initializeGlobalLogger(loggerName, cliOptions.logLevel,
-                         !cliOptions.workerFault.empty());
+  initializeGlobalLogger(loggerName, cliOptions.logLevel, forTesting);
   if (isWorker) {
     return scip_clang::workerMain(std::move(cliOptions));
   }
@@ -3,25 +3,47 @@
 // library code rather than our own code, but this gives
 // confidence that if the driver is not handling timeouts
 // properly, that's a bug in the driver.
+//
+// It also has a --benchmark mode for comparing the different
+// codecs available for IPC messages, a --spawn-benchmark mode for
+// comparing worker startup latency with and without
+// NOTE(ref: worker-zygote), and --shm-ring-hang and --shm-ring-full
+// modes which check timeouts for NOTE(ref: shm-ring-transport).
 
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <optional>
+#include <string>
 #include <thread>
+#include <unistd.h>
+#include <vector>
 
 #include "boost/process/child.hpp"
 #include "boost/process/io.hpp"
 
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/Support/JSON.h"
 
 #include "indexer/CliOptions.h"
 #include "indexer/Enforce.h"
 #include "indexer/JsonIpcQueue.h"
+#include "indexer/ShmIpc.h"
+#include "indexer/Timer.h"
+#include "indexer/Zygote.h"
 
 using namespace scip_clang;
 using namespace std::chrono_literals;
 
-enum class Mode { Hang, Crash };
+enum class Mode {
+  Hang,
+  Crash,
+  Benchmark,
+  SpawnBenchmark,
+  ShmRingHang,
+  ShmRingFull
+};
 
 static std::string modeToString(Mode mode) {
   switch (mode) {
@@ -29,6 +51,14 @@ static std::string modeToString(Mode mode) {
     return "--hang";
   case Mode::Crash:
     return "--crash";
+  case Mode::Benchmark:
+    return "--benchmark";
+  case Mode::SpawnBenchmark:
+    return "--spawn-benchmark";
+  case Mode::ShmRingHang:
+    return "--shm-ring-hang";
+  case Mode::ShmRingFull:
+    return "--shm-ring-full";
   }
 }
 
@@ -36,6 +66,18 @@ static Mode modeFromString(const char *s) {
   if (std::strcmp(s, "--hang") == 0) {
     return Mode::Hang;
   }
+  if (std::strcmp(s, "--benchmark") == 0) {
+    return Mode::Benchmark;
+  }
+  if (std::strcmp(s, "--spawn-benchmark") == 0) {
+    return Mode::SpawnBenchmark;
+  }
+  if (std::strcmp(s, "--shm-ring-hang") == 0) {
+    return Mode::ShmRingHang;
+  }
+  if (std::strcmp(s, "--shm-ring-full") == 0) {
+    return Mode::ShmRingFull;
+  }
   ENFORCE(std::strcmp(s, "--crash") == 0);
   return Mode::Crash;
 }
@@ -56,9 +98,15 @@ static void toyWorkerMain(IpcOptions ipcOptions, Mode mode) {
   auto err = queues.driverToWorker.timedReceive(msg, ipcOptions.receiveTimeout);
   ENFORCE(!err);
   switch (mode) {
+  case Mode::Benchmark:
+  case Mode::SpawnBenchmark:
+  case Mode::ShmRingFull:
+    ENFORCE(false, "mode doesn't spawn toy workers");
+    break;
   case Mode::Crash: {
     crash();
   }
+  case Mode::ShmRingHang:
   case Mode::Hang: {
     std::this_thread::sleep_for(ipcOptions.receiveTimeout * 5);
     // This reply is too late!
@@ -94,17 +142,277 @@ static void toyDriverMain(const char *testExecutablePath, IpcOptions ipcOptions,
   ENFORCE(err.isA<TimeoutError>());
 }
 
+#ifdef __linux__
+static void toyShmRingDriverMain(const char *testExecutablePath,
+                                 IpcOptions ipcOptions) {
+  ShmRingSegment::removeIfPresent(
+      scip_clang::shmRingName(ipcOptions.driverId, ipcOptions.workerId));
+  ShmRingDriverTransport transport(ipcOptions.driverId, 1);
+  JsonIpcQueue driverToWorker(
+      transport.makeSender(0, ipcOptions.receiveTimeout), IpcCodec::Binary);
+
+  std::vector<std::string> args;
+  args.push_back(std::string(testExecutablePath));
+  args.push_back(::modeToString(Mode::ShmRingHang));
+  args.push_back(ipcOptions.driverId);
+  transport.addWorkerArgs(0, args);
+  transport.setInheritable(0, true);
+  boost::process::child worker(args, boost::process::std_out > stdout);
+  transport.setInheritable(0, false);
+
+  IpcTestMessage msg{"All your base are belong to us"};
+  driverToWorker.send(msg);
+  auto start = std::chrono::steady_clock::now();
+  transport.armTimer(start + ipcOptions.receiveTimeout);
+  std::vector<std::pair<WorkerId, std::string>> messages;
+  bool timerExpired = false;
+  transport.wait(messages, timerExpired);
+  ENFORCE(timerExpired, "expected timer to fire before the worker replied");
+  ENFORCE(messages.empty());
+  ENFORCE(std::chrono::steady_clock::now() - start
+          >= ipcOptions.receiveTimeout);
+}
+
+// Checks that the driver doesn't block forever sending to a worker
+// which has died (here, one which was never spawned) once its ring
+// is full.
+static void shmRingFullMain(IpcOptions ipcOptions) {
+  ShmRingSegment::removeIfPresent(
+      scip_clang::shmRingName(ipcOptions.driverId, ipcOptions.workerId));
+  ShmRingDriverTransport transport(ipcOptions.driverId, 1);
+  auto sendTimeout = 200ms;
+  auto sender = transport.makeSender(0, sendTimeout);
+  std::string message(sender->maxMessageSize(), 'x');
+  size_t numSent = 0;
+  while (sender->send(message)) {
+    numSent++;
+    ENFORCE(numSent < 100, "expected the ring to fill up");
+  }
+  ENFORCE(numSent > 0, "expected the first message to fit in the ring");
+  auto start = std::chrono::steady_clock::now();
+  ENFORCE(!sender->send(message));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  ENFORCE(elapsed >= sendTimeout);
+  ENFORCE(elapsed < 10 * sendTimeout, "send took too long to give up");
+}
+#endif
+
+// Roughly mimics the shape of messages for a header-heavy TU which
+// is the first TU processed by a worker, so all paths are new.
+static IndexJobResponse makeSemanticAnalysisResponse(size_t numHeaders) {
+  SemanticAnalysisJobResult semaResult{};
+  semaResult.firstNewPathId = PathId{0};
+  for (size_t i = 0; i < numHeaders; ++i) {
+    auto path = fmt::format(
+        "/home/user/code/monorepo/third_party/some-library/include/"
+        "some-library/detail/header_{}.h",
+        i);
+    HashValue hashValue{HashValue::forText(path)};
+    PathId pathId{uint32_t(i)};
+    semaResult.newPaths.push_back(AbsolutePath{std::move(path)});
+    if (i % 50 == 0) {
+      semaResult.illBehavedFiles.push_back(PreprocessedFileInfoMulti{
+          pathId, {hashValue, HashValue{hashValue.rawValue + 1}}});
+    } else {
+      semaResult.wellBehavedFiles.push_back(
+          PreprocessedFileInfo{pathId, hashValue});
+    }
+  }
+  return IndexJobResponse{
+      0, JobId::newTask(123),
+      IndexJobResult{.kind = IndexJob::Kind::SemanticAnalysis,
+                     .semanticAnalysis = std::move(semaResult)},
+      {}, false};
+}
+
+static IndexJobRequest makeEmitIndexRequest(const IndexJobResponse &response) {
+  EmitIndexJobDetails details{};
+  for (auto &fileInfo : response.result.semanticAnalysis.wellBehavedFiles) {
+    details.filesToBeIndexed.push_back(fileInfo);
+  }
+  return IndexJobRequest{JobId::newTask(123).nextSubtask(),
+                         IndexJob{.kind = IndexJob::Kind::EmitIndex,
+                                  .emitIndex = std::move(details)},
+                         {},
+                         {}};
+}
+
+template <typename T>
+static void benchmarkCodec(IpcCodec codec, const char *codecName,
+                           const char *messageName, const T &message,
+                           size_t numIterations) {
+  ManualTimer encodeTimer, decodeTimer;
+  std::string buffer;
+  TIME_IT(encodeTimer, {
+    for (size_t i = 0; i < numIterations; ++i) {
+      buffer = ipc::encodeMessage(codec, message);
+    }
+  });
+  T decoded{};
+  TIME_IT(decodeTimer, {
+    for (size_t i = 0; i < numIterations; ++i) {
+      decoded = T{};
+      auto err = ipc::decodeMessage(buffer, decoded);
+      ENFORCE(!err, "failed to decode {} message", codecName);
+    }
+  });
+  // The message types don't define operator==, so compare the
+  // encodings byte-for-byte instead.
+  ENFORCE(ipc::encodeMessage(codec, decoded) == buffer,
+          "round-trip changed the {} encoding", codecName);
+  using micros = std::chrono::microseconds;
+  fmt::print("{:<8} {:<18} {:>10} bytes  encode {:>9.1f}us  decode {:>9.1f}us\n",
+             codecName, messageName, buffer.size(),
+             encodeTimer.value<micros>() / double(numIterations),
+             decodeTimer.value<micros>() / double(numIterations));
+}
+
+static void benchmarkMain() {
+  constexpr size_t numHeaders = 5000;
+  constexpr size_t numIterations = 20;
+  auto response = ::makeSemanticAnalysisResponse(numHeaders);
+  auto request = ::makeEmitIndexRequest(response);
+  fmt::print("{} headers, averaged over {} iterations\n", numHeaders,
+             numIterations);
+  for (auto [codec, codecName] :
+       {std::make_pair(IpcCodec::Json, "json"),
+        std::make_pair(IpcCodec::Binary, "binary")}) {
+    ::benchmarkCodec(codec, codecName, "IndexJobResponse", response,
+                     numIterations);
+    ::benchmarkCodec(codec, codecName, "IndexJobRequest", request,
+                     numIterations);
+  }
+}
+
+// Measures the time from asking for workers until all of them have
+// exited after a shutdown request (which they receive as soon as they
+// have opened their queues), for real scip-clang workers.
+static double spawnAndShutdownWorkers(const std::string &scipClangPath,
+                                      WorkerSpawn spawnMode,
+                                      size_t numWorkers) {
+  namespace boost_ip = boost::interprocess;
+  auto driverId = fmt::format("spawn-benchmark-{}-{}", ::getpid(),
+                              spawnMode == WorkerSpawn::Zygote ? "zygote"
+                                                               : "exec");
+  auto w2d = scip_clang::workerToDriverQueueName(driverId);
+  boost_ip::message_queue::remove(w2d.c_str());
+  JsonIpcQueue workerToDriver(std::make_unique<boost_ip::message_queue>(
+      boost_ip::create_only, w2d.c_str(), 1, 4096));
+  std::vector<JsonIpcQueue> driverToWorker;
+  for (size_t workerId = 0; workerId < numWorkers; ++workerId) {
+    auto d2w = scip_clang::driverToWorkerQueueName(driverId, workerId);
+    boost_ip::message_queue::remove(d2w.c_str());
+    driverToWorker.emplace_back(std::make_unique<boost_ip::message_queue>(
+        boost_ip::create_only, d2w.c_str(), 1, 4096));
+    driverToWorker.back().send(IndexJobRequest{JobId::Shutdown(), {}, {}, {}});
+  }
+
+  std::vector<std::string> args{scipClangPath,
+                                fmt::format("--driver-id={}", driverId),
+                                "--log-level=warning"};
+  ManualTimer timer;
+  TIME_IT(timer, {
+    // Starting the zygote is a one-time cost, so include it.
+    std::optional<Zygote> zygote;
+    if (spawnMode == WorkerSpawn::Zygote) {
+      zygote.emplace(std::vector<std::string>(args));
+    }
+    std::vector<WorkerProcess> workers;
+    for (size_t workerId = 0; workerId < numWorkers; ++workerId) {
+      if (zygote.has_value()) {
+        auto worker = zygote->forkWorker(workerId);
+        ENFORCE(worker.has_value(), "failed to fork worker {}", workerId);
+        workers.emplace_back(std::move(*worker));
+        continue;
+      }
+      auto workerArgs = args;
+      workerArgs.push_back("--worker-mode=ipc");
+      workerArgs.push_back(fmt::format("--worker-id={}", workerId));
+      workers.emplace_back(boost::process::child(
+          workerArgs, boost::process::std_out > stdout));
+    }
+    for (auto &worker : workers) {
+      worker.wait();
+    }
+  });
+
+  for (size_t workerId = 0; workerId < numWorkers; ++workerId) {
+    boost_ip::message_queue::remove(
+        scip_clang::driverToWorkerQueueName(driverId, workerId).c_str());
+  }
+  boost_ip::message_queue::remove(w2d.c_str());
+  return timer.value<std::chrono::milliseconds>();
+}
+
+static void spawnBenchmarkMain(const std::string &scipClangPath) {
+  constexpr size_t numWorkers = 8;
+  constexpr size_t numIterations = 5;
+  fmt::print("{} workers, averaged over {} iterations\n", numWorkers,
+             numIterations);
+  for (auto [spawnMode, spawnModeName] :
+       {std::make_pair(WorkerSpawn::Exec, "exec"),
+        std::make_pair(WorkerSpawn::Zygote, "zygote")}) {
+    double totalMillis = 0.0;
+    for (size_t i = 0; i < numIterations; ++i) {
+      totalMillis +=
+          ::spawnAndShutdownWorkers(scipClangPath, spawnMode, numWorkers);
+    }
+    auto millis = totalMillis / double(numIterations);
+    fmt::print("{:<8} total {:>9.1f}ms  per worker {:>7.1f}ms\n",
+               spawnModeName, millis, millis / double(numWorkers));
+  }
+}
+
 int main(int argc, char *argv[]) {
   // If running as driver
-  ENFORCE(argc >= 2, "expected --hang or --crash");
+  ENFORCE(argc >= 2, "expected --hang, --crash, --benchmark, "
+                     "--spawn-benchmark, --shm-ring-hang or --shm-ring-full");
+  if (::modeFromString(argv[1]) == Mode::Benchmark) {
+    ::benchmarkMain();
+    return 0;
+  }
+  if (::modeFromString(argv[1]) == Mode::SpawnBenchmark) {
+    ENFORCE(argc == 3, "expected path to scip-clang after --spawn-benchmark");
+    ::spawnBenchmarkMain(std::string(argv[2]));
+    return 0;
+  }
   std::string driverId;
-  if (argc == 3) {
+  if (argc >= 3) {
     driverId = std::string(argv[2]);
   } else {
     driverId = "ipc-test" + std::string(argv[1]);
   }
   scip_clang::IpcOptions ipcOptions{1s, driverId, 0};
   Mode mode = ::modeFromString(argv[1]);
+  if (mode == Mode::ShmRingFull) {
+#ifdef __linux__
+    ::shmRingFullMain(ipcOptions);
+#else
+    fmt::print("skipping --shm-ring-full on non-Linux platforms\n");
+#endif
+    return 0;
+  }
+  if (mode == Mode::ShmRingHang) {
+#ifdef __linux__
+    if (argc == 2) {
+      ::toyShmRingDriverMain(argv[0], ipcOptions);
+      return 0;
+    }
+    // The worker is passed --ipc-transport and --ipc-eventfds
+    // in the same format as a real worker.
+    ENFORCE(argc == 5);
+    ipcOptions.transport = IpcTransport::ShmRing;
+    llvm::SmallVector<llvm::StringRef, 4> fds;
+    llvm::StringRef(argv[4]).split('=').second.split(fds, ',');
+    for (auto fd : fds) {
+      ipcOptions.eventFds.push_back(std::stoi(fd.str()));
+    }
+    ::toyWorkerMain(ipcOptions, mode);
+#else
+    fmt::print("skipping --shm-ring-hang on non-Linux platforms\n");
+#endif
+    return 0;
+  }
   if (argc == 3) {
     ::toyWorkerMain(ipcOptions, mode);
   } else {
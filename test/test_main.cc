@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
@@ -5,9 +6,13 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include <unistd.h>
+
 #include "absl/algorithm/container.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_replace.h"
@@ -24,10 +29,29 @@
 
 #include "scip/scip.pb.h"
 
+#include "indexer/Autoscaling.h"
+#include "indexer/BatchSizer.h"
+#include "indexer/Cancellation.h"
+#include "indexer/ClaimBalancer.h"
 #include "indexer/CliOptions.h"
 #include "indexer/CompilationDatabase.h"
+#include "indexer/ConcurrentClaimMap.h"
 #include "indexer/Enforce.h"
 #include "indexer/FileSystem.h"
+#include "indexer/InProcessIndexMerger.h"
+#include "indexer/IncludeSetCache.h"
+#include "indexer/IndexingJournal.h"
+#include "indexer/IpcChunking.h"
+#include "indexer/IpcMessages.h"
+#include "indexer/JobCost.h"
+#include "indexer/JsonIpcQueue.h"
+#include "indexer/MemoryBudget.h"
+#include "indexer/PathInterner.h"
+#include "indexer/Quarantine.h"
+#include "indexer/ScipExtras.h"
+#include "indexer/ShardLog.h"
+#include "indexer/ShmClaimTable.h"
+#include "indexer/Statistics.h"
 #include "indexer/Worker.h"
 
 #include "test/Snapshot.h"
@@ -48,6 +72,8 @@ struct CliOptions {
   test::Kind testKind;
   std::string testName;
   test::SnapshotMode testMode;
+  /// Extra arguments for scip-clang in index tests.
+  std::vector<std::string> scipClangArgs;
 };
 
 static test::CliOptions globalCliOptions{};
@@ -109,6 +135,702 @@ TEST_CASE("UNIT_TESTS") {
   }
 };
 
+TEST_CASE("PATH_INTERNING") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  PathInterner interner{};
+  auto a = AbsolutePathRef::tryFrom(std::string_view("/a.h")).value();
+  auto b = AbsolutePathRef::tryFrom(std::string_view("/b.h")).value();
+  auto [idA, newA] = interner.intern(a);
+  auto [idB, newB] = interner.intern(b);
+  auto [idA2, newA2] = interner.intern(a);
+  CHECK(newA);
+  CHECK(newB);
+  CHECK(!newA2);
+  CHECK(idA == idA2);
+  CHECK(idA.value == 0);
+  CHECK(idB.value == 1);
+  CHECK(interner.size() == 2);
+  CHECK(interner.get(idB).asStringRef() == "/b.h");
+  CHECK(interner.lookup(a) == std::optional<PathId>(idA));
+}
+
+/// Fresh directory with a unique name under the system temp directory,
+/// so that concurrent test runs don't clobber each other's files.
+/// Removed along with its contents on scope exit.
+struct TempDir {
+  StdPath path;
+
+  TempDir &operator=(const TempDir &) = delete;
+  TempDir(const TempDir &) = delete;
+  explicit TempDir(std::string_view prefix) {
+    auto pattern = (std::filesystem::temp_directory_path()
+                    / fmt::format("{}-XXXXXX", prefix))
+                       .string();
+    REQUIRE_MESSAGE(::mkdtemp(pattern.data()) != nullptr,
+                    fmt::format("failed to create a directory from '{}'",
+                                pattern));
+    this->path = StdPath(pattern);
+  }
+  ~TempDir() {
+    std::error_code error;
+    std::filesystem::remove_all(this->path, error);
+  }
+};
+
+TEST_CASE("SHARD_LOG") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  TempDir tempDir("scip-clang-shard-log");
+  auto &dir = tempDir.path;
+  scip::Index index1, index2;
+  index1.add_external_symbols()->set_symbol("a");
+  index2.add_external_symbols()->set_symbol("b");
+  ShardLogRecord record1, record2;
+  {
+    ShardLogWriter writer(shardLogPath(dir, 3));
+    record1 = writer.append(index1);
+    writer.flush();
+  }
+  {
+    // A respawned worker keeps appending to the same log.
+    ShardLogWriter writer(shardLogPath(dir, 3));
+    record2 = writer.append(index2);
+    writer.flush();
+  }
+  CHECK(record2.offset > record1.offset);
+  ShardLogReader reader(dir);
+  scip::Index out;
+  REQUIRE(reader.read(3, record2, out));
+  CHECK(out.external_symbols(0).symbol() == "b");
+  REQUIRE(reader.read(3, record1, out));
+  CHECK(out.external_symbols(0).symbol() == "a");
+  CHECK(!reader.read(3, ShardLogRecord{record2.offset, record2.length + 1},
+                     out));
+  CHECK(!reader.read(4, record1, out));
+}
+
+TEST_CASE("INDEXING_JOURNAL") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  TempDir tempDir("scip-clang-journal");
+  auto &dir = tempDir.path;
+
+  clang::tooling::CompileCommand command1("/src", "a.cc", {"clang", "a.cc"},
+                                          "");
+  auto command2 = command1;
+  command2.CommandLine.push_back("-DX");
+  CHECK(compdb::commandKey(command1) == compdb::commandKey(command1));
+  CHECK(compdb::commandKey(command1) != compdb::commandKey(command2));
+
+  scip::Index index;
+  index.add_external_symbols()->set_symbol("a");
+  ShardLogRecord record;
+  {
+    ShardLogWriter writer(shardLogPath(dir, 1));
+    record = writer.append(index);
+    writer.flush();
+  }
+  auto makeEntry = [&](const clang::tooling::CompileCommand &command,
+                       uint32_t taskId) -> CompletedTu {
+    return CompletedTu{
+        compdb::commandKey(command),
+        command.Filename,
+        taskId,
+        1,
+        ShardPaths{AbsolutePath(), AbsolutePath(), ShardStorage::WorkerLog},
+        ShardLogRecords{record, record},
+        IndexingStatistics{1'000, 0, 0, 0, 0},
+        {JournalClaim{AbsolutePath("/src/a.h"), HashValue{42}}}};
+  };
+
+  auto journalPath = IndexingJournal::pathIn(dir);
+  {
+    auto journal = IndexingJournal::create(journalPath, "/src",
+                                           {makeEntry(command1, 3)});
+    REQUIRE(journal.has_value());
+    journal->append(makeEntry(command2, 7));
+  }
+  // Simulate the driver being killed while appending.
+  std::ofstream(journalPath, std::ios_base::app) << "{\"commandKey\":";
+
+  auto entries = IndexingJournal::load(journalPath, "/src");
+  REQUIRE(entries.size() == 2);
+  CHECK(entries[0].commandKey == compdb::commandKey(command1));
+  CHECK(entries[1].taskId == 7);
+  CHECK(entries[1].mainFile == "a.cc");
+  CHECK(entries[1].shardLogRecords.forwardDecls.length == record.length);
+  CHECK(entries[1].statistics.totalTimeMicros == 1'000);
+  REQUIRE(entries[1].claims.size() == 1);
+  CHECK(entries[1].claims[0].path.asStringRef() == "/src/a.h");
+  CHECK(entries[1].claims[0].hashValue == HashValue{42});
+  CHECK(IndexingJournal::hasShards(entries[1], dir));
+  CHECK(IndexingJournal::load(journalPath, "/other").empty());
+
+  auto truncated = entries[1];
+  truncated.shardLogRecords.docsAndExternals.length++;
+  CHECK(!IndexingJournal::hasShards(truncated, dir));
+  truncated.workerId = 2;
+  CHECK(!IndexingJournal::hasShards(truncated, dir));
+  auto missingFiles = entries[1];
+  missingFiles.shardPaths =
+      ShardPaths{AbsolutePath((dir / "missing-docs.shard").string()),
+                 AbsolutePath((dir / "missing-decls.shard").string()),
+                 ShardStorage::File};
+  CHECK(!IndexingJournal::hasShards(missingFiles, dir));
+
+  // Recreating the journal replaces earlier entries.
+  {
+    auto journal = IndexingJournal::create(journalPath, "/src", {entries[0]});
+    REQUIRE(journal.has_value());
+  }
+  CHECK(IndexingJournal::load(journalPath, "/src").size() == 1);
+}
+
+TEST_CASE("TU_QUARANTINE") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  TempDir tempDir("scip-clang-quarantine");
+  auto &dir = tempDir.path;
+  std::ofstream(dir / "a.cc") << "int main() {}";
+  std::ofstream(dir / "b.cc") << "int b;";
+  auto dbPath = (dir / "quarantine.json").string();
+
+  clang::tooling::CompileCommand crashing(dir.string(), "a.cc",
+                                          {"clang", "a.cc"}, "");
+  clang::tooling::CompileCommand hanging(dir.string(), "b.cc",
+                                         {"clang", "b.cc"}, "");
+  {
+    Quarantine quarantine(2);
+    quarantine.load(dbPath);
+    CHECK(quarantine.lookup(crashing) == nullptr);
+    quarantine.recordFailure(crashing, "crashed with signal 11");
+    quarantine.recordFailure(crashing, "crashed with signal 11");
+    quarantine.recordFailure(hanging, "timed out");
+    quarantine.save(dbPath);
+    // The database is written to a separate file and then moved over.
+    CHECK(std::filesystem::exists(dbPath));
+    CHECK(!std::filesystem::exists(dbPath + ".new"));
+  }
+  {
+    Quarantine quarantine(2);
+    quarantine.load(dbPath);
+    auto *entry = quarantine.lookup(crashing);
+    REQUIRE(entry != nullptr);
+    CHECK(entry->reason == "crashed with signal 11");
+    CHECK(entry->numFailures == 1);
+    CHECK(entry->lastFailedRun == 1);
+    auto otherArgs = crashing;
+    otherArgs.CommandLine.push_back("-DX");
+    CHECK(quarantine.lookup(otherArgs) == nullptr);
+    // Indexing successfully leaves the quarantine right away.
+    quarantine.recordSuccess(hanging);
+    CHECK(quarantine.lookup(hanging) == nullptr);
+    quarantine.save(dbPath);
+  }
+  {
+    Quarantine quarantine(2);
+    quarantine.load(dbPath);
+    REQUIRE(quarantine.lookup(crashing) != nullptr);
+    CHECK(quarantine.size() == 1);
+    quarantine.save(dbPath);
+  }
+  {
+    // Not failing for --quarantine-runs runs expires the entry.
+    Quarantine quarantine(2);
+    quarantine.load(dbPath);
+    CHECK(quarantine.size() == 0);
+    quarantine.recordFailure(crashing, "timed out");
+    REQUIRE(quarantine.lookup(crashing) != nullptr);
+    // So does changing the main file.
+    std::ofstream(dir / "a.cc") << "int main() { return 0; }";
+    CHECK(quarantine.lookup(crashing) == nullptr);
+    CHECK(quarantine.size() == 0);
+  }
+  std::ofstream(dbPath) << "{\"version\": 1, \"lastRun\": \"oops\"}";
+  Quarantine malformed(2);
+  malformed.load(dbPath);
+  CHECK(malformed.size() == 0);
+}
+
+TEST_CASE("JOB_COST_MODEL") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  TempDir tempDir("scip-clang-job-cost");
+  auto &dir = tempDir.path;
+  auto makeCommand = [&](std::string name,
+                         size_t size) -> clang::tooling::CompileCommand {
+    std::ofstream(dir / name) << std::string(size, 'x');
+    return clang::tooling::CompileCommand(dir.string(), name, {"clang", name},
+                                          "");
+  };
+  auto small = makeCommand("small.cc", 1000);
+  auto large = makeCommand("large.cc", 100'000);
+  auto smallNoHistory = makeCommand("small2.cc", 1000);
+
+  auto statsPath = (dir / "stats.json").string();
+  StatsEntry::emitAll(
+      {StatsEntry{"small.cc",
+                  IndexingStatistics{2'000'000, 0, 3'000'000'000, 0, 0},
+                  false},
+       StatsEntry{"recycled.cc",
+                  IndexingStatistics{1'000'000, 0, 0, 5'000'000'000, 1'000},
+                  true}},
+      statsPath);
+  std::vector<StatsEntry> entries;
+  std::string error;
+  REQUIRE(StatsEntry::readAll(statsPath, entries, error));
+  REQUIRE(entries.size() == 2);
+  CHECK(!entries[0].workerRecycled);
+  CHECK(entries[1].workerRecycled);
+  CHECK(entries[1].stats.rssAfterBytes == 5'000'000'000);
+  CHECK(entries[1].stats.trimmedBytes == 1'000);
+  JobCostModel model{};
+  model.loadHistory(statsPath);
+  auto costs = model.estimateSeconds({&small, &large, &smallNoHistory});
+  REQUIRE(costs.size() == 3);
+  CHECK(costs[0] == doctest::Approx(2.0));
+  CHECK(costs[1] > costs[0]);
+  // Estimates are scaled to match the history.
+  CHECK(costs[2] == doctest::Approx(2.0));
+  CHECK(model.historicalPeakRssBytesFor("small.cc") == 3'000'000'000);
+  CHECK(!model.historicalPeakRssBytesFor("large.cc").has_value());
+}
+
+TEST_CASE("MEMORY_BUDGET") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  MemoryBudget noBudget{0};
+  CHECK(!noBudget.enabled());
+  noBudget.setExpectedBytes(1, 100);
+  CHECK(noBudget.expectedBytesFor(JobId::newTask(1)) == 0);
+  noBudget.reserve(1'000);
+  CHECK(noBudget.fits(1'000'000));
+
+  MemoryBudget budget{1'000};
+  CHECK(budget.enabled());
+  CHECK(budget.totalBytes() == 1'000);
+  budget.setExpectedBytes(1, 600);
+  CHECK(budget.expectedBytesFor(JobId::newTask(1)) == 600);
+  CHECK(budget.expectedBytesFor(JobId::newTask(1).nextSubtask()) == 600);
+  CHECK(budget.expectedBytesFor(JobId::newTask(2)) == 0);
+  // With nothing in progress, even an oversized TU is started.
+  CHECK(budget.fits(5'000));
+  budget.reserve(600);
+  CHECK(budget.usedBytes() == 600);
+  CHECK(budget.fits(400));
+  CHECK(!budget.fits(401));
+  budget.reserve(400);
+  budget.release(600);
+  CHECK(budget.usedBytes() == 400);
+  CHECK(budget.fits(600));
+  budget.release(400);
+  CHECK(budget.usedBytes() == 0);
+}
+
+TEST_CASE("BATCH_SIZER") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  using std::chrono::milliseconds;
+  BatchSizer unbatched{1};
+  unbatched.recordTuLatency(milliseconds(1));
+  CHECK(unbatched.nextBatchSize(100, 1) == 1);
+
+  BatchSizer sizer{8};
+  // No batching until some TU has finished.
+  CHECK(sizer.nextBatchSize(100, 1) == 1);
+  sizer.recordTuLatency(milliseconds(100));
+  CHECK(sizer.nextBatchSize(100, 1) == 5);
+  // Leave some jobs for the other idle workers.
+  CHECK(sizer.nextBatchSize(6, 3) == 2);
+  CHECK(sizer.nextBatchSize(0, 4) == 1);
+  // A single slow TU only moves the average a little.
+  sizer.recordTuLatency(milliseconds(900));
+  CHECK(sizer.nextBatchSize(100, 1) == 2);
+
+  BatchSizer fastTus{8};
+  fastTus.recordTuLatency(milliseconds(10));
+  CHECK(fastTus.nextBatchSize(100, 1) == 8);
+}
+
+TEST_CASE("HEADER_COVERAGE_ORDERING") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  CHECK(orderByCoverage({{1, 2}, {1, 2, 3, 4}, {5}, {3, 4, 6}, {}})
+        == std::vector<size_t>{1, 2, 3, 0, 4});
+
+  TempDir tempDir("scip-clang-includes");
+  auto &dir = tempDir.path;
+  std::ofstream(dir / "scanned.cc")
+      << "#include <vector>\n  #  include \"a.h\" // comment\n"
+         "#include_next <b.h>\n#include MACRO\n";
+  clang::tooling::CompileCommand scanned(dir.string(), "scanned.cc", {}, "");
+  std::vector<std::string> includes;
+  scanDirectIncludes(scanned, includes);
+  CHECK(includes == std::vector<std::string>{"vector", "a.h"});
+
+  auto cachePath = (dir / "cache.json").string();
+  {
+    IncludeSetCache cache{};
+    cache.record("few.cc", {"/a.h"});
+    cache.record("many.cc", {"/a.h", "/b.h", "/c.h"});
+    cache.save(cachePath);
+  }
+  IncludeSetCache cache{};
+  cache.load(cachePath);
+  CHECK(cache.size() == 2);
+  clang::tooling::CompileCommand few(dir.string(), "few.cc", {}, "");
+  clang::tooling::CompileCommand many(dir.string(), "many.cc", {}, "");
+  CHECK(cache.headerCoverageOrder({&few, &scanned, &many})
+        == std::vector<size_t>{2, 1, 0});
+}
+
+TEST_CASE("CLAIM_BALANCER") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  IncludeSetCache cache{};
+  cache.record("a.cc", {"/a.cc", "/h1.h", "/h2.h"});
+  cache.record("b.cc", {"/b.cc", "/h1.h", "/h2.h"});
+  ClaimBalancer balancer(cache, [](std::string_view) -> double { return 10; });
+  CHECK(balancer.targetCost() == 20);
+  balancer.onTuQueued("a.cc");
+  balancer.onTuQueued("b.cc");
+
+  balancer.onTuAnalyzed("a.cc");
+  CHECK(balancer.shouldClaim(0, "/a.cc", 10));
+  CHECK(balancer.shouldClaim(0, "/h1.h", 10));
+  // Over the fair share, and b.cc will report /h2.h later.
+  CHECK(!balancer.shouldClaim(0, "/h2.h", 10));
+  // Not in the cache, so there is no later TU to defer to.
+  CHECK(balancer.shouldClaim(0, "/new.h", 100));
+  balancer.onTuPlanned(0);
+
+  balancer.onTuAnalyzed("b.cc");
+  CHECK(balancer.shouldClaim(1, "/b.cc", 10));
+  CHECK(balancer.shouldClaim(1, "/h2.h", 10));
+  // No TUs including the header are pending, so it is claimed regardless.
+  CHECK(balancer.shouldClaim(1, "/h1.h", 100));
+  balancer.onTuPlanned(1);
+  CHECK(balancer.numDeferrals() == 1);
+}
+
+#ifdef __linux__
+TEST_CASE("SHM_CLAIM_TABLE") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  std::string name = "/scip-clang-test-header-claims";
+  ShmClaimTable::removeIfPresent(name);
+  auto driverTable = ShmClaimTable::create(std::string(name), 16);
+  auto workerTable = ShmClaimTable::open(std::string(name));
+  using Status = ShmClaimTable::ClaimStatus;
+  auto a = AbsolutePathRef::tryFrom(std::string_view("/a.h")).value();
+  auto b = AbsolutePathRef::tryFrom(std::string_view("/b.h")).value();
+  CHECK(workerTable->claim(a, HashValue{1}) == Status::Claimed);
+  CHECK(driverTable->claim(a, HashValue{1}) == Status::AlreadyClaimed);
+  CHECK(driverTable->claim(a, HashValue{2}) == Status::Claimed);
+  CHECK(workerTable->claim(b, HashValue{1}) == Status::Claimed);
+  auto counts = driverTable->countHashesPerPath();
+  CHECK(counts[HashValue::forText("/a.h")] == 2);
+  CHECK(counts[HashValue::forText("/b.h")] == 1);
+  CHECK(!driverTable->hasOverflowed());
+  // The table stops accepting claims at 3/4 capacity.
+  unsigned numFull = 0;
+  for (uint64_t i = 10; i < 30; ++i) {
+    numFull += workerTable->claim(b, HashValue{i}) == Status::Full;
+  }
+  CHECK(numFull == 11);
+  CHECK(driverTable->hasOverflowed());
+}
+#endif
+
+TEST_CASE("CONCURRENT_CLAIM_MAP") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  ConcurrentClaimMap claims;
+  std::vector<std::string> paths;
+  for (int i = 0; i < 100; ++i) {
+    paths.push_back(fmt::format("/h{}.h", i));
+  }
+  // Every (path, hash) pair should be claimed by exactly one thread.
+  std::vector<unsigned> numClaimed(4, 0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numClaimed.size(); ++t) {
+    threads.emplace_back([&, t]() {
+      for (auto &path : paths) {
+        auto pathRef = AbsolutePathRef::tryFrom(std::string_view(path));
+        for (uint64_t hash = 1; hash <= 2; ++hash) {
+          numClaimed[t] += claims.claim(pathRef.value(), HashValue{hash});
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  unsigned total = 0;
+  for (auto n : numClaimed) {
+    total += n;
+  }
+  CHECK(total == 200);
+  auto a = AbsolutePathRef::tryFrom(std::string_view("/h0.h")).value();
+  auto b = AbsolutePathRef::tryFrom(std::string_view("/b.h")).value();
+  CHECK(claims.hashCount(a) == 2);
+  CHECK(claims.hashCount(b) == 0);
+  CHECK(claims.claim(b, HashValue{1}));
+  CHECK(claims.hashCount(b) == 1);
+}
+
+TEST_CASE("INCREMENTAL_INDEX_BUILDER") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  auto makeDoc = [](std::string path, std::string symbol) -> scip::Document {
+    scip::Document doc;
+    doc.set_relative_path(path);
+    doc.add_occurrences()->set_symbol(symbol);
+    return doc;
+  };
+  scip::Index index;
+  scip::IndexBuilder builder{index, /*incremental*/ true};
+  builder.addDocument(makeDoc("a.h", "a1"), false);
+  builder.addDocument(makeDoc("b.h", "b"), false);
+  builder.addDocument(makeDoc("c.h", "c"), false);
+  // a.h turns out to be multiply indexed, so the earlier document
+  // should be merged with this one.
+  builder.addDocument(makeDoc("a.h", "a2"), true);
+  auto symbolToInfoMap = builder.populateSymbolToInfoMap();
+  builder.finish(/*deterministic*/ true);
+  REQUIRE(index.documents_size() == 3);
+  CHECK(index.documents(0).relative_path() == "b.h");
+  CHECK(index.documents(1).relative_path() == "c.h");
+  auto &merged = index.documents(2);
+  CHECK(merged.relative_path() == "a.h");
+  CHECK(merged.occurrences_size() == 2);
+}
+
+TEST_CASE("IN_PROCESS_INDEX_MERGER") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  RootPath projectRoot{AbsolutePath(std::string("/src")), RootKind::Project};
+  ConcurrentClaimMap claims;
+  auto claim = [&](std::string_view path, uint64_t hash) {
+    claims.claim(AbsolutePathRef::tryFrom(path).value(), HashValue{hash});
+  };
+  claim("/src/a.h", 1);
+  claim("/src/a.h", 2);
+  claim("/src/b.h", 1);
+  auto makeOutput = [](std::string path,
+                       std::string symbol) -> TuIndexingOutput {
+    TuIndexingOutput output;
+    auto *doc = output.docsAndExternals.add_documents();
+    doc->set_relative_path(path);
+    doc->add_occurrences()->set_symbol(symbol);
+    return output;
+  };
+  InProcessIndexMerger merger{projectRoot, claims, /*deterministic*/ true};
+  auto first = makeOutput("a.h", "a1");
+  first.docsAndExternals.add_external_symbols()->set_symbol("ext");
+  first.forwardDecls.add_external_symbols()->set_symbol("fwd");
+  // Out of order, with a TU which emitted no index in between.
+  merger.add(2, makeOutput("b.h", "b"));
+  merger.add(1, std::move(first));
+  merger.add(0, std::nullopt);
+  merger.add(4, makeOutput("a.h", "a2"));
+  auto &index = merger.finish();
+
+  REQUIRE(index.documents_size() == 2);
+  auto docFor = [&](std::string_view path) -> const scip::Document & {
+    auto it = absl::c_find_if(index.documents(), [&](auto &doc) {
+      return doc.relative_path() == path;
+    });
+    REQUIRE(it != index.documents().end());
+    return *it;
+  };
+  // a.h was claimed with two different hashes, so both documents
+  // should be merged even though task 3 never reported.
+  CHECK(docFor("a.h").occurrences_size() == 2);
+  CHECK(docFor("b.h").occurrences_size() == 1);
+  // The unresolved forward declaration is kept as an external symbol.
+  CHECK(index.external_symbols_size() == 2);
+}
+
+TEST_CASE("IPC_CHUNKING") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  std::string big(10'000, 'x');
+  for (size_t i = 0; i < big.size(); ++i) {
+    big[i] = char('a' + i % 26);
+  }
+  std::string small = R"({"small":true})";
+  std::vector<std::string> framesA, framesB;
+  auto collectInto = [](std::vector<std::string> &frames) {
+    return [&frames](std::string_view frame) { frames.emplace_back(frame); };
+  };
+  forEachIpcFrame(big, 1000, /*senderId*/ 1, /*messageId*/ 0,
+                  collectInto(framesA));
+  forEachIpcFrame(small, 1000, 2, 0, collectInto(framesB));
+  forEachIpcFrame(big, 500, 2, 1, collectInto(framesB));
+  REQUIRE(framesA.size() > 1);
+  REQUIRE(framesB.size() > 2);
+  CHECK(framesB[0] == small);
+  for (auto &frame : framesA) {
+    CHECK(frame.size() <= 1000);
+  }
+
+  // Chunks from different senders may be interleaved.
+  IpcChunkAssembler assembler;
+  std::vector<std::string> received;
+  for (size_t i = 0; i < std::max(framesA.size(), framesB.size()); ++i) {
+    for (auto *frames : {&framesA, &framesB}) {
+      std::string_view message;
+      if (i < frames->size()
+          && assembler.add((*frames)[i], message)
+                 == IpcChunkAssembler::Status::Complete) {
+        received.emplace_back(message);
+      }
+    }
+  }
+  REQUIRE(received.size() == 3);
+  CHECK(received[0] == small);
+  CHECK(received[1] == big);
+  CHECK(received[2] == big);
+
+  // A sender restarting midway (e.g. respawned worker) starts afresh.
+  std::string_view message;
+  CHECK(assembler.add(framesA[0], message)
+        == IpcChunkAssembler::Status::Incomplete);
+  for (auto &frame : framesA) {
+    (void)assembler.add(frame, message);
+  }
+  CHECK(message == big);
+}
+
+TEST_CASE("WORKER_HEARTBEATS") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  for (auto codec : {IpcCodec::Json, IpcCodec::Binary}) {
+    IndexJobResponse heartbeat{3, JobId::newTask(7).nextSubtask(), {},
+                               WorkerPhase::Serialization, false};
+    IndexJobResponse decoded{};
+    auto err =
+        ipc::decodeMessage(ipc::encodeMessage(codec, heartbeat), decoded);
+    REQUIRE(!err);
+    CHECK(decoded.workerId == 3);
+    CHECK(decoded.jobId == heartbeat.jobId);
+    CHECK(decoded.heartbeat == std::optional(WorkerPhase::Serialization));
+
+    IndexJobResponse result{3, JobId::newTask(7), {}, {}, false};
+    err = ipc::decodeMessage(ipc::encodeMessage(codec, result), decoded);
+    REQUIRE(!err);
+    CHECK(!decoded.heartbeat.has_value());
+    CHECK(!decoded.cancelled);
+
+    IndexJobResponse cancelled{3, JobId::newTask(7), {}, {}, true};
+    err = ipc::decodeMessage(ipc::encodeMessage(codec, cancelled), decoded);
+    REQUIRE(!err);
+    CHECK(!decoded.heartbeat.has_value());
+    CHECK(decoded.cancelled);
+  }
+
+  std::vector<WorkerPhase> sent;
+  ProgressReporter disabled{};
+  disabled.enterPhase(WorkerPhase::Traversal);
+  disabled.tick();
+  ProgressReporter progress{
+      [&](WorkerPhase phase) { sent.push_back(phase); },
+      std::chrono::steady_clock::duration::zero()};
+  progress.enterPhase(WorkerPhase::Traversal);
+  REQUIRE(sent.size() == 1);
+  // A single tick suffices once the interval has elapsed, as ticks may
+  // be far apart.
+  progress.tick();
+  CHECK(sent.size() == 2);
+  CHECK(sent.back() == WorkerPhase::Traversal);
+
+  ProgressReporter slow{[&](WorkerPhase phase) { sent.push_back(phase); },
+                        std::chrono::hours(1)};
+  slow.enterPhase(WorkerPhase::Parsing);
+  REQUIRE(sent.size() == 3);
+  for (int i = 0; i < 1000; ++i) {
+    slow.tick();
+  }
+  CHECK(sent.size() == 3);
+}
+
+TEST_CASE("SOFT_CANCELLATION") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+#ifdef __linux__
+  installCancellationHandler();
+  setCurrentTask(5);
+  CHECK(!isCurrentTaskCancelled());
+  // With a single thread, a signal sent to the calling process is
+  // delivered before sigqueue returns.
+  REQUIRE(requestCancellation(::getpid(), 4));
+  CHECK(!isCurrentTaskCancelled());
+  REQUIRE(requestCancellation(::getpid(), 5));
+  CHECK(isCurrentTaskCancelled());
+  setCurrentTask(6);
+  CHECK(!isCurrentTaskCancelled());
+#endif
+}
+
+TEST_CASE("WORKER_AUTOSCALING") {
+  if (test::globalCliOptions.testKind != test::Kind::UnitTests) {
+    return;
+  }
+  CHECK(parseCpuMax("200000 100000\n") == 2.0);
+  CHECK(!parseCpuMax("max 100000\n").has_value());
+  CHECK(parsePressureAvg10("some avg10=12.50 avg60=3.00 avg300=1.00 "
+                           "total=1234\nfull avg10=0.00 avg60=0.00 "
+                           "avg300=0.00 total=0\n")
+        == 12.5);
+  CHECK(!parsePressureAvg10("").has_value());
+
+  WorkerAutoscaler autoscaler(8);
+  std::string reason;
+  ResourceSnapshot snapshot{};
+  // Already at the maximum, nothing to grow into.
+  CHECK(autoscaler.update(snapshot, reason) == 8);
+  snapshot.memoryPressure = 20.0;
+  CHECK(autoscaler.update(snapshot, reason) == 6);
+  CHECK(reason == "memory pressure");
+  snapshot.memoryPressure = 0.0;
+  snapshot.cpuPressure = 60.0;
+  CHECK(autoscaler.update(snapshot, reason) == 5);
+  snapshot.cpuPressure = 0.0;
+  snapshot.cpuQuota = 2.5;
+  CHECK(autoscaler.update(snapshot, reason) == 3);
+  CHECK(reason == "cpu quota");
+  snapshot.cpuQuota.reset();
+  snapshot.memoryLimitBytes = 100;
+  snapshot.memoryUsageBytes = 90;
+  CHECK(autoscaler.update(snapshot, reason) == 3);
+  snapshot.memoryUsageBytes = 10;
+  CHECK(autoscaler.update(snapshot, reason) == 4);
+  CHECK(reason == "low pressure");
+  snapshot.memoryPressure = 100.0;
+  for (int i = 0; i < 10; ++i) {
+    autoscaler.update(snapshot, reason);
+  }
+  CHECK(autoscaler.activeWorkers() == 1);
+}
+
 TEST_CASE("COMPDB_PARSING") {
   if (test::globalCliOptions.testKind != test::Kind::CompdbTests) {
     return;
@@ -344,6 +1066,52 @@ TEST_CASE("ROBUSTNESS") {
                                   snapshotLogPath);
 }
 
+TEST_CASE("ROBUSTNESS_QUARANTINE") {
+  if (test::globalCliOptions.testKind != test::Kind::RobustnessTests
+      || test::globalCliOptions.testName != "quarantine") {
+    return;
+  }
+  TempFile dbFile(fmt::format("quarantine-{}.json", ::getpid()));
+  TempFile indexFile(fmt::format("quarantine-{}.scip", ::getpid()));
+  auto runDriver = [&](std::string_view fault) {
+    std::vector<std::string> args;
+    args.push_back("./indexer/scip-clang");
+    args.push_back("--compdb-path=test/robustness/compile_commands.json");
+    args.push_back("--log-level=warning");
+    args.push_back("--receive-timeout-seconds=3");
+    args.push_back(fmt::format("--driver-id=robustness-quarantine-{}-{}",
+                               fault, ::getpid()));
+    args.push_back(fmt::format("--quarantine-db={}", dbFile.path.string()));
+    args.push_back(
+        fmt::format("--index-output-path={}", indexFile.path.string()));
+    if (!fault.empty()) {
+      args.push_back(fmt::format("--force-worker-fault={}", fault));
+      args.push_back("--testing");
+    }
+    boost::process::child driver(
+        args, boost::process::std_out > boost::process::null,
+        boost::process::std_err > boost::process::null);
+    driver.wait();
+  };
+  // The only TU crashes, so it is quarantined...
+  runDriver("crash");
+  Quarantine quarantine(1);
+  quarantine.load(dbFile.path.string());
+  REQUIRE(quarantine.size() == 1);
+  // ... and so it should still be indexed in the next run, even though
+  // there are no other TUs to schedule it after.
+  runDriver("");
+  scip::Index index{};
+  std::ifstream inputStream(indexFile.path,
+                            std::ios_base::in | std::ios_base::binary);
+  REQUIRE(!inputStream.fail());
+  REQUIRE(index.ParseFromIstream(&inputStream));
+  CHECK(index.documents_size() == 1);
+  Quarantine after(1);
+  after.load(dbFile.path.string());
+  CHECK(after.size() == 0);
+}
+
 TEST_CASE("INDEX") {
   if (test::globalCliOptions.testKind != test::Kind::IndexTests) {
     return;
@@ -401,9 +1169,14 @@ TEST_CASE("INDEX") {
         args.push_back(fmt::format("--index-output-path={}", scipIndexPath));
         args.push_back("--log-level=warning");
         args.push_back("--receive-timeout-seconds=60");
-        args.push_back(fmt::format("--driver-id=index-{}",
-                                   test::globalCliOptions.testName));
+        // Variants of the same test may run concurrently, and the driver
+        // ID determines the names of IPC queues and shared memory.
+        args.push_back(fmt::format("--driver-id=index-{}-{}",
+                                   test::globalCliOptions.testName,
+                                   ::getpid()));
         args.push_back("--deterministic");
+        absl::c_copy(test::globalCliOptions.scipClangArgs,
+                     std::back_inserter(args));
         boost::process::child driver(
             args, boost::process::start_dir(rootInSourceDir.asStringRef()),
             boost::process::std_out > stdout, boost::process::std_err > stderr);
@@ -459,6 +1232,12 @@ int main(int argc, char *argv[]) {
   options.add_options()("update",
                         "Should snapshots be updated instead of comparing?",
                         cxxopts::value<bool>());
+  options.add_options()(
+      "scip-clang-args",
+      "(Optional) Comma-separated extra arguments for scip-clang in index "
+      "tests, which should not affect the output",
+      cxxopts::value<std::vector<std::string>>(
+          test::globalCliOptions.scipClangArgs));
 
   auto result = options.parse(argc, argv);
 
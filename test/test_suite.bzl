@@ -1,6 +1,6 @@
 load("@bazel_skylib//lib:paths.bzl", "paths")
 
-def _test_main(name, args, data, tags):
+def _test_main(name, args, data, tags, target_compatible_with = None):
     native.sh_test(
         name = name,
         srcs = ["test_main.sh"],
@@ -9,18 +9,19 @@ def _test_main(name, args, data, tags):
         env = {"TEST_MAIN": "./test/test_main"},
         size = "small",
         tags = tags,
+        target_compatible_with = target_compatible_with,
     )
 
-def _ipc_test(name, args):
+def _ipc_test(name, args, data = [], tags = []):
     native.sh_test(
         name = name,
         srcs = ["test_main.sh"],
         args = args,
-        data = ["//test:ipc_test_main"],
+        data = data + ["//test:ipc_test_main"],
         env = {"TEST_MAIN": "./test/ipc_test_main"},
         size = "small",
         # Don't cache because the test can be non-deterministic
-        tags = ["no-cache"],
+        tags = ["no-cache"] + tags,
     )
 
 def _snapshot_test(name, kind, data, tags = []):
@@ -84,8 +85,30 @@ def _robustness_tests(data):
         )
         tests.append(test_name)
         updates.append(update_name)
+
+    # Checks that TUs are indexed even if all of them are quarantined.
+    _test_main(
+        name = "test_robustness_quarantine",
+        args = ["--test-kind=robustness", "--test-name=quarantine"],
+        data = data + ["//indexer:scip-clang"],
+        tags = ["no-cache", "external"],
+    )
+    tests.append("test_robustness_quarantine")
     return (tests, updates)
 
+# Flags which change how work is split between the driver and workers,
+# but which should not change the index. Each variant is checked against
+# the snapshots for the default configuration, so there are no update
+# targets for them.
+_INDEX_TEST_VARIANTS = {
+    "in_process": struct(args = ["--in-process"], linux_only = False),
+    "shard_storage_shared_memory": struct(args = ["--shard-storage=shared-memory"], linux_only = True),
+    "shard_storage_worker_log": struct(args = ["--shard-storage=worker-log"], linux_only = False),
+    "batched": struct(args = ["--max-tus-per-batch=8", "--jobs=1"], linux_only = False),
+    "provisional_plans": struct(args = ["--provisional-plans"], linux_only = False),
+    "shm_claim_table": struct(args = ["--shm-claim-table"], linux_only = True),
+}
+
 def _index_tests(data):
     index_test_groups = _group_by_top_level_dir("index", data)
     tests, updates = [], []
@@ -93,6 +116,20 @@ def _index_tests(data):
         t, u = _snapshot_test(name = testdir, kind = "index", data = paths + ["//indexer:scip-clang"])
         tests.append(t)
         updates.append(u)
+        for (variant, config) in _INDEX_TEST_VARIANTS.items():
+            variant_name = "test_index_{}_{}".format(testdir, variant)
+            _test_main(
+                name = variant_name,
+                args = [
+                    "--test-kind=index",
+                    "--test-name=" + testdir,
+                    "--scip-clang-args=" + ",".join(config.args),
+                ],
+                data = paths + ["//indexer:scip-clang"],
+                tags = [],
+                target_compatible_with = ["@platforms//os:linux"] if config.linux_only else None,
+            )
+            tests.append(variant_name)
     return (tests, updates)
 
 def scip_clang_test_suite(compdb_data, preprocessor_data, robustness_data, index_data):
@@ -110,7 +147,18 @@ def scip_clang_test_suite(compdb_data, preprocessor_data, robustness_data, index
 
     _ipc_test(name = "test_ipc_hang", args = ["--hang"])
     _ipc_test(name = "test_ipc_crash", args = ["--crash"])
-    tests += ["test_ipc_hang", "test_ipc_crash"]
+    # Benchmarks only print timings, so they are excluded from //... and
+    # the test suite; run them explicitly with bazel test.
+    _ipc_test(name = "test_ipc_codec_benchmark", args = ["--benchmark"], tags = ["manual", "benchmark"])
+    _ipc_test(name = "test_ipc_shm_ring_hang", args = ["--shm-ring-hang"])
+    _ipc_test(name = "test_ipc_shm_ring_full", args = ["--shm-ring-full"])
+    _ipc_test(
+        name = "test_ipc_spawn_benchmark",
+        args = ["--spawn-benchmark", "./indexer/scip-clang"],
+        data = ["//indexer:scip-clang"],
+        tags = ["manual", "benchmark"],
+    )
+    tests += ["test_ipc_hang", "test_ipc_crash", "test_ipc_shm_ring_hang", "test_ipc_shm_ring_full"]
 
     ts, us = _snapshot_test_suite("robustness", _robustness_tests, robustness_data)
     tests += ts